@@ -0,0 +1,163 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include "pilab-gpio-bank.h"
+#include "pilab-gpio-sim.h"
+#include "pilab-time.h"
+
+/* Lines of the bank, latency (in us) of an access and rounds, by default */
+#define PILAB_BENCH_LINES 16
+#define PILAB_BENCH_LATENCY 5
+#define PILAB_BENCH_ROUNDS 1000
+
+/*
+ * Read every line of the bank on its own, the way digitalRead does.
+ *
+ * Returns the levels of the lines, bit i is line i.
+ */
+
+static uint64_t bench_read_lines(struct t_gpio_bank *bank)
+{
+	uint64_t levels;
+	int i;
+
+	levels = 0;
+	for (i = 0; i < bank->num_lines; ++i)
+		if (gpio_bank_read_line(bank, bank->offsets[i]) == 1)
+			levels |= 1ULL << i;
+
+	return levels;
+}
+
+/*
+ * Read every line of the bank from a single snapshot.
+ *
+ * Returns the levels of the lines, bit i is line i.
+ */
+
+static uint64_t bench_snapshot(struct t_gpio_bank *bank)
+{
+	uint64_t levels;
+	int i;
+
+	gpio_bank_snapshot(bank, NULL);
+
+	levels = 0;
+	for (i = 0; i < bank->num_lines; ++i)
+		if (gpio_bank_get(bank, bank->offsets[i]) == 1)
+			levels |= 1ULL << i;
+
+	return levels;
+}
+
+/*
+ * Drive every line of the bank on its own, the way digitalWrite does.
+ */
+
+static void bench_write_lines(struct t_gpio_bank *bank, uint64_t levels)
+{
+	int i;
+
+	for (i = 0; i < bank->num_lines; ++i)
+		gpio_bank_write_line(bank, bank->offsets[i], (levels >> i) & 1);
+}
+
+/*
+ * Drive every line of the bank in a single write.
+ */
+
+static void bench_write(struct t_gpio_bank *bank, uint64_t levels)
+{
+	gpio_bank_write(bank, ~0ULL, levels);
+}
+
+/*
+ * Compare reading and driving a bank of lines one by one against doing it
+ * in a single access, on the simulated chip.
+ *
+ * Usage: bench-gpio-bank [lines] [latency in us] [rounds]
+ */
+
+int main(int argc, char *argv[])
+{
+	struct t_gpio_bank *inputs, *outputs;
+	int offsets[PILAB_GPIO_BANK_MAX_LINES];
+	int num_lines, latency, rounds, i, f;
+	uint64_t started, per_line, snapshot, write_lines, write;
+	uint64_t expected;
+
+	num_lines = (argc > 1) ? atoi(argv[1]) : PILAB_BENCH_LINES;
+	latency = (argc > 2) ? atoi(argv[2]) : PILAB_BENCH_LATENCY;
+	rounds = (argc > 3) ? atoi(argv[3]) : PILAB_BENCH_ROUNDS;
+	if (num_lines < 1 || num_lines > PILAB_GPIO_BANK_MAX_LINES ||
+	    latency < 0 || rounds < 1) {
+		fprintf(stderr,
+			"Usage: bench-gpio-bank [lines] [latency in us] [rounds]\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < num_lines; ++i)
+		offsets[i] = i;
+
+	inputs = gpio_sim_create(offsets, num_lines, 0, latency);
+	outputs = gpio_sim_create(offsets, num_lines, 1, latency);
+	if (!inputs || !outputs) {
+		fprintf(stderr, "Could not create the simulated banks\n");
+		return EXIT_FAILURE;
+	}
+
+	/* every other line high, both ways have to see the same */
+	expected = 0;
+	for (i = 0; i < num_lines; i += 2) {
+		gpio_sim_set_level(inputs, offsets[i], 1);
+		expected |= 1ULL << i;
+	}
+
+	f = 0;
+	started = time_monotonic_ns();
+	for (i = 0; i < rounds; ++i)
+		if (bench_read_lines(inputs) != expected)
+			f++;
+	per_line = time_monotonic_ns() - started;
+
+	started = time_monotonic_ns();
+	for (i = 0; i < rounds; ++i)
+		if (bench_snapshot(inputs) != expected)
+			f++;
+	snapshot = time_monotonic_ns() - started;
+
+	started = time_monotonic_ns();
+	for (i = 0; i < rounds; ++i)
+		bench_write_lines(outputs, (i & 1) ? expected : ~expected);
+	write_lines = time_monotonic_ns() - started;
+
+	started = time_monotonic_ns();
+	for (i = 0; i < rounds; ++i)
+		bench_write(outputs, (i & 1) ? expected : ~expected);
+	write = time_monotonic_ns() - started;
+
+	/* the last round drove line 0 high when it was odd */
+	if (gpio_sim_get_level(outputs, offsets[0]) != ((rounds - 1) & 1))
+		f++;
+
+	printf("%d lines, %d us per access, %d rounds\n", num_lines, latency,
+	       rounds);
+	printf("read line by line:  %8.2f us per bank\n",
+	       per_line / 1000.0 / rounds);
+	printf("read snapshot:      %8.2f us per bank\n",
+	       snapshot / 1000.0 / rounds);
+	printf("write line by line: %8.2f us per bank\n",
+	       write_lines / 1000.0 / rounds);
+	printf("write at once:      %8.2f us per bank\n",
+	       write / 1000.0 / rounds);
+
+	gpio_bank_free(inputs);
+	gpio_bank_free(outputs);
+
+	if (f > 0) {
+		fprintf(stderr, "%d rounds saw the wrong levels\n", f);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <math.h>
+#include "pilab-adaptive.h"
+
+/*
+ * Conjure up a new adaptive sampling policy.
+ *
+ * The interval starts at base_interval (in seconds), readings that differ by
+ * more than threshold from the previous one count as a change.
+ *
+ * Returns a pointer to the newly created policy, NULL otherwise.
+ */
+
+struct t_adaptive *adaptive_create(int base_interval, double threshold)
+{
+	struct t_adaptive *new_adaptive;
+
+	if (base_interval < 1 || threshold <= 0)
+		return NULL;
+
+	new_adaptive = calloc(1, sizeof(*new_adaptive));
+	if (!new_adaptive)
+		return NULL;
+
+	new_adaptive->base_interval = base_interval;
+	new_adaptive->interval = base_interval;
+	new_adaptive->threshold = threshold;
+	new_adaptive->backoff = PILAB_ADAPTIVE_DEFAULT_BACKOFF;
+	new_adaptive->has_last = 0;
+	pthread_mutex_init(&new_adaptive->lock, NULL);
+
+	adaptive_set_bounds(new_adaptive, 0, 0);
+
+	return new_adaptive;
+}
+
+/*
+ * Set the bounds (in seconds) of the interval, pass 0 (or less) to use the
+ * defaults derived from the base interval.
+ */
+
+void adaptive_set_bounds(struct t_adaptive *adaptive, int min_interval,
+			 int max_interval)
+{
+	if (!adaptive)
+		return;
+
+	if (min_interval < 1)
+		min_interval = adaptive->base_interval /
+			       PILAB_ADAPTIVE_DEFAULT_MIN_DIVISOR;
+	if (min_interval < 1)
+		min_interval = 1;
+	if (max_interval < 1)
+		max_interval = adaptive->base_interval *
+			       PILAB_ADAPTIVE_DEFAULT_MAX_FACTOR;
+	if (max_interval < min_interval)
+		max_interval = min_interval;
+
+	pthread_mutex_lock(&adaptive->lock);
+	adaptive->min_interval = min_interval;
+	adaptive->max_interval = max_interval;
+	if (adaptive->interval < min_interval)
+		adaptive->interval = min_interval;
+	if (adaptive->interval > max_interval)
+		adaptive->interval = max_interval;
+	pthread_mutex_unlock(&adaptive->lock);
+}
+
+/*
+ * Set the factor the interval grows with while the signal is flat, a factor
+ * <= 1 falls back to the default.
+ */
+
+void adaptive_set_backoff(struct t_adaptive *adaptive, double backoff)
+{
+	if (!adaptive)
+		return;
+
+	pthread_mutex_lock(&adaptive->lock);
+	adaptive->backoff =
+		(backoff > 1) ? backoff : PILAB_ADAPTIVE_DEFAULT_BACKOFF;
+	pthread_mutex_unlock(&adaptive->lock);
+}
+
+/*
+ * Feed a reading to the policy.
+ *
+ * A change larger than the threshold drops the interval straight to the
+ * minimum, so fast events are followed closely. A flat signal grows the
+ * interval geometrically, up to the maximum.
+ *
+ * The interval (in seconds) until the next reading is stored in interval.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the interval stayed the same.
+ *  1: the interval changed.
+ */
+
+int adaptive_update(struct t_adaptive *adaptive, double value, int *interval)
+{
+	double grown;
+	int next, changed;
+
+	if (!adaptive || !interval)
+		return -1;
+
+	pthread_mutex_lock(&adaptive->lock);
+	next = adaptive->interval;
+
+	if (adaptive->has_last) {
+		if (fabs(value - adaptive->last_value) > adaptive->threshold) {
+			next = adaptive->min_interval;
+		} else {
+			grown = ceil(next * adaptive->backoff);
+			next = (grown > adaptive->max_interval) ?
+				       adaptive->max_interval :
+				       (int)grown;
+		}
+	}
+
+	if (next < adaptive->interval)
+		adaptive->stats.speedups++;
+	else if (next > adaptive->interval)
+		adaptive->stats.backoffs++;
+	changed = (next != adaptive->interval);
+
+	adaptive->interval = next;
+	adaptive->last_value = value;
+	adaptive->has_last = 1;
+
+	adaptive->stats.readings++;
+	adaptive->stats.covered += next;
+	adaptive->stats.fixed_readings =
+		adaptive->stats.covered / adaptive->base_interval;
+	pthread_mutex_unlock(&adaptive->lock);
+
+	*interval = next;
+
+	return changed;
+}
+
+/*
+ * Take a consistent snapshot of the statistics of the policy.
+ */
+
+void adaptive_get_stats(struct t_adaptive *adaptive,
+			struct t_adaptive_stats *stats)
+{
+	if (!adaptive || !stats)
+		return;
+
+	pthread_mutex_lock(&adaptive->lock);
+	*stats = adaptive->stats;
+	pthread_mutex_unlock(&adaptive->lock);
+}
+
+/*
+ * Free the policy.
+ */
+
+void adaptive_free(struct t_adaptive *adaptive)
+{
+	if (!adaptive)
+		return;
+
+	pthread_mutex_destroy(&adaptive->lock);
+	free(adaptive);
+}
@@ -1,15 +1,20 @@
 #include "pilab-log.h"
 #include "pilab-api-client.h"
+#include "pilab-api-calls.h"
 #include "pilab-json-parser.h"
 #include "pilab-string.h"
 
-void pilab_login(struct t_api_client *client)
+/*
+ * Create the request logging in, for the caller to run, e.g. through an
+ * api_multi.
+ *
+ * Returns a pointer to the request, NULL otherwise.
+ */
+
+struct t_api_client_request *pilab_login_request(struct t_api_client *client)
 {
 	struct t_api_client_request *request;
-	struct t_api_client_cookie *cookie;
 	json_object *json;
-	json_object *response_body;
-	char *cookie_header;
 
 	/* create new post fields for request */
 	json = json_object_new_object();
@@ -23,9 +28,29 @@ void pilab_login(struct t_api_client *client)
 	/* create a new json request */
 	request = api_client_request_post_json(
 		client, json, "authentication/signin", "signin");
+	if (!request)
+		return NULL;
+	api_client_request_set_class(request, API_CLIENT_CLASS_LOGIN);
 
-	/* execute the request */
-	api_client_request_execute(request);
+	return request;
+}
+
+/*
+ * Take the cookie of a login request that ran, and close it.
+ *
+ * Returns 1 when logged in, 0 otherwise.
+ */
+
+int pilab_login_finish(struct t_api_client *client,
+		       struct t_api_client_request *request)
+{
+	struct t_api_client_cookie *cookie;
+	json_object *response_body;
+	char *cookie_header;
+	int rc;
+
+	if (!request)
+		return 0;
 
 	/* get set-cookie */
 	cookie_header = api_client_request_get_header(request, "Set-Cookie");
@@ -44,14 +69,38 @@ void pilab_login(struct t_api_client *client)
 			  "true") == 0) {
 		pilab_log(LOG_INFO, "Successful login for %s",
 			  client->config->email);
+		rc = 1;
 	} else {
 		pilab_log(LOG_INFO, "Could not login: %s",
 			  json_parser_object_to_string(json_parser_find_object(
 				  response_body, "Error")));
+		rc = 0;
 	}
 
 	/* close the request */
 	api_client_close_request(client, request);
+
+	return rc;
+}
+
+/*
+ * Log in, and keep the cookie for the requests of the client.
+ *
+ * NOTE: This function is blocking.
+ */
+
+void pilab_login(struct t_api_client *client)
+{
+	struct t_api_client_request *request;
+
+	request = pilab_login_request(client);
+	if (!request)
+		return;
+
+	/* execute the request */
+	api_client_request_execute(request);
+
+	(void)pilab_login_finish(client, request);
 }
 
 void pilab_add_pi(struct t_api_client *client)
@@ -60,7 +109,7 @@ void pilab_add_pi(struct t_api_client *client)
 	json_object *json;
 	json_object *response_body;
 
-	if (!api_client_is_valid_cookie(client->cookie))
+	if (!api_client_has_valid_cookie(client))
 		pilab_login(client);
 
 	/* create new post fields for request */
@@ -79,9 +128,7 @@ void pilab_add_pi(struct t_api_client *client)
 					       "addpi");
 
 	/* add cookie header */
-	api_client_request_add_header(
-		request, string_strcat("Cookie: ",
-				       api_client_get_cookie_content(client)));
+	api_client_request_add_cookie(request);
 
 	api_client_request_execute(request);
 
@@ -110,7 +157,7 @@ void pilab_add_sensor(struct t_api_client *client, const char *name,
 	json_object *json;
 	json_object *response_body;
 
-	if (!api_client_is_valid_cookie(client->cookie))
+	if (!api_client_has_valid_cookie(client))
 		pilab_login(client);
 
 	/* create new post fields for request */
@@ -129,9 +176,7 @@ void pilab_add_sensor(struct t_api_client *client, const char *name,
 					       "sensor/addnewsensor", name);
 
 	/* add cookie header */
-	api_client_request_add_header(
-		request, string_strcat("Cookie: ",
-				       api_client_get_cookie_content(client)));
+	api_client_request_add_cookie(request);
 
 	api_client_request_execute(request);
 
@@ -152,13 +197,20 @@ void pilab_add_sensor(struct t_api_client *client, const char *name,
 	api_client_close_request(client, request);
 }
 
-void pilab_add_data(struct t_api_client *client, const char *value)
+/*
+ * Upload a reading.
+ *
+ * Returns 1 when the backend accepted the reading, 0 otherwise.
+ */
+
+int pilab_add_data(struct t_api_client *client, const char *value)
 {
 	struct t_api_client_request *request;
 	json_object *json;
 	json_object *response_body;
+	int rc;
 
-	if (!api_client_is_valid_cookie(client->cookie))
+	if (!api_client_has_valid_cookie(client))
 		pilab_login(client);
 
 	/* create new post fields for request */
@@ -175,11 +227,10 @@ void pilab_add_data(struct t_api_client *client, const char *value)
 	/* create a new json request */
 	request = api_client_request_post_json(client, json, "sensor/adddata",
 					       "");
+	api_client_request_set_class(request, API_CLIENT_CLASS_READING);
 
 	/* add cookie header */
-	api_client_request_add_header(
-		request, string_strcat("Cookie: ",
-				       api_client_get_cookie_content(client)));
+	api_client_request_add_cookie(request);
 
 	api_client_request_execute(request);
 
@@ -191,11 +242,119 @@ void pilab_add_data(struct t_api_client *client, const char *value)
 			  "true") == 0) {
 		pilab_log(LOG_DEBUG, "Added reading for room: %s",
 			  client->config->classroom);
+		rc = 1;
 	} else {
 		pilab_log(LOG_ERROR, "Could not add data: %s",
 			  json_parser_object_to_string(json_parser_find_object(
 				  response_body, "Error")));
+		rc = 0;
+	}
+
+	api_client_close_request(client, request);
+
+	return rc;
+}
+
+/*
+ * Create the request uploading a batch of readings (see batch_take) in one
+ * go, for the caller to run, e.g. through an api_multi. The readings are put
+ * by it. The request is sent with the cookie at hand, it doesn't log in: that
+ * is up to whoever runs it (see api_client_request_retry).
+ *
+ * NOTE: The name has to outlive the request, and be unique among the requests
+ * of the client on their way.
+ *
+ * Returns a pointer to the request, NULL otherwise.
+ */
+
+struct t_api_client_request *
+	pilab_add_data_batch_request(struct t_api_client *client,
+				     json_object *readings, const char *name)
+{
+	struct t_api_client_request *request;
+	size_t i, length;
+
+	if (!readings)
+		return NULL;
+
+	/* every reading is for the room of the pi */
+	length = json_object_array_length(readings);
+	for (i = 0; i < length; ++i)
+		json_object_object_add(
+			json_object_array_get_idx(readings, i), "Room",
+			json_object_new_string(client->config->classroom));
+
+	/* create a new json request, it puts the readings */
+	request = api_client_request_post_json(
+		client, readings, PILAB_API_CALLS_ADD_DATA_BATCH, name);
+	if (!request)
+		return NULL;
+	api_client_request_set_class(request, API_CLIENT_CLASS_READING);
+
+	/* add cookie header */
+	api_client_request_add_cookie(request);
+
+	return request;
+}
+
+/*
+ * Handle the response to a batch upload that ran, and close its request.
+ *
+ * Returns 1 when the backend accepted the readings, 0 otherwise.
+ */
+
+int pilab_add_data_batch_finish(struct t_api_client *client,
+				struct t_api_client_request *request)
+{
+	json_object *response_body;
+	int rc;
+
+	if (!request)
+		return 0;
+
+	response_body = api_client_request_get_response_body_json(request);
+
+	/* handle response */
+	if (string_strcmp(json_parser_object_to_string(json_parser_find_object(
+				  response_body, "Succeed")),
+			  "true") == 0) {
+		pilab_log(LOG_DEBUG, "Added readings for room: %s",
+			  client->config->classroom);
+		rc = 1;
+	} else {
+		pilab_log(LOG_ERROR, "Could not add readings: %s",
+			  json_parser_object_to_string(json_parser_find_object(
+				  response_body, "Error")));
+		rc = 0;
 	}
 
 	api_client_close_request(client, request);
+
+	return rc;
+}
+
+/*
+ * Upload a batch of readings (see batch_take) in a single request, the
+ * readings are put afterwards.
+ *
+ * NOTE: This function is blocking, logging in included.
+ *
+ * Returns 1 when the backend accepted the readings, 0 otherwise.
+ */
+
+int pilab_add_data_batch(struct t_api_client *client, json_object *readings)
+{
+	struct t_api_client_request *request;
+
+	if (!api_client_has_valid_cookie(client))
+		pilab_login(client);
+
+	request = pilab_add_data_batch_request(client, readings,
+					       "adddatabatch");
+	if (!request)
+		return 0;
+
+	api_client_request_execute(request);
+
+	return pilab_add_data_batch_finish(client, request);
 }
@@ -1,8 +1,13 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
 #include "pilab-list.h"
 #include "pilab-string.h"
 #include "pilab-api-client.h"
+#include "pilab-api-multi.h"
 #include "pilab-log.h"
 #include "pilab-time.h"
 #include "pilab-json-parser.h"
@@ -11,6 +16,176 @@ char *api_client_request_type_string[API_CLIENT_REQUEST_NUM_TYPES] = {
 	PILAB_API_CLIENT_REQUEST_GET, PILAB_API_CLIENT_REQUEST_POST
 };
 
+char *api_client_request_class_string[API_CLIENT_CLASS_NUM_CLASSES] = {
+	PILAB_API_CLIENT_CLASS_DEFAULT, PILAB_API_CLIENT_CLASS_LOGIN,
+	PILAB_API_CLIENT_CLASS_READING
+};
+
+/*
+ * Retry policies a client starts with. A reading that fails is spooled, so
+ * it gives up sooner than the setup requests do.
+ */
+static const struct t_api_client_retry_policy
+	api_client_retry_default[API_CLIENT_CLASS_NUM_CLASSES] = {
+		[API_CLIENT_CLASS_DEFAULT] = { 3, 250, 2000, 3000, 5000, 1 },
+		[API_CLIENT_CLASS_LOGIN] = { 3, 500, 4000, 3000, 5000, 0 },
+		[API_CLIENT_CLASS_READING] = { 2, 100, 500, 2000, 5000, 1 },
+	};
+
+/*
+ * The connection layer all clients share: the DNS cache and the TLS sessions
+ * live in one share object, so a request reuses what an earlier request (of
+ * any client, on any thread) looked up and negotiated. The connections
+ * themselves can't be shared between threads, every client keeps its own
+ * (see spare_handle).
+ */
+static CURLSH *api_client_share = NULL;
+static pthread_once_t api_client_share_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t api_client_share_locks[CURL_LOCK_DATA_LAST];
+static struct t_api_client_connection_stats api_client_connection_stats;
+static pthread_mutex_t api_client_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void api_client_share_lock(CURL *handle, curl_lock_data data,
+				  curl_lock_access access, void *userptr)
+{
+	pthread_mutex_lock(&api_client_share_locks[data]);
+}
+
+static void api_client_share_unlock(CURL *handle, curl_lock_data data,
+				    void *userptr)
+{
+	pthread_mutex_unlock(&api_client_share_locks[data]);
+}
+
+/*
+ * Set up curl and the share object, once.
+ */
+
+static void api_client_share_create(void)
+{
+	int i;
+
+	if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+		pilab_log(LOG_ERROR, "Could not initialise curl");
+		return;
+	}
+
+	api_client_share = curl_share_init();
+	if (!api_client_share) {
+		pilab_log(LOG_ERROR, "Could not create the curl share");
+		return;
+	}
+
+	for (i = 0; i < CURL_LOCK_DATA_LAST; ++i)
+		pthread_mutex_init(&api_client_share_locks[i], NULL);
+
+	curl_share_setopt(api_client_share, CURLSHOPT_LOCKFUNC,
+			  &api_client_share_lock);
+	curl_share_setopt(api_client_share, CURLSHOPT_UNLOCKFUNC,
+			  &api_client_share_unlock);
+	curl_share_setopt(api_client_share, CURLSHOPT_SHARE,
+			  CURL_LOCK_DATA_DNS);
+	curl_share_setopt(api_client_share, CURLSHOPT_SHARE,
+			  CURL_LOCK_DATA_SSL_SESSION);
+}
+
+/*
+ * Set up the connection layer all clients share, it is set up once, by the
+ * first request otherwise.
+ *
+ * Returns 1 on success, 0 when requests go without a shared cache.
+ */
+
+int api_client_connections_init(void)
+{
+	pthread_once(&api_client_share_once, &api_client_share_create);
+
+	return (api_client_share) ? 1 : 0;
+}
+
+/*
+ * Count the connection the last transfer of handle went over.
+ */
+
+static void api_client_count_connection(CURL *handle, CURLcode rc)
+{
+	long connects;
+	double connect_time, tls_time;
+
+	connects = 0;
+	connect_time = 0;
+	tls_time = 0;
+	curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects);
+	curl_easy_getinfo(handle, CURLINFO_CONNECT_TIME, &connect_time);
+	curl_easy_getinfo(handle, CURLINFO_APPCONNECT_TIME, &tls_time);
+
+	pthread_mutex_lock(&api_client_stats_lock);
+	api_client_connection_stats.requests++;
+	if (rc != CURLE_OK)
+		api_client_connection_stats.failures++;
+	if (connects > 0) {
+		api_client_connection_stats.connects += connects;
+		/* the handshake ends after the connect, it covers both */
+		api_client_connection_stats.connect_total_ns += (uint64_t)(
+			((tls_time > connect_time) ? tls_time : connect_time) *
+			1e9);
+		if (tls_time > 0)
+			api_client_connection_stats.tls_handshakes++;
+	} else if (rc == CURLE_OK) {
+		api_client_connection_stats.reused++;
+	}
+	pthread_mutex_unlock(&api_client_stats_lock);
+}
+
+/*
+ * Count a retried attempt, relogin is set when the login was redone for it.
+ */
+
+static void api_client_count_retry(int relogin)
+{
+	pthread_mutex_lock(&api_client_stats_lock);
+	if (relogin)
+		api_client_connection_stats.relogins++;
+	else
+		api_client_connection_stats.retries++;
+	pthread_mutex_unlock(&api_client_stats_lock);
+}
+
+/*
+ * Copy the counters of the connection layer.
+ */
+
+void api_client_get_connection_stats(struct t_api_client_connection_stats *stats)
+{
+	if (!stats)
+		return;
+
+	pthread_mutex_lock(&api_client_stats_lock);
+	*stats = api_client_connection_stats;
+	pthread_mutex_unlock(&api_client_stats_lock);
+}
+
+/*
+ * Close the shared connections and clean up curl.
+ *
+ * NOTE: Call this once at exit, after every request is freed.
+ */
+
+void api_client_connections_free(void)
+{
+	int i;
+
+	if (!api_client_share)
+		return;
+
+	curl_share_cleanup(api_client_share);
+	api_client_share = NULL;
+	for (i = 0; i < CURL_LOCK_DATA_LAST; ++i)
+		pthread_mutex_destroy(&api_client_share_locks[i]);
+
+	curl_global_cleanup();
+}
+
 static void
 	api_client_request_free_request_fields_default_cb(char *request_fields)
 {
@@ -55,6 +230,87 @@ int api_client_get_request_type(const char *type)
 	return -1;
 }
 
+/*
+ * Search for a request class.
+ *
+ * Return index of class in enum t_api_client_request_class, -1 if the class
+ * could not be found.
+ */
+
+int api_client_get_request_class(const char *request_class)
+{
+	if (!request_class)
+		return -1;
+
+	for (int i = 0; i < API_CLIENT_CLASS_NUM_CLASSES; ++i)
+		if (string_strcasecmp(api_client_request_class_string[i],
+				      request_class) == 0)
+			return i;
+
+	/* class not found */
+	return -1;
+}
+
+/*
+ * Create a new session, not logged in, with the default retry policies and
+ * circuit.
+ *
+ * Returns a pointer to the newly created session, NULL otherwise.
+ */
+
+static struct t_api_client_session *api_client_session_create(void)
+{
+	struct t_api_client_session *new_session;
+
+	new_session = malloc(sizeof(*new_session));
+	if (!new_session)
+		return NULL;
+
+	new_session->circuit = circuit_create(0, 0);
+	if (!new_session->circuit) {
+		free(new_session);
+		return NULL;
+	}
+
+	new_session->cookie = NULL;
+	new_session->generation = 0;
+	memcpy(new_session->retry, api_client_retry_default,
+	       sizeof(new_session->retry));
+	new_session->callback_login = NULL;
+	new_session->callback_login_request = NULL;
+	new_session->callback_login_finish = NULL;
+	new_session->refs = 1;
+	pthread_mutex_init(&new_session->lock, NULL);
+	pthread_mutex_init(&new_session->login_lock, NULL);
+
+	return new_session;
+}
+
+/*
+ * Drop a reference to the session, the last client sharing it frees it.
+ */
+
+static void api_client_session_unref(struct t_api_client_session *session)
+{
+	int refs;
+
+	if (!session)
+		return;
+
+	pthread_mutex_lock(&session->lock);
+	refs = --session->refs;
+	pthread_mutex_unlock(&session->lock);
+
+	if (refs > 0)
+		return;
+
+	api_client_cookie_free(session->cookie);
+	circuit_free(session->circuit);
+	pthread_mutex_destroy(&session->lock);
+	pthread_mutex_destroy(&session->login_lock);
+	free(session);
+}
+
 /*
  * Create a new api client with the option to set the callbacks on init.
  *
@@ -81,9 +337,16 @@ struct t_api_client *api_client_create_custom(
 	if (!new_hashtable)
 		return NULL;
 
+	new_client->session = api_client_session_create();
+	if (!new_client->session) {
+		hashtable_free(new_hashtable);
+		free(new_client);
+		return NULL;
+	}
+
 	new_client->config = config;
 	new_client->request_table = new_hashtable;
-	new_client->cookie = NULL;
+	new_client->spare_handle = NULL;
 	new_hashtable->callback_free_value =
 		&api_client_request_free_default_cb;
 	new_client->callback_write_response_body =
@@ -109,6 +372,124 @@ struct t_api_client *api_client_create(struct t_pilab_config *config)
 	return api_client_create_custom(config, NULL, NULL);
 }
 
+/*
+ * Create a new api client, with a request table of its own, that shares the
+ * config, the login, the retry policies and the circuit of client. Free it
+ * with api_client_free_minimal, the config stays with client.
+ *
+ * Returns a pointer to the newly created api client, NULL otherwise.
+ */
+
+struct t_api_client *api_client_create_shared(struct t_api_client *client)
+{
+	struct t_api_client *new_client;
+	struct t_api_client_session *session;
+
+	if (!client)
+		return NULL;
+
+	new_client = api_client_create_custom(
+		client->config, client->callback_write_response_body,
+		client->callback_write_response_headers);
+	if (!new_client)
+		return NULL;
+
+	session = client->session;
+	pthread_mutex_lock(&session->lock);
+	session->refs++;
+	pthread_mutex_unlock(&session->lock);
+
+	api_client_session_unref(new_client->session);
+	new_client->session = session;
+
+	return new_client;
+}
+
+/*
+ * Set a api client property (pointer)
+ *
+ * NOTE: Currently the properties that are allowed to be set:
+ * - callback_login
+ * - callback_login_request
+ * - callback_login_finish
+ */
+
+void api_client_set_pointer(struct t_api_client *client, const char *property,
+			    void *pointer)
+{
+	if (!client || !property)
+		return;
+
+	if (string_strcasecmp(property, "callback_login") == 0)
+		client->session->callback_login = pointer;
+	else if (string_strcasecmp(property, "callback_login_request") == 0)
+		client->session->callback_login_request = pointer;
+	else if (string_strcasecmp(property, "callback_login_finish") == 0)
+		client->session->callback_login_finish = pointer;
+}
+
+/*
+ * Set the retry policy of a request class from a string formatted as
+ * "attempts/delay/max_delay", the delays in milliseconds.
+ *
+ * NOTE: Set it before the requests of the class run.
+ *
+ * Returns:
+ * -1: invalid arguments.
+ *  0: the policy could not be parsed, the class keeps its policy.
+ *  1: on success.
+ */
+
+int api_client_set_retry(struct t_api_client *client, int request_class,
+			 const char *policy)
+{
+	int attempts, delay, max_delay;
+
+	if (!client || !policy || request_class < 0 ||
+	    request_class >= API_CLIENT_CLASS_NUM_CLASSES)
+		return -1;
+
+	if (sscanf(policy, "%d/%d/%d", &attempts, &delay, &max_delay) != 3 ||
+	    attempts < 1 || delay < 0 || max_delay < delay)
+		return 0;
+
+	client->session->retry[request_class].attempts = attempts;
+	client->session->retry[request_class].delay = delay;
+	client->session->retry[request_class].max_delay = max_delay;
+
+	return 1;
+}
+
+/*
+ * Replace the circuit breaker of the client (and the clients sharing its
+ * session), pass 0 (or less) for the defaults.
+ *
+ * NOTE: Set it before any request runs.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the circuit could not be created, the client keeps its circuit.
+ *  1: on success.
+ */
+
+int api_client_set_circuit(struct t_api_client *client, int threshold,
+			   int probe_interval)
+{
+	struct t_circuit *circuit;
+
+	if (!client)
+		return -1;
+
+	circuit = circuit_create(threshold, probe_interval);
+	if (!circuit)
+		return 0;
+
+	circuit_free(client->session->circuit);
+	client->session->circuit = circuit;
+
+	return 1;
+}
+
 /*
  * Create a new cookie.
  *
@@ -201,6 +582,12 @@ struct t_api_client_request *api_client_request_create_custom(
 	}
 
 	new_request->name = name;
+	new_request->client = client;
+	new_request->request_class = API_CLIENT_CLASS_DEFAULT;
+	new_request->cookie_generation = 0;
+	new_request->attempt = 0;
+	new_request->relogged = 0;
+	new_request->seed = 0;
 	new_request->callback_free_request_fields =
 		(callback_free_request_fields) ?
 			callback_free_request_fields :
@@ -299,6 +686,9 @@ void api_client_request_add_request_fields(struct t_api_client_request *request,
 void api_client_request_add_header(struct t_api_client_request *request,
 				   const char *header)
 {
+	if (!request || !header)
+		return;
+
 	request->headers = curl_slist_append(request->headers, header);
 }
 
@@ -344,8 +734,17 @@ int api_client_init_request(struct t_api_client *client,
 	if (!client || !request)
 		return -1;
 
+	(void)api_client_connections_init();
+
 	if (api_client_get_request(client, request->name)) {
-		if ((request->handle = curl_easy_init()) == NULL) {
+		/* the spare handle keeps the connection of the last request */
+		request->handle = client->spare_handle;
+		client->spare_handle = NULL;
+		if (request->handle)
+			curl_easy_reset(request->handle);
+		else
+			request->handle = curl_easy_init();
+		if (!request->handle) {
 			pilab_log(LOG_DEBUG,
 				  "Failed to initialise the request");
 			return 0;
@@ -375,6 +774,21 @@ int api_client_init_request(struct t_api_client *client,
 		/* only one redirect though */
 		curl_easy_setopt(request->handle, CURLOPT_MAXREDIRS, 1);
 
+		/* resume the sessions and reuse the lookups of the others */
+		if (api_client_share)
+			curl_easy_setopt(request->handle, CURLOPT_SHARE,
+					 api_client_share);
+
+		/* keep idle connections open for the next reading */
+		curl_easy_setopt(request->handle, CURLOPT_TCP_KEEPALIVE, 1L);
+		curl_easy_setopt(request->handle, CURLOPT_TCP_KEEPIDLE,
+				 (long)PILAB_API_CLIENT_KEEPALIVE_IDLE);
+		curl_easy_setopt(request->handle, CURLOPT_TCP_KEEPINTVL,
+				 (long)PILAB_API_CLIENT_KEEPALIVE_INTERVAL);
+
+		/* requests run on the sampler workers, no signals there */
+		curl_easy_setopt(request->handle, CURLOPT_NOSIGNAL, 1L);
+
 		request_type =
 			api_client_request_type_string[request->type_request];
 
@@ -423,48 +837,99 @@ int api_client_is_valid_cookie(struct t_api_client_cookie *cookie)
 	return 1;
 }
 
+/*
+ * Check if the session of the client has a valid cookie.
+ *
+ * Returns:
+ *  0: no valid cookie.
+ *  1: valid cookie.
+ */
+
+int api_client_has_valid_cookie(struct t_api_client *client)
+{
+	int rc;
+
+	if (!client)
+		return 0;
+
+	pthread_mutex_lock(&client->session->lock);
+	rc = api_client_is_valid_cookie(client->session->cookie);
+	pthread_mutex_unlock(&client->session->lock);
+
+	return rc;
+}
+
 /*
  * Get the cookie content from the client.
  *
- * Returns a pointer to the cookies content, NULL otherwise.
+ * NOTE: The pointer returned by this function needs to be cleaned up
+ * afterwards, another client may log in and free the cookie meanwhile.
+ *
+ * Returns a copy of the cookies content, NULL otherwise.
  */
 
 char *api_client_get_cookie_content(struct t_api_client *client)
 {
+	char *content;
+
 	if (!client)
 		return NULL;
 
-	return client->cookie->content->string;
+	pthread_mutex_lock(&client->session->lock);
+	content = (client->session->cookie) ?
+			  string_strdup(client->session->cookie->content->string) :
+			  NULL;
+	pthread_mutex_unlock(&client->session->lock);
+
+	return content;
 }
 
 /*
  * Get the cookie expiration date from the client.
  *
- * Returns a pointer to the cookies expiration date, NULL otherwise.
+ * NOTE: The pointer returned by this function needs to be cleaned up
+ * afterwards.
+ *
+ * Returns a copy of the cookies expiration date, NULL otherwise.
  */
 
 char *api_client_get_cookie_expire_date(struct t_api_client *client)
 {
+	char *expires;
+
 	if (!client)
 		return NULL;
 
-	return client->cookie->expires;
+	pthread_mutex_lock(&client->session->lock);
+	expires = (client->session->cookie) ?
+			  string_strdup(client->session->cookie->expires) :
+			  NULL;
+	pthread_mutex_unlock(&client->session->lock);
+
+	return expires;
 }
 
 /*
- * Set a cookie for the client.
+ * Set the cookie of the client, and every client sharing its session. The
+ * session takes the cookie over and frees the one it replaces.
  */
 
 void api_client_set_cookie(struct t_api_client *client,
 			   struct t_api_client_cookie *cookie)
 {
+	struct t_api_client_cookie *old_cookie;
+
 	if (!client)
 		return;
 
-	if (client->cookie)
-		api_client_cookie_free(cookie);
+	pthread_mutex_lock(&client->session->lock);
+	old_cookie = client->session->cookie;
+	client->session->cookie = cookie;
+	client->session->generation++;
+	pthread_mutex_unlock(&client->session->lock);
 
-	client->cookie = cookie;
+	if (old_cookie && old_cookie != cookie)
+		api_client_cookie_free(old_cookie);
 }
 
 /*
@@ -503,10 +968,284 @@ char *api_client_request_get_header(struct t_api_client_request *request,
 }
 
 /*
- * Execute the request.
+ * Empty the response of the request, before it is executed again.
+ */
+
+static void api_client_response_clear(struct t_api_client_response *response)
+{
+	stringbuilder_clear(response->response_body);
+	stringbuilder_clear(response->response_headers);
+}
+
+/*
+ * Add the cookie of the client as the cookie header of the request, replacing
+ * the one it had.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the client is not logged in.
+ *  1: on success.
+ */
+
+int api_client_request_add_cookie(struct t_api_client_request *request)
+{
+	struct t_api_client_session *session;
+	struct curl_slist *headers, *header;
+	char *cookie_header;
+
+	if (!request || !request->client)
+		return -1;
+
+	session = request->client->session;
+
+	pthread_mutex_lock(&session->lock);
+	cookie_header = (session->cookie) ?
+				string_strcat("Cookie: ",
+					      session->cookie->content->string) :
+				NULL;
+	request->cookie_generation = session->generation;
+	pthread_mutex_unlock(&session->lock);
+
+	if (!cookie_header)
+		return 0;
+
+	headers = NULL;
+	for (header = request->headers; header; header = header->next)
+		if (strncmp(header->data, "Cookie:", 7) != 0)
+			headers = curl_slist_append(headers, header->data);
+	headers = curl_slist_append(headers, cookie_header);
+	free(cookie_header);
+
+	curl_slist_free_all(request->headers);
+	request->headers = headers;
+	curl_easy_setopt(request->handle, CURLOPT_HTTPHEADER, request->headers);
+
+	return 1;
+}
+
+/*
+ * Give the request the cookie of the session, when a client of the session
+ * logged in since the request got its cookie.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: nobody logged in since.
+ *  1: the request has a new cookie.
+ */
+
+int api_client_request_renew_cookie(struct t_api_client_request *request)
+{
+	struct t_api_client_session *session;
+	int rc;
+
+	if (!request || !request->client)
+		return -1;
+
+	session = request->client->session;
+
+	pthread_mutex_lock(&session->lock);
+	rc = (session->generation != request->cookie_generation) ? 1 : 0;
+	pthread_mutex_unlock(&session->lock);
+
+	return (rc && api_client_request_add_cookie(request) > 0) ? 1 : 0;
+}
+
+/*
+ * Log in again, as the backend refused the cookie the request was sent with,
+ * and let the request go with the new one. When another client of the session
+ * logged in since, its cookie is used.
+ *
+ * NOTE: This function is blocking, see api_multi for logging in without
+ * blocking.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the login failed.
+ *  1: the request has a new cookie.
+ */
+
+int api_client_request_relogin(struct t_api_client_request *request)
+{
+	struct t_api_client_session *session;
+	int rc;
+
+	if (!request || !request->client)
+		return -1;
+
+	session = request->client->session;
+	if (!session->callback_login)
+		return 0;
+
+	pthread_mutex_lock(&session->login_lock);
+	rc = api_client_request_renew_cookie(request);
+	if (rc < 1) {
+		(void)(session->callback_login)(request->client);
+		rc = api_client_request_renew_cookie(request);
+	}
+	pthread_mutex_unlock(&session->login_lock);
+
+	return (rc > 0) ? 1 : 0;
+}
+
+/*
+ * Check whether a failed attempt can be retried. The connect errors never
+ * reached the backend and a 5xx was not handled by it, other failures may
+ * have been handled and are not sent twice.
+ */
+
+static int api_client_is_retryable(struct t_api_client_request *request,
+				   CURLcode rc, int http_code)
+{
+	double connect_time;
+
+	switch (rc) {
+	case CURLE_OK:
+		return (http_code >= 500) ? 1 : 0;
+	case CURLE_COULDNT_RESOLVE_HOST:
+	case CURLE_COULDNT_CONNECT:
+	case CURLE_SSL_CONNECT_ERROR:
+		return 1;
+	case CURLE_OPERATION_TIMEDOUT:
+		/* only when it timed out connecting */
+		connect_time = 0;
+		curl_easy_getinfo(request->handle, CURLINFO_CONNECT_TIME,
+				  &connect_time);
+		return (connect_time <= 0) ? 1 : 0;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * The delay (ms) before the next attempt, it doubles with every attempt up to
+ * the max delay of the policy. Up to half of it is taken off at random.
+ */
+
+static long api_client_backoff(const struct t_api_client_retry_policy *policy,
+			       int attempt, unsigned int *seed)
+{
+	long delay;
+	int i;
+
+	delay = policy->delay;
+	for (i = 1; i < attempt && delay < policy->max_delay; ++i)
+		delay *= 2;
+	if (delay > policy->max_delay)
+		delay = policy->max_delay;
+
+	return delay - rand_r(seed) % (delay / 2 + 1);
+}
+
+/*
+ * Get the request ready for its first attempt, with the timeouts of the retry
+ * policy of its class (see t_api_client_retry_policy).
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  1: on success.
+ */
+
+int api_client_request_begin(struct t_api_client_request *request)
+{
+	const struct t_api_client_retry_policy *policy;
+
+	if (!request || !request->handle)
+		return -1;
+
+	policy = &request->client->session->retry[request->request_class];
+	curl_easy_setopt(request->handle, CURLOPT_CONNECTTIMEOUT_MS,
+			 (long)policy->connect_timeout);
+	curl_easy_setopt(request->handle, CURLOPT_TIMEOUT_MS,
+			 (long)policy->timeout);
+
+	request->attempt = 0;
+	request->relogged = 0;
+	request->seed = (unsigned int)(time_monotonic_ns() ^ (uintptr_t)request);
+
+	return 1;
+}
+
+/*
+ * Check the circuit of the client before an attempt of the request, and get
+ * the response ready for it.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the backend is down, the request fails right away.
+ *  1: the attempt may go out.
+ */
+
+int api_client_request_allow(struct t_api_client_request *request)
+{
+	if (!request || !request->handle)
+		return -1;
+
+	if (circuit_allow(request->client->session->circuit,
+			  time_monotonic_ns()) == 0) {
+		pilab_log(LOG_DEBUG, "The backend is down, not sending %s",
+			  request->url);
+		return 0;
+	}
+
+	api_client_response_clear(request->response);
+	request->attempt++;
+
+	return 1;
+}
+
+/*
+ * Decide, after api_client_request_complete, whether the attempt of the
+ * request that ended with rc is retried. A refused cookie is renewed and
+ * doesn't use up an attempt, once: the caller logs in again (see
+ * api_client_request_relogin) and attempts again right away.
+ *
+ * Returns the delay (in ms) before the next attempt,
+ * PILAB_API_CLIENT_RETRY_LOGIN when the cookie has to be renewed first, -1
+ * when the request is done (or on invalid argument).
+ */
+
+long api_client_request_retry(struct t_api_client_request *request,
+			      CURLcode rc)
+{
+	const struct t_api_client_retry_policy *policy;
+	struct t_api_client_session *session;
+	int http_code;
+
+	if (!request || !request->handle)
+		return -1;
+
+	session = request->client->session;
+	policy = &session->retry[request->request_class];
+	http_code = api_client_get_http_status_code_request(request);
+
+	if (rc == CURLE_OK && http_code == 401 && policy->relogin &&
+	    (session->callback_login || session->callback_login_request) &&
+	    !request->relogged) {
+		request->relogged = 1;
+		api_client_count_retry(1);
+		request->attempt--;
+		return PILAB_API_CLIENT_RETRY_LOGIN;
+	}
+
+	if (!api_client_is_retryable(request, rc, http_code) ||
+	    request->attempt >= policy->attempts)
+		return -1;
+
+	pilab_log(LOG_DEBUG, "Retrying %s, attempt %d of %d failed: %s",
+		  request->url, request->attempt, policy->attempts,
+		  (rc == CURLE_OK) ? "server error" : curl_easy_strerror(rc));
+	api_client_count_retry(0);
+
+	return api_client_backoff(policy, request->attempt, &request->seed);
+}
+
+/*
+ * Execute the request, following the retry policy of its class (see
+ * t_api_client_retry_policy). While the circuit of the client is open the
+ * request fails right away.
  *
  * NOTE: This function is blocking, as it will only proceed when the request has
- * either failed, timed-out, or succeeded.
+ * either failed, timed-out, or succeeded, retries included.
  *
  * Returns:
  * -1: invalid arguments.
@@ -516,17 +1255,67 @@ char *api_client_request_get_header(struct t_api_client_request *request,
 
 int api_client_request_execute(struct t_api_client_request *request)
 {
+	struct timespec pause;
 	/* curl result code */
 	CURLcode rc;
+	long delay;
+	int done;
+
+	if (api_client_request_begin(request) < 1)
+		return -1;
+
+	for (;;) {
+		if (api_client_request_allow(request) < 1)
+			return 0;
+
+		rc = curl_easy_perform(request->handle);
+		done = api_client_request_complete(request, rc);
+
+		delay = api_client_request_retry(request, rc);
+		if (delay == PILAB_API_CLIENT_RETRY_LOGIN) {
+			if (api_client_request_relogin(request) < 1)
+				return done;
+			continue;
+		}
+		if (delay < 0)
+			return done;
+
+		pause.tv_sec = delay / 1000;
+		pause.tv_nsec = (delay % 1000) * 1000000L;
+		while (nanosleep(&pause, &pause) < 0 && errno == EINTR)
+			;
+	}
+}
+
+/*
+ * Account for a finished transfer of the request, however it was executed.
+ * Anything below a 5xx shows the backend is up to the circuit of the client.
+ *
+ * Returns:
+ * -1: invalid arguments.
+ *  0: the transfer failed, returned an error status or an empty body.
+ *  1: the request succeeded.
+ */
+
+int api_client_request_complete(struct t_api_client_request *request,
+				CURLcode rc)
+{
 	int http_code;
 
-	if (!request)
+	if (!request || !request->handle)
 		return -1;
 
-	rc = curl_easy_perform(request->handle);
+	api_client_count_connection(request->handle, rc);
 
-	if (rc != CURLE_OK || request->response->response_body->length < 1) {
-		http_code = api_client_get_http_status_code_request(request);
+	http_code = api_client_get_http_status_code_request(request);
+	if (rc == CURLE_OK && http_code < 500)
+		circuit_success(request->client->session->circuit);
+	else
+		circuit_failure(request->client->session->circuit,
+				time_monotonic_ns());
+
+	if (rc != CURLE_OK || http_code >= 400 ||
+	    request->response->response_body->length < 1) {
 		pilab_log(
 			LOG_DEBUG,
 			"Failed to fetch the url, server returned a %d status code:",
@@ -539,27 +1328,41 @@ int api_client_request_execute(struct t_api_client_request *request)
 }
 
 /*
- * Execute all the requests of the client.
+ * Execute all the requests of the client, concurrently (see api_multi) with
+ * at most PILAB_API_MULTI_DEFAULT_PARALLEL transfers in flight.
  *
- * NOTE: This function is blocking, as it will only proceed when the request has
- * either failed, timed-out, or succeeded.
+ * NOTE: This function is blocking, as it will only proceed when every request
+ * has either failed, timed-out, or succeeded. It takes about as long as the
+ * slowest request, rather than all of them added up.
  *
  * Returns:
  * -1: invalid arguments.
  *  0: something went wrong while performing the execution.
- *  1: successfully executed the request.
+ *  1: successfully executed the requests.
  */
 
 int api_client_execute_all_requests(struct t_api_client *client)
 {
 	struct t_pilist *key_list;
 	struct t_api_client_request *request;
+	struct t_api_multi *multi;
 	int i, f;
 	char *key;
 
 	if (!client)
 		return -1;
 
+	multi = api_multi_create(client, PILAB_API_MULTI_DEFAULT_PARALLEL);
+	if (multi) {
+		f = (api_multi_add_all_requests(multi) < 0) ? 1 : 0;
+		if (api_multi_run(multi) < 1)
+			f++;
+		api_multi_free(multi);
+
+		return (f > 0) ? 0 : 1;
+	}
+
+	/* one after the other then */
 	key_list = hashtable_get_key_list(client->request_table);
 
 	f = 0;
@@ -588,7 +1391,7 @@ int api_client_execute_all_requests(struct t_api_client *client)
 
 int api_client_get_http_status_code_request(struct t_api_client_request *request)
 {
-	int http_code;
+	long http_code;
 	CURLcode rc;
 
 	if (!request)
@@ -597,14 +1400,12 @@ int api_client_get_http_status_code_request(struct t_api_client_request *request
 	if (api_client_request_is_initialized(request) < 1)
 		return 0;
 
+	/* curl writes a long */
 	http_code = 0;
 	rc = curl_easy_getinfo(request->handle, CURLINFO_RESPONSE_CODE,
 			       &http_code);
 
-	if (rc == CURLE_OK && http_code > 0)
-		return http_code;
-
-	return http_code;
+	return (rc == CURLE_OK) ? (int)http_code : 0;
 }
 
 /*
@@ -740,6 +1541,20 @@ void api_client_request_set_pointer(struct t_api_client_request *request,
 		request->callback_free_request_fields = pointer;
 }
 
+/*
+ * Set the class of a request, selecting its retry policy.
+ */
+
+void api_client_request_set_class(struct t_api_client_request *request,
+				  int request_class)
+{
+	if (!request || request_class < 0 ||
+	    request_class >= API_CLIENT_CLASS_NUM_CLASSES)
+		return;
+
+	request->request_class = request_class;
+}
+
 /*
  * Get a request with the provided fields to the url.
  *
@@ -848,8 +1663,13 @@ void api_client_request_free(struct t_api_client_request *request)
 	if (!request)
 		return;
 
-	if (request->handle)
-		curl_easy_cleanup(request->handle);
+	/* the next request of the client goes over its connection */
+	if (request->handle) {
+		if (request->client && !request->client->spare_handle)
+			request->client->spare_handle = request->handle;
+		else
+			curl_easy_cleanup(request->handle);
+	}
 
 	if (request->headers)
 		curl_slist_free_all(request->headers);
@@ -891,12 +1711,14 @@ void api_client_free(struct t_api_client *client)
 	if (client->config)
 		config_free(client->config);
 
-	if (client->cookie)
-		api_client_cookie_free(client->cookie);
-
 	if (client->request_table)
 		hashtable_free(client->request_table);
 
+	if (client->spare_handle)
+		curl_easy_cleanup(client->spare_handle);
+
+	api_client_session_unref(client->session);
+
 	free(client);
 }
 
@@ -906,5 +1728,8 @@ void api_client_free_minimal(struct t_api_client *client)
 		return;
 
 	free(client->request_table);
+	if (client->spare_handle)
+		curl_easy_cleanup(client->spare_handle);
+	api_client_session_unref(client->session);
 	free(client);
 }
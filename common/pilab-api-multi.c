@@ -0,0 +1,866 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include "pilab-api-multi.h"
+#include "pilab-list.h"
+#include "pilab-string.h"
+#include "pilab-log.h"
+#include "pilab-time.h"
+
+#define PILAB_API_MULTI_NSEC_PER_MSEC 1000000ULL
+/* Due time of a waiting request that waits for the login */
+#define PILAB_API_MULTI_LOGIN_WAIT UINT64_MAX
+
+/*
+ * Append a request to the queue.
+ *
+ * Returns 1 on success, 0 when the queue could not grow.
+ */
+
+static int api_multi_queue(struct t_api_multi *multi,
+			   struct t_api_client_request *request)
+{
+	struct t_api_client_request **new_queue;
+	int new_size;
+
+	if (multi->queue_tail == multi->queue_size) {
+		new_size = (multi->queue_size) ? multi->queue_size * 2 : 8;
+		new_queue = realloc(multi->queue,
+				    new_size * sizeof(*multi->queue));
+		if (!new_queue)
+			return 0;
+
+		multi->queue = new_queue;
+		multi->queue_size = new_size;
+	}
+
+	multi->queue[multi->queue_tail++] = request;
+
+	return 1;
+}
+
+/*
+ * Queue the waiting requests that are due at now (monotonic ns).
+ *
+ * Returns the time (in ms) until the next waiting request is due, -1 when
+ * none is waiting (for a time).
+ */
+
+static long api_multi_release(struct t_api_multi *multi, uint64_t now)
+{
+	uint64_t next;
+	int i, kept;
+
+	next = PILAB_API_MULTI_LOGIN_WAIT;
+	kept = 0;
+	for (i = 0; i < multi->num_waiting; ++i) {
+		if (multi->waiting_due[i] <= now &&
+		    api_multi_queue(multi, multi->waiting[i]))
+			continue;
+
+		if (multi->waiting_due[i] < next)
+			next = multi->waiting_due[i];
+		multi->waiting[kept] = multi->waiting[i];
+		multi->waiting_due[kept] = multi->waiting_due[i];
+		kept++;
+	}
+	multi->num_waiting = kept;
+
+	/* the ones waiting for the login are released when it is done */
+	if (next == PILAB_API_MULTI_LOGIN_WAIT)
+		return -1;
+
+	return (next > now) ?
+		       (long)((next - now + PILAB_API_MULTI_NSEC_PER_MSEC - 1) /
+			      PILAB_API_MULTI_NSEC_PER_MSEC) :
+		       0;
+}
+
+static void api_multi_fill(struct t_api_multi *multi);
+
+/*
+ * Event loop callback, the first waiting request is due.
+ */
+
+static void api_multi_on_retry(struct t_event_loop *loop, int fd,
+			       uint32_t events, void *data)
+{
+	struct t_api_multi *multi;
+	long next;
+
+	multi = (struct t_api_multi *)data;
+
+	event_loop_remove_source(loop, multi->retry_timeout);
+	multi->retry_timeout = NULL;
+
+	next = api_multi_release(multi, time_monotonic_ns());
+	if (next >= 0)
+		multi->retry_timeout = event_loop_add_timeout(
+			loop, (next < 1) ? 1 : (int)next, &api_multi_on_retry,
+			multi);
+
+	api_multi_fill(multi);
+}
+
+/*
+ * Let a request wait delay milliseconds before its next attempt, or until the
+ * login of the multi is done when delay is PILAB_API_CLIENT_RETRY_LOGIN.
+ *
+ * Returns 1 on success, 0 when it could not be kept.
+ */
+
+static int api_multi_wait(struct t_api_multi *multi,
+			  struct t_api_client_request *request, long delay)
+{
+	struct t_api_client_request **new_waiting;
+	uint64_t *new_due;
+	int new_size;
+
+	if (multi->num_waiting == multi->waiting_size) {
+		new_size = (multi->waiting_size) ? multi->waiting_size * 2 : 8;
+		new_waiting = realloc(multi->waiting,
+				      new_size * sizeof(*multi->waiting));
+		if (!new_waiting)
+			return 0;
+		multi->waiting = new_waiting;
+
+		new_due = realloc(multi->waiting_due,
+				  new_size * sizeof(*multi->waiting_due));
+		if (!new_due)
+			return 0;
+		multi->waiting_due = new_due;
+		multi->waiting_size = new_size;
+	}
+
+	multi->waiting[multi->num_waiting] = request;
+	multi->waiting_due[multi->num_waiting] =
+		(delay == PILAB_API_CLIENT_RETRY_LOGIN) ?
+			PILAB_API_MULTI_LOGIN_WAIT :
+			time_monotonic_ns() +
+				(uint64_t)delay * PILAB_API_MULTI_NSEC_PER_MSEC;
+	multi->num_waiting++;
+
+	/* the loop wakes up for the first one due */
+	if (multi->loop && delay != PILAB_API_CLIENT_RETRY_LOGIN) {
+		if (multi->retry_timeout)
+			event_loop_remove_source(multi->loop,
+						 multi->retry_timeout);
+		multi->retry_timeout = event_loop_add_timeout(
+			multi->loop, 1, &api_multi_on_retry, multi);
+	}
+
+	return 1;
+}
+
+/*
+ * Let a request wait for a login of the multi, the login is queued when none
+ * is on its way yet. The login runs as a transfer of the multi like any other
+ * request, so it doesn't block the thread driving the multi. Without a way to
+ * log in like that, a multi that isn't driven by an event loop logs in on the
+ * spot.
+ *
+ * Returns 1 when the request waits for the login, 0 when it can't log in.
+ */
+
+static int api_multi_wait_login(struct t_api_multi *multi,
+				struct t_api_client_request *request)
+{
+	struct t_api_client_session *session;
+
+	session = multi->client->session;
+	if (!session->callback_login_request || !session->callback_login_finish) {
+		if (multi->loop || api_client_request_relogin(request) < 1)
+			return 0;
+		return api_multi_wait(multi, request, 0);
+	}
+
+	if (!multi->login) {
+		multi->login = (session->callback_login_request)(multi->client);
+		if (!multi->login)
+			return 0;
+		api_client_request_begin(multi->login);
+		if (!api_multi_queue(multi, multi->login)) {
+			api_client_close_request(multi->client, multi->login);
+			multi->login = NULL;
+			return 0;
+		}
+		multi->stats.logins++;
+	}
+
+	return api_multi_wait(multi, request, PILAB_API_CLIENT_RETRY_LOGIN);
+}
+
+/*
+ * The login of the multi is done, it is handed to the login callback of the
+ * session. The requests waiting for it go with the new cookie; when it failed
+ * they go with the cookie they have, and fail on a 401 as they don't log in
+ * again.
+ */
+
+static void api_multi_login_done(struct t_api_multi *multi)
+{
+	struct t_api_client_request *login;
+	int logged_in, i;
+
+	login = multi->login;
+	multi->login = NULL;
+	logged_in = (multi->client->session->callback_login_finish)(
+		multi->client, login);
+
+	for (i = 0; i < multi->num_waiting; ++i) {
+		if (multi->waiting_due[i] != PILAB_API_MULTI_LOGIN_WAIT)
+			continue;
+
+		if (logged_in)
+			(void)api_client_request_add_cookie(multi->waiting[i]);
+		multi->waiting[i]->relogged = 1;
+		multi->waiting_due[i] = 0;
+	}
+
+	(void)api_multi_release(multi, time_monotonic_ns());
+}
+
+/*
+ * Check whether a request that is about to go out has to wait for a login
+ * first: the session isn't logged in (anymore), and the request may log in.
+ *
+ * Returns 1 when the request waits for the login, 0 when it may go out.
+ */
+
+static int api_multi_needs_login(struct t_api_multi *multi,
+				 struct t_api_client_request *request)
+{
+	struct t_api_client_session *session;
+
+	session = multi->client->session;
+	if (request == multi->login || request->relogged ||
+	    request->attempt > 0 ||
+	    !session->retry[request->request_class].relogin ||
+	    api_client_has_valid_cookie(request->client))
+		return 0;
+
+	/* another client logged in since the request got its cookie */
+	if (api_client_request_renew_cookie(request) > 0)
+		return 0;
+
+	request->relogged = 1;
+
+	return api_multi_wait_login(multi, request);
+}
+
+/*
+ * Start queued requests while there are free transfer slots, the requests
+ * fail right away while the circuit of the client is open.
+ */
+
+static void api_multi_fill(struct t_api_multi *multi)
+{
+	struct t_api_client_request *request;
+	int slot;
+
+	while (multi->running < multi->max_parallel &&
+	       multi->queue_head < multi->queue_tail) {
+		request = multi->queue[multi->queue_head++];
+
+		if (api_multi_needs_login(multi, request))
+			continue;
+
+		if (api_client_request_allow(request) < 1) {
+			if (request == multi->login) {
+				api_multi_login_done(multi);
+				continue;
+			}
+			multi->stats.failed++;
+			if (multi->callback_done)
+				(void)(multi->callback_done)(
+					multi, request, 0,
+					multi->callback_done_data);
+			continue;
+		}
+
+		curl_easy_setopt(request->handle, CURLOPT_PRIVATE, request);
+		if (curl_multi_add_handle(multi->handle, request->handle) !=
+		    CURLM_OK) {
+			pilab_log(LOG_DEBUG, "Could not start request %s",
+				  request->name);
+			if (request == multi->login) {
+				api_multi_login_done(multi);
+				continue;
+			}
+			multi->stats.failed++;
+			if (multi->callback_done)
+				(void)(multi->callback_done)(
+					multi, request, 0,
+					multi->callback_done_data);
+			continue;
+		}
+
+		for (slot = 0; multi->active[slot]; ++slot)
+			;
+		multi->active[slot] = request;
+		multi->running++;
+		multi->stats.started++;
+		if (multi->running > multi->stats.running_max)
+			multi->stats.running_max = multi->running;
+	}
+
+	/* the queue drained, start over at the front */
+	if (multi->queue_head == multi->queue_tail)
+		multi->queue_head = multi->queue_tail = 0;
+}
+
+/*
+ * Hand the finished transfers to the done callback, unless the retry policy
+ * of the request has it wait for another attempt, and start the queued
+ * requests in their place.
+ */
+
+static void api_multi_check_done(struct t_api_multi *multi)
+{
+	struct t_api_client_request *request;
+	CURLMsg *message;
+	CURLcode result;
+	long delay;
+	int left, rc, slot, waiting;
+
+	while ((message = curl_multi_info_read(multi->handle, &left))) {
+		if (message->msg != CURLMSG_DONE)
+			continue;
+
+		request = NULL;
+		result = message->data.result;
+		curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE,
+				  (char **)&request);
+		curl_multi_remove_handle(multi->handle, message->easy_handle);
+
+		for (slot = 0; slot < multi->max_parallel; ++slot)
+			if (multi->active[slot] == request)
+				break;
+		if (!request || slot == multi->max_parallel)
+			continue;
+		multi->active[slot] = NULL;
+		multi->running--;
+
+		rc = api_client_request_complete(request, result);
+		delay = api_client_request_retry(request, result);
+		if (delay == PILAB_API_CLIENT_RETRY_LOGIN) {
+			/* another client may have logged in already */
+			if (api_client_request_renew_cookie(request) > 0)
+				waiting = api_multi_wait(multi, request, 0);
+			else
+				waiting = api_multi_wait_login(multi, request);
+		} else {
+			waiting = delay >= 0 &&
+				  api_multi_wait(multi, request, delay);
+		}
+		if (waiting) {
+			multi->stats.retried++;
+			api_multi_fill(multi);
+			continue;
+		}
+
+		if (request == multi->login) {
+			api_multi_login_done(multi);
+			api_multi_fill(multi);
+			continue;
+		}
+
+		if (rc == 1)
+			multi->stats.completed++;
+		else
+			multi->stats.failed++;
+
+		api_multi_fill(multi);
+
+		if (multi->callback_done)
+			(void)(multi->callback_done)(multi, request, rc,
+						     multi->callback_done_data);
+	}
+}
+
+/*
+ * Event loop callback, a socket of a transfer is ready.
+ */
+
+static void api_multi_on_socket(struct t_event_loop *loop, int fd,
+				uint32_t events, void *data)
+{
+	struct t_api_multi *multi;
+	int flags, still_running;
+
+	multi = (struct t_api_multi *)data;
+
+	flags = 0;
+	if (events & EPOLLIN)
+		flags |= CURL_CSELECT_IN;
+	if (events & EPOLLOUT)
+		flags |= CURL_CSELECT_OUT;
+	if (events & (EPOLLERR | EPOLLHUP))
+		flags |= CURL_CSELECT_ERR;
+
+	curl_multi_socket_action(multi->handle, fd, flags, &still_running);
+	api_multi_check_done(multi);
+}
+
+/*
+ * Event loop callback, the timeout curl asked for expired.
+ */
+
+static void api_multi_on_timeout(struct t_event_loop *loop, int fd,
+				 uint32_t events, void *data)
+{
+	struct t_api_multi *multi;
+	int still_running;
+
+	multi = (struct t_api_multi *)data;
+
+	/* curl may ask for a new timeout from within the action */
+	event_loop_remove_source(loop, multi->timeout);
+	multi->timeout = NULL;
+
+	curl_multi_socket_action(multi->handle, CURL_SOCKET_TIMEOUT, 0,
+				 &still_running);
+	api_multi_check_done(multi);
+}
+
+/*
+ * Curl callback, watch (or stop watching) a socket of a transfer in the event
+ * loop. The source of the socket is kept by curl, as socketp.
+ */
+
+static int api_multi_socket_cb(CURL *easy, curl_socket_t s, int what,
+			       void *userp, void *socketp)
+{
+	struct t_api_multi *multi;
+	struct t_event_loop_source *source;
+	uint32_t events;
+
+	multi = (struct t_api_multi *)userp;
+	source = (struct t_event_loop_source *)socketp;
+
+	if (what == CURL_POLL_REMOVE) {
+		event_loop_remove_source(multi->loop, source);
+		curl_multi_assign(multi->handle, s, NULL);
+		return 0;
+	}
+
+	events = 0;
+	if (what & CURL_POLL_IN)
+		events |= EPOLLIN;
+	if (what & CURL_POLL_OUT)
+		events |= EPOLLOUT;
+
+	if (source) {
+		event_loop_modify_fd(multi->loop, source, events);
+	} else {
+		source = event_loop_add_fd(multi->loop, s, events,
+					   &api_multi_on_socket, multi);
+		if (!source)
+			return -1;
+		curl_multi_assign(multi->handle, s, source);
+	}
+
+	return 0;
+}
+
+/*
+ * Curl callback, (re)arm the single timeout of the multi in the event loop,
+ * -1 disarms it.
+ */
+
+static int api_multi_timer_cb(CURLM *handle, long timeout_ms, void *userp)
+{
+	struct t_api_multi *multi;
+
+	multi = (struct t_api_multi *)userp;
+
+	if (multi->timeout) {
+		event_loop_remove_source(multi->loop, multi->timeout);
+		multi->timeout = NULL;
+	}
+
+	if (timeout_ms < 0)
+		return 0;
+
+	/* a timeout of 0 means right away, the loop can't do less than 1 */
+	multi->timeout = event_loop_add_timeout(
+		multi->loop, (timeout_ms < 1) ? 1 : (int)timeout_ms,
+		&api_multi_on_timeout, multi);
+
+	return (multi->timeout) ? 0 : -1;
+}
+
+/*
+ * Conjure up a multi, that runs the requests of client concurrently with at
+ * most max_parallel transfers in flight. Pass 0 (or less) for the default.
+ *
+ * Returns a pointer to the newly created multi, NULL otherwise.
+ */
+
+struct t_api_multi *api_multi_create(struct t_api_client *client,
+				     int max_parallel)
+{
+	struct t_api_multi *new_multi;
+
+	if (!client)
+		return NULL;
+
+	if (!api_client_connections_init())
+		return NULL;
+
+	new_multi = calloc(1, sizeof(*new_multi));
+	if (!new_multi)
+		return NULL;
+
+	new_multi->handle = curl_multi_init();
+	if (!new_multi->handle) {
+		pilab_log(LOG_DEBUG, "Could not create a curl multi handle");
+		free(new_multi);
+		return NULL;
+	}
+
+	new_multi->client = client;
+	new_multi->max_parallel = (max_parallel > 0) ?
+					  max_parallel :
+					  PILAB_API_MULTI_DEFAULT_PARALLEL;
+	new_multi->active = calloc(new_multi->max_parallel,
+				   sizeof(*new_multi->active));
+	if (!new_multi->active) {
+		curl_multi_cleanup(new_multi->handle);
+		free(new_multi);
+		return NULL;
+	}
+	new_multi->queue = NULL;
+	new_multi->queue_size = 0;
+	new_multi->queue_head = 0;
+	new_multi->queue_tail = 0;
+	new_multi->running = 0;
+	new_multi->loop = NULL;
+	new_multi->timeout = NULL;
+	new_multi->retry_timeout = NULL;
+	new_multi->waiting = NULL;
+	new_multi->waiting_due = NULL;
+	new_multi->waiting_size = 0;
+	new_multi->num_waiting = 0;
+	new_multi->login = NULL;
+	new_multi->threaded = 0;
+	new_multi->callback_done = NULL;
+	new_multi->callback_done_data = NULL;
+
+	/* no more connections than transfers, the rest waits in the cache */
+	curl_multi_setopt(new_multi->handle, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+			  (long)new_multi->max_parallel);
+
+	return new_multi;
+}
+
+/*
+ * Set a pointer property of the multi.
+ *
+ * Properties:
+ * - callback_done
+ * - callback_done_data
+ */
+
+void api_multi_set_pointer(struct t_api_multi *multi, const char *property,
+			   void *pointer)
+{
+	if (!multi || !property)
+		return;
+
+	if (string_strcasecmp(property, "callback_done") == 0)
+		multi->callback_done = pointer;
+	else if (string_strcasecmp(property, "callback_done_data") == 0)
+		multi->callback_done_data = pointer;
+}
+
+/*
+ * Queue an initialised request, it starts as soon as a transfer slot is free.
+ *
+ * NOTE: The request stays owned by its client, don't close it before the done
+ * callback was called for it.
+ *
+ * Returns:
+ * -1: invalid arguments, or the request is not initialised.
+ *  0: the request could not be queued.
+ *  1: on success.
+ */
+
+int api_multi_add_request(struct t_api_multi *multi,
+			  struct t_api_client_request *request)
+{
+	if (!multi || api_client_request_is_initialized(request) < 1)
+		return -1;
+
+	api_client_request_begin(request);
+	if (!api_multi_queue(multi, request))
+		return 0;
+
+	api_multi_fill(multi);
+
+	return 1;
+}
+
+/*
+ * Queue every initialised request of the client.
+ *
+ * Returns the amount of queued requests, -1 on invalid argument.
+ */
+
+int api_multi_add_all_requests(struct t_api_multi *multi)
+{
+	struct t_pilist *key_list;
+	struct t_api_client_request *request;
+	int i, queued;
+
+	if (!multi)
+		return -1;
+
+	key_list = hashtable_get_key_list(multi->client->request_table);
+	if (!key_list)
+		return 0;
+
+	queued = 0;
+	for (i = 0; i < key_list->size; ++i) {
+		request = api_client_get_request(multi->client,
+						 pilist_get_data(key_list, i));
+		if (api_multi_add_request(multi, request) == 1)
+			queued++;
+	}
+
+	pilist_free(key_list);
+
+	return queued;
+}
+
+/*
+ * Returns the amount of requests queued, in flight or waiting for another
+ * attempt, -1 on invalid argument.
+ */
+
+int api_multi_remaining(struct t_api_multi *multi)
+{
+	if (!multi)
+		return -1;
+
+	return multi->running + multi->queue_tail - multi->queue_head +
+	       multi->num_waiting;
+}
+
+/*
+ * Drive the transfers from an event loop, the done callbacks are called from
+ * the thread running the loop.
+ *
+ * NOTE: Attach before the multi performs anything, and only add requests from
+ * the thread running the loop afterwards.
+ *
+ * Returns:
+ * -1: invalid arguments.
+ *  0: the multi is driven already.
+ *  1: on success.
+ */
+
+int api_multi_attach(struct t_api_multi *multi, struct t_event_loop *loop)
+{
+	int still_running;
+
+	if (!multi || !loop)
+		return -1;
+
+	if (multi->loop || multi->threaded)
+		return 0;
+
+	multi->loop = loop;
+	curl_multi_setopt(multi->handle, CURLMOPT_SOCKETFUNCTION,
+			  &api_multi_socket_cb);
+	curl_multi_setopt(multi->handle, CURLMOPT_SOCKETDATA, multi);
+	curl_multi_setopt(multi->handle, CURLMOPT_TIMERFUNCTION,
+			  &api_multi_timer_cb);
+	curl_multi_setopt(multi->handle, CURLMOPT_TIMERDATA, multi);
+
+	/* kick off the transfers that were added before */
+	curl_multi_socket_action(multi->handle, CURL_SOCKET_TIMEOUT, 0,
+				 &still_running);
+	api_multi_check_done(multi);
+
+	return 1;
+}
+
+/*
+ * Make progress on the transfers, waiting at most timeout milliseconds for
+ * activity when nothing could be done right away. For a multi that isn't
+ * driven by an event loop.
+ *
+ * Returns the amount of requests queued or in flight, -1 on invalid
+ * arguments.
+ */
+
+int api_multi_perform(struct t_api_multi *multi, int timeout)
+{
+	struct timespec pause;
+	int still_running, numfds;
+	long next;
+
+	if (!multi || multi->loop)
+		return -1;
+
+	(void)api_multi_release(multi, time_monotonic_ns());
+	api_multi_fill(multi);
+
+	curl_multi_perform(multi->handle, &still_running);
+	api_multi_check_done(multi);
+
+	if (api_multi_remaining(multi) < 1 || timeout < 1)
+		return api_multi_remaining(multi);
+
+	/* don't sleep past the next retry */
+	next = api_multi_release(multi, time_monotonic_ns());
+	if (next >= 0 && next < timeout)
+		timeout = (int)next;
+
+	if (multi->running > 0) {
+		curl_multi_wait(multi->handle, NULL, 0, timeout, &numfds);
+	} else if (timeout > 0) {
+		/* nothing in flight, curl would return right away */
+		pause.tv_sec = timeout / 1000;
+		pause.tv_nsec = (timeout % 1000) * 1000000L;
+		while (nanosleep(&pause, &pause) < 0 && errno == EINTR)
+			;
+	}
+
+	return api_multi_remaining(multi);
+}
+
+/*
+ * Run all the queued requests.
+ *
+ * NOTE: This function is blocking, but the requests run concurrently, it
+ * takes about as long as the slowest of them.
+ *
+ * Returns:
+ * -1: invalid arguments.
+ *  0: at least one of the requests failed.
+ *  1: every request succeeded.
+ */
+
+int api_multi_run(struct t_api_multi *multi)
+{
+	unsigned long failed;
+
+	if (!multi || multi->loop)
+		return -1;
+
+	failed = multi->stats.failed;
+	while (api_multi_perform(multi, PILAB_API_MULTI_WAIT) > 0)
+		;
+
+	return (multi->stats.failed > failed) ? 0 : 1;
+}
+
+static void *api_multi_thread(void *data)
+{
+	return (void *)(intptr_t)api_multi_run((struct t_api_multi *)data);
+}
+
+/*
+ * Run all the queued requests on a thread of their own, the done callbacks
+ * are called from that thread.
+ *
+ * NOTE: Queue the requests before, and leave the multi alone until
+ * api_multi_join returned.
+ *
+ * Returns:
+ * -1: invalid arguments.
+ *  0: the thread could not be started, or the multi is driven already.
+ *  1: on success.
+ */
+
+int api_multi_start(struct t_api_multi *multi)
+{
+	if (!multi)
+		return -1;
+
+	if (multi->loop || multi->threaded)
+		return 0;
+
+	multi->threaded = (pthread_create(&multi->thread, NULL,
+					  &api_multi_thread, multi) == 0);
+
+	return multi->threaded;
+}
+
+/*
+ * Wait for the thread started by api_multi_start.
+ *
+ * Returns what api_multi_run returned on the thread, -1 when there was no
+ * thread.
+ */
+
+int api_multi_join(struct t_api_multi *multi)
+{
+	void *rc;
+
+	if (!multi || !multi->threaded)
+		return -1;
+
+	pthread_join(multi->thread, &rc);
+	multi->threaded = 0;
+
+	return (int)(intptr_t)rc;
+}
+
+/*
+ * Copy the counters of the multi.
+ */
+
+void api_multi_get_stats(struct t_api_multi *multi,
+			 struct t_api_multi_stats *stats)
+{
+	if (!multi || !stats)
+		return;
+
+	*stats = multi->stats;
+}
+
+/*
+ * Free the multi, the transfers still in flight or waiting for another
+ * attempt are abandoned. The requests themselves stay with their client, but
+ * for a login on its way.
+ *
+ * NOTE: Don't call this from within a done callback.
+ */
+
+void api_multi_free(struct t_api_multi *multi)
+{
+	int slot;
+
+	if (!multi)
+		return;
+
+	(void)api_multi_join(multi);
+
+	/* hand the requests in flight back to their client */
+	for (slot = 0; slot < multi->max_parallel; ++slot)
+		if (multi->active[slot])
+			curl_multi_remove_handle(multi->handle,
+						 multi->active[slot]->handle);
+
+	curl_multi_cleanup(multi->handle);
+
+	/* the login is the only request the multi owns */
+	if (multi->login)
+		api_client_close_request(multi->client, multi->login);
+
+	if (multi->loop && multi->timeout)
+		event_loop_remove_source(multi->loop, multi->timeout);
+	if (multi->loop && multi->retry_timeout)
+		event_loop_remove_source(multi->loop, multi->retry_timeout);
+
+	free(multi->waiting);
+	free(multi->waiting_due);
+	free(multi->active);
+	free(multi->queue);
+	free(multi);
+}
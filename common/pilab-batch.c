@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "pilab-batch.h"
+
+#define PILAB_BATCH_NSEC_PER_MSEC 1000000ULL
+
+/*
+ * Conjure up a new batch of readings, that is due for its upload once it
+ * holds max_items readings or its oldest reading is max_age milliseconds old.
+ * Pass 0 (or less) for the defaults.
+ *
+ * Returns a pointer to the newly created batch, NULL otherwise.
+ */
+
+struct t_batch *batch_create(int max_items, int max_age)
+{
+	struct t_batch *new_batch;
+
+	if (max_items < 1)
+		max_items = PILAB_BATCH_DEFAULT_SIZE;
+	if (max_age < 1)
+		max_age = PILAB_BATCH_DEFAULT_AGE;
+
+	new_batch = calloc(1, sizeof(*new_batch));
+	if (!new_batch)
+		return NULL;
+
+	new_batch->items = calloc(max_items, sizeof(*new_batch->items));
+	if (!new_batch->items) {
+		free(new_batch);
+		return NULL;
+	}
+
+	new_batch->num_items = 0;
+	new_batch->max_items = max_items;
+	new_batch->max_age = (uint64_t)max_age * PILAB_BATCH_NSEC_PER_MSEC;
+	new_batch->oldest = 0;
+	pthread_mutex_init(&new_batch->lock, NULL);
+
+	return new_batch;
+}
+
+/*
+ * Add the reading of sensor name, taken at timestamp (ms since the epoch), at
+ * now (monotonic ns).
+ *
+ * Returns:
+ * -1: invalid arguments.
+ *  0: the batch is full, take it first.
+ *  1: on success.
+ */
+
+int batch_add(struct t_batch *batch, const char *name, const char *type,
+	      uint64_t timestamp, double value, uint64_t now)
+{
+	struct t_batch_item *item;
+
+	if (!batch || !name)
+		return -1;
+
+	pthread_mutex_lock(&batch->lock);
+	if (batch->num_items == batch->max_items) {
+		batch->stats.dropped++;
+		pthread_mutex_unlock(&batch->lock);
+		return 0;
+	}
+
+	if (batch->num_items == 0)
+		batch->oldest = now;
+
+	item = &batch->items[batch->num_items++];
+	snprintf(item->name, sizeof(item->name), "%s", name);
+	snprintf(item->type, sizeof(item->type), "%s",
+		 (type) ? type : PILAB_BATCH_DEFAULT_TYPE);
+	item->timestamp = timestamp;
+	item->value = value;
+	batch->stats.added++;
+	pthread_mutex_unlock(&batch->lock);
+
+	return 1;
+}
+
+/*
+ * batch_is_due, for a caller holding the lock.
+ */
+
+static int batch_is_due_locked(struct t_batch *batch, uint64_t now)
+{
+	if (batch->num_items == 0)
+		return 0;
+
+	if (batch->num_items >= batch->max_items)
+		return 1;
+
+	return (now >= batch->oldest && now - batch->oldest >= batch->max_age) ?
+		       1 :
+		       0;
+}
+
+/*
+ * Returns 1 when the batch is full or too old at now (monotonic ns), 0 when
+ * it can wait, -1 on invalid argument.
+ */
+
+int batch_is_due(struct t_batch *batch, uint64_t now)
+{
+	int due;
+
+	if (!batch)
+		return -1;
+
+	pthread_mutex_lock(&batch->lock);
+	due = batch_is_due_locked(batch, now);
+	pthread_mutex_unlock(&batch->lock);
+
+	return due;
+}
+
+/*
+ * Convert num_items readings to the array uploaded for them.
+ *
+ * NOTE: The array returned by this function needs to be put afterwards.
+ *
+ * Returns the readings as a json array of objects (see PILAB_BATCH_KEY_*),
+ * NULL otherwise.
+ */
+
+json_object *batch_items_to_json(const struct t_batch_item *items,
+				 int num_items)
+{
+	const struct t_batch_item *item;
+	json_object *readings, *reading;
+	int i;
+
+	if (!items || num_items < 0)
+		return NULL;
+
+	readings = json_object_new_array();
+	if (!readings)
+		return NULL;
+
+	for (i = 0; i < num_items; ++i) {
+		item = &items[i];
+
+		reading = json_object_new_object();
+		json_object_object_add(reading, PILAB_BATCH_KEY_NAME,
+				       json_object_new_string(item->name));
+		json_object_object_add(reading, PILAB_BATCH_KEY_TYPE,
+				       json_object_new_string(item->type));
+		json_object_object_add(
+			reading, PILAB_BATCH_KEY_TIMESTAMP,
+			json_object_new_int64((int64_t)item->timestamp));
+		json_object_object_add(reading, PILAB_BATCH_KEY_VALUE,
+				       json_object_new_double(item->value));
+		json_object_array_add(readings, reading);
+	}
+
+	return readings;
+}
+
+/*
+ * Take the readings out of the batch when it is due at now (monotonic ns), or
+ * whenever it holds readings when force is set. Concurrent callers get the
+ * readings once.
+ *
+ * NOTE: The array returned by this function needs to be put afterwards.
+ *
+ * Returns the readings as a json array of objects (see PILAB_BATCH_KEY_*),
+ * NULL when there is nothing to take.
+ */
+
+json_object *batch_take(struct t_batch *batch, uint64_t now, int force)
+{
+	json_object *readings;
+
+	if (!batch)
+		return NULL;
+
+	pthread_mutex_lock(&batch->lock);
+	if (batch->num_items == 0 ||
+	    (!force && !batch_is_due_locked(batch, now))) {
+		pthread_mutex_unlock(&batch->lock);
+		return NULL;
+	}
+
+	readings = batch_items_to_json(batch->items, batch->num_items);
+	if (!readings) {
+		pthread_mutex_unlock(&batch->lock);
+		return NULL;
+	}
+
+	if (batch->num_items >= batch->max_items)
+		batch->stats.full++;
+	else if (batch_is_due_locked(batch, now))
+		batch->stats.aged++;
+	else
+		batch->stats.forced++;
+	batch->stats.taken += batch->num_items;
+	batch->num_items = 0;
+	pthread_mutex_unlock(&batch->lock);
+
+	return readings;
+}
+
+/*
+ * Copy the counters of the batch.
+ */
+
+void batch_get_stats(struct t_batch *batch, struct t_batch_stats *stats)
+{
+	if (!batch || !stats)
+		return;
+
+	pthread_mutex_lock(&batch->lock);
+	*stats = batch->stats;
+	pthread_mutex_unlock(&batch->lock);
+}
+
+/*
+ * Free the batch, the readings it still holds are lost.
+ */
+
+void batch_free(struct t_batch *batch)
+{
+	if (!batch)
+		return;
+
+	pthread_mutex_destroy(&batch->lock);
+	free(batch->items);
+	free(batch);
+}
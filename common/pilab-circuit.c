@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include "pilab-circuit.h"
+#include "pilab-log.h"
+
+#define PILAB_CIRCUIT_NSEC_PER_MSEC 1000000ULL
+
+/*
+ * Conjure up a new circuit breaker, that opens after threshold failures in a
+ * row and then lets a probe through every probe_interval milliseconds. Pass 0
+ * (or less) for the defaults.
+ *
+ * Returns a pointer to the newly created circuit, NULL otherwise.
+ */
+
+struct t_circuit *circuit_create(int threshold, int probe_interval)
+{
+	struct t_circuit *new_circuit;
+
+	if (threshold < 1)
+		threshold = PILAB_CIRCUIT_DEFAULT_THRESHOLD;
+	if (probe_interval < 1)
+		probe_interval = PILAB_CIRCUIT_DEFAULT_PROBE;
+
+	new_circuit = calloc(1, sizeof(*new_circuit));
+	if (!new_circuit)
+		return NULL;
+
+	new_circuit->state = CIRCUIT_CLOSED;
+	new_circuit->failures = 0;
+	new_circuit->threshold = threshold;
+	new_circuit->probe_interval =
+		(uint64_t)probe_interval * PILAB_CIRCUIT_NSEC_PER_MSEC;
+	pthread_mutex_init(&new_circuit->lock, NULL);
+
+	return new_circuit;
+}
+
+/*
+ * Check whether a request may go out at now (monotonic ns). While the circuit
+ * is open one request per probe interval goes out as the probe, its outcome
+ * closes or reopens the circuit.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the backend is down, fail fast.
+ *  1: the request may go out.
+ */
+
+int circuit_allow(struct t_circuit *circuit, uint64_t now)
+{
+	int allow;
+
+	if (!circuit)
+		return -1;
+
+	pthread_mutex_lock(&circuit->lock);
+	if (circuit->state == CIRCUIT_CLOSED) {
+		allow = 1;
+	} else if (now >= circuit->next_probe) {
+		/* a probe that never reported back doesn't block the next */
+		circuit->state = CIRCUIT_HALF_OPEN;
+		circuit->next_probe = now + circuit->probe_interval;
+		circuit->stats.probes++;
+		allow = 1;
+	} else {
+		circuit->stats.rejected++;
+		allow = 0;
+	}
+	pthread_mutex_unlock(&circuit->lock);
+
+	return allow;
+}
+
+/*
+ * A request reached the backend, the circuit closes.
+ */
+
+void circuit_success(struct t_circuit *circuit)
+{
+	if (!circuit)
+		return;
+
+	pthread_mutex_lock(&circuit->lock);
+	circuit->failures = 0;
+	if (circuit->state != CIRCUIT_CLOSED) {
+		circuit->state = CIRCUIT_CLOSED;
+		circuit->stats.closed++;
+		pilab_log(LOG_INFO, "The backend is back, closing the circuit");
+	}
+	pthread_mutex_unlock(&circuit->lock);
+}
+
+/*
+ * A request failed at now (monotonic ns), the circuit opens when that made
+ * threshold failures in a row or the probe failed.
+ */
+
+void circuit_failure(struct t_circuit *circuit, uint64_t now)
+{
+	if (!circuit)
+		return;
+
+	pthread_mutex_lock(&circuit->lock);
+	circuit->failures++;
+	if (circuit->state == CIRCUIT_HALF_OPEN) {
+		circuit->state = CIRCUIT_OPEN;
+		circuit->next_probe = now + circuit->probe_interval;
+	} else if (circuit->state == CIRCUIT_CLOSED &&
+		   circuit->failures >= circuit->threshold) {
+		circuit->state = CIRCUIT_OPEN;
+		circuit->next_probe = now + circuit->probe_interval;
+		circuit->stats.opened++;
+		pilab_log(LOG_ERROR,
+			  "The backend failed %d times in a row, probing it every %llu ms",
+			  circuit->failures,
+			  (unsigned long long)(circuit->probe_interval /
+					       PILAB_CIRCUIT_NSEC_PER_MSEC));
+	}
+	pthread_mutex_unlock(&circuit->lock);
+}
+
+/*
+ * Copy the counters of the circuit.
+ */
+
+void circuit_get_stats(struct t_circuit *circuit, struct t_circuit_stats *stats)
+{
+	if (!circuit || !stats)
+		return;
+
+	pthread_mutex_lock(&circuit->lock);
+	*stats = circuit->stats;
+	pthread_mutex_unlock(&circuit->lock);
+}
+
+/*
+ * Free the circuit.
+ */
+
+void circuit_free(struct t_circuit *circuit)
+{
+	if (!circuit)
+		return;
+
+	pthread_mutex_destroy(&circuit->lock);
+	free(circuit);
+}
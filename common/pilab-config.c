@@ -13,6 +13,16 @@ char *config_field_type_string[CONFIG_FIELD_NUM_TYPES] = {
 	PILAB_CONFIG_FIELD_CLASSROOM, PILAB_CONFIG_FIELD_EMAIL,
 	PILAB_CONFIG_FIELD_PASS,      PILAB_CONFIG_FIELD_ADDRESS,
 	PILAB_CONFIG_FIELD_PORT,      PILAB_CONFIG_FIELD_MAC,
+	PILAB_CONFIG_FIELD_SAMPLER_WORKERS, PILAB_CONFIG_FIELD_SCHEDULE_JITTER,
+	PILAB_CONFIG_FIELD_SHUTDOWN_TIMEOUT, PILAB_CONFIG_FIELD_W1_ROOT,
+	PILAB_CONFIG_FIELD_HAL, PILAB_CONFIG_FIELD_TRACE_RECORD,
+	PILAB_CONFIG_FIELD_TRACE_REPLAY, PILAB_CONFIG_FIELD_TRACE_SPEED,
+	PILAB_CONFIG_FIELD_BATCH_SIZE, PILAB_CONFIG_FIELD_BATCH_AGE,
+	PILAB_CONFIG_FIELD_SPOOL_DIR, PILAB_CONFIG_FIELD_SPOOL_MODE,
+	PILAB_CONFIG_FIELD_SPOOL_SIZE, PILAB_CONFIG_FIELD_SPOOL_RATE,
+	PILAB_CONFIG_FIELD_RETRY_DEFAULT, PILAB_CONFIG_FIELD_RETRY_LOGIN,
+	PILAB_CONFIG_FIELD_RETRY_READING, PILAB_CONFIG_FIELD_CIRCUIT_THRESHOLD,
+	PILAB_CONFIG_FIELD_CIRCUIT_PROBE,
 };
 
 /*
@@ -58,6 +68,26 @@ struct t_pilab_config *config_create_custom(const char *path)
 	new_config->password = NULL;
 	new_config->address = NULL;
 	new_config->port = NULL;
+	new_config->mac = NULL;
+	new_config->sampler_workers = 0;
+	new_config->schedule_jitter = 0;
+	new_config->shutdown_timeout = 0;
+	new_config->w1_root = NULL;
+	new_config->hal = NULL;
+	new_config->trace_record = NULL;
+	new_config->trace_replay = NULL;
+	new_config->trace_speed = 0;
+	new_config->batch_size = 0;
+	new_config->batch_age = 0;
+	new_config->spool_dir = NULL;
+	new_config->spool_mode = NULL;
+	new_config->spool_size = 0;
+	new_config->spool_rate = 0;
+	new_config->retry_default = NULL;
+	new_config->retry_login = NULL;
+	new_config->retry_reading = NULL;
+	new_config->circuit_threshold = 0;
+	new_config->circuit_probe = 0;
 
 	return new_config;
 }
@@ -236,6 +266,91 @@ int config_assign_value(struct t_pilab_config *config,
 				free(config->password);
 			config->password = value;
 			break;
+		case CONFIG_FIELD_SAMPLER_WORKERS:
+			config->sampler_workers = atoi(value);
+			free(value);
+			break;
+		case CONFIG_FIELD_SCHEDULE_JITTER:
+			config->schedule_jitter = atoi(value);
+			free(value);
+			break;
+		case CONFIG_FIELD_SHUTDOWN_TIMEOUT:
+			config->shutdown_timeout = atoi(value);
+			free(value);
+			break;
+		case CONFIG_FIELD_W1_ROOT:
+			if (config->w1_root)
+				free(config->w1_root);
+			config->w1_root = value;
+			break;
+		case CONFIG_FIELD_HAL:
+			if (config->hal)
+				free(config->hal);
+			config->hal = value;
+			break;
+		case CONFIG_FIELD_TRACE_RECORD:
+			if (config->trace_record)
+				free(config->trace_record);
+			config->trace_record = value;
+			break;
+		case CONFIG_FIELD_TRACE_REPLAY:
+			if (config->trace_replay)
+				free(config->trace_replay);
+			config->trace_replay = value;
+			break;
+		case CONFIG_FIELD_TRACE_SPEED:
+			config->trace_speed = atoi(value);
+			free(value);
+			break;
+		case CONFIG_FIELD_BATCH_SIZE:
+			config->batch_size = atoi(value);
+			free(value);
+			break;
+		case CONFIG_FIELD_BATCH_AGE:
+			config->batch_age = atoi(value);
+			free(value);
+			break;
+		case CONFIG_FIELD_SPOOL_DIR:
+			if (config->spool_dir)
+				free(config->spool_dir);
+			config->spool_dir = value;
+			break;
+		case CONFIG_FIELD_SPOOL_MODE:
+			if (config->spool_mode)
+				free(config->spool_mode);
+			config->spool_mode = value;
+			break;
+		case CONFIG_FIELD_SPOOL_SIZE:
+			config->spool_size = atoi(value);
+			free(value);
+			break;
+		case CONFIG_FIELD_SPOOL_RATE:
+			config->spool_rate = atoi(value);
+			free(value);
+			break;
+		case CONFIG_FIELD_RETRY_DEFAULT:
+			if (config->retry_default)
+				free(config->retry_default);
+			config->retry_default = value;
+			break;
+		case CONFIG_FIELD_RETRY_LOGIN:
+			if (config->retry_login)
+				free(config->retry_login);
+			config->retry_login = value;
+			break;
+		case CONFIG_FIELD_RETRY_READING:
+			if (config->retry_reading)
+				free(config->retry_reading);
+			config->retry_reading = value;
+			break;
+		case CONFIG_FIELD_CIRCUIT_THRESHOLD:
+			config->circuit_threshold = atoi(value);
+			free(value);
+			break;
+		case CONFIG_FIELD_CIRCUIT_PROBE:
+			config->circuit_probe = atoi(value);
+			free(value);
+			break;
 		case CONFIG_FIELD_NUM_TYPES:;
 		}
 	}
@@ -387,6 +502,24 @@ void config_free(struct t_pilab_config *config)
 		free(config->mac);
 	if (config->base_url)
 		free(config->base_url);
+	if (config->w1_root)
+		free(config->w1_root);
+	if (config->hal)
+		free(config->hal);
+	if (config->trace_record)
+		free(config->trace_record);
+	if (config->trace_replay)
+		free(config->trace_replay);
+	if (config->spool_dir)
+		free(config->spool_dir);
+	if (config->spool_mode)
+		free(config->spool_mode);
+	if (config->retry_default)
+		free(config->retry_default);
+	if (config->retry_login)
+		free(config->retry_login);
+	if (config->retry_reading)
+		free(config->retry_reading);
 
 	free(config);
 }
@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <math.h>
+#include "pilab-deadband.h"
+
+#define PILAB_DEADBAND_NSEC_PER_SEC 1000000000ULL
+
+/*
+ * Conjure up a new deadband (report by exception).
+ *
+ * A reading is only reported when it differs from the last reported value by
+ * more than the absolute change, and by more than the relative change (0.01 is
+ * 1%) of the last reported value. When nothing was reported for max_silence
+ * seconds, the reading is reported anyway, so the backend knows the sensor is
+ * alive. Pass 0 (or less) as max_silence to use the default heartbeat.
+ *
+ * Returns a pointer to the newly created deadband, NULL otherwise.
+ */
+
+struct t_deadband *deadband_create(double absolute, double relative,
+				   int max_silence)
+{
+	struct t_deadband *new_deadband;
+
+	if (absolute < 0 || relative < 0)
+		return NULL;
+
+	new_deadband = calloc(1, sizeof(*new_deadband));
+	if (!new_deadband)
+		return NULL;
+
+	if (max_silence < 1)
+		max_silence = PILAB_DEADBAND_DEFAULT_MAX_SILENCE;
+
+	new_deadband->absolute = absolute;
+	new_deadband->relative = relative;
+	new_deadband->max_silence =
+		(uint64_t)max_silence * PILAB_DEADBAND_NSEC_PER_SEC;
+	new_deadband->has_sent = 0;
+	pthread_mutex_init(&new_deadband->lock, NULL);
+
+	return new_deadband;
+}
+
+/*
+ * Check whether a reading taken at now (monotonic ns) should be reported.
+ *
+ * NOTE: Call deadband_sent once the reading was reported successfully, a
+ * reading that fails to upload is retried with the next reading.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the reading lies within the deadband.
+ *  1: the reading should be reported.
+ */
+
+int deadband_check(struct t_deadband *deadband, double value, uint64_t now)
+{
+	double change, band;
+	int rc;
+
+	if (!deadband)
+		return -1;
+
+	pthread_mutex_lock(&deadband->lock);
+	deadband->stats.readings++;
+
+	if (!deadband->has_sent) {
+		rc = 1;
+	} else {
+		change = fabs(value - deadband->last_value);
+		band = deadband->relative * fabs(deadband->last_value);
+		if (band < deadband->absolute)
+			band = deadband->absolute;
+
+		if (change > band) {
+			rc = 1;
+		} else if (now - deadband->last_sent_at >=
+			   deadband->max_silence) {
+			deadband->stats.heartbeats++;
+			rc = 1;
+		} else {
+			deadband->stats.suppressed++;
+			rc = 0;
+		}
+	}
+	pthread_mutex_unlock(&deadband->lock);
+
+	return rc;
+}
+
+/*
+ * Remember the reading that was just reported at now (monotonic ns).
+ */
+
+void deadband_sent(struct t_deadband *deadband, double value, uint64_t now)
+{
+	if (!deadband)
+		return;
+
+	pthread_mutex_lock(&deadband->lock);
+	deadband->last_value = value;
+	deadband->last_sent_at = now;
+	deadband->has_sent = 1;
+	deadband->stats.sent++;
+	pthread_mutex_unlock(&deadband->lock);
+}
+
+/*
+ * Take a consistent snapshot of the statistics of the deadband.
+ */
+
+void deadband_get_stats(struct t_deadband *deadband,
+			struct t_deadband_stats *stats)
+{
+	if (!deadband || !stats)
+		return;
+
+	pthread_mutex_lock(&deadband->lock);
+	*stats = deadband->stats;
+	pthread_mutex_unlock(&deadband->lock);
+}
+
+/*
+ * Free the deadband.
+ */
+
+void deadband_free(struct t_deadband *deadband)
+{
+	if (!deadband)
+		return;
+
+	pthread_mutex_destroy(&deadband->lock);
+	free(deadband);
+}
@@ -0,0 +1,479 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include "pilab-event-loop.h"
+#include "pilab-log.h"
+
+/*
+ * Drain the wake-up eventfd, the wake-up itself is all we need.
+ */
+
+static void event_loop_on_wake(struct t_event_loop *loop, int fd,
+			       uint32_t events, void *data)
+{
+	uint64_t value;
+
+	(void)read(fd, &value, sizeof(value));
+}
+
+/*
+ * Read the pending signals from a signalfd and hand them to the callback.
+ */
+
+static void event_loop_on_signal(struct t_event_loop *loop, int fd,
+				 uint32_t events, void *data)
+{
+	struct t_event_loop_source *source;
+	struct signalfd_siginfo info;
+
+	source = (struct t_event_loop_source *)data;
+
+	while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+		if (source->callback_signal)
+			(void)(source->callback_signal)(loop, info.ssi_signo,
+							source->data);
+	}
+}
+
+/*
+ * Register a source with the loop.
+ *
+ * Returns a pointer to the new source, NULL otherwise.
+ */
+
+static struct t_event_loop_source *
+	event_loop_add_source(struct t_event_loop *loop, int fd,
+			      uint32_t events, int owned)
+{
+	struct t_event_loop_source *new_source;
+	struct epoll_event event = { 0 };
+
+	new_source = malloc(sizeof(*new_source));
+	if (!new_source)
+		return NULL;
+
+	new_source->fd = fd;
+	new_source->events = events;
+	new_source->owned = owned;
+	new_source->removed = 0;
+	new_source->data = NULL;
+	new_source->callback_fd = NULL;
+	new_source->callback_signal = NULL;
+
+	event.events = events;
+	event.data.ptr = new_source;
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+		pilab_log(LOG_DEBUG, "Could not add fd %d to the event loop: %d",
+			  fd, errno);
+		free(new_source);
+		return NULL;
+	}
+
+	new_source->next = loop->sources;
+	loop->sources = new_source;
+
+	return new_source;
+}
+
+/*
+ * Free the sources that were removed during the last round of events.
+ */
+
+static void event_loop_collect_removed(struct t_event_loop *loop)
+{
+	struct t_event_loop_source **source_ptr;
+	struct t_event_loop_source *trash;
+
+	source_ptr = &loop->sources;
+	while (*source_ptr) {
+		if ((*source_ptr)->removed) {
+			trash = *source_ptr;
+			*source_ptr = trash->next;
+			free(trash);
+		} else {
+			source_ptr = &(*source_ptr)->next;
+		}
+	}
+}
+
+/*
+ * Conjure up a new event loop.
+ *
+ * Returns a pointer to the newly created event loop, NULL otherwise.
+ */
+
+struct t_event_loop *event_loop_create()
+{
+	struct t_event_loop *new_loop;
+	struct t_event_loop_source *wake_source;
+
+	new_loop = malloc(sizeof(*new_loop));
+	if (!new_loop)
+		return NULL;
+
+	new_loop->sources = NULL;
+	new_loop->running = 0;
+
+	new_loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (new_loop->epoll_fd < 0) {
+		free(new_loop);
+		return NULL;
+	}
+
+	new_loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (new_loop->wake_fd < 0) {
+		close(new_loop->epoll_fd);
+		free(new_loop);
+		return NULL;
+	}
+
+	wake_source = event_loop_add_fd(new_loop, new_loop->wake_fd, EPOLLIN,
+					&event_loop_on_wake, NULL);
+	if (!wake_source) {
+		close(new_loop->wake_fd);
+		close(new_loop->epoll_fd);
+		free(new_loop);
+		return NULL;
+	}
+	wake_source->owned = 1;
+
+	return new_loop;
+}
+
+/*
+ * Watch a file descriptor, the callback is called whenever one of the epoll
+ * events occurs.
+ *
+ * NOTE: The file descriptor stays owned by the caller.
+ *
+ * Returns a pointer to the new source, NULL otherwise.
+ */
+
+struct t_event_loop_source *
+	event_loop_add_fd(struct t_event_loop *loop, int fd, uint32_t events,
+			  t_event_loop_fd_callback *callback_fd, void *data)
+{
+	struct t_event_loop_source *new_source;
+
+	if (!loop || fd < 0 || !callback_fd)
+		return NULL;
+
+	new_source = event_loop_add_source(loop, fd, events, 0);
+	if (!new_source)
+		return NULL;
+
+	new_source->callback_fd = callback_fd;
+	new_source->data = data;
+
+	return new_source;
+}
+
+/*
+ * Change the epoll events a source is interested in.
+ *
+ * Returns:
+ * -1: invalid arguments.
+ *  0: the events could not be changed.
+ *  1: on success.
+ */
+
+int event_loop_modify_fd(struct t_event_loop *loop,
+			 struct t_event_loop_source *source, uint32_t events)
+{
+	struct epoll_event event = { 0 };
+
+	if (!loop || !source || source->removed)
+		return -1;
+
+	event.events = events;
+	event.data.ptr = source;
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, source->fd, &event) < 0)
+		return 0;
+
+	source->events = events;
+
+	return 1;
+}
+
+/*
+ * Register a timerfd owned by the loop, that expires after interval
+ * milliseconds and then every interval milliseconds when periodic is set.
+ *
+ * Returns a pointer to the new source, NULL otherwise.
+ */
+
+static struct t_event_loop_source *
+	event_loop_add_timerfd(struct t_event_loop *loop, int interval,
+			       int periodic, t_event_loop_fd_callback *callback_fd,
+			       void *data)
+{
+	struct t_event_loop_source *new_source;
+	struct itimerspec spec = { 0 };
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0) {
+		pilab_log(LOG_DEBUG, "Could not create a timerfd: %d", errno);
+		return NULL;
+	}
+
+	spec.it_value.tv_sec = interval / 1000;
+	spec.it_value.tv_nsec = (interval % 1000) * 1000000L;
+	if (periodic)
+		spec.it_interval = spec.it_value;
+	if (timerfd_settime(fd, 0, &spec, NULL) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	new_source = event_loop_add_source(loop, fd, EPOLLIN, 1);
+	if (!new_source) {
+		close(fd);
+		return NULL;
+	}
+
+	new_source->callback_fd = callback_fd;
+	new_source->data = data;
+
+	return new_source;
+}
+
+/*
+ * Call the callback every interval milliseconds, through a timerfd owned by
+ * the loop.
+ *
+ * NOTE: The callback has to read the expiration count from the fd.
+ *
+ * Returns a pointer to the new source, NULL otherwise.
+ */
+
+struct t_event_loop_source *
+	event_loop_add_timer(struct t_event_loop *loop, int interval,
+			     t_event_loop_fd_callback *callback_fd, void *data)
+{
+	if (!loop || interval < 1 || !callback_fd)
+		return NULL;
+
+	return event_loop_add_timerfd(loop, interval, 1, callback_fd, data);
+}
+
+/*
+ * Call the callback once, after timeout milliseconds. With a timeout of 0 the
+ * source is created disarmed, for event_loop_arm_timeout.
+ *
+ * NOTE: The source stays registered after it fired, the callback should
+ * remove it or read the expiration count from the fd.
+ *
+ * Returns a pointer to the new source, NULL otherwise.
+ */
+
+struct t_event_loop_source *
+	event_loop_add_timeout(struct t_event_loop *loop, int timeout,
+			       t_event_loop_fd_callback *callback_fd, void *data)
+{
+	if (!loop || timeout < 0 || !callback_fd)
+		return NULL;
+
+	return event_loop_add_timerfd(loop, timeout, 0, callback_fd, data);
+}
+
+/*
+ * (Re)arm a timeout source to fire once after timeout milliseconds, or right
+ * away when timeout is less than 1.
+ *
+ * NOTE: Only the timerfd is touched, so this is safe to call from other
+ * threads, as long as the source isn't removed meanwhile.
+ *
+ * Returns:
+ *   -1: invalid source
+ *    0: the timer could not be armed
+ *    1: the timer is armed
+ */
+
+int event_loop_arm_timeout(struct t_event_loop_source *source, int timeout)
+{
+	struct itimerspec spec = { 0 };
+
+	if (!source)
+		return -1;
+
+	if (timeout < 1) {
+		/* a zero it_value disarms the timer, take the earliest instead */
+		spec.it_value.tv_nsec = 1;
+	} else {
+		spec.it_value.tv_sec = timeout / 1000;
+		spec.it_value.tv_nsec = (timeout % 1000) * 1000000L;
+	}
+
+	return (timerfd_settime(source->fd, 0, &spec, NULL) < 0) ? 0 : 1;
+}
+
+/*
+ * Receive the signals in mask through the loop, instead of through
+ * asynchronous signal handlers.
+ *
+ * NOTE: The signals are blocked for the calling thread, so call this before
+ * any other threads are created, as they inherit the signal mask.
+ *
+ * Returns a pointer to the new source, NULL otherwise.
+ */
+
+struct t_event_loop_source *
+	event_loop_add_signals(struct t_event_loop *loop, const sigset_t *mask,
+			       t_event_loop_signal_callback *callback_signal,
+			       void *data)
+{
+	struct t_event_loop_source *new_source;
+	int fd;
+
+	if (!loop || !mask || !callback_signal)
+		return NULL;
+
+	if (pthread_sigmask(SIG_BLOCK, mask, NULL) != 0)
+		return NULL;
+
+	fd = signalfd(-1, mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd < 0) {
+		pilab_log(LOG_DEBUG, "Could not create a signalfd: %d", errno);
+		return NULL;
+	}
+
+	new_source = event_loop_add_source(loop, fd, EPOLLIN, 1);
+	if (!new_source) {
+		close(fd);
+		return NULL;
+	}
+
+	new_source->callback_fd = &event_loop_on_signal;
+	new_source->callback_signal = callback_signal;
+	new_source->data = data;
+
+	return new_source;
+}
+
+/*
+ * Stop watching a source.
+ *
+ * NOTE: It is safe to call this from within a callback, the source is freed
+ * once the current round of events has been handled.
+ */
+
+void event_loop_remove_source(struct t_event_loop *loop,
+			      struct t_event_loop_source *source)
+{
+	if (!loop || !source || source->removed)
+		return;
+
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+	if (source->owned)
+		close(source->fd);
+
+	source->removed = 1;
+}
+
+/*
+ * Wait at most timeout milliseconds (-1 for no limit) for events, and handle
+ * them.
+ *
+ * Returns the amount of handled events, -1 on error.
+ */
+
+int event_loop_dispatch(struct t_event_loop *loop, int timeout)
+{
+	struct epoll_event events[PILAB_EVENT_LOOP_MAX_EVENTS];
+	struct t_event_loop_source *source;
+	int count, i;
+
+	if (!loop)
+		return -1;
+
+	count = epoll_wait(loop->epoll_fd, events, PILAB_EVENT_LOOP_MAX_EVENTS,
+			   timeout);
+	if (count < 0)
+		return (errno == EINTR) ? 0 : -1;
+
+	for (i = 0; i < count; ++i) {
+		source = (struct t_event_loop_source *)events[i].data.ptr;
+		if (source->removed || !source->callback_fd)
+			continue;
+
+		/* signal sources need the source itself, for the callback */
+		if (source->callback_signal)
+			(void)(source->callback_fd)(loop, source->fd,
+						    events[i].events, source);
+		else
+			(void)(source->callback_fd)(loop, source->fd,
+						    events[i].events,
+						    source->data);
+	}
+
+	event_loop_collect_removed(loop);
+
+	return count;
+}
+
+/*
+ * Run the loop, until event_loop_stop is called.
+ *
+ * Returns:
+ * -1: invalid argument, or epoll failed.
+ *  1: the loop was stopped.
+ */
+
+int event_loop_run(struct t_event_loop *loop)
+{
+	if (!loop)
+		return -1;
+
+	loop->running = 1;
+	while (loop->running) {
+		if (event_loop_dispatch(loop, -1) < 0) {
+			pilab_log(LOG_ERROR, "Event loop failed: %d", errno);
+			loop->running = 0;
+			return -1;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Stop the loop, this is safe to call from any thread.
+ */
+
+void event_loop_stop(struct t_event_loop *loop)
+{
+	uint64_t value;
+
+	if (!loop)
+		return;
+
+	loop->running = 0;
+
+	value = 1;
+	(void)write(loop->wake_fd, &value, sizeof(value));
+}
+
+/*
+ * Free the loop and all its sources, closing the file descriptors it owns.
+ */
+
+void event_loop_free(struct t_event_loop *loop)
+{
+	struct t_event_loop_source *source;
+
+	if (!loop)
+		return;
+
+	for (source = loop->sources; source; source = source->next)
+		event_loop_remove_source(loop, source);
+	event_loop_collect_removed(loop);
+
+	close(loop->epoll_fd);
+	free(loop);
+}
@@ -0,0 +1,296 @@
+#include <stdlib.h>
+#include <math.h>
+#include "pilab-filter.h"
+#include "pilab-string.h"
+
+/* Values closer than this to a sentinel count as the sentinel */
+#define PILAB_FILTER_SENTINEL_EPSILON 1e-6
+
+char *filter_method_string[FILTER_NUM_METHODS] = {
+	PILAB_FILTER_MEDIAN,
+	PILAB_FILTER_TRIMMED_MEAN,
+	PILAB_FILTER_EWMA,
+};
+
+/*
+ * Compare two doubles, for qsort.
+ */
+
+static int filter_compare(const void *a, const void *b)
+{
+	double x, y;
+
+	x = *(const double *)a;
+	y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Reduce the sub-samples to a single value, following the method of the
+ * filter.
+ *
+ * NOTE: The sub-samples get sorted, for the median and trimmed mean.
+ */
+
+static double filter_reduce(struct t_filter *filter, double *samples,
+			    int count)
+{
+	double sum;
+	int cut, i;
+
+	switch (filter->method) {
+	case FILTER_TRIMMED_MEAN:
+		qsort(samples, count, sizeof(*samples), &filter_compare);
+		cut = count * filter->trim / 100;
+		/* always keep at least one sample */
+		if (2 * cut >= count)
+			cut = (count - 1) / 2;
+		sum = 0;
+		for (i = cut; i < count - cut; ++i)
+			sum += samples[i];
+		return sum / (count - 2 * cut);
+	case FILTER_EWMA:
+		/* the average carries over from the previous readings */
+		if (!filter->has_average) {
+			filter->average = samples[0];
+			filter->has_average = 1;
+		}
+		for (i = 0; i < count; ++i)
+			filter->average +=
+				filter->alpha * (samples[i] - filter->average);
+		return filter->average;
+	case FILTER_MEDIAN:
+	case FILTER_NUM_METHODS:
+		break;
+	}
+
+	qsort(samples, count, sizeof(*samples), &filter_compare);
+	if (count % 2)
+		return samples[count / 2];
+
+	return (samples[count / 2 - 1] + samples[count / 2]) / 2;
+}
+
+/*
+ * Search for a filter method.
+ *
+ * Return index of method, -1 if the method could not be found.
+ */
+
+int filter_get_method(const char *method)
+{
+	if (!method)
+		return -1;
+
+	for (int i = 0; i < FILTER_NUM_METHODS; ++i)
+		if (string_strcmp(filter_method_string[i], method) == 0)
+			return i;
+
+	/* method was not found */
+	return -1;
+}
+
+/*
+ * Conjure up a new filter, taking samples valid sub-samples per reading and
+ * reducing them with method.
+ *
+ * Pass 0 (or less) as samples to use the default.
+ *
+ * Returns a pointer to the newly created filter, NULL otherwise.
+ */
+
+struct t_filter *filter_create(int method, int samples)
+{
+	struct t_filter *new_filter;
+
+	if (method < 0 || method >= FILTER_NUM_METHODS)
+		return NULL;
+
+	if (samples < 1)
+		samples = PILAB_FILTER_DEFAULT_SAMPLES;
+
+	new_filter = calloc(1, sizeof(*new_filter));
+	if (!new_filter)
+		return NULL;
+
+	new_filter->buffer = malloc(samples * sizeof(*new_filter->buffer));
+	if (!new_filter->buffer) {
+		free(new_filter);
+		return NULL;
+	}
+
+	new_filter->method = method;
+	new_filter->samples = samples;
+	new_filter->max_rereads = PILAB_FILTER_DEFAULT_REREADS;
+	new_filter->trim = PILAB_FILTER_DEFAULT_TRIM;
+	new_filter->alpha = PILAB_FILTER_DEFAULT_ALPHA;
+	new_filter->num_sentinels = 0;
+	new_filter->has_average = 0;
+	pthread_mutex_init(&new_filter->lock, NULL);
+
+	return new_filter;
+}
+
+/*
+ * Set the amount of extra sub-samples a reading may take, to replace rejected
+ * ones.
+ */
+
+void filter_set_max_rereads(struct t_filter *filter, int max_rereads)
+{
+	if (!filter || max_rereads < 0)
+		return;
+
+	filter->max_rereads = max_rereads;
+}
+
+/*
+ * Set the percentage (0 - 49) cut from both ends by the trimmed mean.
+ */
+
+void filter_set_trim(struct t_filter *filter, int trim)
+{
+	if (!filter || trim < 0 || trim > 49)
+		return;
+
+	filter->trim = trim;
+}
+
+/*
+ * Set the smoothing factor (0, 1] of the EWMA.
+ */
+
+void filter_set_alpha(struct t_filter *filter, double alpha)
+{
+	if (!filter || alpha <= 0 || alpha > 1)
+		return;
+
+	filter->alpha = alpha;
+}
+
+/*
+ * Add a value the device returns when a read went wrong, sub-samples with this
+ * value are rejected.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: there is no room for another sentinel.
+ *  1: on success.
+ */
+
+int filter_add_sentinel(struct t_filter *filter, double sentinel)
+{
+	if (!filter)
+		return -1;
+
+	if (filter->num_sentinels >= PILAB_FILTER_MAX_SENTINELS)
+		return 0;
+
+	filter->sentinels[filter->num_sentinels++] = sentinel;
+
+	return 1;
+}
+
+/*
+ * Returns 1 if the value is one of the sentinels of the filter, 0 otherwise.
+ */
+
+int filter_is_sentinel(struct t_filter *filter, double value)
+{
+	int i;
+
+	if (!filter)
+		return 0;
+
+	for (i = 0; i < filter->num_sentinels; ++i)
+		if (fabs(value - filter->sentinels[i]) <
+		    PILAB_FILTER_SENTINEL_EPSILON)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Take a filtered reading.
+ *
+ * Sub-samples are taken with read_sample until the filter has enough valid
+ * ones. Failed reads and sentinel values are rejected and replaced, as long
+ * as the re-reads allow it. Whatever valid sub-samples were collected are
+ * reduced to value.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: not a single valid sub-sample could be taken.
+ *  1: on success.
+ */
+
+int filter_read(struct t_filter *filter, t_filter_read_sample *read_sample,
+		void *data, double *value)
+{
+	double sample;
+	int count, attempts, rc;
+
+	if (!filter || !read_sample || !value)
+		return -1;
+
+	/* readings of one sensor are serialised, they share the buffer */
+	pthread_mutex_lock(&filter->lock);
+	count = 0;
+	attempts = 0;
+	while (count < filter->samples &&
+	       attempts < filter->samples + filter->max_rereads) {
+		if (attempts >= filter->samples)
+			filter->stats.rereads++;
+		attempts++;
+		filter->stats.samples++;
+
+		if ((read_sample)(data, &sample) < 1 ||
+		    filter_is_sentinel(filter, sample)) {
+			filter->stats.rejects++;
+			continue;
+		}
+
+		filter->buffer[count++] = sample;
+	}
+
+	filter->stats.readings++;
+	if (count > 0) {
+		*value = filter_reduce(filter, filter->buffer, count);
+		rc = 1;
+	} else {
+		filter->stats.failures++;
+		rc = 0;
+	}
+	pthread_mutex_unlock(&filter->lock);
+
+	return rc;
+}
+
+/*
+ * Take a consistent snapshot of the statistics of the filter.
+ */
+
+void filter_get_stats(struct t_filter *filter, struct t_filter_stats *stats)
+{
+	if (!filter || !stats)
+		return;
+
+	pthread_mutex_lock(&filter->lock);
+	*stats = filter->stats;
+	pthread_mutex_unlock(&filter->lock);
+}
+
+/*
+ * Free the filter.
+ */
+
+void filter_free(struct t_filter *filter)
+{
+	if (!filter)
+		return;
+
+	pthread_mutex_destroy(&filter->lock);
+	free(filter->buffer);
+	free(filter);
+}
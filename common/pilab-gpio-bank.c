@@ -0,0 +1,375 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include "pilab-gpio-bank.h"
+#include "pilab-gpio-input.h"
+#include "pilab-log.h"
+
+/*
+ * Backend on top of a line request of the gpio character device, all lines of
+ * the bank are read or driven by a single ioctl.
+ */
+
+struct t_gpio_bank_chardev {
+	/*
+	 * Descriptor of the line request.
+	 */
+	int fd;
+};
+
+static int gpio_bank_chardev_get_values(void *instance, uint64_t mask,
+					uint64_t *bits)
+{
+	struct t_gpio_bank_chardev *chardev;
+	struct gpio_v2_line_values values;
+
+	chardev = (struct t_gpio_bank_chardev *)instance;
+
+	memset(&values, 0, sizeof(values));
+	values.mask = mask;
+	if (ioctl(chardev->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0)
+		return 0;
+
+	*bits = values.bits;
+
+	return 1;
+}
+
+static int gpio_bank_chardev_set_values(void *instance, uint64_t mask,
+					uint64_t bits)
+{
+	struct t_gpio_bank_chardev *chardev;
+	struct gpio_v2_line_values values;
+
+	chardev = (struct t_gpio_bank_chardev *)instance;
+
+	memset(&values, 0, sizeof(values));
+	values.mask = mask;
+	values.bits = bits;
+
+	return (ioctl(chardev->fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) <
+		0) ?
+		       0 :
+		       1;
+}
+
+static void gpio_bank_chardev_free(void *instance)
+{
+	struct t_gpio_bank_chardev *chardev;
+
+	chardev = (struct t_gpio_bank_chardev *)instance;
+
+	close(chardev->fd);
+	free(chardev);
+}
+
+/*
+ * Conjure up a new bank of lines around a backend.
+ *
+ * NOTE: The bank owns the instance, it is freed through free_bank.
+ *
+ * Returns a pointer to the newly created bank, NULL otherwise.
+ */
+
+struct t_gpio_bank *gpio_bank_create(void *instance, const int *offsets,
+				     int num_lines, int output,
+				     t_gpio_bank_get_values *get_values,
+				     t_gpio_bank_set_values *set_values,
+				     t_gpio_bank_free_bank *free_bank)
+{
+	struct t_gpio_bank *new_bank;
+	int i;
+
+	if (!instance || !offsets || num_lines < 1 ||
+	    num_lines > PILAB_GPIO_BANK_MAX_LINES || !get_values ||
+	    (output && !set_values))
+		return NULL;
+
+	new_bank = calloc(1, sizeof(*new_bank));
+	if (!new_bank)
+		return NULL;
+
+	for (i = 0; i < num_lines; ++i)
+		new_bank->offsets[i] = offsets[i];
+	new_bank->instance = instance;
+	new_bank->num_lines = num_lines;
+	new_bank->output = output;
+	new_bank->values = 0;
+	new_bank->get_values = get_values;
+	new_bank->set_values = (output) ? set_values : NULL;
+	new_bank->free_bank = free_bank;
+	pthread_mutex_init(&new_bank->lock, NULL);
+
+	return new_bank;
+}
+
+/*
+ * Request the lines at offsets of the gpio chip once, as inputs or as
+ * outputs, so they can be read or driven together from then on.
+ *
+ * Pass NULL as chip for the gpio chip of the Raspberry Pi.
+ *
+ * Returns a pointer to the newly created bank, NULL otherwise.
+ */
+
+struct t_gpio_bank *gpio_bank_request(const char *chip, const int *offsets,
+				      int num_lines, int output)
+{
+	struct t_gpio_bank_chardev *chardev;
+	struct t_gpio_bank *new_bank;
+	struct gpio_v2_line_request request;
+	int chip_fd, i;
+
+	if (!offsets || num_lines < 1 || num_lines > PILAB_GPIO_BANK_MAX_LINES)
+		return NULL;
+
+	if (!chip)
+		chip = PILAB_GPIO_INPUT_DEFAULT_CHIP;
+
+	chip_fd = open(chip, O_RDWR | O_CLOEXEC);
+	if (chip_fd < 0) {
+		pilab_log(LOG_DEBUG, "Could not open %s: %d", chip, errno);
+		return NULL;
+	}
+
+	memset(&request, 0, sizeof(request));
+	for (i = 0; i < num_lines; ++i)
+		request.offsets[i] = offsets[i];
+	request.num_lines = num_lines;
+	request.config.flags = (output) ? GPIO_V2_LINE_FLAG_OUTPUT :
+					  GPIO_V2_LINE_FLAG_INPUT;
+	snprintf(request.consumer, sizeof(request.consumer), "%s",
+		 PILAB_GPIO_BANK_CONSUMER);
+
+	i = ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &request);
+	close(chip_fd);
+	if (i < 0) {
+		pilab_log(LOG_DEBUG, "Could not request the lines of %s: %d",
+			  chip, errno);
+		return NULL;
+	}
+
+	chardev = malloc(sizeof(*chardev));
+	if (!chardev) {
+		close(request.fd);
+		return NULL;
+	}
+	chardev->fd = request.fd;
+	(void)fcntl(chardev->fd, F_SETFD, FD_CLOEXEC);
+
+	new_bank = gpio_bank_create(chardev, offsets, num_lines, output,
+				    &gpio_bank_chardev_get_values,
+				    &gpio_bank_chardev_set_values,
+				    &gpio_bank_chardev_free);
+	if (!new_bank)
+		gpio_bank_chardev_free(chardev);
+
+	return new_bank;
+}
+
+/*
+ * Returns the index of the line at offset in the bank, -1 when it is not part
+ * of the bank.
+ */
+
+int gpio_bank_index(struct t_gpio_bank *bank, int offset)
+{
+	int i;
+
+	if (!bank)
+		return -1;
+
+	for (i = 0; i < bank->num_lines; ++i)
+		if (bank->offsets[i] == offset)
+			return i;
+
+	return -1;
+}
+
+/*
+ * Mask covering every line of the bank.
+ */
+
+static uint64_t gpio_bank_mask(struct t_gpio_bank *bank)
+{
+	return (bank->num_lines == PILAB_GPIO_BANK_MAX_LINES) ?
+		       ~0ULL :
+		       (1ULL << bank->num_lines) - 1;
+}
+
+/*
+ * Read every line of the bank in one go, the values are kept for
+ * gpio_bank_get. Pass NULL as values when only those are wanted.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the lines could not be read.
+ *  1: on success.
+ */
+
+int gpio_bank_snapshot(struct t_gpio_bank *bank, uint64_t *values)
+{
+	uint64_t bits;
+	int rc;
+
+	if (!bank)
+		return -1;
+
+	pthread_mutex_lock(&bank->lock);
+	rc = (bank->get_values)(bank->instance, gpio_bank_mask(bank), &bits);
+	bank->stats.reads++;
+	if (rc) {
+		bank->values = bits & gpio_bank_mask(bank);
+		bank->stats.lines_read += bank->num_lines;
+		if (values)
+			*values = bank->values;
+	} else {
+		bank->stats.errors++;
+	}
+	pthread_mutex_unlock(&bank->lock);
+
+	return rc;
+}
+
+/*
+ * Read a single line of the bank, the way digitalRead does.
+ *
+ * Returns the level (1 high, 0 low) of the line, -1 when it is not part of the
+ * bank or could not be read.
+ */
+
+int gpio_bank_read_line(struct t_gpio_bank *bank, int offset)
+{
+	uint64_t bits;
+	int index, rc;
+
+	index = gpio_bank_index(bank, offset);
+	if (index < 0)
+		return -1;
+
+	pthread_mutex_lock(&bank->lock);
+	rc = (bank->get_values)(bank->instance, 1ULL << index, &bits);
+	bank->stats.reads++;
+	if (rc) {
+		bank->values = (bank->values & ~(1ULL << index)) |
+			       (bits & (1ULL << index));
+		bank->stats.lines_read++;
+	} else {
+		bank->stats.errors++;
+	}
+	pthread_mutex_unlock(&bank->lock);
+
+	return (rc) ? (int)((bits >> index) & 1) : -1;
+}
+
+/*
+ * Returns the level (1 high, 0 low) of the line at offset as of the last
+ * snapshot, -1 when it is not part of the bank.
+ */
+
+int gpio_bank_get(struct t_gpio_bank *bank, int offset)
+{
+	int index, level;
+
+	index = gpio_bank_index(bank, offset);
+	if (index < 0)
+		return -1;
+
+	pthread_mutex_lock(&bank->lock);
+	level = (bank->values >> index) & 1;
+	pthread_mutex_unlock(&bank->lock);
+
+	return level;
+}
+
+/*
+ * Drive the lines of an output bank in mask (bit i is line i of the bank) to
+ * the levels in bits, in a single atomic update.
+ *
+ * Returns:
+ * -1: invalid argument, or the bank holds inputs.
+ *  0: the lines could not be driven.
+ *  1: on success.
+ */
+
+int gpio_bank_write(struct t_gpio_bank *bank, uint64_t mask, uint64_t bits)
+{
+	int rc, i;
+
+	if (!bank || !bank->set_values)
+		return -1;
+
+	mask &= gpio_bank_mask(bank);
+	if (mask == 0)
+		return 1;
+
+	pthread_mutex_lock(&bank->lock);
+	rc = (bank->set_values)(bank->instance, mask, bits);
+	bank->stats.writes++;
+	if (rc) {
+		bank->values = (bank->values & ~mask) | (bits & mask);
+		for (i = 0; i < bank->num_lines; ++i)
+			if (mask & (1ULL << i))
+				bank->stats.lines_written++;
+	} else {
+		bank->stats.errors++;
+	}
+	pthread_mutex_unlock(&bank->lock);
+
+	return rc;
+}
+
+/*
+ * Drive a single line of an output bank, the way digitalWrite does.
+ *
+ * Returns -1 on invalid argument, 0 when the line could not be driven and 1
+ * on success.
+ */
+
+int gpio_bank_write_line(struct t_gpio_bank *bank, int offset, int value)
+{
+	int index;
+
+	index = gpio_bank_index(bank, offset);
+	if (index < 0)
+		return -1;
+
+	return gpio_bank_write(bank, 1ULL << index,
+			       (value) ? 1ULL << index : 0);
+}
+
+/*
+ * Copy the counters of the bank.
+ */
+
+void gpio_bank_get_stats(struct t_gpio_bank *bank,
+			 struct t_gpio_bank_stats *stats)
+{
+	if (!bank || !stats)
+		return;
+
+	pthread_mutex_lock(&bank->lock);
+	*stats = bank->stats;
+	pthread_mutex_unlock(&bank->lock);
+}
+
+/*
+ * Release the lines and free the bank.
+ */
+
+void gpio_bank_free(struct t_gpio_bank *bank)
+{
+	if (!bank)
+		return;
+
+	if (bank->free_bank)
+		(bank->free_bank)(bank->instance);
+	pthread_mutex_destroy(&bank->lock);
+	free(bank);
+}
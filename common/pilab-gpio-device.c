@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <wiringPi.h>
 #include "pilab-gpio-device.h"
+#include "pilab-hal.h"
 #include "pilab-string.h"
 #include "pilab-log.h"
 
@@ -23,9 +24,9 @@ int gpio_device_analog_read(const void *instance, int pin)
 	if (!device)
 		return -99999;
 
-	pinMode(pin, INPUT);
+	hal_pin_mode(pin, INPUT);
 
-	return analogRead(pin);
+	return hal_analog_read(pin);
 }
 
 /*
@@ -46,9 +47,9 @@ void gpio_device_analog_write(const void *instance, int pin, int value)
 	if (!device)
 		return;
 
-	pinMode(pin, OUTPUT);
+	hal_pin_mode(pin, OUTPUT);
 
-	analogWrite(pin, value);
+	hal_analog_write(pin, value);
 }
 
 /*
@@ -69,7 +70,7 @@ int gpio_device_digital_read(const void *instance, int pin)
 	if (!device)
 		return -99999;
 
-	return digitalRead(pin);
+	return hal_digital_read(pin);
 }
 
 /*
@@ -90,7 +91,43 @@ void gpio_device_digital_write(const void *instance, int pin, int value)
 	if (!device)
 		return;
 
-	digitalWrite(pin, value);
+	hal_digital_write(pin, value);
+}
+
+/*
+ * GPIO device's concrete read sample implementation.
+ *
+ * Reads the module at the pin base once and scales the result, a probe on the
+ * 1-Wire bus is read through the bus instead.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the read failed, the sample is marked bad.
+ *  1: on success.
+ */
+
+int gpio_device_read_sample(const void *instance,
+			    struct t_slave_device_sample *sample)
+{
+	struct t_gpio_device *device;
+	int raw;
+
+	if (!instance || !sample)
+		return -1;
+
+	device = (struct t_gpio_device *)instance;
+
+	if (device->w1_probe) {
+		if (w1_probe_read(device->w1_probe, &raw) < 1)
+			raw = PILAB_SLAVE_DEVICE_READ_FAILED;
+	} else {
+		raw = hal_analog_read(device->pin_base);
+	}
+
+	slave_device_sample_init(sample, raw, device->failed_raw,
+				 device->scale, device->unit);
+
+	return (sample->quality == SLAVE_DEVICE_QUALITY_GOOD) ? 1 : 0;
 }
 
 /*
@@ -214,8 +251,8 @@ void gpio_device_free_device(const void *instance)
  * Creates a new gpio device and will act as an abstract slave_device so we can add
  * it to a host device.
  *
- * NOTE: Make sure that there are no overlapping pin offsets when registering
- * the device as a extension module, as there is no boundary checking.
+ * NOTE: The host refuses a module whose pins overlap those of another one,
+ * a device created directly is not checked.
  *
  * Returns pointer to the newly created gpio_device, NULL otherwise.
  */
@@ -249,6 +286,10 @@ struct t_gpio_device *gpio_device_create(int pin_base, const char *device_name,
 
 	new_device->pin_base = pin_base;
 	new_device->device_name = device_name;
+	new_device->scale = 1.0;
+	new_device->unit = "";
+	new_device->failed_raw = PILAB_SLAVE_DEVICE_READ_FAILED;
+	new_device->w1_probe = NULL;
 	new_device->callback_init_strategy = NULL;
 
 	new_slave->get_expansion_pin = &gpio_device_get_expansion_pin;
@@ -257,10 +298,18 @@ struct t_gpio_device *gpio_device_create(int pin_base, const char *device_name,
 	new_slave->analog_write = &gpio_device_analog_write;
 	new_slave->digital_read = &gpio_device_digital_read;
 	new_slave->digital_write = &gpio_device_digital_write;
+	new_slave->read_sample = &gpio_device_read_sample;
+	new_slave->start_sample = NULL;
+	new_slave->collect_sample = NULL;
+	new_slave->batch_begin = NULL;
+	new_slave->batch_commit = NULL;
 	new_slave->set_pointer = &gpio_device_set_pointer;
 	new_slave->get_pinbase = &gpio_device_get_pin_base;
 	new_slave->free_device = &gpio_device_free_device;
 	new_slave->instance = new_device;
+	new_slave->sample_interval = 0;
+	new_slave->read_timeout = PILAB_GPIO_DEVICE_READ_TIMEOUT;
+	new_slave->options = NULL;
 
 	if (host) {
 		/* register the device */
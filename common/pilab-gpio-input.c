@@ -0,0 +1,236 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include "pilab-gpio-input.h"
+#include "pilab-string.h"
+#include "pilab-log.h"
+#include "pilab-time.h"
+
+#define PILAB_GPIO_INPUT_NSEC_PER_MSEC 1000000ULL
+
+/*
+ * Returns the requested line at offset, NULL when it wasn't requested.
+ */
+
+static struct t_gpio_input_line *gpio_input_find(struct t_gpio_input *input,
+						 int offset)
+{
+	int i;
+
+	for (i = 0; i < input->num_lines; ++i)
+		if (input->lines[i].offset == offset)
+			return &input->lines[i];
+
+	return NULL;
+}
+
+/*
+ * Take the current levels of the lines, so the first edge is judged against
+ * what the line really is.
+ */
+
+static void gpio_input_read_levels(struct t_gpio_input *input)
+{
+	struct gpio_v2_line_values values;
+	int i;
+
+	memset(&values, 0, sizeof(values));
+	for (i = 0; i < input->num_lines; ++i)
+		values.mask |= 1ULL << i;
+
+	if (ioctl(input->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0)
+		return;
+
+	for (i = 0; i < input->num_lines; ++i)
+		input->lines[i].level = (values.bits >> i) & 1;
+}
+
+/*
+ * Request the lines at offsets of the gpio chip as inputs, reporting both
+ * edges. The kernel timestamps every edge, they are debounced with those
+ * timestamps when dispatched.
+ *
+ * Pass NULL as chip for the gpio chip of the Raspberry Pi, and 0 (or less) as
+ * debounce (in ms) for the default.
+ *
+ * Returns a pointer to the newly created input, NULL otherwise.
+ */
+
+struct t_gpio_input *gpio_input_create(const char *chip, const int *offsets,
+				       int num_lines, int debounce)
+{
+	struct t_gpio_input *new_input;
+	struct gpio_v2_line_request request;
+	int chip_fd, i;
+
+	if (!offsets || num_lines < 1 || num_lines > PILAB_GPIO_INPUT_MAX_LINES)
+		return NULL;
+
+	if (!chip)
+		chip = PILAB_GPIO_INPUT_DEFAULT_CHIP;
+	if (debounce < 1)
+		debounce = PILAB_GPIO_INPUT_DEFAULT_DEBOUNCE;
+
+	new_input = calloc(1, sizeof(*new_input));
+	if (!new_input)
+		return NULL;
+
+	chip_fd = open(chip, O_RDWR | O_CLOEXEC);
+	if (chip_fd < 0) {
+		pilab_log(LOG_DEBUG, "Could not open %s: %d", chip, errno);
+		free(new_input);
+		return NULL;
+	}
+
+	memset(&request, 0, sizeof(request));
+	for (i = 0; i < num_lines; ++i) {
+		request.offsets[i] = offsets[i];
+		new_input->lines[i].offset = offsets[i];
+	}
+	request.num_lines = num_lines;
+	request.config.flags = GPIO_V2_LINE_FLAG_INPUT |
+			       GPIO_V2_LINE_FLAG_EDGE_RISING |
+			       GPIO_V2_LINE_FLAG_EDGE_FALLING;
+	snprintf(request.consumer, sizeof(request.consumer), "%s",
+		 PILAB_GPIO_INPUT_CONSUMER);
+
+	if (ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &request) < 0) {
+		pilab_log(LOG_DEBUG, "Could not request the lines of %s: %d",
+			  chip, errno);
+		close(chip_fd);
+		free(new_input);
+		return NULL;
+	}
+	/* the request lives on without the chip */
+	close(chip_fd);
+
+	new_input->fd = request.fd;
+	(void)fcntl(new_input->fd, F_SETFL,
+		    fcntl(new_input->fd, F_GETFL) | O_NONBLOCK);
+	(void)fcntl(new_input->fd, F_SETFD, FD_CLOEXEC);
+	new_input->num_lines = num_lines;
+	new_input->debounce = debounce * PILAB_GPIO_INPUT_NSEC_PER_MSEC;
+	new_input->callback_edge = NULL;
+
+	gpio_input_read_levels(new_input);
+
+	return new_input;
+}
+
+/*
+ * Set a pointer property of the input.
+ *
+ * Properties:
+ * - callback_edge
+ */
+
+void gpio_input_set_pointer(struct t_gpio_input *input, const char *property,
+			    void *pointer)
+{
+	if (!input || !property)
+		return;
+
+	if (string_strcasecmp(property, "callback_edge") == 0)
+		input->callback_edge = pointer;
+}
+
+/*
+ * Read the pending edges and pass the ones that aren't contact bounce on to
+ * the edge callback, together with data. Call this when the descriptor of the
+ * input is readable, it doesn't block.
+ *
+ * An edge within the debounce of the last accepted edge of its line is
+ * dropped. Edges alternate, so an accepted edge is passed on even when the
+ * opposite edge before it was dropped.
+ *
+ * Returns the amount of edges passed on, -1 on invalid argument.
+ */
+
+int gpio_input_dispatch(struct t_gpio_input *input, void *data)
+{
+	struct gpio_v2_line_event events[PILAB_GPIO_INPUT_MAX_EVENTS];
+	struct t_gpio_input_line *line;
+	uint64_t now;
+	ssize_t count;
+	int i, passed;
+
+	if (!input)
+		return -1;
+
+	passed = 0;
+	while ((count = read(input->fd, events, sizeof(events))) > 0) {
+		now = time_monotonic_ns();
+		for (i = 0; i < (int)(count / sizeof(events[0])); ++i) {
+			input->stats.events++;
+
+			line = gpio_input_find(input, events[i].offset);
+			if (!line)
+				continue;
+
+			if (line->last_edge &&
+			    events[i].timestamp_ns - line->last_edge <
+				    input->debounce) {
+				input->stats.bounces++;
+				continue;
+			}
+
+			line->last_edge = events[i].timestamp_ns;
+			if (events[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE) {
+				line->level = 1;
+				input->stats.rising++;
+			} else {
+				line->level = 0;
+				input->stats.falling++;
+			}
+
+			if (now > events[i].timestamp_ns &&
+			    now - events[i].timestamp_ns >
+				    input->stats.max_latency)
+				input->stats.max_latency =
+					now - events[i].timestamp_ns;
+
+			passed++;
+			if (input->callback_edge)
+				(void)(input->callback_edge)(
+					input, line->offset, line->level, data);
+		}
+	}
+
+	return passed;
+}
+
+/*
+ * Returns the debounced level (1 high, 0 low) of the line at offset, -1 when
+ * it wasn't requested.
+ */
+
+int gpio_input_get_level(struct t_gpio_input *input, int offset)
+{
+	struct t_gpio_input_line *line;
+
+	if (!input)
+		return -1;
+
+	line = gpio_input_find(input, offset);
+
+	return (line) ? line->level : -1;
+}
+
+/*
+ * Release the lines and free the input.
+ */
+
+void gpio_input_free(struct t_gpio_input *input)
+{
+	if (!input)
+		return;
+
+	close(input->fd);
+	free(input);
+}
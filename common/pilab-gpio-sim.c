@@ -0,0 +1,133 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include "pilab-gpio-sim.h"
+#include "pilab-time.h"
+
+#define PILAB_GPIO_SIM_NSEC_PER_USEC 1000ULL
+
+/*
+ * Take the latency of the chip, spinning so it is as exact as an ioctl.
+ */
+
+static void gpio_sim_access(struct t_gpio_sim *sim)
+{
+	uint64_t until;
+
+	sim->accesses++;
+	if (sim->latency == 0)
+		return;
+
+	until = time_monotonic_ns() + sim->latency;
+	while (time_monotonic_ns() < until)
+		;
+}
+
+static int gpio_sim_get_values(void *instance, uint64_t mask, uint64_t *bits)
+{
+	struct t_gpio_sim *sim;
+
+	sim = (struct t_gpio_sim *)instance;
+
+	gpio_sim_access(sim);
+	*bits = sim->levels & mask;
+
+	return 1;
+}
+
+static int gpio_sim_set_values(void *instance, uint64_t mask, uint64_t bits)
+{
+	struct t_gpio_sim *sim;
+
+	sim = (struct t_gpio_sim *)instance;
+
+	gpio_sim_access(sim);
+	sim->levels = (sim->levels & ~mask) | (bits & mask);
+
+	return 1;
+}
+
+static void gpio_sim_free(void *instance)
+{
+	free(instance);
+}
+
+/*
+ * Conjure up a bank of lines on an in-memory chip, all of them low.
+ *
+ * Every access takes latency microseconds, pass 0 for none.
+ *
+ * Returns a pointer to the newly created bank, NULL otherwise.
+ */
+
+struct t_gpio_bank *gpio_sim_create(const int *offsets, int num_lines,
+				    int output, int latency)
+{
+	struct t_gpio_sim *sim;
+	struct t_gpio_bank *new_bank;
+
+	sim = calloc(1, sizeof(*sim));
+	if (!sim)
+		return NULL;
+
+	sim->latency =
+		(latency > 0) ? latency * PILAB_GPIO_SIM_NSEC_PER_USEC : 0;
+
+	new_bank = gpio_bank_create(sim, offsets, num_lines, output,
+				    &gpio_sim_get_values, &gpio_sim_set_values,
+				    &gpio_sim_free);
+	if (!new_bank)
+		gpio_sim_free(sim);
+
+	return new_bank;
+}
+
+/*
+ * Set the level of a line on the simulated chip, like the outside world does
+ * for an input.
+ *
+ * Returns -1 when the line is not part of the bank, 1 on success.
+ */
+
+int gpio_sim_set_level(struct t_gpio_bank *bank, int offset, int value)
+{
+	struct t_gpio_sim *sim;
+	int index;
+
+	index = gpio_bank_index(bank, offset);
+	if (index < 0)
+		return -1;
+
+	sim = (struct t_gpio_sim *)bank->instance;
+
+	pthread_mutex_lock(&bank->lock);
+	if (value)
+		sim->levels |= 1ULL << index;
+	else
+		sim->levels &= ~(1ULL << index);
+	pthread_mutex_unlock(&bank->lock);
+
+	return 1;
+}
+
+/*
+ * Returns the level of a line on the simulated chip, -1 when the line is not
+ * part of the bank.
+ */
+
+int gpio_sim_get_level(struct t_gpio_bank *bank, int offset)
+{
+	struct t_gpio_sim *sim;
+	int index, level;
+
+	index = gpio_bank_index(bank, offset);
+	if (index < 0)
+		return -1;
+
+	sim = (struct t_gpio_sim *)bank->instance;
+
+	pthread_mutex_lock(&bank->lock);
+	level = (sim->levels >> index) & 1;
+	pthread_mutex_unlock(&bank->lock);
+
+	return level;
+}
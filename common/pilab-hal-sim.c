@@ -0,0 +1,429 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <wiringPi.h>
+#include "pilab-hal-sim.h"
+#include "pilab-time.h"
+
+#define PILAB_HAL_SIM_KEY_SIZE 64
+#define PILAB_HAL_SIM_NSEC_PER_MSEC 1000000ULL
+#define PILAB_HAL_SIM_NSEC_PER_SEC 1e9
+#define PILAB_HAL_SIM_TWO_PI 6.28318530717958647692
+
+/*
+ * Returns the value of waveform at seconds since the start of the simulation.
+ */
+
+double hal_sim_waveform_value(const struct t_hal_waveform *waveform,
+			      double seconds, unsigned int *seed)
+{
+	double phase, wave;
+
+	if (!waveform)
+		return 0.0;
+
+	phase = (waveform->period > 0) ?
+			fmod(seconds / waveform->period, 1.0) :
+			0.0;
+
+	switch (waveform->type) {
+	case HAL_WAVEFORM_SINE:
+		wave = sin(PILAB_HAL_SIM_TWO_PI * phase);
+		break;
+	case HAL_WAVEFORM_SQUARE:
+		wave = (phase < 0.5) ? 1.0 : -1.0;
+		break;
+	case HAL_WAVEFORM_RAMP:
+		wave = 2.0 * phase - 1.0;
+		break;
+	case HAL_WAVEFORM_NOISE:
+		wave = 2.0 * ((double)rand_r(seed) / RAND_MAX) - 1.0;
+		break;
+	case HAL_WAVEFORM_CONSTANT:
+	case HAL_WAVEFORM_NUM_TYPES:
+	default:
+		wave = 0.0;
+		break;
+	}
+
+	return waveform->offset + waveform->amplitude * wave;
+}
+
+/*
+ * Take the latency of a read, like the real device would.
+ */
+
+static void hal_sim_wait(int latency)
+{
+	struct timespec pause;
+
+	if (latency < 1)
+		return;
+
+	pause.tv_sec = latency / 1000;
+	pause.tv_nsec = (latency % 1000) * PILAB_HAL_SIM_NSEC_PER_MSEC;
+	while (nanosleep(&pause, &pause) < 0 && errno == EINTR)
+		;
+}
+
+/*
+ * Sample the signal at key, taking its latency.
+ *
+ * Returns 1 when there is a signal at key, 0 otherwise.
+ */
+
+static int hal_sim_sample(struct t_hal_sim *sim, const char *key,
+			  double *value)
+{
+	struct t_hal_waveform *waveform;
+	double seconds;
+	int latency;
+
+	pthread_mutex_lock(&sim->lock);
+	waveform = (struct t_hal_waveform *)hashtable_get(sim->signals, key);
+	if (waveform) {
+		seconds = (time_monotonic_ns() - sim->started) /
+			  PILAB_HAL_SIM_NSEC_PER_SEC;
+		*value = hal_sim_waveform_value(waveform, seconds, &sim->seed);
+		latency = waveform->latency;
+	}
+	pthread_mutex_unlock(&sim->lock);
+
+	if (!waveform)
+		return 0;
+
+	hal_sim_wait(latency);
+
+	return 1;
+}
+
+/*
+ * Sample the signal of a pin, or what was written to it.
+ */
+
+static double hal_sim_read_pin(struct t_hal_sim *sim, int pin)
+{
+	char key[PILAB_HAL_SIM_KEY_SIZE];
+	double value;
+
+	snprintf(key, sizeof(key), PILAB_HAL_SIM_KEY_PIN "%d", pin);
+	if (hal_sim_sample(sim, key, &value)) {
+		pthread_mutex_lock(&sim->lock);
+		sim->stats.pin_reads++;
+		pthread_mutex_unlock(&sim->lock);
+		return value;
+	}
+
+	pthread_mutex_lock(&sim->lock);
+	sim->stats.pin_reads++;
+	value = (pin >= 0 && pin < PILAB_HAL_SIM_PINS) ? sim->levels[pin] : 0;
+	pthread_mutex_unlock(&sim->lock);
+
+	return value;
+}
+
+static void hal_sim_pin_mode(void *instance, int pin, int mode)
+{
+	/* Silence! */
+	(void)instance;
+	(void)pin;
+	(void)mode;
+}
+
+static int hal_sim_digital_read(void *instance, int pin)
+{
+	return (hal_sim_read_pin((struct t_hal_sim *)instance, pin) >= 0.5) ?
+		       HIGH :
+		       LOW;
+}
+
+static int hal_sim_analog_read(void *instance, int pin)
+{
+	return (int)lround(hal_sim_read_pin((struct t_hal_sim *)instance, pin));
+}
+
+static void hal_sim_analog_write(void *instance, int pin, int value)
+{
+	struct t_hal_sim *sim;
+
+	sim = (struct t_hal_sim *)instance;
+
+	pthread_mutex_lock(&sim->lock);
+	sim->stats.pin_writes++;
+	if (pin >= 0 && pin < PILAB_HAL_SIM_PINS)
+		sim->levels[pin] = value;
+	pthread_mutex_unlock(&sim->lock);
+}
+
+static void hal_sim_digital_write(void *instance, int pin, int value)
+{
+	hal_sim_analog_write(instance, pin, (value == LOW) ? LOW : HIGH);
+}
+
+/*
+ * Simulated i2c transaction, a read returns the signal of the device big
+ * endian, or all ones (the pull-ups) without a signal. Every device answers.
+ *
+ * Returns 1.
+ */
+
+static int hal_sim_i2c_transfer(void *instance, int address,
+				const uint8_t *write_buffer, int write_length,
+				uint8_t *read_buffer, int read_length)
+{
+	struct t_hal_sim *sim;
+	char key[PILAB_HAL_SIM_KEY_SIZE];
+	long raw;
+	double value;
+	int i;
+
+	sim = (struct t_hal_sim *)instance;
+
+	/* Silence! */
+	(void)write_buffer;
+	(void)write_length;
+
+	snprintf(key, sizeof(key), PILAB_HAL_SIM_KEY_I2C "%d", address);
+	if (read_length > 0 && hal_sim_sample(sim, key, &value)) {
+		raw = lround(value);
+		for (i = read_length - 1; i >= 0; --i) {
+			read_buffer[i] = (uint8_t)(raw & 0xff);
+			raw >>= 8;
+		}
+	} else if (read_length > 0) {
+		memset(read_buffer, 0xff, read_length);
+	}
+
+	pthread_mutex_lock(&sim->lock);
+	sim->stats.i2c_transfers++;
+	pthread_mutex_unlock(&sim->lock);
+
+	return 1;
+}
+
+static int hal_sim_i2c_block_read(void *instance, int address,
+				  uint8_t command, uint8_t *buffer, int length)
+{
+	return hal_sim_i2c_transfer(instance, address, &command, 1, buffer,
+				    length);
+}
+
+/*
+ * Every device gets a bus of its own on the simulated board.
+ *
+ * NOTE: The bus doesn't own the simulation, it isn't freed with the bus.
+ */
+
+static struct t_i2c_bus *hal_sim_i2c_open(void *instance, const char *path,
+					  int address)
+{
+	/* Silence! */
+	(void)path;
+	(void)address;
+
+	return i2c_bus_create(instance, 1, &hal_sim_i2c_transfer,
+			      &hal_sim_i2c_block_read, NULL);
+}
+
+/*
+ * A simulated conversion takes as long as the slowest simulated probe.
+ */
+
+static int hal_sim_w1_convert(void *instance, const char *root,
+			      const char *master)
+{
+	struct t_hal_sim *sim;
+	int conversion_time;
+
+	sim = (struct t_hal_sim *)instance;
+
+	/* Silence! */
+	(void)root;
+	(void)master;
+
+	pthread_mutex_lock(&sim->lock);
+	sim->stats.w1_conversions++;
+	conversion_time = sim->conversion_time;
+	pthread_mutex_unlock(&sim->lock);
+
+	hal_sim_wait(conversion_time);
+
+	return 1;
+}
+
+/*
+ * Build the w1_slave attribute of a probe converted to its signal, the way
+ * the kernel formats it.
+ */
+
+static int hal_sim_w1_read(void *instance, const char *root, const char *id,
+			   char *buffer, int size)
+{
+	struct t_hal_sim *sim;
+	struct t_hal_waveform *waveform;
+	char key[PILAB_HAL_SIM_KEY_SIZE];
+	double value;
+	int count;
+
+	sim = (struct t_hal_sim *)instance;
+
+	/* Silence! */
+	(void)root;
+
+	snprintf(key, sizeof(key), PILAB_HAL_SIM_KEY_W1 "%s", id);
+
+	/* the latency of a probe is spent converting, the read is instant */
+	pthread_mutex_lock(&sim->lock);
+	waveform = (struct t_hal_waveform *)hashtable_get(sim->signals, key);
+	if (waveform)
+		value = hal_sim_waveform_value(
+			waveform,
+			(time_monotonic_ns() - sim->started) /
+				PILAB_HAL_SIM_NSEC_PER_SEC,
+			&sim->seed);
+	sim->stats.w1_reads++;
+	pthread_mutex_unlock(&sim->lock);
+
+	/* no signal, no probe */
+	if (!waveform)
+		return -1;
+
+	count = snprintf(buffer, size,
+			 "50 05 4b 46 7f ff 0c 10 1c : crc=1c YES\n"
+			 "50 05 4b 46 7f ff 0c 10 1c t=%ld\n",
+			 lround(value * 1000.0));
+
+	return (count < size) ? count : size - 1;
+}
+
+/*
+ * Feed a signal to the reads of key.
+ *
+ * Returns 1 on success, 0 otherwise.
+ */
+
+static int hal_sim_simulate(void *instance, const char *key,
+			    const struct t_hal_waveform *waveform)
+{
+	struct t_hal_sim *sim;
+	struct t_hal_waveform *copy;
+	int rc;
+
+	sim = (struct t_hal_sim *)instance;
+
+	copy = malloc(sizeof(*copy));
+	if (!copy)
+		return 0;
+	*copy = *waveform;
+
+	pthread_mutex_lock(&sim->lock);
+	rc = (hashtable_set(sim->signals, key, copy)) ? 1 : 0;
+	if (rc && strncmp(key, PILAB_HAL_SIM_KEY_W1,
+			  strlen(PILAB_HAL_SIM_KEY_W1)) == 0 &&
+	    copy->latency > sim->conversion_time)
+		sim->conversion_time = copy->latency;
+	pthread_mutex_unlock(&sim->lock);
+
+	if (!rc)
+		free(copy);
+
+	return rc;
+}
+
+static void hal_sim_free_signal_cb(struct t_hashtable *hashtable,
+				   const void *key, void *value)
+{
+	free(value);
+}
+
+static void hal_sim_free_key_cb(struct t_hashtable *hashtable, void *key)
+{
+	free(key);
+}
+
+static void hal_sim_free(void *instance)
+{
+	struct t_hal_sim *sim;
+
+	sim = (struct t_hal_sim *)instance;
+
+	hashtable_free(sim->signals);
+	pthread_mutex_destroy(&sim->lock);
+	free(sim);
+}
+
+/*
+ * Conjure up a simulated board, without any signals. A pin without a signal
+ * reads back what was written to it, an i2c device all ones, and a 1-Wire
+ * probe is missing.
+ *
+ * Returns a pointer to the newly created backend, NULL otherwise.
+ */
+
+struct t_hal *hal_sim_create(void)
+{
+	struct t_hal_sim *sim;
+	struct t_hal *new_hal;
+
+	sim = calloc(1, sizeof(*sim));
+	if (!sim)
+		return NULL;
+
+	sim->signals = hashtable_create(PILAB_HAL_SIM_SIGNALS,
+					PILAB_HASHTABLE_STRING,
+					PILAB_HASHTABLE_POINTER, NULL, NULL);
+	new_hal = calloc(1, sizeof(*new_hal));
+	if (!sim->signals || !new_hal) {
+		hashtable_free(sim->signals);
+		free(new_hal);
+		free(sim);
+		return NULL;
+	}
+	hashtable_set_pointer(sim->signals, "callback_free_value",
+			      &hal_sim_free_signal_cb);
+	hashtable_set_pointer(sim->signals, "callback_free_key",
+			      &hal_sim_free_key_cb);
+
+	sim->conversion_time = 0;
+	sim->started = time_monotonic_ns();
+	sim->seed = (unsigned int)sim->started;
+	pthread_mutex_init(&sim->lock, NULL);
+
+	new_hal->name = PILAB_HAL_SIM;
+	new_hal->instance = sim;
+	new_hal->extensions = 0;
+	new_hal->pin_mode = &hal_sim_pin_mode;
+	new_hal->digital_read = &hal_sim_digital_read;
+	new_hal->digital_write = &hal_sim_digital_write;
+	new_hal->analog_read = &hal_sim_analog_read;
+	new_hal->analog_write = &hal_sim_analog_write;
+	new_hal->i2c_open = &hal_sim_i2c_open;
+	new_hal->w1_convert = &hal_sim_w1_convert;
+	new_hal->w1_read = &hal_sim_w1_read;
+	new_hal->simulate = &hal_sim_simulate;
+	new_hal->free_hal = &hal_sim_free;
+
+	return new_hal;
+}
+
+/*
+ * Copy the counters of a simulated board.
+ */
+
+void hal_sim_get_stats(struct t_hal *hal, struct t_hal_sim_stats *stats)
+{
+	struct t_hal_sim *sim;
+
+	if (!hal || !stats || hal->free_hal != &hal_sim_free)
+		return;
+
+	sim = (struct t_hal_sim *)hal->instance;
+
+	pthread_mutex_lock(&sim->lock);
+	*stats = sim->stats;
+	pthread_mutex_unlock(&sim->lock);
+}
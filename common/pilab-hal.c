@@ -0,0 +1,357 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <wiringPi.h>
+#include "pilab-hal.h"
+#include "pilab-hal-sim.h"
+#include "pilab-string.h"
+#include "pilab-log.h"
+
+#define PILAB_HAL_KEY_SIZE 64
+
+char *hal_waveform_type_string[HAL_WAVEFORM_NUM_TYPES] = {
+	PILAB_HAL_WAVEFORM_CONSTANT, PILAB_HAL_WAVEFORM_SINE,
+	PILAB_HAL_WAVEFORM_SQUARE,   PILAB_HAL_WAVEFORM_RAMP,
+	PILAB_HAL_WAVEFORM_NOISE,
+};
+
+/*
+ * The backend the drivers go through, the wiringPi one until another one is
+ * set.
+ */
+static struct t_hal *hal_current = NULL;
+
+/*
+ * Backend on top of wiringPi, the way the drivers used it before.
+ */
+
+static void hal_wiringpi_pin_mode(void *instance, int pin, int mode)
+{
+	pinMode(pin, mode);
+}
+
+static int hal_wiringpi_digital_read(void *instance, int pin)
+{
+	return digitalRead(pin);
+}
+
+static void hal_wiringpi_digital_write(void *instance, int pin, int value)
+{
+	digitalWrite(pin, value);
+}
+
+static int hal_wiringpi_analog_read(void *instance, int pin)
+{
+	return analogRead(pin);
+}
+
+static void hal_wiringpi_analog_write(void *instance, int pin, int value)
+{
+	analogWrite(pin, value);
+}
+
+static struct t_i2c_bus *hal_wiringpi_i2c_open(void *instance,
+					       const char *path, int address)
+{
+	return i2c_bus_open(path, address);
+}
+
+/*
+ * Conjure up the wiringPi backend.
+ *
+ * NOTE: wiringPi itself is set up by the caller (wiringPiSetupGpio).
+ *
+ * Returns a pointer to the newly created backend, NULL otherwise.
+ */
+
+struct t_hal *hal_wiringpi_create(void)
+{
+	struct t_hal *new_hal;
+
+	new_hal = calloc(1, sizeof(*new_hal));
+	if (!new_hal)
+		return NULL;
+
+	new_hal->name = PILAB_HAL_WIRINGPI;
+	new_hal->instance = NULL;
+	new_hal->extensions = 1;
+	new_hal->pin_mode = &hal_wiringpi_pin_mode;
+	new_hal->digital_read = &hal_wiringpi_digital_read;
+	new_hal->digital_write = &hal_wiringpi_digital_write;
+	new_hal->analog_read = &hal_wiringpi_analog_read;
+	new_hal->analog_write = &hal_wiringpi_analog_write;
+	new_hal->i2c_open = &hal_wiringpi_i2c_open;
+	/* the w1 bus reads sysfs itself, keeping its descriptors open */
+	new_hal->w1_convert = NULL;
+	new_hal->w1_read = NULL;
+	new_hal->simulate = NULL;
+	new_hal->free_hal = NULL;
+
+	return new_hal;
+}
+
+/*
+ * Conjure up the backend called name (wiringpi or sim), NULL selects
+ * wiringPi.
+ *
+ * Returns a pointer to the newly created backend, NULL otherwise.
+ */
+
+struct t_hal *hal_create_by_name(const char *name)
+{
+	if (!name || string_strcasecmp(name, PILAB_HAL_WIRINGPI) == 0)
+		return hal_wiringpi_create();
+
+	if (string_strcasecmp(name, PILAB_HAL_SIM) == 0)
+		return hal_sim_create();
+
+	pilab_log(LOG_ERROR, "Unknown hal '%s', expected %s or %s", name,
+		  PILAB_HAL_WIRINGPI, PILAB_HAL_SIM);
+
+	return NULL;
+}
+
+/*
+ * Returns the backend the drivers go through.
+ */
+
+struct t_hal *hal_get(void)
+{
+	if (!hal_current)
+		hal_current = hal_wiringpi_create();
+
+	return hal_current;
+}
+
+/*
+ * Make hal the backend the drivers go through, the previous one is freed.
+ *
+ * NOTE: Select the backend at startup, before any device is set up.
+ */
+
+void hal_set(struct t_hal *hal)
+{
+	if (!hal || hal == hal_current)
+		return;
+
+	hal_free(hal_current);
+	hal_current = hal;
+}
+
+/*
+ * Search for a waveform type.
+ *
+ * Return index of type, -1 if the type could not be found.
+ */
+
+int hal_get_waveform_type(const char *type)
+{
+	if (!type)
+		return -1;
+
+	for (int i = 0; i < HAL_WAVEFORM_NUM_TYPES; ++i)
+		if (string_strcasecmp(hal_waveform_type_string[i], type) == 0)
+			return i;
+
+	/* type was not found */
+	return -1;
+}
+
+/*
+ * Set the mode (INPUT/OUTPUT) of a pin.
+ */
+
+void hal_pin_mode(int pin, int mode)
+{
+	struct t_hal *hal;
+
+	hal = hal_get();
+	if (hal)
+		(hal->pin_mode)(hal->instance, pin, mode);
+}
+
+/*
+ * Returns the level (HIGH/LOW) of a pin.
+ */
+
+int hal_digital_read(int pin)
+{
+	struct t_hal *hal;
+
+	hal = hal_get();
+
+	return (hal) ? (hal->digital_read)(hal->instance, pin) : LOW;
+}
+
+/*
+ * Drive a pin HIGH or LOW.
+ */
+
+void hal_digital_write(int pin, int value)
+{
+	struct t_hal *hal;
+
+	hal = hal_get();
+	if (hal)
+		(hal->digital_write)(hal->instance, pin, value);
+}
+
+/*
+ * Returns the value of an analog (or extension) pin.
+ */
+
+int hal_analog_read(int pin)
+{
+	struct t_hal *hal;
+
+	hal = hal_get();
+
+	return (hal) ? (hal->analog_read)(hal->instance, pin) : 0;
+}
+
+/*
+ * Write the value of an analog (or extension) pin.
+ */
+
+void hal_analog_write(int pin, int value)
+{
+	struct t_hal *hal;
+
+	hal = hal_get();
+	if (hal)
+		(hal->analog_write)(hal->instance, pin, value);
+}
+
+/*
+ * Open the i2c bus at path for the device at address.
+ *
+ * Returns the bus, NULL otherwise.
+ */
+
+struct t_i2c_bus *hal_i2c_open(const char *path, int address)
+{
+	struct t_hal *hal;
+
+	hal = hal_get();
+
+	return (hal) ? (hal->i2c_open)(hal->instance, path, address) : NULL;
+}
+
+/*
+ * Convert every probe on the 1-Wire bus at once.
+ *
+ * Returns:
+ * -1: the backend uses the sysfs interface as is.
+ *  0: the bus can't broadcast a conversion.
+ *  1: the probes converted.
+ */
+
+int hal_w1_convert(const char *root, const char *master)
+{
+	struct t_hal *hal;
+
+	hal = hal_get();
+	if (!hal || !hal->w1_convert)
+		return -1;
+
+	return (hal->w1_convert)(hal->instance, root, master);
+}
+
+/*
+ * Read the w1_slave attribute of the probe with id.
+ *
+ * Returns the amount of bytes read, -1 when it could not be read or the
+ * backend uses the sysfs interface as is.
+ */
+
+int hal_w1_read(const char *root, const char *id, char *buffer, int size)
+{
+	struct t_hal *hal;
+
+	hal = hal_get();
+	if (!hal || !hal->w1_read || !buffer || size < 1)
+		return -1;
+
+	return (hal->w1_read)(hal->instance, root, id, buffer, size);
+}
+
+/*
+ * Feed a simulated signal to the reads of key.
+ *
+ * Returns -1 when the backend is no simulation, 0 on failure and 1 on success.
+ */
+
+static int hal_simulate(const char *key, const struct t_hal_waveform *waveform)
+{
+	struct t_hal *hal;
+
+	hal = hal_get();
+	if (!hal || !hal->simulate || !waveform)
+		return -1;
+
+	return (hal->simulate)(hal->instance, key, waveform);
+}
+
+/*
+ * Feed a simulated signal to the reads of a pin.
+ *
+ * Returns -1 when the backend is no simulation, 0 on failure and 1 on success.
+ */
+
+int hal_simulate_pin(int pin, const struct t_hal_waveform *waveform)
+{
+	char key[PILAB_HAL_KEY_SIZE];
+
+	snprintf(key, sizeof(key), PILAB_HAL_SIM_KEY_PIN "%d", pin);
+
+	return hal_simulate(key, waveform);
+}
+
+/*
+ * Feed a simulated signal to the reads of the i2c device at address, a read
+ * returns it big endian.
+ *
+ * Returns -1 when the backend is no simulation, 0 on failure and 1 on success.
+ */
+
+int hal_simulate_i2c(int address, const struct t_hal_waveform *waveform)
+{
+	char key[PILAB_HAL_KEY_SIZE];
+
+	snprintf(key, sizeof(key), PILAB_HAL_SIM_KEY_I2C "%d", address);
+
+	return hal_simulate(key, waveform);
+}
+
+/*
+ * Feed a simulated signal (in degrees) to the 1-Wire probe with id.
+ *
+ * Returns -1 when the backend is no simulation, 0 on failure and 1 on success.
+ */
+
+int hal_simulate_w1(const char *id, const struct t_hal_waveform *waveform)
+{
+	char key[PILAB_HAL_KEY_SIZE];
+
+	if (!id)
+		return -1;
+
+	snprintf(key, sizeof(key), PILAB_HAL_SIM_KEY_W1 "%s", id);
+
+	return hal_simulate(key, waveform);
+}
+
+/*
+ * Free the backend.
+ */
+
+void hal_free(struct t_hal *hal)
+{
+	if (!hal)
+		return;
+
+	if (hal->free_hal)
+		(hal->free_hal)(hal->instance);
+	if (hal == hal_current)
+		hal_current = NULL;
+	free(hal);
+}
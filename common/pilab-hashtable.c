@@ -281,6 +281,7 @@ struct t_hashtable_item *hashtable_set(struct t_hashtable *hashtable,
 		hashtable_free_value(hashtable, item_ptr);
 		hashtable_alloc_type(hashtable->type_values, value,
 				     &item_ptr->value);
+		return item_ptr;
 	}
 
 	/* create the new item */
@@ -1,17 +1,23 @@
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <wiringPi.h>
 #include <ds18b20.h>
 #include <pcf8574.h>
 #include "pilab-host-device.h"
+#include "pilab-hal.h"
 #include "pilab-gpio-device.h"
 #include "pilab-i2c-device.h"
+#include "pilab-w1-device.h"
 #include "pilab-hashtable.h"
 #include "pilab-list.h"
 #include "pilab-readline.h"
 #include "pilab-log.h"
 #include "pilab-string.h"
 #include "pilab-lcd.h"
+#include "pilab-w1-bus.h"
+#include "pilab-i2c-bus.h"
+#include "pilab-time.h"
 
 static const char *sensor_config_paths[] = {
 	SYSCONFDIR "/pilab/sensors",
@@ -27,22 +33,39 @@ char *host_device_sensor_module[HOST_DEVICE_NUM_MODULES] = {
 	PILAB_HOST_MODULE_DS18B20,
 	PILAB_HOST_MODULE_PCF8574,
 	PILAB_HOST_MODULE_HD44780,
+	PILAB_HOST_MODULE_W1,
+};
+
+/* Pins every module takes from its pin base on */
+int host_device_sensor_module_pins[HOST_DEVICE_NUM_MODULES] = {
+	1,
+	PILAB_I2C_DEVICE_PCF8574_PINS,
+	PILAB_I2C_DEVICE_PCF8574_PINS,
+	1,
 };
 
 /*
- * Search for sensor module.
+ * Search for sensor module, a sensor name can carry a label after the module
+ * (e.g. ds18b20:office), so a module can be used more than once.
  *
  * Return index of type, -1 if the type could not be found.
  */
 
 int host_device_get_sensor_module(const char *type)
 {
+	size_t length;
+
 	if (!type)
 		return -1;
 
-	for (int i = 0; i < HOST_DEVICE_NUM_MODULES; ++i)
-		if (string_strcmp(host_device_sensor_module[i], type) == 0)
+	for (int i = 0; i < HOST_DEVICE_NUM_MODULES; ++i) {
+		length = strlen(host_device_sensor_module[i]);
+		if (string_strncmp(host_device_sensor_module[i], type,
+				   length) == 0 &&
+		    (type[length] == '\0' ||
+		     type[length] == PILAB_HOST_DEVICE_LABEL_SEPARATOR))
 			return i;
+	}
 
 	/* type was not found */
 	return -1;
@@ -84,6 +107,8 @@ void host_device_free_device_default_cb(struct t_hashtable *hashtable,
 	device = (struct t_slave_device *)value;
 
 	device->free_device(device->instance);
+	slave_device_free_options(device);
+	free(device);
 }
 
 /*
@@ -98,18 +123,302 @@ void host_device_free_name_default_cb(struct t_hashtable *hashtable, void *key)
 	free(key);
 }
 
+/*
+ * Keep the setup of a registered device for host_device_setup_devices, so the
+ * bus I/O of the devices can overlap.
+ *
+ * Returns 1 on success, 0 otherwise.
+ */
+
+static int host_device_queue_setup(struct t_host_device *host_device,
+				   int module, struct t_slave_device *slave,
+				   void *device, int pin_base, const char *addr)
+{
+	struct t_host_device_setup *new_setups, *setup;
+
+	if (!slave || !device)
+		return 0;
+
+	new_setups = realloc(host_device->setups,
+			     (host_device->num_setups + 1) *
+				     sizeof(*new_setups));
+	if (!new_setups)
+		return 0;
+	host_device->setups = new_setups;
+
+	setup = &host_device->setups[host_device->num_setups];
+	memset(setup, 0, sizeof(*setup));
+	setup->module = module;
+	setup->slave = slave;
+	setup->device = device;
+	setup->pin_base = pin_base;
+	setup->addr = (addr) ? string_strdup(addr) : NULL;
+	host_device->num_setups++;
+
+	return 1;
+}
+
+/*
+ * wiringPi keeps its extension nodes in a global list that isn't locked, the
+ * setups that add a node take turns.
+ *
+ * NOTE: wiringPi prepends a node in one store, a pin lookup racing with it
+ * sees the list either with or without the new node.
+ */
+static pthread_mutex_t host_device_node_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Set up the pcf8574 expander of an i2c device, with a shadowed port and
+ * wiringPi's own extension when that fails.
+ *
+ * Returns 1 on success, 0 otherwise.
+ */
+
+static int host_device_setup_pcf8574(struct t_host_device *host_device,
+				     struct t_host_device_setup *setup)
+{
+	struct t_i2c_device *i2c_device;
+	int rc;
+
+	i2c_device = (struct t_i2c_device *)setup->device;
+
+	pthread_mutex_lock(&host_device_node_lock);
+	rc = (i2c_device_pcf8574_setup(i2c_device, host_device->pin_table) ==
+	      1);
+	if (!rc)
+		rc = pcf8574Setup(setup->pin_base, i2c_device->i2c_addr);
+	pthread_mutex_unlock(&host_device_node_lock);
+
+	return (rc) ? 1 : 0;
+}
+
+/*
+ * Run the setup of a single device.
+ *
+ * Returns 1 on success, 0 otherwise.
+ */
+
+static int host_device_run_setup(struct t_host_device *host_device,
+				 struct t_host_device_setup *setup)
+{
+	struct t_i2c_device *i2c_device;
+	struct t_lcd *lcd;
+	int four_bit[4];
+	int rs, en, rc;
+
+	/* there is no wiringPi behind the backend, nothing to set up */
+	if (!hal_get()->extensions) {
+		if (setup->module == HOST_DEVICE_MODULE_HD44780)
+			pilab_log(LOG_INFO, "Not creating lcd device on %s",
+				  hal_get()->name);
+		return 1;
+	}
+
+	switch (setup->module) {
+	case HOST_DEVICE_MODULE_DS18B20:
+		pthread_mutex_lock(&host_device_node_lock);
+		rc = ds18b20Setup(setup->pin_base, setup->addr);
+		pthread_mutex_unlock(&host_device_node_lock);
+		return (rc) ? 1 : 0;
+	case HOST_DEVICE_MODULE_PCF8574:
+		return host_device_setup_pcf8574(host_device, setup);
+	case HOST_DEVICE_MODULE_HD44780:
+		if (host_device_setup_pcf8574(host_device, setup) < 1)
+			return 0;
+		i2c_device = (struct t_i2c_device *)setup->device;
+		four_bit[0] = i2c_device_get_expansion_pin(i2c_device, 4);
+		four_bit[1] = i2c_device_get_expansion_pin(i2c_device, 5);
+		four_bit[2] = i2c_device_get_expansion_pin(i2c_device, 6);
+		four_bit[3] = i2c_device_get_expansion_pin(i2c_device, 7);
+		rs = i2c_device_get_expansion_pin(i2c_device, 0);
+		en = i2c_device_get_expansion_pin(i2c_device, 2);
+		pilab_log(LOG_DEBUG, "Creating new lcd device");
+		lcd = lcd_4bit_create(4, 20, rs, en, four_bit);
+		if (!lcd)
+			return 0;
+		lcd_assign_expander_chip(lcd, setup->slave);
+		host_device->lcd = lcd;
+		return 1;
+	case HOST_DEVICE_MODULE_W1:
+	case HOST_DEVICE_NUM_MODULES:
+		break;
+	}
+
+	return 1;
+}
+
+/*
+ * The setups of a single bus, run in order on a thread of their own.
+ */
+
+struct t_host_device_bus_setup {
+	struct t_host_device *host_device;
+	const char *bus;
+	pthread_t thread;
+	/*
+	 * 1 when the setups run on the thread, 0 when they ran in turn.
+	 */
+	int threaded;
+	/*
+	 * Time (ns) the setups of the bus took, amount of them and failures.
+	 */
+	uint64_t elapsed;
+	int devices;
+	int failures;
+};
+
+static void *host_device_setup_bus(void *data)
+{
+	struct t_host_device_bus_setup *bus_setup;
+	struct t_host_device_setup *setup;
+	uint64_t started, bus_started;
+	int i;
+
+	bus_setup = (struct t_host_device_bus_setup *)data;
+
+	bus_started = time_monotonic_ns();
+	for (i = 0; i < bus_setup->host_device->num_setups; ++i) {
+		setup = &bus_setup->host_device->setups[i];
+		if (strcmp(setup->bus, bus_setup->bus) != 0)
+			continue;
+
+		started = time_monotonic_ns();
+		setup->done = host_device_run_setup(bus_setup->host_device,
+						    setup);
+		setup->elapsed = time_monotonic_ns() - started;
+
+		bus_setup->devices++;
+		if (!setup->done) {
+			bus_setup->failures++;
+			pilab_log(LOG_ERROR, "Could not set up %s on %s",
+				  setup->slave->get_name(setup->slave->instance),
+				  setup->bus);
+		} else {
+			pilab_log(LOG_DEBUG, "Set up %s on %s in %llu ms",
+				  setup->slave->get_name(setup->slave->instance),
+				  setup->bus,
+				  (unsigned long long)(setup->elapsed /
+						       1000000));
+		}
+	}
+	bus_setup->elapsed = time_monotonic_ns() - bus_started;
+
+	return NULL;
+}
+
+/*
+ * Run the setups of the registered devices, the buses concurrently and the
+ * devices on the same bus in the order of the sensors file. Returns once all
+ * of them are done.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: a device could not be set up, it is logged.
+ *  1: on success.
+ */
+
+int host_device_setup_devices(struct t_host_device *host_device)
+{
+	struct t_host_device_bus_setup *buses;
+	struct t_host_device_setup *setup;
+	uint64_t started;
+	const char *path;
+	int num_buses, i, j;
+
+	if (!host_device)
+		return -1;
+
+	if (host_device->num_setups == 0)
+		return 1;
+
+	buses = calloc(host_device->num_setups, sizeof(*buses));
+	if (!buses)
+		return 0;
+
+	/* the options are known now, an i2c device can name its bus */
+	num_buses = 0;
+	for (i = 0; i < host_device->num_setups; ++i) {
+		setup = &host_device->setups[i];
+		if (setup->module == HOST_DEVICE_MODULE_DS18B20) {
+			setup->bus = PILAB_HOST_DEVICE_W1_BUS;
+		} else {
+			path = slave_device_get_option(
+				setup->slave, PILAB_I2C_DEVICE_OPTION_BUS);
+			setup->bus = (path) ? path :
+					      PILAB_I2C_BUS_DEFAULT_DEVICE;
+		}
+
+		for (j = 0; j < num_buses; ++j)
+			if (strcmp(buses[j].bus, setup->bus) == 0)
+				break;
+		if (j == num_buses) {
+			buses[num_buses].host_device = host_device;
+			buses[num_buses].bus = setup->bus;
+			num_buses++;
+		}
+	}
+
+	started = time_monotonic_ns();
+	/* the first bus is set up by this thread, while the others run */
+	for (i = 1; i < num_buses; ++i) {
+		buses[i].threaded = (pthread_create(&buses[i].thread, NULL,
+						    &host_device_setup_bus,
+						    &buses[i]) == 0);
+		if (!buses[i].threaded) {
+			pilab_log(LOG_DEBUG,
+				  "Could not start a thread for %s, setting it up in turn",
+				  buses[i].bus);
+			(void)host_device_setup_bus(&buses[i]);
+		}
+	}
+	(void)host_device_setup_bus(&buses[0]);
+	for (i = 1; i < num_buses; ++i)
+		if (buses[i].threaded)
+			pthread_join(buses[i].thread, NULL);
+
+	host_device->startup.setup_ns = time_monotonic_ns() - started;
+	host_device->startup.buses = num_buses;
+	for (i = 0; i < num_buses; ++i) {
+		host_device->startup.devices += buses[i].devices;
+		host_device->startup.failures += buses[i].failures;
+		pilab_log(LOG_DEBUG, "Bus %s: %d devices set up in %llu ms",
+			  buses[i].bus, buses[i].devices,
+			  (unsigned long long)(buses[i].elapsed / 1000000));
+	}
+	for (i = 0; i < host_device->num_setups; ++i) {
+		host_device->startup.busy_ns += host_device->setups[i].elapsed;
+		free(host_device->setups[i].addr);
+	}
+	free(host_device->setups);
+	host_device->setups = NULL;
+	host_device->num_setups = 0;
+	free(buses);
+
+	return (host_device->startup.failures) ? 0 : 1;
+}
+
 /*
  * Register the module with the host device.
+ *
+ * The pins of the module are checked against the pins of the modules already
+ * registered, before the module is set up.
+ *
+ * NOTE: The bus I/O of setting the module up is left to
+ * host_device_setup_devices.
+ *
+ * Returns:
+ * -1: invalid argument, or an unknown module.
+ *  0: the pins of the module overlap those of another module.
+ *  1: on success.
  */
 
-void host_device_module_register(struct t_host_device *host_device,
-				 char *sensor_name, int pin_base, char *addr)
+int host_device_module_register(struct t_host_device *host_device,
+				char *sensor_name, int pin_base, char *addr)
 {
 	struct t_i2c_device *i2c_device;
 	struct t_gpio_device *gpio_device;
+	struct t_w1_device *w1_device;
 	struct t_slave_device *slave_ref;
-	struct t_lcd *lcd;
-	int four_bit[4];
 	int valid_module;
 	int addr_int;
 
@@ -121,14 +430,47 @@ void host_device_module_register(struct t_host_device *host_device,
 	   Possible solution?: let the callback_init_strategy take a void*, which can be
 	   used to cast to the function pointer in question.
 	 */
+	if (!host_device || !sensor_name)
+		return -1;
+
 	valid_module = host_device_get_sensor_module(sensor_name);
+	if (valid_module < 0) {
+		pilab_log(LOG_ERROR, "Unknown sensor module: %s", sensor_name);
+		return -1;
+	}
+
+	if (pin_table_check(host_device->pin_table, pin_base,
+			    host_device_sensor_module_pins[valid_module]) < 1) {
+		pilab_log(LOG_ERROR, "Pin base %d of %s is not usable",
+			  pin_base, sensor_name);
+		return 0;
+	}
+
+	slave_ref = NULL;
 	switch (valid_module) {
 	case HOST_DEVICE_MODULE_DS18B20:
 		gpio_device =
 			gpio_device_create(pin_base, sensor_name, host_device);
+		slave_ref = (struct t_slave_device *)hashtable_get(
+			host_device->slave_devices_lookup, sensor_name);
 		pilab_log(LOG_DEBUG, "Setting up %s with pinbase: %d",
 			  gpio_device->device_name, gpio_device->pin_base);
-		ds18b20Setup(pin_base, addr);
+		/* the module reports tenths of a degree, -9999 on a bad crc */
+		gpio_device->scale = 0.1;
+		gpio_device->unit = "C";
+		gpio_device->failed_raw = -9999;
+		(void)host_device_queue_setup(host_device, valid_module,
+					      slave_ref, gpio_device, pin_base,
+					      addr);
+		/* samples come from the bus, which converts all probes at once */
+		gpio_device->w1_probe =
+			w1_bus_add_probe(host_device->w1_bus, addr);
+		if (gpio_device->w1_probe) {
+			/* millidegrees, a failed read is flagged by the bus */
+			gpio_device->scale = 0.001;
+			gpio_device->failed_raw =
+				PILAB_SLAVE_DEVICE_READ_FAILED;
+		}
 		/* TODO: Figure out a way to do through the callback */
 		/* gpio_device_set_pointer(gpio_device, "callback_init_strategy", */
 		/* 			&ds18b20Setup); */
@@ -136,12 +478,16 @@ void host_device_module_register(struct t_host_device *host_device,
 	case HOST_DEVICE_MODULE_PCF8574:
 		addr_int = (int)strtol(addr, NULL, 16);
 		i2c_device = i2c_device_create(pin_base, addr_int, sensor_name,
-					       host_device, NULL);
+					       host_device, &slave_ref);
 		pilab_log(LOG_DEBUG,
 			  "Setting up %s with pinbase: %d and address: %d",
 			  i2c_device->device_name, i2c_device->pin_base,
 			  i2c_device->i2c_addr);
-		pcf8574Setup(pin_base, addr_int);
+		(void)pin_table_add(host_device->pin_table, pin_base,
+				    PILAB_I2C_DEVICE_PCF8574_PINS, slave_ref);
+		(void)host_device_queue_setup(host_device, valid_module,
+					      slave_ref, i2c_device, pin_base,
+					      addr);
 		/* TODO: Figure out a way to do through the callback */
 		/* i2c_device_set_pointer(i2c_device, "callback_init_strategy", */
 		/* 		       &pcf8574Setup); */
@@ -154,23 +500,190 @@ void host_device_module_register(struct t_host_device *host_device,
 			  "Setting up %s with pinbase: %d and address: %d",
 			  i2c_device->device_name, i2c_device->pin_base,
 			  i2c_device->i2c_addr);
-		pcf8574Setup(pin_base, addr_int);
+		(void)pin_table_add(host_device->pin_table, pin_base,
+				    PILAB_I2C_DEVICE_PCF8574_PINS, slave_ref);
+		/* the display is created once its expander is set up */
+		(void)host_device_queue_setup(host_device, valid_module,
+					      slave_ref, i2c_device, pin_base,
+					      addr);
 		/* TODO: Figure out a way to do through the callback */
 		/* i2c_device_set_pointer(i2c_device, "callback_init_strategy", */
 		/* 		       &pcf8574Setup); */
-		four_bit[0] = i2c_device_get_expansion_pin(i2c_device, 4);
-		four_bit[0] = i2c_device_get_expansion_pin(i2c_device, 5);
-		four_bit[0] = i2c_device_get_expansion_pin(i2c_device, 6);
-		four_bit[0] = i2c_device_get_expansion_pin(i2c_device, 7);
-		int rs = i2c_device_get_expansion_pin(i2c_device, 0);
-		int en = i2c_device_get_expansion_pin(i2c_device, 2);
-		pilab_log(LOG_DEBUG, "Creating new lcd device");
-		lcd = lcd_4bit_create(4, 20, rs, en, four_bit);
-		lcd_assign_expander_chip(lcd, slave_ref);
-		host_device->lcd = lcd;
+		break;
+	case HOST_DEVICE_MODULE_W1:
+		w1_device = w1_device_create(pin_base, sensor_name, addr,
+					     host_device);
+		if (!w1_device) {
+			pilab_log(LOG_ERROR, "Could not set up %s", sensor_name);
+			break;
+		}
+		pilab_log(LOG_DEBUG, "Setting up %s with slave id: %s",
+			  w1_device->device_name, w1_device->id);
+		slave_ref = (struct t_slave_device *)hashtable_get(
+			host_device->slave_devices_lookup, sensor_name);
 		break;
 	case HOST_DEVICE_NUM_MODULES:;
 	}
+
+	/* the expanders took their pins before they were set up */
+	if (slave_ref && !pin_table_lookup(host_device->pin_table, pin_base))
+		(void)pin_table_add(host_device->pin_table, pin_base,
+				    host_device_sensor_module_pins[valid_module],
+				    slave_ref);
+
+	return 1;
+}
+
+/*
+ * Set the sampling interval (in seconds) of a registered device from the
+ * interval column of the sensors file.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the device is not registered, or the interval is not a positive number.
+ *  1: on success.
+ */
+
+int host_device_set_sample_interval(struct t_host_device *host_device,
+				    const char *sensor_name,
+				    const char *interval)
+{
+	struct t_slave_device *slave;
+	char *end;
+	long value;
+
+	if (!host_device || !sensor_name || !interval)
+		return -1;
+
+	slave = (struct t_slave_device *)hashtable_get(
+		host_device->slave_devices_lookup, sensor_name);
+	if (!slave)
+		return 0;
+
+	value = strtol(interval, &end, 10);
+	if (*end != '\0' || value < 1) {
+		pilab_log(
+			LOG_ERROR,
+			"Invalid interval '%s' for %s, it should be a positive amount of seconds. Falling back to the default interval.",
+			interval, sensor_name);
+		return 0;
+	}
+
+	slave->sample_interval = (int)value;
+
+	return 1;
+}
+
+/*
+ * Set a key=value option on a registered slave device.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the device is not registered, or the option is malformed.
+ *  1: on success.
+ */
+
+int host_device_set_option(struct t_host_device *host_device,
+			   const char *sensor_name, const char *option)
+{
+	struct t_slave_device *slave;
+
+	if (!host_device || !sensor_name || !option)
+		return -1;
+
+	slave = (struct t_slave_device *)hashtable_get(
+		host_device->slave_devices_lookup, sensor_name);
+	if (!slave)
+		return 0;
+
+	if (slave_device_parse_option(slave, option) < 1) {
+		pilab_log(LOG_ERROR, "Invalid option '%s' for %s, ignoring it.",
+			  option, sensor_name);
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Feed the simulated signal described by the sim_* options of a registered
+ * device to the backend. A ds18b20 or w1 probe is simulated in degrees by its
+ * slave id, a pcf8574 by its address and anything else by its pin base.
+ *
+ * Returns:
+ * -1: invalid argument, or the backend is no simulation.
+ *  0: the device has no (valid) simulated signal.
+ *  1: on success.
+ */
+
+static int host_device_simulate(struct t_host_device *host_device,
+				const char *sensor_name, int pin_base,
+				const char *addr)
+{
+	struct t_slave_device *slave;
+	struct t_hal_waveform waveform;
+	const char *wave;
+	char *id;
+	int type, rc;
+
+	if (!host_device || !sensor_name || !hal_get()->simulate)
+		return -1;
+
+	slave = (struct t_slave_device *)hashtable_get(
+		host_device->slave_devices_lookup, sensor_name);
+	if (!slave)
+		return 0;
+
+	wave = slave_device_get_option(slave, PILAB_HAL_OPTION_WAVE);
+	if (!wave)
+		return 0;
+
+	type = hal_get_waveform_type(wave);
+	if (type < 0) {
+		pilab_log(LOG_ERROR, "Unknown %s '%s' for %s, not simulating it.",
+			  PILAB_HAL_OPTION_WAVE, wave, sensor_name);
+		return 0;
+	}
+
+	waveform.type = type;
+	waveform.offset = slave_device_get_option_double(
+		slave, PILAB_HAL_OPTION_OFFSET, 0.0);
+	waveform.amplitude = slave_device_get_option_double(
+		slave, PILAB_HAL_OPTION_AMPLITUDE, 0.0);
+	waveform.period = slave_device_get_option_double(
+		slave, PILAB_HAL_OPTION_PERIOD, 60.0);
+	waveform.latency =
+		slave_device_get_option_int(slave, PILAB_HAL_OPTION_LATENCY, 0);
+
+	switch (host_device_get_sensor_module(sensor_name)) {
+	case HOST_DEVICE_MODULE_DS18B20:
+	case HOST_DEVICE_MODULE_W1:
+		if (!addr)
+			return 0;
+		if (strchr(addr, '-'))
+			id = string_strdup(addr);
+		else
+			id = string_strcat_delimiter(
+				PILAB_W1_BUS_FAMILY_DS18B20, addr, "-");
+		rc = hal_simulate_w1(id, &waveform);
+		free(id);
+		break;
+	case HOST_DEVICE_MODULE_PCF8574:
+	case HOST_DEVICE_MODULE_HD44780:
+		if (!addr)
+			return 0;
+		rc = hal_simulate_i2c((int)strtol(addr, NULL, 16), &waveform);
+		break;
+	default:
+		rc = hal_simulate_pin(pin_base, &waveform);
+		break;
+	}
+
+	if (rc > 0)
+		pilab_log(LOG_DEBUG, "Simulating %s as a %s wave around %g",
+			  sensor_name, wave, waveform.offset);
+
+	return rc;
 }
 
 /*
@@ -186,9 +699,9 @@ void host_device_module_register(struct t_host_device *host_device,
 int host_device_slave_builder(struct t_host_device *host_device,
 			      struct t_pilist *slave_components)
 {
-	int valid_type;
-	int pin_base;
-	char *sensor_name, *type;
+	int valid_type, registered;
+	int pin_base, i;
+	char *sensor_name, *type, *column;
 
 	if (!host_device || !slave_components)
 		return -1;
@@ -200,11 +713,12 @@ int host_device_slave_builder(struct t_host_device *host_device,
 	pin_base = atoi((char *)pilist_get_data(slave_components, 2));
 
 	valid_type = host_device_get_sensor_type(type);
+	registered = -1;
 
 	if (valid_type > -1) {
 		switch (valid_type) {
 		case HOST_DEVICE_GPIO:
-			host_device_module_register(
+			registered = host_device_module_register(
 				host_device, sensor_name, pin_base,
 				(char *)pilist_get_data(slave_components, 3));
 			break;
@@ -216,7 +730,7 @@ int host_device_slave_builder(struct t_host_device *host_device,
 					"An i2c device should have at least four columns: <name>, <type>, <pinbase>, <address>. Please make sure the sensor config is properly configured and aligned!");
 				return 0;
 			}
-			host_device_module_register(
+			registered = host_device_module_register(
 				host_device, sensor_name, pin_base,
 				(char *)pilist_get_data(slave_components, 3));
 			break;
@@ -228,12 +742,31 @@ int host_device_slave_builder(struct t_host_device *host_device,
 					"An lcd device should have and i2c device attached, therefore should have at least four columns: <name>, <type>, <pinbase>, <address>. Please make sure the sensor config is properly configured and aligned!");
 				return 0;
 			}
-			host_device_module_register(
+			registered = host_device_module_register(
 				host_device, sensor_name, pin_base,
 				(char *)pilist_get_data(slave_components, 3));
 			break;
 		case HOST_DEVICE_NUM_TYPES:;
 		}
+
+		/* overlapping pins would have devices write each other's pins */
+		if (registered == 0)
+			return 0;
+
+		/* optional sampling interval, followed by key=value options */
+		for (i = 4; i < slave_components->size; ++i) {
+			column = (char *)pilist_get_data(slave_components, i);
+			if (strchr(column, '='))
+				host_device_set_option(host_device, sensor_name,
+						       column);
+			else if (i == 4)
+				host_device_set_sample_interval(
+					host_device, sensor_name, column);
+		}
+
+		(void)host_device_simulate(
+			host_device, sensor_name, pin_base,
+			(char *)pilist_get_data(slave_components, 3));
 	}
 
 	return 1;
@@ -265,7 +798,27 @@ struct t_host_device *host_device_create_with_max_registrations_size(int size)
 		return NULL;
 	}
 
+	new_host->w1_bus = w1_bus_create(NULL, NULL);
+	if (!new_host->w1_bus) {
+		hashtable_free(new_slave_device_lookup_table);
+		free(new_host);
+		return NULL;
+	}
+
+	new_host->pin_table = pin_table_create();
+	if (!new_host->pin_table) {
+		w1_bus_free(new_host->w1_bus);
+		hashtable_free(new_slave_device_lookup_table);
+		free(new_host);
+		return NULL;
+	}
+
 	new_host->slave_devices_lookup = new_slave_device_lookup_table;
+	new_host->lcd = NULL;
+	new_host->num_gpio_banks = 0;
+	new_host->setups = NULL;
+	new_host->num_setups = 0;
+	memset(&new_host->startup, 0, sizeof(new_host->startup));
 	hashtable_set_pointer(new_host->slave_devices_lookup,
 			      "callback_free_value",
 			      &host_device_free_device_default_cb);
@@ -289,6 +842,31 @@ struct t_host_device *host_device_create()
 	return host_device_create_with_max_registrations_size(26);
 }
 
+/*
+ * Free the host device, its slave devices, its 1-Wire bus and its lcd.
+ *
+ * NOTE: Make sure no slave device is still being read.
+ */
+
+void host_device_free(struct t_host_device *host_device)
+{
+	if (!host_device)
+		return;
+
+	hashtable_free(host_device->slave_devices_lookup);
+	pin_table_free(host_device->pin_table);
+	w1_bus_free(host_device->w1_bus);
+	for (int i = 0; i < host_device->num_gpio_banks; i++)
+		gpio_bank_free(host_device->gpio_banks[i]);
+	if (host_device->lcd)
+		lcd_free(host_device->lcd);
+	for (int i = 0; i < host_device->num_setups; i++)
+		free(host_device->setups[i].addr);
+	free(host_device->setups);
+
+	free(host_device);
+}
+
 /*
  * Register a new slave device, effectively adding it to the host.
  *
@@ -318,6 +896,8 @@ void host_device_deregister_slave_device(
 	if (!host_device || !slave_device)
 		return;
 
+	pin_table_remove(host_device->pin_table,
+			 (struct t_slave_device *)slave_device);
 	hashtable_remove(host_device->slave_devices_lookup,
 			 slave_device->get_name(slave_device->instance));
 }
@@ -328,9 +908,20 @@ void host_device_deregister_slave_device(
 
 void host_device_deregister_all_slave_devices(struct t_host_device *host_device)
 {
+	struct t_slave_device *slave;
+
 	if (!host_device)
 		return;
 
+	/* the pins of the devices that aren't registered (an lcd) stay */
+	for (int i = 0; i < host_device->pin_table->size; i++) {
+		slave = host_device->pin_table->pins[i];
+		if (slave && hashtable_get(host_device->slave_devices_lookup,
+					   slave->get_name(slave->instance)) ==
+				     slave)
+			pin_table_remove(host_device->pin_table, slave);
+	}
+
 	hashtable_remove_all(host_device->slave_devices_lookup);
 }
 
@@ -348,70 +939,89 @@ int host_device_get_slave_devices_count(struct t_host_device *host_device)
 
 /*
  * Read in the sensors and initialise them.
+ *
+ * Loading stops at the first sensor that can't be set up, e.g. because its
+ * pins overlap those of a sensor before it.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: a sensor is misconfigured.
+ *  1: on success, a missing sensor file is logged.
  */
 
-void host_device_read_in_sensor_modules(struct t_host_device *host_device)
+int host_device_read_in_sensor_modules(struct t_host_device *host_device)
 {
 	char *line;
 	FILE *file;
-	int line_no;
+	int line_no, rc;
+	uint64_t started;
 	struct t_pilist *split_sensor_line;
 
 	if (!host_device)
-		return;
+		return -1;
 
+	rc = 1;
 	line_no = 0;
+	started = time_monotonic_ns();
 	file = fopen(sensor_config_paths[0], "r");
-	if (file) {
-		while (!feof(file)) {
-			line = read_line(file);
+	if (!file) {
+		pilab_log(LOG_ERROR, "%s", "Could not open sensor file");
+		return rc;
+	}
 
-			if (!line)
-				continue;
+	while (rc == 1 && !feof(file)) {
+		line = read_line(file);
 
-			line_no++;
-			pilab_log(LOG_DEBUG, "Read line %d: %s", line_no, line);
-			line = string_strip_whitespace(line);
+		if (!line)
+			continue;
 
-			/* this is a comment, skip it */
-			if (*line == '#') {
-				free(line);
-				continue;
-			}
+		line_no++;
+		pilab_log(LOG_DEBUG, "Read line %d: %s", line_no, line);
+		line = string_strip_whitespace(line);
 
-			/* empty is just empty */
-			if (strlen(line) == 0) {
-				free(line);
-				continue;
-			}
+		/* this is a comment, skip it */
+		if (*line == '#') {
+			free(line);
+			continue;
+		}
+
+		/* empty is just empty */
+		if (strlen(line) == 0) {
+			free(line);
+			continue;
+		}
 
-			split_sensor_line = NULL;
-			/* we split on whitespace */
-			split_sensor_line = string_split(line, " ");
-			if (split_sensor_line) {
-				if (host_device_slave_builder(
-					    host_device, split_sensor_line)) {
-					free(split_sensor_line);
-					free(line);
-					split_sensor_line = NULL;
-					line = NULL;
-				} else {
-					pilab_log(LOG_DEBUG,
-						  "Could not split line %d: %s",
-						  line_no, line);
-				}
+		split_sensor_line = NULL;
+		/* we split on whitespace */
+		split_sensor_line = string_split(line, " ");
+		if (split_sensor_line) {
+			if (host_device_slave_builder(host_device,
+						      split_sensor_line)) {
+				free(split_sensor_line);
+				free(line);
+				split_sensor_line = NULL;
+				line = NULL;
 			} else {
-				pilab_log(
-					LOG_DEBUG,
-					"Could not split line for sensors...");
+				pilab_log(LOG_ERROR,
+					  "Could not set up line %d: %s",
+					  line_no, line);
+				rc = 0;
 			}
+		} else {
+			pilab_log(LOG_DEBUG,
+				  "Could not split line for sensors...");
 		}
-	} else {
-		pilab_log(LOG_ERROR, "%s", "Could not open sensor file");
 	}
 
 	/* whats open needs to be closed */
 	fclose(file);
+	host_device->startup.parse_ns = time_monotonic_ns() - started;
+
+	/* a device that can't be set up is logged, the others still work */
+	if (rc == 1)
+		(void)host_device_setup_devices(host_device);
+
+	return rc;
 }
 
 /*
@@ -478,3 +1088,76 @@ struct t_pilist *host_device_get_sensor_list(struct t_host_device *host_device)
 
 	return sensor_list;
 }
+
+/*
+ * Hand a bank of gpio lines to the host, the host frees it.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the host holds the maximum amount of banks.
+ *  1: on success.
+ */
+
+int host_device_add_gpio_bank(struct t_host_device *host_device,
+			      struct t_gpio_bank *bank)
+{
+	if (!host_device || !bank)
+		return -1;
+
+	if (host_device->num_gpio_banks >= PILAB_HOST_DEVICE_MAX_GPIO_BANKS)
+		return 0;
+
+	host_device->gpio_banks[host_device->num_gpio_banks++] = bank;
+
+	return 1;
+}
+
+/*
+ * Request the gpio pins (BCM numbers) once as a bank of inputs or outputs.
+ * All pins of the bank are then read with a single gpio_bank_snapshot, or
+ * driven with a single gpio_bank_write, instead of a digitalRead or
+ * digitalWrite per pin.
+ *
+ * NOTE: Nothing requests a bank yet, the modules sit behind an expander or
+ * the 1-Wire bus and the buttons read their lines at once through gpio_input.
+ * This is for a module wired to the pins of the pi itself.
+ *
+ * Returns a pointer to the bank, owned by the host, NULL otherwise.
+ */
+
+struct t_gpio_bank *
+	host_device_request_gpio_bank(struct t_host_device *host_device,
+				      const int *pins, int num_pins, int output)
+{
+	struct t_gpio_bank *bank;
+
+	if (!host_device ||
+	    host_device->num_gpio_banks >= PILAB_HOST_DEVICE_MAX_GPIO_BANKS)
+		return NULL;
+
+	bank = gpio_bank_request(NULL, pins, num_pins, output);
+	if (!bank) {
+		pilab_log(LOG_DEBUG, "Could not request a bank of %d pins",
+			  num_pins);
+		return NULL;
+	}
+
+	(void)host_device_add_gpio_bank(host_device, bank);
+
+	return bank;
+}
+
+/*
+ * Resolve an extension pin to the device it belongs to, in constant time.
+ *
+ * Returns the device of the pin, NULL when no device has the pin.
+ */
+
+struct t_slave_device *
+	host_device_get_slave_by_pin(struct t_host_device *host_device, int pin)
+{
+	if (!host_device)
+		return NULL;
+
+	return pin_table_lookup(host_device->pin_table, pin);
+}
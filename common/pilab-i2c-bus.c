@@ -0,0 +1,349 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include "pilab-i2c-bus.h"
+#include "pilab-log.h"
+
+/*
+ * Backend on top of the i2c-dev interface of the kernel.
+ */
+
+struct t_i2c_bus_linux {
+	/*
+	 * Descriptor of the bus, opened once.
+	 */
+	int fd;
+	/*
+	 * Address the SMBus calls go to, -1 when none was set.
+	 */
+	int address;
+};
+
+/*
+ * Issue a combined transaction through I2C_RDWR, the kernel puts a repeated
+ * start between the write and the read.
+ *
+ * Returns 1 on success, 0 otherwise.
+ */
+
+static int i2c_bus_linux_transfer(void *instance, int address,
+				  const uint8_t *write_buffer,
+				  int write_length, uint8_t *read_buffer,
+				  int read_length)
+{
+	struct t_i2c_bus_linux *linux_bus;
+	struct i2c_msg messages[2];
+	struct i2c_rdwr_ioctl_data transaction;
+	int count;
+
+	linux_bus = (struct t_i2c_bus_linux *)instance;
+
+	count = 0;
+	if (write_length > 0) {
+		messages[count].addr = address;
+		messages[count].flags = 0;
+		messages[count].len = write_length;
+		messages[count].buf = (uint8_t *)write_buffer;
+		count++;
+	}
+	if (read_length > 0) {
+		messages[count].addr = address;
+		messages[count].flags = I2C_M_RD;
+		messages[count].len = read_length;
+		messages[count].buf = read_buffer;
+		count++;
+	}
+	if (count == 0)
+		return 1;
+
+	transaction.msgs = messages;
+	transaction.nmsgs = count;
+
+	return (ioctl(linux_bus->fd, I2C_RDWR, &transaction) == count) ? 1 : 0;
+}
+
+/*
+ * Issue an SMBus i2c block read through I2C_SMBUS, for adapters that can't do
+ * combined transactions.
+ *
+ * Returns 1 on success, 0 otherwise.
+ */
+
+static int i2c_bus_linux_block_read(void *instance, int address,
+				    uint8_t command, uint8_t *buffer,
+				    int length)
+{
+	struct t_i2c_bus_linux *linux_bus;
+	struct i2c_smbus_ioctl_data args;
+	union i2c_smbus_data data;
+
+	linux_bus = (struct t_i2c_bus_linux *)instance;
+
+	if (length > I2C_SMBUS_BLOCK_MAX)
+		return 0;
+
+	if (linux_bus->address != address) {
+		if (ioctl(linux_bus->fd, I2C_SLAVE, address) < 0)
+			return 0;
+		linux_bus->address = address;
+	}
+
+	data.block[0] = length;
+	args.read_write = I2C_SMBUS_READ;
+	args.command = command;
+	args.size = I2C_SMBUS_I2C_BLOCK_DATA;
+	args.data = &data;
+	if (ioctl(linux_bus->fd, I2C_SMBUS, &args) < 0 || data.block[0] < length)
+		return 0;
+
+	memcpy(buffer, &data.block[1], length);
+
+	return 1;
+}
+
+static void i2c_bus_linux_free(void *instance)
+{
+	struct t_i2c_bus_linux *linux_bus;
+
+	linux_bus = (struct t_i2c_bus_linux *)instance;
+
+	close(linux_bus->fd);
+	free(linux_bus);
+}
+
+/*
+ * Conjure up a new bus around a backend.
+ *
+ * NOTE: The bus owns the instance, it is freed through free_bus.
+ *
+ * Returns a pointer to the newly created bus, NULL otherwise.
+ */
+
+struct t_i2c_bus *i2c_bus_create(void *instance, int combined,
+				 t_i2c_bus_transfer *transfer,
+				 t_i2c_bus_block_read *block_read,
+				 t_i2c_bus_free_bus *free_bus)
+{
+	struct t_i2c_bus *new_bus;
+
+	if (!instance || !transfer)
+		return NULL;
+
+	new_bus = calloc(1, sizeof(*new_bus));
+	if (!new_bus)
+		return NULL;
+
+	new_bus->instance = instance;
+	new_bus->combined = combined;
+	new_bus->transfer = transfer;
+	new_bus->block_read = block_read;
+	new_bus->free_bus = free_bus;
+	pthread_mutex_init(&new_bus->lock, NULL);
+
+	return new_bus;
+}
+
+/*
+ * Open an i2c-dev bus (e.g. /dev/i2c-1) once, for the device at address.
+ *
+ * Returns a pointer to the newly created bus, NULL otherwise.
+ */
+
+struct t_i2c_bus *i2c_bus_open(const char *path, int address)
+{
+	struct t_i2c_bus_linux *linux_bus;
+	struct t_i2c_bus *new_bus;
+	unsigned long funcs;
+
+	if (!path)
+		return NULL;
+
+	linux_bus = malloc(sizeof(*linux_bus));
+	if (!linux_bus)
+		return NULL;
+
+	linux_bus->fd = open(path, O_RDWR | O_CLOEXEC);
+	if (linux_bus->fd < 0) {
+		pilab_log(LOG_DEBUG, "Could not open %s: %d", path, errno);
+		free(linux_bus);
+		return NULL;
+	}
+
+	/* an adapter that can't tell is assumed to do plain i2c */
+	if (ioctl(linux_bus->fd, I2C_FUNCS, &funcs) < 0)
+		funcs = I2C_FUNC_I2C;
+
+	linux_bus->address = -1;
+	if (ioctl(linux_bus->fd, I2C_SLAVE, address) == 0)
+		linux_bus->address = address;
+
+	new_bus = i2c_bus_create(
+		linux_bus, (funcs & I2C_FUNC_I2C) ? 1 : 0,
+		&i2c_bus_linux_transfer,
+		(funcs & I2C_FUNC_SMBUS_READ_I2C_BLOCK) ?
+			&i2c_bus_linux_block_read :
+			NULL,
+		&i2c_bus_linux_free);
+	if (!new_bus)
+		i2c_bus_linux_free(linux_bus);
+
+	return new_bus;
+}
+
+/*
+ * Account a transaction in the statistics of the bus.
+ *
+ * NOTE: Call this with the lock held.
+ */
+
+static void i2c_bus_account(struct t_i2c_bus *bus, int rc, int written,
+			    int read)
+{
+	bus->stats.transactions++;
+	if (rc < 1) {
+		bus->stats.errors++;
+		return;
+	}
+	bus->stats.bytes_written += written;
+	bus->stats.bytes_read += read;
+}
+
+/*
+ * Write and then read from the device at address, in one transaction.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the transaction failed.
+ *  1: on success.
+ */
+
+int i2c_bus_transfer(struct t_i2c_bus *bus, int address,
+		     const uint8_t *write_buffer, int write_length,
+		     uint8_t *read_buffer, int read_length)
+{
+	int rc;
+
+	if (!bus || write_length < 0 || read_length < 0 ||
+	    (write_length > 0 && !write_buffer) ||
+	    (read_length > 0 && !read_buffer))
+		return -1;
+
+	pthread_mutex_lock(&bus->lock);
+	rc = (bus->transfer)(bus->instance, address, write_buffer,
+			     write_length, read_buffer, read_length);
+	i2c_bus_account(bus, rc, write_length, read_length);
+	pthread_mutex_unlock(&bus->lock);
+
+	return rc;
+}
+
+/*
+ * Read length bytes from the device at address.
+ *
+ * Returns -1 on invalid argument, 0 when the read failed and 1 on success.
+ */
+
+int i2c_bus_read(struct t_i2c_bus *bus, int address, uint8_t *buffer,
+		 int length)
+{
+	return i2c_bus_transfer(bus, address, NULL, 0, buffer, length);
+}
+
+/*
+ * Write length bytes to the device at address.
+ *
+ * Returns -1 on invalid argument, 0 when the write failed and 1 on success.
+ */
+
+int i2c_bus_write(struct t_i2c_bus *bus, int address, const uint8_t *buffer,
+		  int length)
+{
+	return i2c_bus_transfer(bus, address, buffer, length, NULL, 0);
+}
+
+/*
+ * Read length consecutive registers, starting at reg, in a single round-trip.
+ *
+ * A combined transaction is used when the adapter supports it, an SMBus
+ * block read otherwise.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the read failed.
+ *  1: on success.
+ */
+
+int i2c_bus_read_registers(struct t_i2c_bus *bus, int address, uint8_t reg,
+			   uint8_t *buffer, int length)
+{
+	if (!bus || !buffer || length < 1)
+		return -1;
+
+	if (!bus->combined && bus->block_read)
+		return i2c_bus_block_read(bus, address, reg, buffer, length);
+
+	return i2c_bus_transfer(bus, address, &reg, 1, buffer, length);
+}
+
+/*
+ * Read length bytes starting at command, as an SMBus i2c block read.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the read failed, or the backend has no block reads.
+ *  1: on success.
+ */
+
+int i2c_bus_block_read(struct t_i2c_bus *bus, int address, uint8_t command,
+		       uint8_t *buffer, int length)
+{
+	int rc;
+
+	if (!bus || !buffer || length < 1 || length > PILAB_I2C_BUS_BLOCK_MAX)
+		return -1;
+
+	if (!bus->block_read)
+		return 0;
+
+	pthread_mutex_lock(&bus->lock);
+	rc = (bus->block_read)(bus->instance, address, command, buffer, length);
+	i2c_bus_account(bus, rc, 1, length);
+	pthread_mutex_unlock(&bus->lock);
+
+	return rc;
+}
+
+/*
+ * Copy the counters of the bus.
+ */
+
+void i2c_bus_get_stats(struct t_i2c_bus *bus, struct t_i2c_bus_stats *stats)
+{
+	if (!bus || !stats)
+		return;
+
+	pthread_mutex_lock(&bus->lock);
+	*stats = bus->stats;
+	pthread_mutex_unlock(&bus->lock);
+}
+
+/*
+ * Free the bus and its backend.
+ */
+
+void i2c_bus_free(struct t_i2c_bus *bus)
+{
+	if (!bus)
+		return;
+
+	if (bus->free_bus)
+		(bus->free_bus)(bus->instance);
+	pthread_mutex_destroy(&bus->lock);
+	free(bus);
+}
@@ -1,11 +1,92 @@
 #include <stdio.h>
 #include <unistd.h>
+#include <wiringPi.h>
 #include <wiringPiI2C.h>
 #include <stdlib.h>
 #include "pilab-i2c-device.h"
+#include "pilab-hal.h"
 #include "pilab-string.h"
 #include "pilab-log.h"
 
+/*
+ * Pins of the host, the wiringPi callbacks of an expander only get its pin
+ * base to find the device with.
+ */
+static struct t_pin_table *i2c_device_pin_table = NULL;
+
+/*
+ * Take the read options of the device from the sensor config, and open its
+ * bus. This is done once, on first use.
+ *
+ * Returns the bus, NULL when wiringPi has to be used.
+ */
+
+static struct t_i2c_bus *i2c_device_open_bus(struct t_i2c_device *device)
+{
+	const char *value;
+	const char *path;
+
+	if (device->bus_tried)
+		return device->bus;
+
+	device->bus_tried = 1;
+
+	/* registers are usually written in hex */
+	value = slave_device_get_option(device->slave,
+					PILAB_I2C_DEVICE_OPTION_REGISTER);
+	if (value)
+		device->reg = (int)strtol(value, NULL, 0) & 0xff;
+
+	device->length = slave_device_get_option_int(
+		device->slave, PILAB_I2C_DEVICE_OPTION_LENGTH, 1);
+	if (device->length < 1 ||
+	    device->length > PILAB_I2C_DEVICE_MAX_LENGTH) {
+		pilab_log(LOG_ERROR,
+			  "%s should be 1 to %d bytes for %s, reading 1.",
+			  PILAB_I2C_DEVICE_OPTION_LENGTH,
+			  PILAB_I2C_DEVICE_MAX_LENGTH, device->device_name);
+		device->length = 1;
+	}
+
+	if (!device->bus) {
+		path = slave_device_get_option(device->slave,
+					       PILAB_I2C_DEVICE_OPTION_BUS);
+		device->bus = hal_i2c_open(
+			(path) ? path : PILAB_I2C_BUS_DEFAULT_DEVICE,
+			device->i2c_addr);
+	}
+
+	return device->bus;
+}
+
+/*
+ * Write the shadow register to the port of the expander, when it differs from
+ * what the port holds.
+ *
+ * NOTE: Call this with the shadow lock held.
+ */
+
+static void i2c_device_flush_shadow(struct t_i2c_device *device)
+{
+	uint8_t port;
+	int rc;
+
+	if (device->shadow == device->written)
+		return;
+
+	port = device->shadow;
+	if (i2c_device_open_bus(device))
+		rc = (i2c_bus_write(device->bus, device->i2c_addr, &port, 1) ==
+		      1);
+	else
+		rc = (wiringPiI2CWrite(device->handle, port) >= 0);
+
+	device->port_writes++;
+	/* a failed write is retried with the next one */
+	if (rc)
+		device->written = port;
+}
+
 /*
  * I2C device's concrete analog read implementation.
  *
@@ -27,6 +108,14 @@ int i2c_device_analog_read(const void *instance, int pin)
 
 	device = (struct t_i2c_device *)instance;
 
+	if (i2c_device_open_bus(device)) {
+		uint8_t byte;
+
+		if (i2c_bus_read(device->bus, device->i2c_addr, &byte, 1) < 1)
+			return PILAB_SLAVE_DEVICE_READ_FAILED;
+		return byte;
+	}
+
 	return wiringPiI2CRead(device->handle);
 }
 
@@ -51,6 +140,23 @@ void i2c_device_analog_write(const void *instance, int pin, int value)
 	/* Silence! */
 	(void)pin;
 
+	/* the whole port of an expander goes through its shadow register */
+	if (device->expander) {
+		pthread_mutex_lock(&device->shadow_lock);
+		device->shadow = (uint8_t)value;
+		if (device->batch_depth == 0)
+			i2c_device_flush_shadow(device);
+		pthread_mutex_unlock(&device->shadow_lock);
+		return;
+	}
+
+	if (i2c_device_open_bus(device)) {
+		uint8_t byte = (uint8_t)value;
+
+		(void)i2c_bus_write(device->bus, device->i2c_addr, &byte, 1);
+		return;
+	}
+
 	wiringPiI2CWrite (device->handle, value);
 }
 
@@ -101,6 +207,242 @@ void i2c_device_digital_write(const void *instance, int pin, int value)
 	i2c_device_analog_write(instance, pin, value);
 }
 
+/*
+ * I2C device's concrete read sample implementation.
+ *
+ * Reads the bytes of a sample in a single transaction. A device with registers
+ * gets its register pointer written and is read with a repeated start, so a
+ * multi-register sensor takes one round-trip. Without a bus, the port is read
+ * through the handle of the wiringPi extension set up at the pin base.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the read failed, the sample is marked bad.
+ *  1: on success.
+ */
+
+int i2c_device_read_sample(const void *instance,
+			   struct t_slave_device_sample *sample)
+{
+	struct t_i2c_device *device;
+	struct wiringPiNodeStruct *node;
+	uint8_t buffer[PILAB_I2C_DEVICE_MAX_LENGTH];
+	int raw, rc, i;
+
+	if (!instance || !sample)
+		return -1;
+
+	device = (struct t_i2c_device *)instance;
+
+	if (i2c_device_open_bus(device)) {
+		if (device->reg >= 0)
+			rc = i2c_bus_read_registers(device->bus,
+						    device->i2c_addr,
+						    device->reg, buffer,
+						    device->length);
+		else
+			rc = i2c_bus_read(device->bus, device->i2c_addr,
+					  buffer, device->length);
+		device->reads++;
+
+		raw = PILAB_SLAVE_DEVICE_READ_FAILED;
+		if (rc == 1)
+			for (i = 0, raw = 0; i < device->length; ++i)
+				raw = (raw << 8) | buffer[i];
+		slave_device_sample_init(sample, raw,
+					 PILAB_SLAVE_DEVICE_READ_FAILED,
+					 device->scale, device->unit);
+
+		return (sample->quality == SLAVE_DEVICE_QUALITY_GOOD) ? 1 : 0;
+	}
+
+	if (device->handle < 0) {
+		node = wiringPiFindNode(device->pin_base);
+		if (node)
+			device->handle = node->fd;
+	}
+
+	raw = (device->handle < 0) ? PILAB_SLAVE_DEVICE_READ_FAILED :
+				     wiringPiI2CRead(device->handle);
+	/* wiringPi reports i2c errors as -1 */
+	slave_device_sample_init(sample, raw, -1, device->scale, device->unit);
+
+	return (sample->quality == SLAVE_DEVICE_QUALITY_GOOD) ? 1 : 0;
+}
+
+/*
+ * Read the device through another bus, e.g. a simulated one.
+ *
+ * NOTE: The device takes over the bus, and frees it.
+ */
+
+void i2c_device_set_bus(struct t_i2c_device *device, struct t_i2c_bus *bus)
+{
+	if (!device)
+		return;
+
+	if (device->bus && device->bus != bus)
+		i2c_bus_free(device->bus);
+	device->bus = bus;
+}
+
+/*
+ * Returns the expander set up at pin base, NULL otherwise.
+ */
+
+static struct t_i2c_device *i2c_device_find_expander(int pin_base)
+{
+	struct t_slave_device *slave;
+	struct t_i2c_device *device;
+
+	slave = pin_table_lookup(i2c_device_pin_table, pin_base);
+	if (!slave || slave->get_pinbase != &i2c_device_get_pin_base)
+		return NULL;
+
+	device = (struct t_i2c_device *)slave->instance;
+
+	return (device->expander) ? device : NULL;
+}
+
+/*
+ * wiringPi digitalWrite of an expander pin, it only changes the shadow
+ * register while a batch is open.
+ */
+
+static void i2c_device_pcf8574_digital_write(struct wiringPiNodeStruct *node,
+					     int pin, int value)
+{
+	struct t_i2c_device *device;
+	uint8_t bit;
+
+	device = i2c_device_find_expander(node->pinBase);
+	if (!device)
+		return;
+
+	bit = 1 << ((pin - node->pinBase) & (PILAB_I2C_DEVICE_PCF8574_PINS - 1));
+
+	pthread_mutex_lock(&device->shadow_lock);
+	if (value == LOW)
+		device->shadow &= ~bit;
+	else
+		device->shadow |= bit;
+	device->pin_writes++;
+	if (device->batch_depth == 0)
+		i2c_device_flush_shadow(device);
+	pthread_mutex_unlock(&device->shadow_lock);
+}
+
+/*
+ * wiringPi digitalRead of an expander pin, the whole port is read.
+ */
+
+static int i2c_device_pcf8574_digital_read(struct wiringPiNodeStruct *node,
+					   int pin)
+{
+	struct t_i2c_device *device;
+	int port;
+
+	device = i2c_device_find_expander(node->pinBase);
+	if (!device)
+		return LOW;
+
+	port = i2c_device_analog_read(device, pin);
+	if (port < 0)
+		return LOW;
+
+	return (port >> ((pin - node->pinBase) &
+			 (PILAB_I2C_DEVICE_PCF8574_PINS - 1))) &
+	       1;
+}
+
+/*
+ * Set up a pcf8574 at the pin base of the device, as a wiringPi extension
+ * that keeps a shadow copy of the output port. A pin write then only reaches
+ * the bus when it changes the port, or when the batch it is part of is
+ * committed.
+ *
+ * NOTE: The pins of the device should be in pin_table already, the pin writes
+ * find the device through it.
+ *
+ * Returns:
+ * -1: invalid argument, or the pins are not the device's.
+ *  0: the expander could not be set up.
+ *  1: on success.
+ */
+
+int i2c_device_pcf8574_setup(struct t_i2c_device *device,
+			     struct t_pin_table *pin_table)
+{
+	struct wiringPiNodeStruct *node;
+	int port;
+
+	if (!device ||
+	    pin_table_lookup(pin_table, device->pin_base) != device->slave)
+		return -1;
+
+	device->handle = wiringPiI2CSetup(device->i2c_addr);
+	node = wiringPiNewNode(device->pin_base, PILAB_I2C_DEVICE_PCF8574_PINS);
+	if (device->handle < 0 || !node)
+		return 0;
+
+	i2c_device_pin_table = pin_table;
+
+	/* start from what the port holds, like the wiringPi extension does */
+	port = wiringPiI2CRead(device->handle);
+	device->shadow = (port < 0) ? 0xff : (uint8_t)port;
+	device->written = device->shadow;
+	device->expander = 1;
+
+	node->fd = device->handle;
+	node->digitalWrite = &i2c_device_pcf8574_digital_write;
+	node->digitalRead = &i2c_device_pcf8574_digital_read;
+
+	return 1;
+}
+
+/*
+ * I2C device's concrete batch begin implementation.
+ *
+ * Pin writes only change the shadow register, until the batch is committed.
+ */
+
+void i2c_device_batch_begin(const void *instance)
+{
+	struct t_i2c_device *device;
+
+	if (!instance)
+		return;
+
+	device = (struct t_i2c_device *)instance;
+
+	pthread_mutex_lock(&device->shadow_lock);
+	device->batch_depth++;
+	pthread_mutex_unlock(&device->shadow_lock);
+}
+
+/*
+ * I2C device's concrete batch commit implementation.
+ *
+ * Closing the outermost batch writes all pin changes in a single transfer.
+ */
+
+void i2c_device_batch_commit(const void *instance)
+{
+	struct t_i2c_device *device;
+
+	if (!instance)
+		return;
+
+	device = (struct t_i2c_device *)instance;
+
+	pthread_mutex_lock(&device->shadow_lock);
+	if (device->batch_depth > 0)
+		device->batch_depth--;
+	if (device->batch_depth == 0 && device->expander)
+		i2c_device_flush_shadow(device);
+	pthread_mutex_unlock(&device->shadow_lock);
+}
+
 /*
  * I2C device's concrete set pointer implementation.
  *
@@ -187,12 +529,36 @@ int i2c_device_get_address(const void *instance)
 void i2c_device_free_device(const void *instance)
 {
 	struct t_i2c_device *device;
+	struct t_i2c_bus_stats stats;
 
 	if (!instance)
 		return;
 
 	device = (struct t_i2c_device *)instance;
 
+	if (device->expander) {
+		device->expander = 0;
+		pilab_log(LOG_DEBUG, "%s: %lu pin writes in %lu port writes",
+			  device->device_name, device->pin_writes,
+			  device->port_writes);
+	}
+
+	if (device->bus) {
+		i2c_bus_get_stats(device->bus, &stats);
+		if (device->reads > 0)
+			pilab_log(
+				LOG_DEBUG,
+				"%s: %lu reads, %.1f transactions and %.1f bytes per read, %lu failed transactions",
+				device->device_name, device->reads,
+				(double)stats.transactions / device->reads,
+				(double)(stats.bytes_read +
+					 stats.bytes_written) /
+					device->reads,
+				stats.errors);
+		i2c_bus_free(device->bus);
+	}
+
+	pthread_mutex_destroy(&device->shadow_lock);
 	free(device);
 }
 
@@ -203,8 +569,8 @@ void i2c_device_free_device(const void *instance)
  * When setting up the i2c device as an extension module, make sure the
  * the pin_base is > 0x40
  *
- * NOTE: Make sure that there are no overlapping pin offsets when registering
- * the device as a extension module, as there is no boundary checking.
+ * NOTE: The host refuses a module whose pins overlap those of another one,
+ * a device created directly is not checked.
  *
  * Returns pointer to the newly created i2c_device, NULL otherwise.
  */
@@ -240,6 +606,22 @@ struct t_i2c_device *i2c_device_create(int pin_base, int address,
 	new_device->pin_base = pin_base;
 	new_device->i2c_addr = address;
 	new_device->device_name = device_name;
+	new_device->handle = -1;
+	new_device->scale = 1.0;
+	new_device->unit = "";
+	new_device->slave = new_slave;
+	new_device->bus = NULL;
+	new_device->bus_tried = 0;
+	new_device->reg = -1;
+	new_device->length = 1;
+	new_device->reads = 0;
+	new_device->shadow = 0xff;
+	new_device->written = 0xff;
+	new_device->expander = 0;
+	new_device->batch_depth = 0;
+	new_device->pin_writes = 0;
+	new_device->port_writes = 0;
+	pthread_mutex_init(&new_device->shadow_lock, NULL);
 	new_device->callback_init_strategy = NULL;
 
 	new_slave->get_expansion_pin = &i2c_device_get_expansion_pin;
@@ -248,10 +630,18 @@ struct t_i2c_device *i2c_device_create(int pin_base, int address,
 	new_slave->analog_write = &i2c_device_analog_write;
 	new_slave->digital_read = &i2c_device_digital_read;
 	new_slave->digital_write = &i2c_device_digital_write;
+	new_slave->read_sample = &i2c_device_read_sample;
+	new_slave->start_sample = NULL;
+	new_slave->collect_sample = NULL;
+	new_slave->batch_begin = &i2c_device_batch_begin;
+	new_slave->batch_commit = &i2c_device_batch_commit;
 	new_slave->set_pointer = &i2c_device_set_pointer;
 	new_slave->get_pinbase = &i2c_device_get_pin_base;
 	new_slave->free_device = &i2c_device_free_device;
 	new_slave->instance = new_device;
+	new_slave->sample_interval = 0;
+	new_slave->read_timeout = PILAB_I2C_DEVICE_READ_TIMEOUT;
+	new_slave->options = NULL;
 
 	if (slave_ref)
 		*slave_ref = new_slave;
@@ -0,0 +1,167 @@
+#include <stdlib.h>
+#include "pilab-i2c-sim.h"
+
+/*
+ * Returns the simulated device at address, NULL when nothing answers.
+ */
+
+static struct t_i2c_sim_device *i2c_sim_find(struct t_i2c_sim *sim,
+					     int address)
+{
+	if (address < 0 || address >= PILAB_I2C_SIM_ADDRESSES)
+		return NULL;
+
+	return sim->devices[address];
+}
+
+/*
+ * Simulated combined transaction, the first byte written sets the register
+ * pointer and the rest is written from there on.
+ *
+ * Returns 1 on success, 0 when no device answers at address.
+ */
+
+static int i2c_sim_transfer(void *instance, int address,
+			    const uint8_t *write_buffer, int write_length,
+			    uint8_t *read_buffer, int read_length)
+{
+	struct t_i2c_sim_device *device;
+	int i;
+
+	device = i2c_sim_find((struct t_i2c_sim *)instance, address);
+	if (!device)
+		return 0;
+
+	for (i = 0; i < write_length; ++i) {
+		if (i == 0)
+			device->pointer = write_buffer[i];
+		else
+			device->registers[device->pointer++] = write_buffer[i];
+	}
+
+	for (i = 0; i < read_length; ++i)
+		read_buffer[i] = device->registers[device->pointer++];
+
+	return 1;
+}
+
+/*
+ * Simulated SMBus i2c block read.
+ *
+ * Returns 1 on success, 0 when no device answers at address.
+ */
+
+static int i2c_sim_block_read(void *instance, int address, uint8_t command,
+			      uint8_t *buffer, int length)
+{
+	return i2c_sim_transfer(instance, address, &command, 1, buffer, length);
+}
+
+static void i2c_sim_free(void *instance)
+{
+	struct t_i2c_sim *sim;
+	int i;
+
+	sim = (struct t_i2c_sim *)instance;
+
+	for (i = 0; i < PILAB_I2C_SIM_ADDRESSES; ++i)
+		free(sim->devices[i]);
+	free(sim);
+}
+
+/*
+ * Conjure up an in-memory i2c bus, without any devices on it.
+ *
+ * Pass 0 as combined or block_read to simulate an adapter lacking them.
+ *
+ * Returns a pointer to the newly created bus, NULL otherwise.
+ */
+
+struct t_i2c_bus *i2c_sim_create(int combined, int block_read)
+{
+	struct t_i2c_sim *sim;
+	struct t_i2c_bus *new_bus;
+
+	sim = calloc(1, sizeof(*sim));
+	if (!sim)
+		return NULL;
+
+	new_bus = i2c_bus_create(sim, combined, &i2c_sim_transfer,
+				 (block_read) ? &i2c_sim_block_read : NULL,
+				 &i2c_sim_free);
+	if (!new_bus)
+		i2c_sim_free(sim);
+
+	return new_bus;
+}
+
+/*
+ * Put a device with zeroed registers on the simulated bus.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the device could not be allocated.
+ *  1: on success, or when the device already existed.
+ */
+
+int i2c_sim_add_device(struct t_i2c_bus *bus, int address)
+{
+	struct t_i2c_sim *sim;
+
+	if (!bus || address < 0 || address >= PILAB_I2C_SIM_ADDRESSES)
+		return -1;
+
+	sim = (struct t_i2c_sim *)bus->instance;
+
+	pthread_mutex_lock(&bus->lock);
+	if (!sim->devices[address])
+		sim->devices[address] = calloc(1, sizeof(struct t_i2c_sim_device));
+	pthread_mutex_unlock(&bus->lock);
+
+	return (sim->devices[address]) ? 1 : 0;
+}
+
+/*
+ * Set a register of a simulated device.
+ *
+ * Returns -1 on invalid argument, 0 when there is no device at address and 1
+ * on success.
+ */
+
+int i2c_sim_set_register(struct t_i2c_bus *bus, int address, uint8_t reg,
+			 uint8_t value)
+{
+	struct t_i2c_sim_device *device;
+
+	if (!bus)
+		return -1;
+
+	pthread_mutex_lock(&bus->lock);
+	device = i2c_sim_find((struct t_i2c_sim *)bus->instance, address);
+	if (device)
+		device->registers[reg] = value;
+	pthread_mutex_unlock(&bus->lock);
+
+	return (device) ? 1 : 0;
+}
+
+/*
+ * Returns the value of a register of a simulated device, -1 when there is no
+ * device at address.
+ */
+
+int i2c_sim_get_register(struct t_i2c_bus *bus, int address, uint8_t reg)
+{
+	struct t_i2c_sim_device *device;
+	int value;
+
+	if (!bus)
+		return -1;
+
+	pthread_mutex_lock(&bus->lock);
+	device = i2c_sim_find((struct t_i2c_sim *)bus->instance, address);
+	value = (device) ? device->registers[reg] : -1;
+	pthread_mutex_unlock(&bus->lock);
+
+	return value;
+}
@@ -4,6 +4,7 @@
 #include <string.h>
 #include "pilab-string.h"
 #include "pilab-lcd.h"
+#include "pilab-hal.h"
 
 /*
  * Create a new LCD using a 4-bit interface
@@ -20,14 +21,18 @@ struct t_lcd *lcd_4bit_create(int rows, int columns, int rs, int en, int db[4])
 	lcd = malloc(sizeof(*lcd));
 	cursor = malloc(sizeof(*cursor));
 
-	if (!lcd || cursor)
+	if (!lcd || !cursor) {
+		free(lcd);
+		free(cursor);
 		return NULL;
+	}
 
 	fd = lcdInit(rows, columns, 4, rs, en, db[0], db[1], db[2], db[3], 0, 0,
 		     0, 0);
 
 	if (fd == -1) {
 		free(lcd);
+		free(cursor);
 		return NULL;
 	}
 
@@ -60,14 +65,18 @@ struct t_lcd *lcd_8bit_create(int rows, int columns, int rs, int en, int db[8])
 	lcd = malloc(sizeof(*lcd));
 	cursor = malloc(sizeof(*cursor));
 
-	if (!lcd || cursor)
+	if (!lcd || !cursor) {
+		free(lcd);
+		free(cursor);
 		return NULL;
+	}
 
 	fd = lcdInit(rows, columns, 8, rs, en, db[0], db[1], db[2], db[3],
 		     db[4], db[5], db[6], db[7]);
 
 	if (fd == -1) {
 		free(lcd);
+		free(cursor);
 		return NULL;
 	}
 
@@ -101,6 +110,26 @@ void lcd_assign_expander_chip(struct t_lcd *lcd,
 	lcd->expander_chip = expander_chip;
 }
 
+/*
+ * Hold back the pin writes to the expander chip, when it can batch them.
+ */
+
+static void lcd_batch_begin(struct t_lcd *lcd)
+{
+	if (lcd->expander_chip && lcd->expander_chip->batch_begin)
+		(lcd->expander_chip->batch_begin)(lcd->expander_chip->instance);
+}
+
+/*
+ * Write the held back pin writes to the expander chip, at once.
+ */
+
+static void lcd_batch_commit(struct t_lcd *lcd)
+{
+	if (lcd->expander_chip && lcd->expander_chip->batch_commit)
+		(lcd->expander_chip->batch_commit)(lcd->expander_chip->instance);
+}
+
 /*
  * Switch off the backlight using the specified logic level.
  */
@@ -117,8 +146,8 @@ void lcd_backlight(struct t_lcd *lcd, int pin, enum t_backlight_state state)
 		ext_pin = lcd->expander_chip->get_expansion_pin(
 			lcd->expander_chip->instance, pin);
 
-	pinMode(ext_pin, OUTPUT);
-	digitalWrite(ext_pin, state);
+	hal_pin_mode(ext_pin, OUTPUT);
+	hal_digital_write(ext_pin, state);
 }
 
 /*
@@ -170,11 +199,13 @@ void lcd_relative_write(struct t_lcd *lcd, const char *string)
 	ca = lcd->expander_chip->get_expansion_pin(lcd->expander_chip->instance,
 						   0x03);
 
-	pinMode(rw, OUTPUT);
-	pinMode(ca, OUTPUT);
+	hal_pin_mode(rw, OUTPUT);
+	hal_pin_mode(ca, OUTPUT);
 
-	digitalWrite(rw, LOW);
-	digitalWrite(ca, HIGH);
+	lcd_batch_begin(lcd);
+	hal_digital_write(rw, LOW);
+	hal_digital_write(ca, HIGH);
+	lcd_batch_commit(lcd);
 
 	len = strlen(string);
 	ya = ((len + lcd->cursor->x) / lcd->columns);
@@ -217,11 +248,13 @@ void lcd_writeline(struct t_lcd *lcd, int y, const char *string)
 	ca = lcd->expander_chip->get_expansion_pin(lcd->expander_chip->instance,
 						   0x03);
 
-	pinMode(rw, OUTPUT);
-	pinMode(ca, OUTPUT);
+	hal_pin_mode(rw, OUTPUT);
+	hal_pin_mode(ca, OUTPUT);
 
-	digitalWrite(rw, LOW);
-	digitalWrite(ca, HIGH);
+	lcd_batch_begin(lcd);
+	hal_digital_write(rw, LOW);
+	hal_digital_write(ca, HIGH);
+	lcd_batch_commit(lcd);
 
 	len = strlen(string);
 	ya = (int)(len / lcd->columns);
@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <string.h>
+#include "pilab-pin-table.h"
+#include "pilab-log.h"
+
+/*
+ * Conjure up an empty pin table, it grows as ranges are added.
+ *
+ * Returns a pointer to the newly created table, NULL otherwise.
+ */
+
+struct t_pin_table *pin_table_create(void)
+{
+	struct t_pin_table *new_table;
+
+	new_table = malloc(sizeof(*new_table));
+	if (!new_table)
+		return NULL;
+
+	new_table->pins = NULL;
+	new_table->size = 0;
+	new_table->num_ranges = 0;
+
+	return new_table;
+}
+
+/*
+ * Check that the num_pins pins from pin_base on are free, the owner of a
+ * taken pin is logged.
+ *
+ * Returns:
+ * -1: invalid argument, or a range outside of the extension pins.
+ *  0: the range overlaps the range of another device.
+ *  1: the range is free.
+ */
+
+int pin_table_check(struct t_pin_table *table, int pin_base, int num_pins)
+{
+	struct t_slave_device *owner;
+	int pin;
+
+	if (!table || num_pins < 1 || pin_base < PILAB_PIN_TABLE_FIRST_PIN ||
+	    pin_base > PILAB_PIN_TABLE_MAX_PIN - num_pins)
+		return -1;
+
+	for (pin = pin_base; pin < pin_base + num_pins; ++pin) {
+		owner = pin_table_lookup(table, pin);
+		if (owner) {
+			pilab_log(
+				LOG_ERROR,
+				"Pins %d to %d overlap pin %d of %s, pin bases should be at least the pins of a device apart.",
+				pin_base, pin_base + num_pins - 1, pin,
+				owner->get_name(owner->instance));
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Give the num_pins pins from pin_base on to slave.
+ *
+ * Returns:
+ * -1: invalid argument, or a range outside of the extension pins.
+ *  0: the range overlaps, or the table could not grow.
+ *  1: on success.
+ */
+
+int pin_table_add(struct t_pin_table *table, int pin_base, int num_pins,
+		  struct t_slave_device *slave)
+{
+	struct t_slave_device **pins;
+	int rc, size, pin;
+
+	if (!slave)
+		return -1;
+
+	rc = pin_table_check(table, pin_base, num_pins);
+	if (rc < 1)
+		return rc;
+
+	size = pin_base + num_pins - PILAB_PIN_TABLE_FIRST_PIN;
+	if (size > table->size) {
+		pins = realloc(table->pins, size * sizeof(*pins));
+		if (!pins)
+			return 0;
+		memset(pins + table->size, 0,
+		       (size - table->size) * sizeof(*pins));
+		table->pins = pins;
+		table->size = size;
+	}
+
+	for (pin = pin_base; pin < pin_base + num_pins; ++pin)
+		table->pins[pin - PILAB_PIN_TABLE_FIRST_PIN] = slave;
+	table->num_ranges++;
+
+	return 1;
+}
+
+/*
+ * Returns the device the pin belongs to, NULL when no device has it.
+ */
+
+struct t_slave_device *pin_table_lookup(struct t_pin_table *table, int pin)
+{
+	if (!table || pin < PILAB_PIN_TABLE_FIRST_PIN ||
+	    pin - PILAB_PIN_TABLE_FIRST_PIN >= table->size)
+		return NULL;
+
+	return table->pins[pin - PILAB_PIN_TABLE_FIRST_PIN];
+}
+
+/*
+ * Free the pins of slave, e.g. when it is deregistered.
+ */
+
+void pin_table_remove(struct t_pin_table *table, struct t_slave_device *slave)
+{
+	int i, found;
+
+	if (!table || !slave)
+		return;
+
+	found = 0;
+	for (i = 0; i < table->size; ++i) {
+		if (table->pins[i] == slave) {
+			table->pins[i] = NULL;
+			found = 1;
+		}
+	}
+	if (found)
+		table->num_ranges--;
+}
+
+/*
+ * Free the table, the devices are left alone.
+ */
+
+void pin_table_free(struct t_pin_table *table)
+{
+	if (!table)
+		return;
+
+	free(table->pins);
+	free(table);
+}
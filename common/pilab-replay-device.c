@@ -0,0 +1,246 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include "pilab-replay-device.h"
+#include "pilab-log.h"
+
+#define PILAB_REPLAY_DEVICE_NSEC_PER_USEC 1000ULL
+#define PILAB_REPLAY_DEVICE_NSEC_PER_SEC 1000000000ULL
+
+/*
+ * Replay device's concrete read sample implementation.
+ *
+ * Serves the next recorded read, after the recorded latency divided by the
+ * speed. The sample keeps the timestamp it was recorded with.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the recorded read failed, or the trace ran out.
+ *  1: on success.
+ */
+
+int replay_device_read_sample(const void *instance,
+			      struct t_slave_device_sample *sample)
+{
+	struct t_replay_device *device;
+	struct t_trace_read read;
+	struct timespec pause;
+	uint64_t latency;
+
+	if (!instance || !sample)
+		return -1;
+
+	device = (struct t_replay_device *)instance;
+
+	pthread_mutex_lock(&device->lock);
+	if (device->next >= device->trace->num_reads) {
+		device->exhausted++;
+		pthread_mutex_unlock(&device->lock);
+		slave_device_sample_init(sample, PILAB_SLAVE_DEVICE_READ_FAILED,
+					 PILAB_SLAVE_DEVICE_READ_FAILED, 1.0,
+					 device->trace->unit);
+		return 0;
+	}
+	read = device->trace->reads[device->next++];
+	pthread_mutex_unlock(&device->lock);
+
+	latency = read.latency * PILAB_REPLAY_DEVICE_NSEC_PER_USEC /
+		  device->speed;
+	if (latency > 0) {
+		pause.tv_sec = latency / PILAB_REPLAY_DEVICE_NSEC_PER_SEC;
+		pause.tv_nsec = latency % PILAB_REPLAY_DEVICE_NSEC_PER_SEC;
+		while (nanosleep(&pause, &pause) < 0 && errno == EINTR)
+			;
+	}
+
+	sample->value = read.value;
+	sample->unit = device->trace->unit;
+	sample->quality = read.quality;
+	sample->timestamp = read.timestamp;
+	sample->raw = read.raw;
+
+	return (sample->quality == SLAVE_DEVICE_QUALITY_GOOD) ? 1 : 0;
+}
+
+/*
+ * Replay device's concrete analog read implementation.
+ *
+ * Returns the raw value of the next recorded read, otherwise -99999.
+ */
+
+int replay_device_analog_read(const void *instance, int pin)
+{
+	struct t_slave_device_sample sample;
+
+	if (replay_device_read_sample(instance, &sample) < 0)
+		return PILAB_SLAVE_DEVICE_READ_FAILED;
+
+	return sample.raw;
+}
+
+/*
+ * Replay device's concrete analog write implementation.
+ *
+ * NOTE: A replayed device can't be written to, this does nothing.
+ */
+
+void replay_device_analog_write(const void *instance, int pin, int value)
+{
+	/* Silence! */
+	(void)instance;
+	(void)pin;
+	(void)value;
+}
+
+/*
+ * Replay device's concrete get pin base implementation.
+ *
+ * Returns the pin base of the replaced device, -1 otherwise.
+ */
+
+int replay_device_get_pin_base(const void *instance)
+{
+	struct t_replay_device *device;
+
+	if (!instance)
+		return -1;
+
+	device = (struct t_replay_device *)instance;
+
+	return (device->replaced_get_pinbase) ?
+		       (device->replaced_get_pinbase)(device->replaced) :
+		       -1;
+}
+
+/*
+ * Replay device's concrete get expansion pin implementation.
+ *
+ * Returns the expansion pin of the replaced device, -1 otherwise.
+ */
+
+int replay_device_get_expansion_pin(const void *instance, int pin)
+{
+	struct t_replay_device *device;
+
+	if (!instance)
+		return -1;
+
+	device = (struct t_replay_device *)instance;
+
+	return (device->replaced_get_expansion_pin) ?
+		       (device->replaced_get_expansion_pin)(device->replaced,
+							    pin) :
+		       -1;
+}
+
+/*
+ * Replay device's concrete get name implementation.
+ *
+ * Returns the name of the replaced device, NULL otherwise.
+ */
+
+const char *replay_device_get_name(const void *instance)
+{
+	struct t_replay_device *device;
+
+	if (!instance)
+		return NULL;
+
+	device = (struct t_replay_device *)instance;
+
+	return (device->replaced_get_name) ?
+		       (device->replaced_get_name)(device->replaced) :
+		       device->trace->name;
+}
+
+/*
+ * Replay device's concrete free implementation, the replaced device is freed
+ * along with it.
+ */
+
+void replay_device_free_device(const void *instance)
+{
+	struct t_replay_device *device;
+
+	if (!instance)
+		return;
+
+	device = (struct t_replay_device *)instance;
+
+	if (device->exhausted)
+		pilab_log(LOG_INFO,
+			  "Replay of %s ran out of reads %lu times after %d reads",
+			  device->trace->name, device->exhausted,
+			  device->trace->num_reads);
+
+	if (device->replaced_free_device)
+		(device->replaced_free_device)(device->replaced);
+	pthread_mutex_destroy(&device->lock);
+	free(device);
+}
+
+/*
+ * Serve the reads of a registered slave device from the trace, at speed times
+ * the recorded pace. The device keeps its name, options and pins, but isn't
+ * touched anymore. A device that isn't in the trace is left alone.
+ *
+ * NOTE: The trace must outlive the device.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the device is not in the trace, or could not be replayed.
+ *  1: on success.
+ */
+
+int replay_device_attach(struct t_slave_device *slave, struct t_trace *trace,
+			 int speed)
+{
+	struct t_replay_device *new_device;
+	struct t_trace_device *recorded;
+
+	if (!slave || !trace || !slave->get_name)
+		return -1;
+
+	recorded = trace_get_device(trace, slave->get_name(slave->instance));
+	if (!recorded)
+		return 0;
+
+	new_device = calloc(1, sizeof(*new_device));
+	if (!new_device)
+		return 0;
+
+	if (speed < 1)
+		speed = 1;
+	if (speed > PILAB_REPLAY_DEVICE_MAX_SPEED)
+		speed = PILAB_REPLAY_DEVICE_MAX_SPEED;
+
+	new_device->trace = recorded;
+	new_device->next = 0;
+	new_device->speed = speed;
+	new_device->replaced = slave->instance;
+	new_device->replaced_get_name = slave->get_name;
+	new_device->replaced_get_pinbase = slave->get_pinbase;
+	new_device->replaced_get_expansion_pin = slave->get_expansion_pin;
+	new_device->replaced_free_device = slave->free_device;
+	pthread_mutex_init(&new_device->lock, NULL);
+
+	slave->instance = new_device;
+	slave->analog_read = &replay_device_analog_read;
+	slave->analog_write = &replay_device_analog_write;
+	slave->digital_read = &replay_device_analog_read;
+	slave->digital_write = &replay_device_analog_write;
+	slave->read_sample = &replay_device_read_sample;
+	slave->start_sample = NULL;
+	slave->collect_sample = NULL;
+	slave->batch_begin = NULL;
+	slave->batch_commit = NULL;
+	slave->set_pointer = NULL;
+	slave->get_address = NULL;
+	slave->get_pinbase = &replay_device_get_pin_base;
+	slave->get_expansion_pin = &replay_device_get_expansion_pin;
+	slave->get_name = &replay_device_get_name;
+	slave->free_device = &replay_device_free_device;
+
+	return 1;
+}
@@ -0,0 +1,447 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include "pilab-sampler.h"
+#include "pilab-string.h"
+#include "pilab-time.h"
+#include "pilab-log.h"
+
+/*
+ * Main loop of a worker thread.
+ *
+ * Takes jobs from the queue until the sampler is stopped and the queue is
+ * empty, or until the worker is abandoned.
+ */
+
+static void *sampler_worker_main(void *arg)
+{
+	struct t_sampler_worker *worker;
+	struct t_sampler *sampler;
+	struct t_sampler_job job;
+	uint64_t started, finished;
+	int abandoned;
+
+	worker = (struct t_sampler_worker *)arg;
+	sampler = worker->sampler;
+
+	if (sampler->callback_worker_init)
+		worker->worker_data = (sampler->callback_worker_init)(
+			sampler, sampler->callback_data);
+
+	pthread_mutex_lock(&sampler->lock);
+	while (1) {
+		while (sampler->running && sampler->stats.queue_depth == 0)
+			pthread_cond_wait(&sampler->job_available,
+					  &sampler->lock);
+
+		/* stopped and nothing left to do */
+		if (sampler->stats.queue_depth == 0)
+			break;
+
+		job = sampler->queue[sampler->queue_head];
+		sampler->queue_head =
+			(sampler->queue_head + 1) % sampler->queue_size;
+		sampler->stats.queue_depth--;
+		sampler->stats.jobs_active++;
+		worker->job = job;
+		worker->busy = 1;
+		pthread_mutex_unlock(&sampler->lock);
+
+		started = time_monotonic_ns();
+		if (sampler->callback_read_slave)
+			(void)(sampler->callback_read_slave)(
+				sampler, worker->worker_data, job.slave,
+				job.data);
+		finished = time_monotonic_ns();
+
+		pthread_mutex_lock(&sampler->lock);
+		worker->busy = 0;
+		sampler->stats.jobs_completed++;
+		sampler->stats.wait_total_ns += started - job.enqueued_at;
+		sampler->stats.latency_total_ns += finished - started;
+		if (finished - started > sampler->stats.latency_max_ns)
+			sampler->stats.latency_max_ns = finished - started;
+
+		/* a replacement took over, the job stays active until we exit */
+		if (worker->abandoned)
+			break;
+
+		sampler->stats.jobs_active--;
+		if (sampler->stats.jobs_active == 0 &&
+		    sampler->stats.queue_depth == 0)
+			pthread_cond_broadcast(&sampler->idle);
+	}
+	abandoned = worker->abandoned;
+	pthread_mutex_unlock(&sampler->lock);
+
+	if (sampler->callback_worker_free)
+		(void)(sampler->callback_worker_free)(sampler,
+						      worker->worker_data);
+	worker->worker_data = NULL;
+
+	if (abandoned) {
+		pthread_mutex_lock(&sampler->lock);
+		sampler->stats.jobs_active--;
+		sampler->stats.workers_abandoned--;
+		if (sampler->stats.jobs_active == 0 &&
+		    sampler->stats.queue_depth == 0)
+			pthread_cond_broadcast(&sampler->idle);
+		pthread_mutex_unlock(&sampler->lock);
+		/* nobody joins a detached worker, it cleans up after itself */
+		free(worker);
+	}
+
+	return NULL;
+}
+
+/*
+ * Conjure up a worker and start its thread.
+ *
+ * Returns a pointer to the new worker, NULL otherwise.
+ */
+
+static struct t_sampler_worker *sampler_worker_start(struct t_sampler *sampler)
+{
+	struct t_sampler_worker *new_worker;
+
+	new_worker = calloc(1, sizeof(*new_worker));
+	if (!new_worker)
+		return NULL;
+
+	new_worker->sampler = sampler;
+	new_worker->worker_data = NULL;
+	new_worker->busy = 0;
+	new_worker->abandoned = 0;
+
+	if (pthread_create(&new_worker->thread, NULL, &sampler_worker_main,
+			   new_worker)) {
+		free(new_worker);
+		return NULL;
+	}
+
+	return new_worker;
+}
+
+/*
+ * Conjure up a new sampler, a fixed-size pool of threads reading slave devices.
+ *
+ * Pass 0 (or less) to use the defaults for the amount of workers and the size
+ * of the queue.
+ *
+ * NOTE: The workers are not started until sampler_start is called.
+ *
+ * Returns a pointer to the newly created sampler, NULL otherwise.
+ */
+
+struct t_sampler *sampler_create(int num_workers, int queue_size)
+{
+	struct t_sampler *new_sampler;
+	pthread_condattr_t idle_attr;
+
+	if (num_workers < 1)
+		num_workers = PILAB_SAMPLER_DEFAULT_WORKERS;
+	if (queue_size < 1)
+		queue_size = PILAB_SAMPLER_DEFAULT_QUEUE_SIZE;
+
+	new_sampler = calloc(1, sizeof(*new_sampler));
+	if (!new_sampler)
+		return NULL;
+
+	new_sampler->workers =
+		calloc(num_workers, sizeof(*new_sampler->workers));
+	if (!new_sampler->workers) {
+		free(new_sampler);
+		return NULL;
+	}
+
+	new_sampler->queue = calloc(queue_size, sizeof(*new_sampler->queue));
+	if (!new_sampler->queue) {
+		free(new_sampler->workers);
+		free(new_sampler);
+		return NULL;
+	}
+
+	pthread_mutex_init(&new_sampler->lock, NULL);
+	pthread_cond_init(&new_sampler->job_available, NULL);
+	/* drain deadlines are measured on the monotonic clock */
+	pthread_condattr_init(&idle_attr);
+	pthread_condattr_setclock(&idle_attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&new_sampler->idle, &idle_attr);
+	pthread_condattr_destroy(&idle_attr);
+
+	new_sampler->num_workers = num_workers;
+	new_sampler->queue_size = queue_size;
+	new_sampler->queue_head = 0;
+	new_sampler->running = 0;
+	new_sampler->callback_data = NULL;
+	new_sampler->callback_read_slave = NULL;
+	new_sampler->callback_worker_init = NULL;
+	new_sampler->callback_worker_free = NULL;
+
+	return new_sampler;
+}
+
+/*
+ * Set sampler property (pointer)
+ *
+ * NOTE: Currently the properties that are allowed to be set:
+ * - callback_data
+ * - callback_read_slave
+ * - callback_worker_init
+ * - callback_worker_free
+ */
+
+void sampler_set_pointer(struct t_sampler *sampler, const char *property,
+			 void *pointer)
+{
+	if (!sampler || !property)
+		return;
+
+	if (string_strcmp(property, "callback_data") == 0)
+		sampler->callback_data = pointer;
+	else if (string_strcmp(property, "callback_read_slave") == 0)
+		sampler->callback_read_slave = pointer;
+	else if (string_strcmp(property, "callback_worker_init") == 0)
+		sampler->callback_worker_init = pointer;
+	else if (string_strcmp(property, "callback_worker_free") == 0)
+		sampler->callback_worker_free = pointer;
+}
+
+/*
+ * Start the worker threads of the sampler.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: not all workers could be started.
+ *  1: on success.
+ */
+
+int sampler_start(struct t_sampler *sampler)
+{
+	int i;
+
+	if (!sampler)
+		return -1;
+
+	sampler->running = 1;
+
+	for (i = 0; i < sampler->num_workers; ++i) {
+		sampler->workers[i] = sampler_worker_start(sampler);
+		if (!sampler->workers[i]) {
+			pilab_log(LOG_ERROR,
+				  "Failed to create sampler worker %d", i);
+			/* only join what was started */
+			sampler->num_workers = i;
+			sampler_stop(sampler);
+			return 0;
+		}
+	}
+
+	pilab_log(LOG_DEBUG, "Started sampler with %d workers",
+		  sampler->num_workers);
+
+	return 1;
+}
+
+/*
+ * Queue a read of a slave device.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the sampler is stopped or the queue is full.
+ *  1: the job was queued.
+ */
+
+int sampler_submit(struct t_sampler *sampler, struct t_slave_device *slave,
+		   void *data)
+{
+	struct t_sampler_job *job;
+	int rc;
+
+	if (!sampler || !slave)
+		return -1;
+
+	rc = 0;
+	pthread_mutex_lock(&sampler->lock);
+	if (!sampler->running ||
+	    sampler->stats.queue_depth >= sampler->queue_size) {
+		sampler->stats.jobs_dropped++;
+	} else {
+		job = &sampler->queue[(sampler->queue_head +
+				       sampler->stats.queue_depth) %
+				      sampler->queue_size];
+		job->slave = slave;
+		job->data = data;
+		job->enqueued_at = time_monotonic_ns();
+
+		sampler->stats.queue_depth++;
+		sampler->stats.jobs_submitted++;
+		if (sampler->stats.queue_depth > sampler->stats.queue_depth_max)
+			sampler->stats.queue_depth_max =
+				sampler->stats.queue_depth;
+
+		pthread_cond_signal(&sampler->job_available);
+		rc = 1;
+	}
+	pthread_mutex_unlock(&sampler->lock);
+
+	return rc;
+}
+
+/*
+ * Take a consistent snapshot of the sampler's statistics.
+ */
+
+void sampler_get_stats(struct t_sampler *sampler,
+		       struct t_sampler_stats *stats)
+{
+	if (!sampler || !stats)
+		return;
+
+	pthread_mutex_lock(&sampler->lock);
+	*stats = sampler->stats;
+	pthread_mutex_unlock(&sampler->lock);
+}
+
+/*
+ * Replace the worker that is stuck reading slave by a fresh worker, so the
+ * pool keeps its capacity.
+ *
+ * The stuck worker is detached, and exits as soon as its read returns. At most
+ * num_workers workers can be abandoned at once, so a bus that hangs every read
+ * can't pile up threads.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: no worker is reading slave, or it could not be replaced.
+ *  1: on success.
+ */
+
+int sampler_replace_worker(struct t_sampler *sampler,
+			   struct t_slave_device *slave)
+{
+	struct t_sampler_worker *new_worker;
+	int i, rc;
+
+	if (!sampler || !slave)
+		return -1;
+
+	rc = 0;
+	pthread_mutex_lock(&sampler->lock);
+	if (!sampler->running ||
+	    sampler->stats.workers_abandoned >= sampler->num_workers)
+		goto end;
+
+	for (i = 0; i < sampler->num_workers; ++i) {
+		if (!sampler->workers[i] || !sampler->workers[i]->busy ||
+		    sampler->workers[i]->job.slave != slave)
+			continue;
+
+		/* the new worker waits for the lock we hold */
+		new_worker = sampler_worker_start(sampler);
+		if (!new_worker)
+			break;
+
+		pthread_detach(sampler->workers[i]->thread);
+		sampler->workers[i]->abandoned = 1;
+		sampler->workers[i] = new_worker;
+		sampler->stats.workers_abandoned++;
+		sampler->stats.workers_replaced++;
+		rc = 1;
+		break;
+	}
+
+end:
+	pthread_mutex_unlock(&sampler->lock);
+
+	return rc;
+}
+
+/*
+ * Stop accepting jobs and wait at most timeout seconds for the queued and
+ * running jobs to finish.
+ *
+ * When the timeout expires, the jobs that are still queued are cancelled.
+ * Jobs that are already running can't be interrupted, so their workers can't
+ * be joined either.
+ *
+ * Returns the amount of jobs still running (0 when the sampler is idle and
+ * safe to free), -1 on invalid argument.
+ */
+
+int sampler_drain(struct t_sampler *sampler, int timeout)
+{
+	struct timespec deadline;
+	int active;
+
+	if (!sampler)
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += (timeout > 0) ? timeout : 0;
+
+	pthread_mutex_lock(&sampler->lock);
+	sampler->running = 0;
+	pthread_cond_broadcast(&sampler->job_available);
+
+	while (sampler->stats.queue_depth + sampler->stats.jobs_active > 0) {
+		if (pthread_cond_timedwait(&sampler->idle, &sampler->lock,
+					   &deadline) == ETIMEDOUT)
+			break;
+	}
+
+	/* out of time, nothing new gets started */
+	sampler->stats.jobs_cancelled += sampler->stats.queue_depth;
+	sampler->stats.queue_depth = 0;
+	active = sampler->stats.jobs_active;
+	pthread_mutex_unlock(&sampler->lock);
+
+	return active;
+}
+
+/*
+ * Stop the sampler, the jobs already queued are still executed before the
+ * workers are joined.
+ */
+
+void sampler_stop(struct t_sampler *sampler)
+{
+	int i;
+
+	if (!sampler)
+		return;
+
+	pthread_mutex_lock(&sampler->lock);
+	sampler->running = 0;
+	pthread_cond_broadcast(&sampler->job_available);
+	pthread_mutex_unlock(&sampler->lock);
+
+	for (i = 0; i < sampler->num_workers; ++i) {
+		if (!sampler->workers[i])
+			continue;
+		pthread_join(sampler->workers[i]->thread, NULL);
+		free(sampler->workers[i]);
+		sampler->workers[i] = NULL;
+	}
+}
+
+/*
+ * Free the sampler, stopping it first if it is still running.
+ */
+
+void sampler_free(struct t_sampler *sampler)
+{
+	if (!sampler)
+		return;
+
+	sampler_stop(sampler);
+
+	pthread_cond_destroy(&sampler->job_available);
+	pthread_cond_destroy(&sampler->idle);
+	pthread_mutex_destroy(&sampler->lock);
+
+	free(sampler->queue);
+	free(sampler->workers);
+	free(sampler);
+}
@@ -0,0 +1,516 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "pilab-scheduler.h"
+#include "pilab-hashtable.h"
+#include "pilab-time.h"
+#include "pilab-log.h"
+
+/*
+ * Convert monotonic nanoseconds to a timespec.
+ */
+
+static void scheduler_ns_to_timespec(uint64_t ns, struct timespec *ts)
+{
+	ts->tv_sec = (time_t)(ns / PILAB_SCHEDULER_NSEC_PER_SEC);
+	ts->tv_nsec = (long)(ns % PILAB_SCHEDULER_NSEC_PER_SEC);
+}
+
+/*
+ * Swap two entries in the heap, keeping their positions up to date.
+ */
+
+static void scheduler_swap(struct t_scheduler *scheduler, int i, int j)
+{
+	struct t_scheduler_entry *tmp;
+
+	tmp = scheduler->heap[i];
+	scheduler->heap[i] = scheduler->heap[j];
+	scheduler->heap[j] = tmp;
+
+	scheduler->heap[i]->index = i;
+	scheduler->heap[j]->index = j;
+}
+
+/*
+ * Move an entry up, until its parent is due before it.
+ */
+
+static void scheduler_sift_up(struct t_scheduler *scheduler, int i)
+{
+	int parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (scheduler->heap[parent]->deadline <=
+		    scheduler->heap[i]->deadline)
+			break;
+		scheduler_swap(scheduler, i, parent);
+		i = parent;
+	}
+}
+
+/*
+ * Move an entry down, until both children are due after it.
+ */
+
+static void scheduler_sift_down(struct t_scheduler *scheduler, int i)
+{
+	int left, right, smallest;
+
+	while (1) {
+		left = 2 * i + 1;
+		right = left + 1;
+		smallest = i;
+
+		if (left < scheduler->size &&
+		    scheduler->heap[left]->deadline <
+			    scheduler->heap[smallest]->deadline)
+			smallest = left;
+		if (right < scheduler->size &&
+		    scheduler->heap[right]->deadline <
+			    scheduler->heap[smallest]->deadline)
+			smallest = right;
+
+		if (smallest == i)
+			break;
+
+		scheduler_swap(scheduler, i, smallest);
+		i = smallest;
+	}
+}
+
+/*
+ * Mix the bits of x (splitmix64).
+ */
+
+static uint64_t scheduler_mix(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+
+	return x ^ (x >> 31);
+}
+
+/*
+ * Draw a random jitter for an entry, bounded by the jitter percentage of its
+ * interval. The entries of a group draw once per period: their jitter only
+ * depends on the group and the nominal deadline, which they share.
+ *
+ * Returns the jitter in ns.
+ */
+
+static uint64_t scheduler_draw_jitter(struct t_scheduler *scheduler,
+				      struct t_scheduler_entry *entry)
+{
+	uint64_t bound, random;
+
+	if (scheduler->jitter < 1)
+		return 0;
+
+	bound = entry->interval / 100 * scheduler->jitter;
+	if (bound == 0)
+		return 0;
+
+	if (entry->group > 0)
+		return scheduler_mix(scheduler->identity ^ entry->nominal ^
+				     ((uint64_t)entry->group << 48)) %
+		       bound;
+
+	/* rand_r only gives 31 bits, an interval in ns needs more */
+	random = (uint64_t)rand_r(&scheduler->seed) << 31;
+	random |= (uint64_t)rand_r(&scheduler->seed);
+
+	return random % bound;
+}
+
+/*
+ * Returns an interval (in seconds) in ns, at the speed of the scheduler.
+ */
+
+static uint64_t scheduler_interval_ns(struct t_scheduler *scheduler,
+				      int interval)
+{
+	if (interval < 1)
+		interval = PILAB_SCHEDULER_DEFAULT_INTERVAL;
+
+	return interval * PILAB_SCHEDULER_NSEC_PER_SEC / scheduler->speed;
+}
+
+/*
+ * Restore the heap property for an entry of which the deadline has changed.
+ */
+
+static void scheduler_fix(struct t_scheduler *scheduler, int i)
+{
+	if (i > 0 && scheduler->heap[(i - 1) / 2]->deadline >
+			     scheduler->heap[i]->deadline)
+		scheduler_sift_up(scheduler, i);
+	else
+		scheduler_sift_down(scheduler, i);
+}
+
+/*
+ * Conjure up a new scheduler, with room for capacity entries (the heap grows
+ * when needed).
+ *
+ * Returns a pointer to the newly created scheduler, NULL otherwise.
+ */
+
+struct t_scheduler *scheduler_create(int capacity)
+{
+	struct t_scheduler *new_scheduler;
+
+	if (capacity < 1)
+		capacity = 16;
+
+	new_scheduler = malloc(sizeof(*new_scheduler));
+	if (!new_scheduler)
+		return NULL;
+
+	new_scheduler->heap = malloc(capacity * sizeof(*new_scheduler->heap));
+	if (!new_scheduler->heap) {
+		free(new_scheduler);
+		return NULL;
+	}
+
+	pthread_mutex_init(&new_scheduler->lock, NULL);
+
+	new_scheduler->timer_fd =
+		timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (new_scheduler->timer_fd < 0)
+		pilab_log(LOG_DEBUG,
+			  "Could not create a timerfd for the scheduler.");
+
+	new_scheduler->size = 0;
+	new_scheduler->capacity = capacity;
+	new_scheduler->identity = 0;
+	new_scheduler->seed = 0;
+	new_scheduler->jitter = 0;
+	new_scheduler->groups = 0;
+	new_scheduler->speed = 1;
+
+	return new_scheduler;
+}
+
+/*
+ * Schedule a device to be sampled every interval seconds, the first sample is
+ * due immediately.
+ *
+ * NOTE: An interval < 1 falls back to PILAB_SCHEDULER_DEFAULT_INTERVAL.
+ *
+ * Returns a pointer to the new entry, NULL otherwise.
+ */
+
+struct t_scheduler_entry *scheduler_add(struct t_scheduler *scheduler,
+					struct t_slave_device *slave,
+					int interval, void *data)
+{
+	struct t_scheduler_entry *new_entry;
+	struct t_scheduler_entry **new_heap;
+
+	if (!scheduler || !slave)
+		return NULL;
+
+	new_entry = malloc(sizeof(*new_entry));
+	if (!new_entry)
+		return NULL;
+
+	pthread_mutex_lock(&scheduler->lock);
+	if (scheduler->size == scheduler->capacity) {
+		new_heap = realloc(scheduler->heap,
+				   2 * scheduler->capacity *
+					   sizeof(*scheduler->heap));
+		if (!new_heap) {
+			pthread_mutex_unlock(&scheduler->lock);
+			free(new_entry);
+			return NULL;
+		}
+		scheduler->heap = new_heap;
+		scheduler->capacity *= 2;
+	}
+
+	new_entry->slave = slave;
+	new_entry->data = data;
+	new_entry->interval = scheduler_interval_ns(scheduler, interval);
+	new_entry->deadline = time_monotonic_ns();
+	new_entry->nominal = new_entry->deadline;
+	new_entry->missed = 0;
+	new_entry->group = 0;
+	new_entry->index = scheduler->size;
+
+	scheduler->heap[scheduler->size++] = new_entry;
+	scheduler_sift_up(scheduler, new_entry->index);
+	pthread_mutex_unlock(&scheduler->lock);
+
+	return new_entry;
+}
+
+/*
+ * Let an entry be due together with leader, from now on: it takes over the
+ * deadline of the leader and joins its group, so the jitter doesn't pull
+ * them apart again. Entries of a group should share their interval.
+ */
+
+void scheduler_group(struct t_scheduler *scheduler,
+		     struct t_scheduler_entry *entry,
+		     struct t_scheduler_entry *leader)
+{
+	if (!scheduler || !entry || !leader || entry == leader)
+		return;
+
+	pthread_mutex_lock(&scheduler->lock);
+	if (leader->group == 0)
+		leader->group = ++scheduler->groups;
+	entry->group = leader->group;
+	entry->nominal = leader->nominal;
+	entry->deadline = leader->deadline;
+	scheduler_fix(scheduler, entry->index);
+	pthread_mutex_unlock(&scheduler->lock);
+}
+
+/*
+ * Change the sampling interval (in seconds) of an entry.
+ *
+ * The next deadline is moved so it lies one new interval after the previous
+ * sample, the entry is repositioned in O(log n).
+ *
+ * NOTE: This is safe to call from any thread, re-arm the timer afterwards.
+ */
+
+void scheduler_set_interval(struct t_scheduler *scheduler,
+			    struct t_scheduler_entry *entry, int interval)
+{
+	uint64_t new_interval;
+
+	if (!scheduler || !entry)
+		return;
+
+	new_interval = scheduler_interval_ns(scheduler, interval);
+
+	pthread_mutex_lock(&scheduler->lock);
+	if (new_interval != entry->interval) {
+		/* keep the jitter that was already drawn for this deadline */
+		entry->deadline =
+			entry->deadline - entry->interval + new_interval;
+		entry->nominal = entry->nominal - entry->interval + new_interval;
+		entry->interval = new_interval;
+		scheduler_fix(scheduler, entry->index);
+	}
+	pthread_mutex_unlock(&scheduler->lock);
+}
+
+/*
+ * Set the identity of this device (e.g. the mac address or classroom).
+ *
+ * The identity is hashed into a deterministic offset, so devices in a fleet
+ * that start at the same moment don't sample (and upload) in the same second.
+ * It also seeds the random generator used for the jitter.
+ */
+
+void scheduler_set_identity(struct t_scheduler *scheduler, const char *identity)
+{
+	if (!scheduler || !identity)
+		return;
+
+	scheduler->identity = hashtable_hash_key_djb2(identity);
+	scheduler->seed = (unsigned int)(scheduler->identity ^
+					 (scheduler->identity >> 32));
+}
+
+/*
+ * Set the maximum jitter added to every deadline, as a percentage of the
+ * interval (0 disables the jitter).
+ */
+
+void scheduler_set_jitter(struct t_scheduler *scheduler, int jitter)
+{
+	if (!scheduler)
+		return;
+
+	if (jitter < 0)
+		jitter = 0;
+	if (jitter > PILAB_SCHEDULER_MAX_JITTER)
+		jitter = PILAB_SCHEDULER_MAX_JITTER;
+
+	scheduler->jitter = jitter;
+}
+
+/*
+ * Run the intervals speed times faster than real time, e.g. to replay a trace
+ * of a day in minutes.
+ *
+ * NOTE: Set the speed before adding any entry.
+ */
+
+void scheduler_set_speed(struct t_scheduler *scheduler, int speed)
+{
+	if (!scheduler)
+		return;
+
+	scheduler->speed = (speed < 1) ? 1 : speed;
+}
+
+/*
+ * Spread the first deadlines of all entries evenly over their interval,
+ * starting from start (absolute monotonic time in ns).
+ *
+ * Entry k of n gets phase k / n of its interval, shifted by the offset derived
+ * from the identity of the device, so neither the sensors of one device nor
+ * the devices of a fleet fire at the same instant.
+ */
+
+void scheduler_spread(struct t_scheduler *scheduler, uint64_t start)
+{
+	struct t_scheduler_entry *entry;
+	uint64_t offset;
+	int i;
+
+	if (!scheduler || scheduler->size < 1)
+		return;
+
+	pthread_mutex_lock(&scheduler->lock);
+	for (i = 0; i < scheduler->size; ++i) {
+		entry = scheduler->heap[i];
+		offset = scheduler->identity % entry->interval;
+		offset += entry->interval / scheduler->size * i;
+		entry->nominal = start + offset % entry->interval;
+		entry->deadline =
+			entry->nominal + scheduler_draw_jitter(scheduler, entry);
+	}
+
+	/* every deadline changed, rebuild the heap */
+	for (i = scheduler->size / 2 - 1; i >= 0; --i)
+		scheduler_sift_down(scheduler, i);
+	pthread_mutex_unlock(&scheduler->lock);
+}
+
+/*
+ * Take the next entry that is due at the given time.
+ *
+ * The entry is rescheduled relative to its previous (nominal) deadline,
+ * instead of relative to now, so the sampling period doesn't drift. When the
+ * scheduler fell behind by more than a period, the missed periods are skipped.
+ *
+ * Returns the entry that is due, NULL if nothing is due.
+ */
+
+struct t_scheduler_entry *scheduler_pop_due(struct t_scheduler *scheduler,
+					    uint64_t now)
+{
+	struct t_scheduler_entry *entry;
+	uint64_t behind;
+
+	if (!scheduler)
+		return NULL;
+
+	pthread_mutex_lock(&scheduler->lock);
+	if (scheduler->size < 1 || scheduler->heap[0]->deadline > now) {
+		pthread_mutex_unlock(&scheduler->lock);
+		return NULL;
+	}
+
+	entry = scheduler->heap[0];
+
+	entry->nominal += entry->interval;
+	if (entry->nominal <= now) {
+		behind = (now - entry->nominal) / entry->interval + 1;
+		entry->nominal += behind * entry->interval;
+		entry->missed += behind;
+	}
+	entry->deadline =
+		entry->nominal + scheduler_draw_jitter(scheduler, entry);
+
+	scheduler_sift_down(scheduler, 0);
+	pthread_mutex_unlock(&scheduler->lock);
+
+	return entry;
+}
+
+/*
+ * Arm the timerfd of the scheduler at the earliest deadline, or disarm it when
+ * nothing is scheduled.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the timer could not be armed.
+ *  1: on success.
+ */
+
+int scheduler_arm_timer(struct t_scheduler *scheduler)
+{
+	struct itimerspec spec = { 0 };
+	int rc;
+
+	if (!scheduler || scheduler->timer_fd < 0)
+		return -1;
+
+	/*
+	 * Hold the lock while arming, so a thread with an older view of the
+	 * heap can't overwrite an earlier deadline.
+	 */
+	pthread_mutex_lock(&scheduler->lock);
+	if (scheduler->size > 0)
+		scheduler_ns_to_timespec(scheduler->heap[0]->deadline,
+					 &spec.it_value);
+	rc = timerfd_settime(scheduler->timer_fd, TFD_TIMER_ABSTIME, &spec,
+			     NULL);
+	pthread_mutex_unlock(&scheduler->lock);
+
+	if (rc < 0) {
+		pilab_log(LOG_DEBUG, "Could not arm the scheduler timer: %d",
+			  errno);
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Disarm the timerfd of the scheduler, no deadline will fire until it is
+ * armed again.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the timer could not be disarmed.
+ *  1: on success.
+ */
+
+int scheduler_disarm_timer(struct t_scheduler *scheduler)
+{
+	struct itimerspec spec = { 0 };
+
+	if (!scheduler || scheduler->timer_fd < 0)
+		return -1;
+
+	if (timerfd_settime(scheduler->timer_fd, 0, &spec, NULL) < 0)
+		return 0;
+
+	return 1;
+}
+
+/*
+ * Free the scheduler and all its entries.
+ */
+
+void scheduler_free(struct t_scheduler *scheduler)
+{
+	int i;
+
+	if (!scheduler)
+		return;
+
+	for (i = 0; i < scheduler->size; ++i)
+		free(scheduler->heap[i]);
+
+	if (scheduler->timer_fd >= 0)
+		close(scheduler->timer_fd);
+
+	pthread_mutex_destroy(&scheduler->lock);
+	free(scheduler->heap);
+	free(scheduler);
+}
@@ -1,3 +1,189 @@
-#include "pilab-api-client.h"
+#include <stdlib.h>
+#include <string.h>
+#include "pilab-slave-device.h"
+#include "pilab-string.h"
+#include "pilab-log.h"
+#include "pilab-time.h"
 
-/* intentionally left blank */
+/*
+ * Free the keys and values of the options table.
+ */
+
+static void slave_device_free_option_cb(struct t_hashtable *hashtable,
+					const void *key, void *value)
+{
+	free(value);
+}
+
+static void slave_device_free_option_key_cb(struct t_hashtable *hashtable,
+					    void *key)
+{
+	free(key);
+}
+
+/*
+ * Fill in a sample from a raw value, for the read_sample implementations.
+ *
+ * The sample is marked bad when the raw value is PILAB_SLAVE_DEVICE_READ_FAILED
+ * or failed_raw, the failure value of the device.
+ */
+
+void slave_device_sample_init(struct t_slave_device_sample *sample, int raw,
+			      int failed_raw, double scale, const char *unit)
+{
+	if (!sample)
+		return;
+
+	sample->raw = raw;
+	sample->value = raw * scale;
+	sample->unit = (unit) ? unit : "";
+	sample->timestamp = time_realtime_ns();
+	sample->quality = (raw == PILAB_SLAVE_DEVICE_READ_FAILED ||
+			   raw == failed_raw) ?
+				  SLAVE_DEVICE_QUALITY_BAD :
+				  SLAVE_DEVICE_QUALITY_GOOD;
+}
+
+/*
+ * Set an option of a slave device, replacing any previous value.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the option could not be stored.
+ *  1: on success.
+ */
+
+int slave_device_set_option(struct t_slave_device *slave, const char *key,
+			    const char *value)
+{
+	if (!slave || !key || !value)
+		return -1;
+
+	if (!slave->options) {
+		slave->options = hashtable_create(
+			PILAB_SLAVE_DEVICE_OPTIONS_SIZE, PILAB_HASHTABLE_STRING,
+			PILAB_HASHTABLE_STRING, NULL, NULL);
+		if (!slave->options)
+			return 0;
+		hashtable_set_pointer(slave->options, "callback_free_value",
+				      &slave_device_free_option_cb);
+		hashtable_set_pointer(slave->options, "callback_free_key",
+				      &slave_device_free_option_key_cb);
+	}
+
+	return (hashtable_set(slave->options, key, value)) ? 1 : 0;
+}
+
+/*
+ * Set an option of a slave device from a "key=value" string.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the string is not a key=value pair.
+ *  1: on success.
+ */
+
+int slave_device_parse_option(struct t_slave_device *slave, const char *option)
+{
+	const char *separator;
+	char *key;
+	size_t length;
+	int rc;
+
+	if (!slave || !option)
+		return -1;
+
+	separator = strchr(option, '=');
+	if (!separator || separator == option || !separator[1])
+		return 0;
+
+	length = separator - option;
+	key = malloc(length + 1);
+	if (!key)
+		return 0;
+	memcpy(key, option, length);
+	key[length] = '\0';
+
+	rc = slave_device_set_option(slave, key, separator + 1);
+	free(key);
+
+	return rc;
+}
+
+/*
+ * Returns the value of an option, NULL when it is not set.
+ */
+
+const char *slave_device_get_option(struct t_slave_device *slave,
+				    const char *key)
+{
+	if (!slave || !key || !slave->options)
+		return NULL;
+
+	return (const char *)hashtable_get(slave->options, key);
+}
+
+/*
+ * Returns the value of an option as an integer, default_value when it is not
+ * set or not a number.
+ */
+
+int slave_device_get_option_int(struct t_slave_device *slave, const char *key,
+				int default_value)
+{
+	const char *value;
+	char *end;
+	long number;
+
+	value = slave_device_get_option(slave, key);
+	if (!value)
+		return default_value;
+
+	number = strtol(value, &end, 10);
+	if (*end != '\0') {
+		pilab_log(LOG_ERROR, "Option %s=%s is not a whole number.", key,
+			  value);
+		return default_value;
+	}
+
+	return (int)number;
+}
+
+/*
+ * Returns the value of an option as a double, default_value when it is not
+ * set or not a number.
+ */
+
+double slave_device_get_option_double(struct t_slave_device *slave,
+				      const char *key, double default_value)
+{
+	const char *value;
+	char *end;
+	double number;
+
+	value = slave_device_get_option(slave, key);
+	if (!value)
+		return default_value;
+
+	number = strtod(value, &end);
+	if (*end != '\0') {
+		pilab_log(LOG_ERROR, "Option %s=%s is not a number.", key,
+			  value);
+		return default_value;
+	}
+
+	return number;
+}
+
+/*
+ * Free the options of a slave device.
+ */
+
+void slave_device_free_options(struct t_slave_device *slave)
+{
+	if (!slave || !slave->options)
+		return;
+
+	hashtable_free(slave->options);
+	slave->options = NULL;
+}
@@ -0,0 +1,670 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "pilab-spool.h"
+#include "pilab-string.h"
+#include "pilab-log.h"
+
+#define PILAB_SPOOL_NSEC_PER_MSEC 1000000ULL
+#define PILAB_SPOOL_SEGMENT_SIZE                                             \
+	((uint32_t)PILAB_SPOOL_RECORD_SIZE * PILAB_SPOOL_SEGMENT_RECORDS)
+#define PILAB_SPOOL_PATH_SIZE 512
+/* Offsets of the record fields */
+#define PILAB_SPOOL_TYPE_OFFSET PILAB_BATCH_MAX_NAME
+#define PILAB_SPOOL_TIMESTAMP_OFFSET                                         \
+	(PILAB_SPOOL_TYPE_OFFSET + PILAB_BATCH_MAX_TYPE)
+#define PILAB_SPOOL_VALUE_OFFSET (PILAB_SPOOL_TIMESTAMP_OFFSET + 8)
+#define PILAB_SPOOL_CHECKSUM_OFFSET (PILAB_SPOOL_VALUE_OFFSET + 8)
+
+/*
+ * Little endian encoding of the record fields.
+ */
+
+static void spool_put_u32(uint8_t *buffer, uint32_t value)
+{
+	int i;
+
+	for (i = 0; i < 4; ++i)
+		buffer[i] = (uint8_t)(value >> (8 * i));
+}
+
+static void spool_put_u64(uint8_t *buffer, uint64_t value)
+{
+	int i;
+
+	for (i = 0; i < 8; ++i)
+		buffer[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint32_t spool_get_u32(const uint8_t *buffer)
+{
+	uint32_t value;
+	int i;
+
+	value = 0;
+	for (i = 3; i >= 0; --i)
+		value = (value << 8) | buffer[i];
+
+	return value;
+}
+
+static uint64_t spool_get_u64(const uint8_t *buffer)
+{
+	uint64_t value;
+	int i;
+
+	value = 0;
+	for (i = 7; i >= 0; --i)
+		value = (value << 8) | buffer[i];
+
+	return value;
+}
+
+/*
+ * FNV-1a over the fields of a record, a torn or damaged record doesn't match
+ * its checksum.
+ */
+
+static uint32_t spool_checksum(const uint8_t *record)
+{
+	uint32_t hash;
+	int i;
+
+	hash = 2166136261u;
+	for (i = 0; i < PILAB_SPOOL_CHECKSUM_OFFSET; ++i) {
+		hash ^= record[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static void spool_encode(uint8_t *record, const char *name, const char *type,
+			 uint64_t timestamp, double value)
+{
+	uint64_t bits;
+
+	memset(record, 0, PILAB_SPOOL_RECORD_SIZE);
+	strncpy((char *)record, name, PILAB_BATCH_MAX_NAME - 1);
+	strncpy((char *)record + PILAB_SPOOL_TYPE_OFFSET,
+		(type) ? type : PILAB_BATCH_DEFAULT_TYPE,
+		PILAB_BATCH_MAX_TYPE - 1);
+	spool_put_u64(record + PILAB_SPOOL_TIMESTAMP_OFFSET, timestamp);
+	memcpy(&bits, &value, sizeof(bits));
+	spool_put_u64(record + PILAB_SPOOL_VALUE_OFFSET, bits);
+	spool_put_u32(record + PILAB_SPOOL_CHECKSUM_OFFSET,
+		      spool_checksum(record));
+}
+
+/*
+ * Returns 1 when the record is intact and decoded into item, 0 otherwise.
+ */
+
+static int spool_decode(const uint8_t *record, struct t_batch_item *item)
+{
+	uint64_t bits;
+
+	if (spool_get_u32(record + PILAB_SPOOL_CHECKSUM_OFFSET) !=
+	    spool_checksum(record))
+		return 0;
+
+	memcpy(item->name, record, PILAB_BATCH_MAX_NAME);
+	item->name[PILAB_BATCH_MAX_NAME - 1] = '\0';
+	memcpy(item->type, record + PILAB_SPOOL_TYPE_OFFSET,
+	       PILAB_BATCH_MAX_TYPE);
+	item->type[PILAB_BATCH_MAX_TYPE - 1] = '\0';
+	item->timestamp = spool_get_u64(record + PILAB_SPOOL_TIMESTAMP_OFFSET);
+	bits = spool_get_u64(record + PILAB_SPOOL_VALUE_OFFSET);
+	memcpy(&item->value, &bits, sizeof(bits));
+
+	return 1;
+}
+
+static void spool_segment_path(struct t_spool *spool, uint32_t segment,
+			       char *path, size_t size)
+{
+	snprintf(path, size, "%s/%08u" PILAB_SPOOL_SEGMENT_SUFFIX, spool->dir,
+		 segment);
+}
+
+static int spool_open_segment(struct t_spool *spool, uint32_t segment,
+			      int flags)
+{
+	char path[PILAB_SPOOL_PATH_SIZE];
+
+	spool_segment_path(spool, segment, path, sizeof(path));
+
+	return open(path, flags | O_CLOEXEC, 0600);
+}
+
+static void spool_remove_segment(struct t_spool *spool, uint32_t segment)
+{
+	char path[PILAB_SPOOL_PATH_SIZE];
+
+	spool_segment_path(spool, segment, path, sizeof(path));
+	if (unlink(path) < 0 && errno != ENOENT)
+		pilab_log(LOG_ERROR, "Could not remove %s: %d", path, errno);
+}
+
+/*
+ * Write the cursor to a new file and rename it over the old one, so a crash
+ * leaves either of them.
+ *
+ * Returns 1 on success, 0 otherwise.
+ */
+
+static int spool_write_cursor(struct t_spool *spool)
+{
+	char path[PILAB_SPOOL_PATH_SIZE], temp[PILAB_SPOOL_PATH_SIZE];
+	char line[32];
+	int fd, length, rc;
+
+	snprintf(path, sizeof(path), "%s/" PILAB_SPOOL_CURSOR, spool->dir);
+	snprintf(temp, sizeof(temp), "%s/" PILAB_SPOOL_CURSOR ".new",
+		 spool->dir);
+	length = snprintf(line, sizeof(line), "%u %u\n", spool->read_segment,
+			  spool->read_offset);
+
+	fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return 0;
+
+	rc = (write(fd, line, length) == length && fdatasync(fd) == 0);
+	close(fd);
+
+	if (!rc || rename(temp, path) < 0) {
+		pilab_log(LOG_ERROR, "Could not write the cursor of %s",
+			  spool->dir);
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Read the cursor, it is left at the oldest segment when there is no valid
+ * one.
+ */
+
+static void spool_read_cursor(struct t_spool *spool)
+{
+	char path[PILAB_SPOOL_PATH_SIZE];
+	unsigned int segment, offset;
+	FILE *file;
+	int rc;
+
+	spool->read_segment = spool->first_segment;
+	spool->read_offset = 0;
+
+	snprintf(path, sizeof(path), "%s/" PILAB_SPOOL_CURSOR, spool->dir);
+	file = fopen(path, "re");
+	if (!file)
+		return;
+
+	rc = fscanf(file, "%u %u", &segment, &offset);
+	fclose(file);
+
+	if (rc != 2 || segment < spool->first_segment ||
+	    segment > spool->write_segment ||
+	    offset % PILAB_SPOOL_RECORD_SIZE != 0 ||
+	    offset > PILAB_SPOOL_SEGMENT_SIZE ||
+	    (segment == spool->write_segment && offset > spool->write_offset)) {
+		pilab_log(LOG_ERROR, "Ignoring the damaged cursor of %s",
+			  spool->dir);
+		return;
+	}
+
+	spool->read_segment = segment;
+	spool->read_offset = offset;
+}
+
+/*
+ * Find the oldest and the newest segment in the directory.
+ *
+ * Returns 1 when there are segments, 0 otherwise.
+ */
+
+static int spool_scan(struct t_spool *spool)
+{
+	struct dirent *entry;
+	DIR *dir;
+	unsigned long segment;
+	char *end;
+	int found;
+
+	dir = opendir(spool->dir);
+	if (!dir)
+		return 0;
+
+	found = 0;
+	while ((entry = readdir(dir))) {
+		segment = strtoul(entry->d_name, &end, 10);
+		if (end == entry->d_name || segment == 0 ||
+		    strcmp(end, PILAB_SPOOL_SEGMENT_SUFFIX) != 0)
+			continue;
+
+		if (!found || segment < spool->first_segment)
+			spool->first_segment = (uint32_t)segment;
+		if (!found || segment > spool->write_segment)
+			spool->write_segment = (uint32_t)segment;
+		found = 1;
+	}
+	closedir(dir);
+
+	return found;
+}
+
+/*
+ * Open the segment appended to, a torn record at its end is cut off.
+ *
+ * Returns 1 on success, 0 otherwise.
+ */
+
+static int spool_open_write_segment(struct t_spool *spool)
+{
+	struct stat st;
+
+	spool->write_fd = spool_open_segment(spool, spool->write_segment,
+					     O_WRONLY | O_CREAT | O_APPEND);
+	if (spool->write_fd < 0 || fstat(spool->write_fd, &st) < 0)
+		return 0;
+
+	spool->write_offset = (uint32_t)(st.st_size - st.st_size %
+							      PILAB_SPOOL_RECORD_SIZE);
+	if (st.st_size != spool->write_offset &&
+	    ftruncate(spool->write_fd, spool->write_offset) < 0)
+		return 0;
+
+	return 1;
+}
+
+/*
+ * Continue in a new segment, the current one is full.
+ *
+ * Returns 1 on success, 0 otherwise.
+ */
+
+static int spool_roll(struct t_spool *spool)
+{
+	(void)fdatasync(spool->write_fd);
+	close(spool->write_fd);
+	spool->stats.syncs++;
+	spool->unsynced = 0;
+
+	spool->write_segment++;
+	if (!spool_open_write_segment(spool)) {
+		pilab_log(LOG_ERROR, "Could not create segment %u of %s",
+			  spool->write_segment, spool->dir);
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Remove the oldest segments while the spool is larger than allowed, the
+ * readings in them are lost.
+ */
+
+static void spool_enforce_size(struct t_spool *spool)
+{
+	uint64_t size;
+
+	for (;;) {
+		size = (uint64_t)(spool->write_segment - spool->first_segment) *
+			       PILAB_SPOOL_SEGMENT_SIZE +
+		       spool->write_offset;
+		if (size <= spool->max_size ||
+		    spool->first_segment >= spool->write_segment)
+			break;
+
+		if (spool->read_segment == spool->first_segment) {
+			spool->stats.dropped += (PILAB_SPOOL_SEGMENT_SIZE -
+						 spool->read_offset) /
+						PILAB_SPOOL_RECORD_SIZE;
+			spool->read_segment++;
+			spool->read_offset = 0;
+			(void)spool_write_cursor(spool);
+		}
+
+		spool_remove_segment(spool, spool->first_segment);
+		spool->first_segment++;
+	}
+}
+
+/*
+ * Open the spool in dir, it is created when it doesn't exist. The segments
+ * take at most max_size KB, pass 0 (or less) for the default.
+ *
+ * Returns a pointer to the opened spool, NULL otherwise.
+ */
+
+struct t_spool *spool_open(const char *dir, int max_size)
+{
+	struct t_spool *new_spool;
+	uint32_t segment;
+
+	if (!dir)
+		return NULL;
+
+	if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+		pilab_log(LOG_ERROR, "Could not create spool %s: %d", dir,
+			  errno);
+		return NULL;
+	}
+
+	if (max_size < 1)
+		max_size = PILAB_SPOOL_DEFAULT_MAX_SIZE;
+
+	new_spool = calloc(1, sizeof(*new_spool));
+	if (!new_spool)
+		return NULL;
+
+	new_spool->dir = string_strdup(dir);
+	/* at least the segment appended to and the one forwarded from */
+	new_spool->max_size = (uint64_t)max_size * 1024;
+	if (new_spool->max_size < 2 * (uint64_t)PILAB_SPOOL_SEGMENT_SIZE)
+		new_spool->max_size = 2 * (uint64_t)PILAB_SPOOL_SEGMENT_SIZE;
+
+	if (!spool_scan(new_spool))
+		new_spool->first_segment = new_spool->write_segment = 1;
+
+	if (!spool_open_write_segment(new_spool)) {
+		pilab_log(LOG_ERROR, "Could not open spool %s: %d", dir, errno);
+		if (new_spool->write_fd >= 0)
+			close(new_spool->write_fd);
+		free(new_spool->dir);
+		free(new_spool);
+		return NULL;
+	}
+
+	spool_read_cursor(new_spool);
+
+	/* forwarded before a crash, but not removed yet */
+	for (segment = new_spool->first_segment;
+	     segment < new_spool->read_segment; ++segment)
+		spool_remove_segment(new_spool, segment);
+	new_spool->first_segment = new_spool->read_segment;
+
+	if (new_spool->write_offset >= PILAB_SPOOL_SEGMENT_SIZE)
+		(void)spool_roll(new_spool);
+
+	pthread_mutex_init(&new_spool->lock, NULL);
+
+	return new_spool;
+}
+
+/*
+ * Append the reading of sensor name, taken at timestamp (ms since the epoch),
+ * at now (monotonic ns). The oldest readings are dropped when the spool is
+ * full.
+ *
+ * NOTE: The reading is synced to disk along with the ones appended after it,
+ * see spool_sync.
+ *
+ * Returns:
+ * -1: invalid arguments.
+ *  0: the reading could not be written.
+ *  1: on success.
+ */
+
+int spool_append(struct t_spool *spool, const char *name, const char *type,
+		 uint64_t timestamp, double value, uint64_t now)
+{
+	uint8_t record[PILAB_SPOOL_RECORD_SIZE];
+	ssize_t written;
+
+	if (!spool || !name)
+		return -1;
+
+	spool_encode(record, name, type, timestamp, value);
+
+	pthread_mutex_lock(&spool->lock);
+	if (spool->write_fd < 0) {
+		pthread_mutex_unlock(&spool->lock);
+		return 0;
+	}
+
+	written = write(spool->write_fd, record, sizeof(record));
+	if (written != sizeof(record)) {
+		/* don't leave a torn record for the next one to follow */
+		if (written > 0)
+			(void)ftruncate(spool->write_fd, spool->write_offset);
+		pthread_mutex_unlock(&spool->lock);
+		pilab_log(LOG_ERROR, "Could not spool a reading of %s", name);
+		return 0;
+	}
+
+	spool->write_offset += sizeof(record);
+	spool->stats.appended++;
+	if (spool->unsynced++ == 0)
+		spool->unsynced_since = now;
+
+	if (spool->write_offset >= PILAB_SPOOL_SEGMENT_SIZE) {
+		if (!spool_roll(spool)) {
+			close(spool->write_fd);
+			spool->write_fd = -1;
+		}
+	} else if (spool->unsynced >= PILAB_SPOOL_SYNC_RECORDS) {
+		(void)fdatasync(spool->write_fd);
+		spool->stats.syncs++;
+		spool->unsynced = 0;
+	}
+
+	spool_enforce_size(spool);
+	pthread_mutex_unlock(&spool->lock);
+
+	return 1;
+}
+
+/*
+ * Sync the appended readings to disk, once the first of them waited
+ * PILAB_SPOOL_SYNC_INTERVAL at now (monotonic ns) or right away when force is
+ * set.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: nothing needed a sync.
+ *  1: the readings were synced.
+ */
+
+int spool_sync(struct t_spool *spool, uint64_t now, int force)
+{
+	int rc;
+
+	if (!spool)
+		return -1;
+
+	rc = 0;
+	pthread_mutex_lock(&spool->lock);
+	if (spool->unsynced > 0 && spool->write_fd >= 0 &&
+	    (force || now - spool->unsynced_since >=
+			      PILAB_SPOOL_SYNC_INTERVAL *
+				      PILAB_SPOOL_NSEC_PER_MSEC)) {
+		(void)fdatasync(spool->write_fd);
+		spool->stats.syncs++;
+		spool->unsynced = 0;
+		rc = 1;
+	}
+	pthread_mutex_unlock(&spool->lock);
+
+	return rc;
+}
+
+/*
+ * Read up to max_items of the oldest readings into items, without forwarding
+ * them. records is set to the amount of records read, damaged ones included,
+ * and end to the position right after the last of them, for spool_commit.
+ *
+ * Returns the amount of readings in items, -1 on invalid arguments.
+ */
+
+int spool_peek(struct t_spool *spool, struct t_batch_item *items,
+	       int max_items, int *records, struct t_spool_position *end)
+{
+	uint8_t record[PILAB_SPOOL_RECORD_SIZE];
+	uint32_t segment, offset;
+	int fd, count, read;
+
+	if (!spool || !items || max_items < 1 || !records || !end)
+		return -1;
+
+	count = 0;
+	read = 0;
+	fd = -1;
+
+	pthread_mutex_lock(&spool->lock);
+	segment = spool->read_segment;
+	offset = spool->read_offset;
+	while (read < max_items) {
+		if (segment == spool->write_segment &&
+		    offset >= spool->write_offset)
+			break;
+
+		if (offset >= PILAB_SPOOL_SEGMENT_SIZE) {
+			segment++;
+			offset = 0;
+			if (fd >= 0)
+				close(fd);
+			fd = -1;
+			continue;
+		}
+
+		if (fd < 0) {
+			fd = spool_open_segment(spool, segment, O_RDONLY);
+			if (fd < 0)
+				break;
+		}
+
+		if (pread(fd, record, sizeof(record), offset) !=
+		    sizeof(record))
+			break;
+
+		offset += sizeof(record);
+		read++;
+		if (spool_decode(record, &items[count]))
+			count++;
+		else
+			spool->stats.corrupt++;
+	}
+	pthread_mutex_unlock(&spool->lock);
+
+	if (fd >= 0)
+		close(fd);
+
+	*records = read;
+	end->segment = segment;
+	end->offset = offset;
+
+	return count;
+}
+
+/*
+ * Forward the cursor to end, as set by spool_peek, once the readings before it
+ * were uploaded. The cursor never moves back: when the size limit dropped the
+ * segment they came from in the meantime, it already is past them. The
+ * segments that were fully forwarded are removed.
+ *
+ * Returns:
+ * -1: invalid arguments.
+ *  0: the cursor could not be written, the readings are forwarded again
+ *     after a restart.
+ *  1: on success.
+ */
+
+int spool_commit(struct t_spool *spool, const struct t_spool_position *end)
+{
+	uint64_t from, to;
+	uint32_t segment, offset;
+	int rc;
+
+	if (!spool || !end)
+		return -1;
+
+	rc = 1;
+	pthread_mutex_lock(&spool->lock);
+	segment = end->segment;
+	offset = end->offset;
+	/* a full segment is done, continue at the start of the next one */
+	if (offset >= PILAB_SPOOL_SEGMENT_SIZE &&
+	    segment < spool->write_segment) {
+		segment++;
+		offset = 0;
+	}
+	from = (uint64_t)spool->read_segment * PILAB_SPOOL_SEGMENT_SIZE +
+	       spool->read_offset;
+	to = (uint64_t)segment * PILAB_SPOOL_SEGMENT_SIZE + offset;
+	if (to > from) {
+		spool->stats.forwarded += (to - from) / PILAB_SPOOL_RECORD_SIZE;
+		spool->read_segment = segment;
+		spool->read_offset = offset;
+		rc = spool_write_cursor(spool);
+	}
+
+	/* the cursor moved on, the segments before it are done */
+	while (spool->first_segment < spool->read_segment) {
+		spool_remove_segment(spool, spool->first_segment);
+		spool->first_segment++;
+	}
+	pthread_mutex_unlock(&spool->lock);
+
+	return rc;
+}
+
+/*
+ * Returns the amount of readings that weren't forwarded yet.
+ */
+
+unsigned long spool_pending(struct t_spool *spool)
+{
+	uint64_t bytes;
+
+	if (!spool)
+		return 0;
+
+	pthread_mutex_lock(&spool->lock);
+	bytes = (uint64_t)(spool->write_segment - spool->read_segment) *
+			PILAB_SPOOL_SEGMENT_SIZE +
+		spool->write_offset - spool->read_offset;
+	pthread_mutex_unlock(&spool->lock);
+
+	return (unsigned long)(bytes / PILAB_SPOOL_RECORD_SIZE);
+}
+
+/*
+ * Copy the counters of the spool.
+ */
+
+void spool_get_stats(struct t_spool *spool, struct t_spool_stats *stats)
+{
+	if (!spool || !stats)
+		return;
+
+	pthread_mutex_lock(&spool->lock);
+	*stats = spool->stats;
+	pthread_mutex_unlock(&spool->lock);
+}
+
+/*
+ * Sync the appended readings and close the spool, the readings that weren't
+ * forwarded are forwarded after the next open.
+ */
+
+void spool_close(struct t_spool *spool)
+{
+	if (!spool)
+		return;
+
+	(void)spool_sync(spool, 0, 1);
+	if (spool->write_fd >= 0)
+		close(spool->write_fd);
+	pthread_mutex_destroy(&spool->lock);
+	free(spool->dir);
+	free(spool);
+}
@@ -138,15 +138,13 @@ int string_strncmp(const char *string1, const char *string2, size_t n)
 		count++;
 	}
 
-	slen1 = strlen(string1);
-	slen2 = strlen(string2);
-
-	if (slen1 != slen2)
-		return (slen1 < slen2) ? -1 : 1;
-
+	/* the first n bytes are equal, whatever follows them */
 	if (count >= n)
 		return 0;
 
+	slen1 = strlen(string1);
+	slen2 = strlen(string2);
+
 	return slen1 < slen2 ? -1 : ((slen1 > slen2) ? 1 : 0);
 }
 
@@ -208,15 +206,13 @@ int string_strcasencmp(const char *string1, const char *string2, size_t n)
 		count++;
 	}
 
-	slen1 = strlen(string1);
-	slen2 = strlen(string2);
-
-	if (slen1 != slen2)
-		return (slen1 < slen2) ? -1 : 1;
-
+	/* the first n bytes are equal, whatever follows them */
 	if (count >= n)
 		return 0;
 
+	slen1 = strlen(string1);
+	slen2 = strlen(string2);
+
 	return slen1 < slen2 ? -1 : ((slen1 > slen2) ? 1 : 0);
 }
 
@@ -67,6 +67,19 @@ void stringbuilder_free(struct t_stringbuilder *sb)
 	free(sb);
 }
 
+/*
+ * Empty the stringbuilder, keeping its allocated space.
+ */
+
+void stringbuilder_clear(struct t_stringbuilder *sb)
+{
+	if (!sb || !sb->string)
+		return;
+
+	sb->length = 0;
+	sb->string[0] = '\0';
+}
+
 /*
  * Make sure that the stringbuilder contains enough allocated space.
  *
@@ -106,3 +106,37 @@ char *time_get_time()
 {
 	return time_get_time_fmt(PILAB_TIME_DEFAULT_FORMAT);
 }
+
+/*
+ * Get the current value of the monotonic clock in nanoseconds.
+ *
+ * NOTE: Only useful for measuring intervals, as the epoch is unspecified.
+ *
+ * Returns the monotonic time in nanoseconds, 0 otherwise.
+ */
+
+uint64_t time_monotonic_ns()
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) != 0)
+		return 0;
+
+	return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/*
+ * Get the current wall clock time in nanoseconds since the epoch.
+ *
+ * Returns the wall clock time in nanoseconds, 0 otherwise.
+ */
+
+uint64_t time_realtime_ns()
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_REALTIME, &now) != 0)
+		return 0;
+
+	return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
@@ -0,0 +1,487 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pilab-trace.h"
+#include "pilab-string.h"
+#include "pilab-log.h"
+
+#define PILAB_TRACE_NSEC_PER_USEC 1000ULL
+
+/*
+ * Little endian encoding of the record fields.
+ */
+
+static void trace_put_u16(uint8_t *buffer, uint16_t value)
+{
+	buffer[0] = (uint8_t)value;
+	buffer[1] = (uint8_t)(value >> 8);
+}
+
+static void trace_put_u32(uint8_t *buffer, uint32_t value)
+{
+	int i;
+
+	for (i = 0; i < 4; ++i)
+		buffer[i] = (uint8_t)(value >> (8 * i));
+}
+
+static void trace_put_u64(uint8_t *buffer, uint64_t value)
+{
+	int i;
+
+	for (i = 0; i < 8; ++i)
+		buffer[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint16_t trace_get_u16(const uint8_t *buffer)
+{
+	return (uint16_t)(buffer[0] | (buffer[1] << 8));
+}
+
+static uint32_t trace_get_u32(const uint8_t *buffer)
+{
+	uint32_t value;
+	int i;
+
+	value = 0;
+	for (i = 3; i >= 0; --i)
+		value = (value << 8) | buffer[i];
+
+	return value;
+}
+
+static uint64_t trace_get_u64(const uint8_t *buffer)
+{
+	uint64_t value;
+	int i;
+
+	value = 0;
+	for (i = 7; i >= 0; --i)
+		value = (value << 8) | buffer[i];
+
+	return value;
+}
+
+/*
+ * Create (or truncate) a trace file at path, and write its header.
+ *
+ * Returns a pointer to the newly created writer, NULL otherwise.
+ */
+
+struct t_trace_writer *trace_writer_open(const char *path)
+{
+	struct t_trace_writer *new_writer;
+	uint8_t header[PILAB_TRACE_HEADER_SIZE];
+
+	if (!path)
+		return NULL;
+
+	new_writer = calloc(1, sizeof(*new_writer));
+	if (!new_writer)
+		return NULL;
+
+	new_writer->file = fopen(path, "wbe");
+	if (!new_writer->file) {
+		pilab_log(LOG_ERROR, "Could not create trace %s", path);
+		free(new_writer);
+		return NULL;
+	}
+	/* a record is a handful of bytes, don't write them one by one */
+	(void)setvbuf(new_writer->file, NULL, _IOFBF, PILAB_TRACE_BUFFER_SIZE);
+
+	memcpy(header, PILAB_TRACE_MAGIC, 4);
+	trace_put_u16(header + 4, PILAB_TRACE_VERSION);
+	trace_put_u16(header + 6, 0);
+	if (fwrite(header, sizeof(header), 1, new_writer->file) != 1) {
+		fclose(new_writer->file);
+		free(new_writer);
+		return NULL;
+	}
+
+	new_writer->bytes = sizeof(header);
+	pthread_mutex_init(&new_writer->lock, NULL);
+
+	return new_writer;
+}
+
+/*
+ * Returns the id of the device called name, a device record is written for a
+ * device that is new to the trace. -1 when there is no room for it.
+ *
+ * NOTE: Call this with the lock held.
+ */
+
+static int trace_writer_device_id(struct t_trace_writer *writer,
+				  const char *name, const char *unit)
+{
+	uint8_t record[3 + 1 + PILAB_TRACE_MAX_NAME + 1 + PILAB_TRACE_MAX_NAME];
+	char **new_names;
+	size_t name_length, unit_length, size;
+	int i;
+
+	for (i = 0; i < writer->num_names; ++i)
+		if (strcmp(writer->names[i], name) == 0)
+			return i;
+
+	if (writer->num_names >= PILAB_TRACE_MAX_DEVICES)
+		return -1;
+
+	new_names = realloc(writer->names,
+			    (writer->num_names + 1) * sizeof(*new_names));
+	if (!new_names)
+		return -1;
+	writer->names = new_names;
+	writer->names[writer->num_names] = string_strdup(name);
+	if (!writer->names[writer->num_names])
+		return -1;
+
+	name_length = strlen(name);
+	if (name_length > PILAB_TRACE_MAX_NAME)
+		name_length = PILAB_TRACE_MAX_NAME;
+	unit_length = (unit) ? strlen(unit) : 0;
+	if (unit_length > PILAB_TRACE_MAX_NAME)
+		unit_length = PILAB_TRACE_MAX_NAME;
+
+	record[0] = TRACE_RECORD_DEVICE;
+	trace_put_u16(record + 1, (uint16_t)writer->num_names);
+	size = 3;
+	record[size++] = (uint8_t)name_length;
+	memcpy(record + size, name, name_length);
+	size += name_length;
+	record[size++] = (uint8_t)unit_length;
+	if (unit_length)
+		memcpy(record + size, unit, unit_length);
+	size += unit_length;
+
+	if (fwrite(record, size, 1, writer->file) != 1) {
+		free(writer->names[writer->num_names]);
+		return -1;
+	}
+	writer->bytes += size;
+
+	return writer->num_names++;
+}
+
+/*
+ * Append a raw read of the device called name to the trace, latency is the
+ * time (in ns) the read took.
+ *
+ * NOTE: This is safe to call from the sampler workers.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the read could not be written.
+ *  1: on success.
+ */
+
+int trace_writer_record(struct t_trace_writer *writer, const char *name,
+			int pin, const struct t_slave_device_sample *sample,
+			uint64_t latency)
+{
+	uint8_t record[PILAB_TRACE_READ_SIZE];
+	uint64_t value_bits;
+	int id, rc;
+
+	if (!writer || !name || !sample)
+		return -1;
+
+	latency /= PILAB_TRACE_NSEC_PER_USEC;
+	if (latency > UINT32_MAX)
+		latency = UINT32_MAX;
+	memcpy(&value_bits, &sample->value, sizeof(value_bits));
+
+	pthread_mutex_lock(&writer->lock);
+	id = trace_writer_device_id(writer, name, sample->unit);
+	if (id < 0) {
+		pthread_mutex_unlock(&writer->lock);
+		return 0;
+	}
+
+	record[0] = TRACE_RECORD_READ;
+	trace_put_u16(record + 1, (uint16_t)id);
+	record[3] = (uint8_t)sample->quality;
+	trace_put_u32(record + 4, (uint32_t)pin);
+	trace_put_u32(record + 8, (uint32_t)sample->raw);
+	trace_put_u64(record + 12, value_bits);
+	trace_put_u64(record + 20, sample->timestamp);
+	trace_put_u32(record + 28, (uint32_t)latency);
+
+	rc = (fwrite(record, sizeof(record), 1, writer->file) == 1) ? 1 : 0;
+	if (rc) {
+		writer->reads++;
+		writer->bytes += sizeof(record);
+	}
+	pthread_mutex_unlock(&writer->lock);
+
+	return rc;
+}
+
+/*
+ * Push the buffered records to the trace file.
+ *
+ * Returns -1 on invalid argument, 0 when the records could not be written and
+ * 1 on success.
+ */
+
+int trace_writer_flush(struct t_trace_writer *writer)
+{
+	int rc;
+
+	if (!writer)
+		return -1;
+
+	pthread_mutex_lock(&writer->lock);
+	rc = (fflush(writer->file) == 0) ? 1 : 0;
+	pthread_mutex_unlock(&writer->lock);
+
+	return rc;
+}
+
+/*
+ * Flush and close the trace file, and free the writer.
+ */
+
+void trace_writer_close(struct t_trace_writer *writer)
+{
+	int i;
+
+	if (!writer)
+		return;
+
+	if (fclose(writer->file) != 0)
+		pilab_log(LOG_ERROR, "Could not finish the trace");
+	for (i = 0; i < writer->num_names; ++i)
+		free(writer->names[i]);
+	free(writer->names);
+	pthread_mutex_destroy(&writer->lock);
+	free(writer);
+}
+
+/*
+ * Read a length prefixed string of a device record.
+ *
+ * Returns the string, NULL otherwise.
+ */
+
+static char *trace_read_string(FILE *file)
+{
+	char *string;
+	int length;
+
+	length = fgetc(file);
+	if (length == EOF)
+		return NULL;
+
+	string = malloc(length + 1);
+	if (!string)
+		return NULL;
+
+	if (length > 0 && fread(string, length, 1, file) != 1) {
+		free(string);
+		return NULL;
+	}
+	string[length] = '\0';
+
+	return string;
+}
+
+/*
+ * Append a read to a device of the trace.
+ *
+ * Returns 1 on success, 0 otherwise.
+ */
+
+static int trace_device_add_read(struct t_trace_device *device,
+				 const struct t_trace_read *read)
+{
+	struct t_trace_read *new_reads;
+	int new_capacity;
+
+	if (device->num_reads == device->capacity) {
+		new_capacity = (device->capacity) ? 2 * device->capacity : 64;
+		new_reads = realloc(device->reads,
+				    new_capacity * sizeof(*new_reads));
+		if (!new_reads)
+			return 0;
+		device->reads = new_reads;
+		device->capacity = new_capacity;
+	}
+
+	device->reads[device->num_reads++] = *read;
+
+	return 1;
+}
+
+/*
+ * Read a device record (without its type) into the trace.
+ *
+ * Returns 1 on success, 0 when the record is malformed.
+ */
+
+static int trace_load_device(struct t_trace *trace, FILE *file)
+{
+	struct t_trace_device *new_devices;
+	uint8_t id[2];
+
+	if (fread(id, sizeof(id), 1, file) != 1 ||
+	    trace_get_u16(id) != trace->num_devices)
+		return 0;
+
+	new_devices = realloc(trace->devices,
+			      (trace->num_devices + 1) * sizeof(*new_devices));
+	if (!new_devices)
+		return 0;
+	trace->devices = new_devices;
+
+	memset(&trace->devices[trace->num_devices], 0,
+	       sizeof(trace->devices[0]));
+	trace->devices[trace->num_devices].name = trace_read_string(file);
+	trace->devices[trace->num_devices].unit = trace_read_string(file);
+	/* counted before checking, so it gets freed either way */
+	trace->num_devices++;
+
+	return (trace->devices[trace->num_devices - 1].name &&
+		trace->devices[trace->num_devices - 1].unit) ?
+		       1 :
+		       0;
+}
+
+/*
+ * Read a read record (without its type) into the trace.
+ *
+ * Returns 1 on success, 0 when the record is malformed.
+ */
+
+static int trace_load_read(struct t_trace *trace, FILE *file)
+{
+	uint8_t record[PILAB_TRACE_READ_SIZE - 1];
+	struct t_trace_read read;
+	uint64_t value_bits;
+	int id;
+
+	if (fread(record, sizeof(record), 1, file) != 1)
+		return 0;
+
+	/* the offsets are one less, the type was read already */
+	id = trace_get_u16(record);
+	if (id >= trace->num_devices ||
+	    record[2] >= SLAVE_DEVICE_NUM_QUALITIES)
+		return 0;
+
+	read.quality = record[2];
+	read.pin = (int)trace_get_u32(record + 3);
+	read.raw = (int)trace_get_u32(record + 7);
+	value_bits = trace_get_u64(record + 11);
+	memcpy(&read.value, &value_bits, sizeof(read.value));
+	read.timestamp = trace_get_u64(record + 19);
+	read.latency = trace_get_u32(record + 27);
+
+	if (trace->first == 0 || read.timestamp < trace->first)
+		trace->first = read.timestamp;
+	if (read.timestamp > trace->last)
+		trace->last = read.timestamp;
+
+	return trace_device_add_read(&trace->devices[id], &read);
+}
+
+/*
+ * Load the trace at path in memory. A trace that was cut short (e.g. by a
+ * crash) is loaded up to its last complete record.
+ *
+ * Returns a pointer to the loaded trace, NULL otherwise.
+ */
+
+struct t_trace *trace_load(const char *path)
+{
+	struct t_trace *new_trace;
+	uint8_t header[PILAB_TRACE_HEADER_SIZE];
+	FILE *file;
+	int type, rc;
+
+	if (!path)
+		return NULL;
+
+	file = fopen(path, "rbe");
+	if (!file) {
+		pilab_log(LOG_ERROR, "Could not open trace %s", path);
+		return NULL;
+	}
+
+	if (fread(header, sizeof(header), 1, file) != 1 ||
+	    memcmp(header, PILAB_TRACE_MAGIC, 4) != 0 ||
+	    trace_get_u16(header + 4) != PILAB_TRACE_VERSION) {
+		pilab_log(LOG_ERROR, "%s is not a version %d trace", path,
+			  PILAB_TRACE_VERSION);
+		fclose(file);
+		return NULL;
+	}
+
+	new_trace = calloc(1, sizeof(*new_trace));
+	if (!new_trace) {
+		fclose(file);
+		return NULL;
+	}
+
+	rc = 1;
+	while (rc && (type = fgetc(file)) != EOF) {
+		switch (type) {
+		case TRACE_RECORD_DEVICE:
+			rc = trace_load_device(new_trace, file);
+			break;
+		case TRACE_RECORD_READ:
+			rc = trace_load_read(new_trace, file);
+			break;
+		default:
+			rc = 0;
+			break;
+		}
+	}
+	if (!rc)
+		pilab_log(LOG_ERROR,
+			  "Trace %s ends in a damaged record, replaying up to it",
+			  path);
+	fclose(file);
+
+	return new_trace;
+}
+
+/*
+ * Returns the reads of the device called name, NULL when it is not in the
+ * trace.
+ */
+
+struct t_trace_device *trace_get_device(struct t_trace *trace,
+					const char *name)
+{
+	int i;
+
+	if (!trace || !name)
+		return NULL;
+
+	for (i = 0; i < trace->num_devices; ++i)
+		if (trace->devices[i].name &&
+		    strcmp(trace->devices[i].name, name) == 0)
+			return &trace->devices[i];
+
+	return NULL;
+}
+
+/*
+ * Free a loaded trace.
+ */
+
+void trace_free(struct t_trace *trace)
+{
+	int i;
+
+	if (!trace)
+		return;
+
+	for (i = 0; i < trace->num_devices; ++i) {
+		free(trace->devices[i].name);
+		free(trace->devices[i].unit);
+		free(trace->devices[i].reads);
+	}
+	free(trace->devices);
+	free(trace);
+}
@@ -0,0 +1,561 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "pilab-w1-bus.h"
+#include "pilab-hal.h"
+#include "pilab-log.h"
+#include "pilab-string.h"
+#include "pilab-time.h"
+
+#define PILAB_W1_BUS_NSEC_PER_MSEC 1000000ULL
+#define PILAB_W1_BUS_PATH_SIZE 256
+/* A w1_slave file is two lines of about 40 characters */
+#define PILAB_W1_BUS_SLAVE_SIZE 128
+
+/*
+ * Read a small sysfs file into buffer, as a nul terminated string.
+ *
+ * Returns the amount of bytes read, -1 otherwise.
+ */
+
+static int w1_bus_read_file(const char *path, char *buffer, int size)
+{
+	ssize_t count;
+	int fd, total;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	total = 0;
+	while (total < size - 1) {
+		count = read(fd, buffer + total, size - 1 - total);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0)
+			break;
+		total += (int)count;
+	}
+	close(fd);
+
+	buffer[total] = '\0';
+
+	return total;
+}
+
+/*
+ * Read the w1_slave attribute of the probe with id, through the backend when
+ * it simulates the bus.
+ *
+ * Returns the amount of bytes read, -1 otherwise.
+ */
+
+static int w1_bus_read_slave(const char *root, const char *id, char *buffer,
+			     int size)
+{
+	char path[PILAB_W1_BUS_PATH_SIZE];
+	int count;
+
+	count = hal_w1_read(root, id, buffer, size);
+	if (count >= 0 || hal_get()->w1_read)
+		return count;
+
+	snprintf(path, sizeof(path), "%s/%s/%s", root, id, PILAB_W1_BUS_SLAVE);
+
+	return w1_bus_read_file(path, buffer, size);
+}
+
+/*
+ * Open the bulk read attribute of the bus master once, it is kept open for
+ * the lifetime of the bus.
+ *
+ * NOTE: Call this with the lock held.
+ *
+ * Returns the descriptor, -1 when the master has no such attribute.
+ */
+
+static int w1_bus_bulk_fd(struct t_w1_bus *bus)
+{
+	char path[PILAB_W1_BUS_PATH_SIZE];
+
+	if (bus->bulk_fd < 0) {
+		snprintf(path, sizeof(path), "%s/%s/%s", bus->root, bus->master,
+			 PILAB_W1_BUS_BULK_READ);
+		bus->bulk_fd = open(path, O_RDWR | O_CLOEXEC);
+	}
+
+	return bus->bulk_fd;
+}
+
+/*
+ * Broadcast a convert to every probe on the bus, through the bulk read
+ * attribute of the bus master.
+ *
+ * Returns 1 when the conversion got started, 0 otherwise.
+ */
+
+static int w1_bus_trigger(int fd)
+{
+	static const char trigger[] = "trigger\n";
+
+	if (fd < 0)
+		return 0;
+
+	return (pwrite(fd, trigger, sizeof(trigger) - 1, 0) ==
+		(ssize_t)(sizeof(trigger) - 1)) ?
+		       1 :
+		       0;
+}
+
+/*
+ * Wait until the bus master reports that no probe is converting anymore, it
+ * reports -1 while at least one of them still is.
+ *
+ * NOTE: Reading a scratchpad waits for the conversion as well, this only keeps
+ * that wait from being charged to the first probe.
+ */
+
+static void w1_bus_wait(int fd)
+{
+	char state[8];
+	struct timespec pause;
+	ssize_t count;
+	int waited;
+
+	pause.tv_sec = 0;
+	pause.tv_nsec = PILAB_W1_BUS_POLL_INTERVAL * PILAB_W1_BUS_NSEC_PER_MSEC;
+
+	for (waited = 0; waited < PILAB_W1_BUS_CONVERSION_TIMEOUT;
+	     waited += PILAB_W1_BUS_POLL_INTERVAL) {
+		count = pread(fd, state, sizeof(state) - 1, 0);
+		if (count < 1)
+			return;
+		state[count] = '\0';
+		if (atoi(state) != -1)
+			return;
+		nanosleep(&pause, NULL);
+	}
+}
+
+/*
+ * Convert every probe on the bus once, and read all of their scratchpads.
+ *
+ * NOTE: Call this with the lock held and no conversion running, the lock is
+ * released during the conversion itself.
+ *
+ * Returns the amount of probes with a valid reading.
+ */
+
+static int w1_bus_run_conversion(struct t_w1_bus *bus)
+{
+	char buffer[PILAB_W1_BUS_SLAVE_SIZE];
+	struct t_w1_probe *probe;
+	uint64_t started, elapsed;
+	int bulk, fd, valid, failures, converted, i;
+
+	bus->converting = 1;
+	bulk = bus->bulk;
+	fd = (bulk && !hal_get()->w1_convert) ? w1_bus_bulk_fd(bus) : -1;
+	pthread_mutex_unlock(&bus->lock);
+
+	started = time_monotonic_ns();
+	if (bulk) {
+		converted = hal_w1_convert(bus->root, bus->master);
+		if (converted < 0)
+			converted = w1_bus_trigger(fd);
+		if (converted) {
+			if (fd >= 0)
+				w1_bus_wait(fd);
+		} else {
+			/* without it every probe converts when it gets read */
+			pilab_log(
+				LOG_INFO,
+				"Bus master %s can't convert all probes at once, converting them one by one.",
+				bus->master);
+			bulk = 0;
+		}
+	}
+
+	/* the probes are not touched by readers while converting is set */
+	valid = 0;
+	failures = 0;
+	for (i = 0; i < bus->num_probes; ++i) {
+		probe = bus->probes[i];
+		probe->valid = 0;
+		if (w1_bus_read_slave(bus->root, probe->id, buffer,
+				      sizeof(buffer)) > 0 &&
+		    w1_bus_parse_slave(buffer, &probe->millidegrees) == 1)
+			probe->valid = 1;
+
+		if (probe->valid)
+			valid++;
+		else
+			failures++;
+	}
+	elapsed = time_monotonic_ns() - started;
+
+	pthread_mutex_lock(&bus->lock);
+	bus->bulk = bulk;
+	bus->epoch++;
+	bus->converted_at = time_monotonic_ns();
+	for (i = 0; i < bus->num_probes; ++i)
+		bus->probes[i]->epoch = bus->epoch;
+
+	bus->stats.conversions++;
+	if (bulk)
+		bus->stats.bulk_conversions++;
+	bus->stats.failures += failures;
+	bus->stats.conversion_total_ns += elapsed;
+	if (elapsed > bus->stats.conversion_max_ns)
+		bus->stats.conversion_max_ns = elapsed;
+
+	bus->converting = 0;
+	pthread_cond_broadcast(&bus->converted);
+
+	return valid;
+}
+
+/*
+ * Parse the w1_slave attribute of a thermometer, e.g.
+ *
+ * 72 01 4b 46 7f ff 0e 10 57 : crc=57 YES
+ * 72 01 4b 46 7f ff 0e 10 57 t=23125
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the scratchpad failed its crc, or could not be parsed.
+ *  1: on success, with the temperature in millidegrees.
+ */
+
+int w1_bus_parse_slave(const char *buffer, int *millidegrees)
+{
+	const char *crc, *verdict, *line_end, *temperature;
+	char *end;
+	long value;
+
+	if (!buffer || !millidegrees)
+		return -1;
+
+	crc = strstr(buffer, "crc=");
+	if (!crc)
+		return 0;
+
+	line_end = strchr(crc, '\n');
+	verdict = strstr(crc, "YES");
+	if (!verdict || (line_end && verdict > line_end))
+		return 0;
+
+	temperature = strstr(crc, "t=");
+	if (!temperature)
+		return 0;
+
+	value = strtol(temperature + 2, &end, 10);
+	if (end == temperature + 2)
+		return 0;
+
+	*millidegrees = (int)value;
+
+	return 1;
+}
+
+/*
+ * Conjure up a new 1-Wire bus, pass NULL to use the default sysfs root or bus
+ * master.
+ *
+ * Returns a pointer to the newly created bus, NULL otherwise.
+ */
+
+struct t_w1_bus *w1_bus_create(const char *root, const char *master)
+{
+	struct t_w1_bus *new_bus;
+
+	new_bus = calloc(1, sizeof(*new_bus));
+	if (!new_bus)
+		return NULL;
+
+	new_bus->root = string_strdup((root) ? root : PILAB_W1_BUS_DEFAULT_ROOT);
+	new_bus->master =
+		string_strdup((master) ? master : PILAB_W1_BUS_DEFAULT_MASTER);
+	if (!new_bus->root || !new_bus->master) {
+		free(new_bus->root);
+		free(new_bus->master);
+		free(new_bus);
+		return NULL;
+	}
+
+	new_bus->probes = NULL;
+	new_bus->num_probes = 0;
+	new_bus->bulk = 1;
+	new_bus->bulk_fd = -1;
+	new_bus->started_at = 0;
+	new_bus->converting = 0;
+	new_bus->epoch = 0;
+	new_bus->converted_at = 0;
+	new_bus->max_age =
+		PILAB_W1_BUS_DEFAULT_MAX_AGE * PILAB_W1_BUS_NSEC_PER_MSEC;
+	pthread_mutex_init(&new_bus->lock, NULL);
+	pthread_cond_init(&new_bus->converted, NULL);
+
+	return new_bus;
+}
+
+/*
+ * Move the bus to another sysfs root, e.g. a simulated w1 tree.
+ *
+ * NOTE: Call this before the probes are read.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the root could not be stored.
+ *  1: on success.
+ */
+
+int w1_bus_set_root(struct t_w1_bus *bus, const char *root)
+{
+	char *new_root;
+
+	if (!bus || !root)
+		return -1;
+
+	new_root = string_strdup(root);
+	if (!new_root)
+		return 0;
+
+	pthread_mutex_lock(&bus->lock);
+	free(bus->root);
+	bus->root = new_root;
+	/* the new root gets its own chance at bulk conversions */
+	bus->bulk = 1;
+	if (bus->bulk_fd >= 0)
+		close(bus->bulk_fd);
+	bus->bulk_fd = -1;
+	pthread_mutex_unlock(&bus->lock);
+
+	return 1;
+}
+
+/*
+ * Set the time (in ms) a conversion may be handed to probes that did not read
+ * it yet, 0 lets every read convert the bus again.
+ */
+
+void w1_bus_set_max_age(struct t_w1_bus *bus, int max_age)
+{
+	if (!bus || max_age < 0)
+		return;
+
+	pthread_mutex_lock(&bus->lock);
+	bus->max_age = max_age * PILAB_W1_BUS_NSEC_PER_MSEC;
+	pthread_mutex_unlock(&bus->lock);
+}
+
+/*
+ * Attach a thermometer to the bus, by its serial (e.g. 216dc3000900) or by
+ * its full slave id (e.g. 28-216dc3000900).
+ *
+ * NOTE: Attach the probes before the bus is read.
+ *
+ * Returns a pointer to the probe, NULL otherwise.
+ */
+
+struct t_w1_probe *w1_bus_add_probe(struct t_w1_bus *bus, const char *serial)
+{
+	struct t_w1_probe *new_probe, **new_probes;
+
+	if (!bus || !serial)
+		return NULL;
+
+	new_probe = calloc(1, sizeof(*new_probe));
+	if (!new_probe)
+		return NULL;
+
+	if (strchr(serial, '-'))
+		new_probe->id = string_strdup(serial);
+	else
+		new_probe->id = string_strcat_delimiter(
+			PILAB_W1_BUS_FAMILY_DS18B20, serial, "-");
+	if (!new_probe->id) {
+		free(new_probe);
+		return NULL;
+	}
+	new_probe->bus = bus;
+
+	pthread_mutex_lock(&bus->lock);
+	new_probes = realloc(bus->probes,
+			     (bus->num_probes + 1) * sizeof(*new_probes));
+	if (!new_probes) {
+		pthread_mutex_unlock(&bus->lock);
+		free(new_probe->id);
+		free(new_probe);
+		return NULL;
+	}
+	new_probes[bus->num_probes] = new_probe;
+	bus->probes = new_probes;
+	bus->num_probes++;
+	pthread_mutex_unlock(&bus->lock);
+
+	return new_probe;
+}
+
+/*
+ * Broadcast a convert to every probe on the bus without waiting for it, the
+ * results are collected from the w1_slave attribute of each probe later on.
+ * A conversion that was started less than a conversion time ago is reused,
+ * and none is broadcast while w1_bus_convert is converting the probes, the
+ * caller waits a conversion time for that one instead.
+ *
+ * Returns the time (in ms) until the conversion is done, 0 when it could not
+ * be started (a probe converts on its own when it gets read) and -1 on
+ * invalid argument.
+ */
+
+int w1_bus_start_conversion(struct t_w1_bus *bus)
+{
+	uint64_t now, elapsed, remaining;
+
+	if (!bus)
+		return -1;
+
+	remaining = 0;
+	now = time_monotonic_ns();
+
+	pthread_mutex_lock(&bus->lock);
+	elapsed = now - bus->started_at;
+	if (bus->converting) {
+		remaining = PILAB_W1_BUS_CONVERSION_TIME;
+	} else if (bus->started_at &&
+	    elapsed < PILAB_W1_BUS_CONVERSION_TIME * PILAB_W1_BUS_NSEC_PER_MSEC) {
+		remaining = PILAB_W1_BUS_CONVERSION_TIME -
+			    elapsed / PILAB_W1_BUS_NSEC_PER_MSEC;
+	} else if (bus->bulk && hal_get()->w1_convert) {
+		/* a simulated probe converts while it gets collected */
+	} else if (bus->bulk) {
+		if (w1_bus_trigger(w1_bus_bulk_fd(bus))) {
+			bus->started_at = now;
+			bus->stats.conversions++;
+			bus->stats.bulk_conversions++;
+			remaining = PILAB_W1_BUS_CONVERSION_TIME;
+		} else {
+			pilab_log(
+				LOG_INFO,
+				"Bus master %s can't convert all probes at once, converting them one by one.",
+				bus->master);
+			bus->bulk = 0;
+		}
+	}
+	pthread_mutex_unlock(&bus->lock);
+
+	return (int)remaining;
+}
+
+/*
+ * Convert every probe on the bus at once, waiting for a conversion that is
+ * already running first.
+ *
+ * Returns the amount of probes with a valid reading, -1 on invalid argument.
+ */
+
+int w1_bus_convert(struct t_w1_bus *bus)
+{
+	int valid;
+
+	if (!bus)
+		return -1;
+
+	pthread_mutex_lock(&bus->lock);
+	while (bus->converting)
+		pthread_cond_wait(&bus->converted, &bus->lock);
+	valid = w1_bus_run_conversion(bus);
+	pthread_mutex_unlock(&bus->lock);
+
+	return valid;
+}
+
+/*
+ * Read the temperature of a probe.
+ *
+ * A probe that did not use the last conversion of its bus yet gets that
+ * result, as long as it is recent enough. Otherwise the whole bus is
+ * converted again, so the probes that are read next get theirs for free.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the scratchpad of the probe could not be read, or failed its crc.
+ *  1: on success, with the temperature in millidegrees.
+ */
+
+int w1_probe_read(struct t_w1_probe *probe, int *millidegrees)
+{
+	struct t_w1_bus *bus;
+	int fresh, rc;
+
+	if (!probe || !millidegrees)
+		return -1;
+
+	bus = probe->bus;
+
+	pthread_mutex_lock(&bus->lock);
+	bus->stats.reads++;
+	while (bus->converting)
+		pthread_cond_wait(&bus->converted, &bus->lock);
+
+	fresh = bus->epoch > 0 && probe->epoch == bus->epoch &&
+		probe->consumed != probe->epoch &&
+		time_monotonic_ns() - bus->converted_at <= bus->max_age;
+	if (fresh)
+		bus->stats.shared++;
+	else
+		(void)w1_bus_run_conversion(bus);
+
+	probe->consumed = probe->epoch;
+	rc = probe->valid;
+	if (rc)
+		*millidegrees = probe->millidegrees;
+	pthread_mutex_unlock(&bus->lock);
+
+	return rc;
+}
+
+/*
+ * Copy the counters of the bus.
+ */
+
+void w1_bus_get_stats(struct t_w1_bus *bus, struct t_w1_bus_stats *stats)
+{
+	if (!bus || !stats)
+		return;
+
+	pthread_mutex_lock(&bus->lock);
+	*stats = bus->stats;
+	pthread_mutex_unlock(&bus->lock);
+}
+
+/*
+ * Free the bus and its probes.
+ */
+
+void w1_bus_free(struct t_w1_bus *bus)
+{
+	int i;
+
+	if (!bus)
+		return;
+
+	for (i = 0; i < bus->num_probes; ++i) {
+		free(bus->probes[i]->id);
+		free(bus->probes[i]);
+	}
+	free(bus->probes);
+	if (bus->bulk_fd >= 0)
+		close(bus->bulk_fd);
+	free(bus->root);
+	free(bus->master);
+	pthread_cond_destroy(&bus->converted);
+	pthread_mutex_destroy(&bus->lock);
+	free(bus);
+}
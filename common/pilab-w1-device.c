@@ -0,0 +1,427 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "pilab-w1-device.h"
+#include "pilab-hal.h"
+#include "pilab-string.h"
+#include "pilab-log.h"
+#include "pilab-time.h"
+
+#define PILAB_W1_DEVICE_NSEC_PER_MSEC 1000000ULL
+#define PILAB_W1_DEVICE_PATH_SIZE 256
+/* A w1_slave attribute is two lines of about 40 characters */
+#define PILAB_W1_DEVICE_SLAVE_SIZE 128
+
+/*
+ * Open the w1_slave attribute of the probe once, it is kept open for the
+ * lifetime of the device and re-read with pread.
+ *
+ * The conversion time of the probe is taken from the kernel when it tells.
+ *
+ * Returns the descriptor, -1 otherwise.
+ */
+
+static int w1_device_open(struct t_w1_device *device)
+{
+	char path[PILAB_W1_DEVICE_PATH_SIZE];
+	char conv_time[16];
+	ssize_t count;
+	int fd, value;
+
+	if (device->slave_fd >= 0)
+		return device->slave_fd;
+
+	snprintf(path, sizeof(path), "%s/%s/%s", device->bus->root, device->id,
+		 PILAB_W1_DEVICE_CONV_TIME);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		count = pread(fd, conv_time, sizeof(conv_time) - 1, 0);
+		close(fd);
+		if (count > 0) {
+			conv_time[count] = '\0';
+			value = atoi(conv_time);
+			if (value > 0)
+				device->conversion_time = value;
+		}
+	}
+
+	snprintf(path, sizeof(path), "%s/%s/%s", device->bus->root, device->id,
+		 PILAB_W1_BUS_SLAVE);
+	device->slave_fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (device->slave_fd < 0)
+		pilab_log(LOG_DEBUG, "Could not open %s: %d", path, errno);
+
+	return device->slave_fd;
+}
+
+/*
+ * W1 device's concrete analog read implementation.
+ *
+ * NOTE: A 1-Wire thermometer has no pins, every read is a full reading.
+ *
+ * Returns the temperature in millidegrees, otherwise -99999.
+ */
+
+int w1_device_analog_read(const void *instance, int pin)
+{
+	struct t_slave_device_sample sample;
+
+	/* Silence! */
+	(void)pin;
+
+	if (w1_device_read_sample(instance, &sample) < 1)
+		return PILAB_SLAVE_DEVICE_READ_FAILED;
+
+	return sample.raw;
+}
+
+/*
+ * W1 device's concrete analog write implementation.
+ *
+ * NOTE: A 1-Wire thermometer can't be written to, this does nothing.
+ */
+
+void w1_device_analog_write(const void *instance, int pin, int value)
+{
+	/* Silence! */
+	(void)instance;
+	(void)pin;
+	(void)value;
+}
+
+/*
+ * W1 device's concrete digital read implementation.
+ *
+ * Returns the temperature in millidegrees, otherwise -99999.
+ */
+
+int w1_device_digital_read(const void *instance, int pin)
+{
+	return w1_device_analog_read(instance, pin);
+}
+
+/*
+ * W1 device's concrete digital write implementation.
+ *
+ * NOTE: A 1-Wire thermometer can't be written to, this does nothing.
+ */
+
+void w1_device_digital_write(const void *instance, int pin, int value)
+{
+	w1_device_analog_write(instance, pin, value);
+}
+
+/*
+ * W1 device's concrete start sample implementation.
+ *
+ * Starts a conversion on the bus of the probe, and returns right away.
+ *
+ * NOTE: Start and collect are not locked, don't start a device that is
+ * being read.
+ *
+ * Returns the time (in ms) until the sample can be collected, 0 when the
+ * conversion happens while collecting and -1 on invalid argument.
+ */
+
+int w1_device_start_sample(const void *instance)
+{
+	struct t_w1_device *device;
+	int remaining;
+
+	if (!instance)
+		return -1;
+
+	device = (struct t_w1_device *)instance;
+
+	/* this also learns the conversion time of the probe */
+	if (!hal_get()->w1_read)
+		(void)w1_device_open(device);
+
+	remaining = w1_bus_start_conversion(device->bus);
+	if (remaining < 1) {
+		device->ready_at = 0;
+		return 0;
+	}
+
+	/* the bus assumes a 12 bit conversion, the probe may be set up faster */
+	remaining += device->conversion_time - PILAB_W1_BUS_CONVERSION_TIME;
+	if (remaining < 1)
+		remaining = 1;
+
+	device->ready_at = time_monotonic_ns() +
+			   remaining * PILAB_W1_DEVICE_NSEC_PER_MSEC;
+
+	return remaining;
+}
+
+/*
+ * W1 device's concrete collect sample implementation.
+ *
+ * Reads the scratchpad of the probe through its cached descriptor. When the
+ * started conversion is not done yet, only the time left is waited for.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the scratchpad could not be read, or failed its crc.
+ *  1: on success.
+ */
+
+int w1_device_collect_sample(const void *instance,
+			     struct t_slave_device_sample *sample)
+{
+	struct t_w1_device *device;
+	char buffer[PILAB_W1_DEVICE_SLAVE_SIZE];
+	struct timespec pause;
+	uint64_t now;
+	ssize_t count;
+	int fd, raw;
+
+	if (!instance || !sample)
+		return -1;
+
+	device = (struct t_w1_device *)instance;
+
+	now = time_monotonic_ns();
+	if (device->ready_at > now) {
+		pause.tv_sec = (device->ready_at - now) / 1000000000ULL;
+		pause.tv_nsec = (device->ready_at - now) % 1000000000ULL;
+		while (nanosleep(&pause, &pause) < 0 && errno == EINTR)
+			;
+	}
+	device->ready_at = 0;
+
+	raw = PILAB_SLAVE_DEVICE_READ_FAILED;
+	if (hal_get()->w1_read) {
+		/* the backend simulates the bus, there is no attribute */
+		if (hal_w1_convert(device->bus->root, device->bus->master) < 1 ||
+		    hal_w1_read(device->bus->root, device->id, buffer,
+				sizeof(buffer)) < 1 ||
+		    w1_bus_parse_slave(buffer, &raw) < 1)
+			raw = PILAB_SLAVE_DEVICE_READ_FAILED;
+	} else if ((fd = w1_device_open(device)) >= 0) {
+		count = pread(fd, buffer, sizeof(buffer) - 1, 0);
+		if (count > 0) {
+			buffer[count] = '\0';
+			if (w1_bus_parse_slave(buffer, &raw) < 1)
+				raw = PILAB_SLAVE_DEVICE_READ_FAILED;
+		} else {
+			/* the probe may have dropped off the bus, reopen it */
+			close(device->slave_fd);
+			device->slave_fd = -1;
+		}
+	}
+
+	slave_device_sample_init(sample, raw, PILAB_SLAVE_DEVICE_READ_FAILED,
+				 0.001, "C");
+
+	return (sample->quality == SLAVE_DEVICE_QUALITY_GOOD) ? 1 : 0;
+}
+
+/*
+ * W1 device's concrete read sample implementation.
+ *
+ * Collects the conversion that was started earlier, or starts one and waits
+ * for it.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the read failed, the sample is marked bad.
+ *  1: on success.
+ */
+
+int w1_device_read_sample(const void *instance,
+			  struct t_slave_device_sample *sample)
+{
+	struct t_w1_device *device;
+
+	if (!instance || !sample)
+		return -1;
+
+	device = (struct t_w1_device *)instance;
+
+	if (device->ready_at == 0)
+		(void)w1_device_start_sample(instance);
+
+	return w1_device_collect_sample(instance, sample);
+}
+
+/*
+ * W1 device's concrete get pin base implementation.
+ *
+ * Returns the device's pinbase, -1 otherwise
+ */
+
+int w1_device_get_pin_base(const void *instance)
+{
+	struct t_w1_device *device;
+
+	if (!instance)
+		return -1;
+
+	device = (struct t_w1_device *)instance;
+
+	return device->pin_base;
+}
+
+/*
+ * W1 device's concrete set pointer implementation.
+ *
+ * NOTE: The device has no properties that can be set.
+ */
+
+void w1_device_set_pointer(const void *instance, const char *property,
+			   void *pointer)
+{
+	/* Silence! */
+	(void)instance;
+	(void)property;
+	(void)pointer;
+}
+
+/*
+ * W1 device's concrete get expander pin implementation.
+ *
+ * Returns the expansion pin, -1 otherwise.
+ */
+
+int w1_device_get_expansion_pin(const void *instance, int pin)
+{
+	struct t_w1_device *device;
+
+	if (!instance)
+		return -1;
+
+	device = (struct t_w1_device *)instance;
+
+	return device->pin_base + pin;
+}
+
+/*
+ * W1 device's concrete get name implementation.
+ *
+ * Returns the name of the device, NULL otherwise.
+ */
+
+const char *w1_device_get_name(const void *instance)
+{
+	struct t_w1_device *device;
+
+	if (!instance)
+		return NULL;
+
+	device = (struct t_w1_device *)instance;
+
+	return device->device_name;
+}
+
+/*
+ * W1 device's concrete free implementation.
+ */
+
+void w1_device_free_device(const void *instance)
+{
+	struct t_w1_device *device;
+
+	if (!instance)
+		return;
+
+	device = (struct t_w1_device *)instance;
+
+	if (device->slave_fd >= 0)
+		close(device->slave_fd);
+	free(device->id);
+	free(device);
+}
+
+/*
+ * Creates a new 1-Wire thermometer, read through the kernel w1 sysfs
+ * interface instead of wiringPi, and registers it with the host.
+ *
+ * The serial can be given bare (e.g. 216dc3000900), or as the full slave id
+ * (e.g. 28-216dc3000900).
+ *
+ * Returns pointer to the newly created w1_device, NULL otherwise.
+ */
+
+struct t_w1_device *w1_device_create(int pin_base, const char *device_name,
+				     const char *serial,
+				     struct t_host_device *host)
+{
+	struct t_w1_device *new_device;
+	struct t_slave_device *new_slave;
+
+	if (pin_base < 0x40) {
+		pilab_log(
+			LOG_DEBUG,
+			"Pin base should be a number > 0x40 in w1_device_create.");
+		return NULL;
+	}
+
+	if (!serial || !host || !host->w1_bus) {
+		pilab_log(LOG_DEBUG,
+			  "A w1 device needs a serial and a host with a bus.");
+		return NULL;
+	}
+
+	new_device = malloc(sizeof(*new_device));
+	if (!new_device) {
+		pilab_log(LOG_DEBUG,
+			  "Could not allocate memory for new w1 device.");
+		return NULL;
+	}
+
+	new_slave = malloc(sizeof(*new_slave));
+	if (!new_slave) {
+		pilab_log(LOG_DEBUG,
+			  "Could not allocate memory for new slave device.");
+		free(new_device);
+		return NULL;
+	}
+
+	if (strchr(serial, '-'))
+		new_device->id = string_strdup(serial);
+	else
+		new_device->id = string_strcat_delimiter(
+			PILAB_W1_BUS_FAMILY_DS18B20, serial, "-");
+	if (!new_device->id) {
+		free(new_slave);
+		free(new_device);
+		return NULL;
+	}
+
+	new_device->pin_base = pin_base;
+	new_device->device_name = device_name;
+	new_device->bus = host->w1_bus;
+	new_device->slave_fd = -1;
+	new_device->conversion_time = PILAB_W1_BUS_CONVERSION_TIME;
+	new_device->ready_at = 0;
+
+	new_slave->get_expansion_pin = &w1_device_get_expansion_pin;
+	new_slave->get_name = &w1_device_get_name;
+	new_slave->analog_read = &w1_device_analog_read;
+	new_slave->analog_write = &w1_device_analog_write;
+	new_slave->digital_read = &w1_device_digital_read;
+	new_slave->digital_write = &w1_device_digital_write;
+	new_slave->read_sample = &w1_device_read_sample;
+	new_slave->start_sample = &w1_device_start_sample;
+	new_slave->collect_sample = &w1_device_collect_sample;
+	new_slave->batch_begin = NULL;
+	new_slave->batch_commit = NULL;
+	new_slave->set_pointer = &w1_device_set_pointer;
+	new_slave->get_pinbase = &w1_device_get_pin_base;
+	new_slave->free_device = &w1_device_free_device;
+	new_slave->instance = new_device;
+	new_slave->sample_interval = 0;
+	new_slave->read_timeout = PILAB_W1_DEVICE_READ_TIMEOUT;
+	new_slave->options = NULL;
+
+	/* register the device */
+	host_device_register_slave_device(host, new_slave);
+
+	return new_device;
+}
@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include "pilab-watchdog.h"
+
+#define PILAB_WATCHDOG_NSEC_PER_MSEC 1000000ULL
+#define PILAB_WATCHDOG_NSEC_PER_SEC 1000000000ULL
+
+/*
+ * Conjure up a new watchdog for the reads of a single device.
+ *
+ * A read taking longer than timeout milliseconds counts as a timeout, after
+ * threshold consecutive timeouts the device is quarantined for backoff
+ * seconds, doubling with every next quarantine. Pass 0 (or less) as threshold
+ * or backoff to use the defaults.
+ *
+ * Returns a pointer to the newly created watchdog, NULL otherwise.
+ */
+
+struct t_watchdog *watchdog_create(int timeout, int threshold, int backoff)
+{
+	struct t_watchdog *new_watchdog;
+
+	if (timeout < 1)
+		return NULL;
+
+	new_watchdog = calloc(1, sizeof(*new_watchdog));
+	if (!new_watchdog)
+		return NULL;
+
+	if (threshold < 1)
+		threshold = PILAB_WATCHDOG_DEFAULT_THRESHOLD;
+	if (backoff < 1)
+		backoff = PILAB_WATCHDOG_DEFAULT_BACKOFF;
+
+	new_watchdog->timeout = timeout * PILAB_WATCHDOG_NSEC_PER_MSEC;
+	new_watchdog->threshold = threshold;
+	new_watchdog->backoff = backoff * PILAB_WATCHDOG_NSEC_PER_SEC;
+	new_watchdog->started = 0;
+	new_watchdog->busy = 0;
+	new_watchdog->timed_out = 0;
+	new_watchdog->consecutive = 0;
+	new_watchdog->level = 0;
+	new_watchdog->quarantined_until = 0;
+	pthread_mutex_init(&new_watchdog->lock, NULL);
+
+	return new_watchdog;
+}
+
+/*
+ * Quarantine the device at now (monotonic ns) when it timed out threshold
+ * times in a row, for twice as long as the previous time. The lock must be
+ * held.
+ */
+
+static void watchdog_quarantine(struct t_watchdog *watchdog, uint64_t now)
+{
+	uint64_t backoff;
+
+	if (watchdog->consecutive < watchdog->threshold)
+		return;
+
+	backoff = watchdog->backoff << watchdog->level;
+	if (backoff > PILAB_WATCHDOG_MAX_BACKOFF * PILAB_WATCHDOG_NSEC_PER_SEC)
+		backoff = PILAB_WATCHDOG_MAX_BACKOFF *
+			  PILAB_WATCHDOG_NSEC_PER_SEC;
+	else
+		watchdog->level++;
+
+	watchdog->quarantined_until = now + backoff;
+	watchdog->consecutive = 0;
+	watchdog->stats.quarantines++;
+}
+
+/*
+ * A read of the device starts at now (monotonic ns).
+ */
+
+void watchdog_begin(struct t_watchdog *watchdog, uint64_t now)
+{
+	if (!watchdog)
+		return;
+
+	pthread_mutex_lock(&watchdog->lock);
+	watchdog->started = now;
+	watchdog->timed_out = 0;
+	watchdog->stats.reads++;
+	pthread_mutex_unlock(&watchdog->lock);
+}
+
+/*
+ * The read of the device returned at now (monotonic ns).
+ *
+ * A read that finished in time lifts the quarantine history of the device.
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: the read already timed out.
+ *  1: the read finished in time.
+ */
+
+int watchdog_end(struct t_watchdog *watchdog, uint64_t now)
+{
+	int rc;
+
+	if (!watchdog)
+		return -1;
+
+	pthread_mutex_lock(&watchdog->lock);
+	if (watchdog->timed_out ||
+	    now - watchdog->started > watchdog->timeout) {
+		/* late, but the check didn't get to it yet */
+		if (!watchdog->timed_out) {
+			watchdog->stats.timeouts++;
+			watchdog->consecutive++;
+			watchdog_quarantine(watchdog, now);
+		}
+		watchdog->stats.late++;
+		rc = 0;
+	} else {
+		watchdog->consecutive = 0;
+		watchdog->level = 0;
+		rc = 1;
+	}
+	watchdog->started = 0;
+	watchdog->timed_out = 0;
+	pthread_mutex_unlock(&watchdog->lock);
+
+	return rc;
+}
+
+/*
+ * Check the read in flight against its deadline at now (monotonic ns).
+ *
+ * Returns:
+ * -1: invalid argument.
+ *  0: nothing (new) to report.
+ *  1: the read just timed out, the device is stuck.
+ */
+
+int watchdog_check(struct t_watchdog *watchdog, uint64_t now)
+{
+	int rc;
+
+	if (!watchdog)
+		return -1;
+
+	rc = 0;
+	pthread_mutex_lock(&watchdog->lock);
+	if (watchdog->started && !watchdog->timed_out &&
+	    now - watchdog->started > watchdog->timeout) {
+		watchdog->timed_out = 1;
+		watchdog->consecutive++;
+		watchdog->stats.timeouts++;
+		watchdog_quarantine(watchdog, now);
+		rc = 1;
+	}
+	pthread_mutex_unlock(&watchdog->lock);
+
+	return rc;
+}
+
+/*
+ * Hand out a reading of the device at now (monotonic ns), unless it is
+ * quarantined or busy. It stays busy until watchdog_release, so a second
+ * reading can't be handed out while the first one is queued, in flight or
+ * between its reads.
+ *
+ * Returns 1 when the reading may go ahead, 0 otherwise (the reading is
+ * counted as skipped).
+ */
+
+int watchdog_claim(struct t_watchdog *watchdog, uint64_t now)
+{
+	int rc;
+
+	if (!watchdog)
+		return 1;
+
+	pthread_mutex_lock(&watchdog->lock);
+	rc = !watchdog->busy && !watchdog->started &&
+	     now >= watchdog->quarantined_until;
+	if (rc)
+		watchdog->busy = 1;
+	else
+		watchdog->stats.skipped++;
+	pthread_mutex_unlock(&watchdog->lock);
+
+	return rc;
+}
+
+/*
+ * The reading handed out by watchdog_claim is done, or was never taken.
+ */
+
+void watchdog_release(struct t_watchdog *watchdog)
+{
+	if (!watchdog)
+		return;
+
+	pthread_mutex_lock(&watchdog->lock);
+	watchdog->busy = 0;
+	pthread_mutex_unlock(&watchdog->lock);
+}
+
+/*
+ * Take a consistent snapshot of the statistics of the watchdog.
+ */
+
+void watchdog_get_stats(struct t_watchdog *watchdog,
+			struct t_watchdog_stats *stats)
+{
+	if (!watchdog || !stats)
+		return;
+
+	pthread_mutex_lock(&watchdog->lock);
+	*stats = watchdog->stats;
+	pthread_mutex_unlock(&watchdog->lock);
+}
+
+/*
+ * Free the watchdog.
+ */
+
+void watchdog_free(struct t_watchdog *watchdog)
+{
+	if (!watchdog)
+		return;
+
+	pthread_mutex_destroy(&watchdog->lock);
+	free(watchdog);
+}
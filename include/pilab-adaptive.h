@@ -0,0 +1,90 @@
+#ifndef _PILAB_ADAPTIVE_H
+#define _PILAB_ADAPTIVE_H
+#include <pthread.h>
+#include <stdint.h>
+
+/* Defaults of the adaptive sampling policy */
+#define PILAB_ADAPTIVE_DEFAULT_BACKOFF 2.0
+/* The bounds default to base interval / 5 and base interval * 4 */
+#define PILAB_ADAPTIVE_DEFAULT_MIN_DIVISOR 5
+#define PILAB_ADAPTIVE_DEFAULT_MAX_FACTOR 4
+
+/* Sensor options controlling the policy */
+#define PILAB_ADAPTIVE_OPTION_THRESHOLD "adaptive_threshold"
+#define PILAB_ADAPTIVE_OPTION_MIN "adaptive_min"
+#define PILAB_ADAPTIVE_OPTION_MAX "adaptive_max"
+#define PILAB_ADAPTIVE_OPTION_BACKOFF "adaptive_backoff"
+
+struct t_adaptive_stats {
+	/*
+	 * Amount of readings fed to the policy.
+	 */
+	unsigned long readings;
+	/*
+	 * Amount of times the interval was shortened.
+	 */
+	unsigned long speedups;
+	/*
+	 * Amount of times the interval was lengthened.
+	 */
+	unsigned long backoffs;
+	/*
+	 * Total time (in seconds) covered by the readings, i.e. the sum of the
+	 * intervals that followed them.
+	 */
+	uint64_t covered;
+	/*
+	 * Amount of readings a fixed base interval would have taken over the
+	 * covered time.
+	 */
+	unsigned long fixed_readings;
+};
+
+struct t_adaptive {
+	/*
+	 * The configured (fixed) interval, in seconds.
+	 */
+	int base_interval;
+	/*
+	 * The current interval, in seconds.
+	 */
+	int interval;
+	/*
+	 * Lower and upper bound of the interval, in seconds.
+	 */
+	int min_interval;
+	int max_interval;
+	/*
+	 * Two readings further apart than this count as a change.
+	 */
+	double threshold;
+	/*
+	 * Factor the interval grows with, while the signal is flat.
+	 */
+	double backoff;
+	/*
+	 * Previous reading, valid when has_last is set.
+	 */
+	double last_value;
+	int has_last;
+	/*
+	 * Statistics of the policy.
+	 */
+	struct t_adaptive_stats stats;
+	/*
+	 * Protects the state, readings of one sensor may overlap.
+	 */
+	pthread_mutex_t lock;
+};
+
+extern struct t_adaptive *adaptive_create(int base_interval, double threshold);
+extern void adaptive_set_bounds(struct t_adaptive *adaptive, int min_interval,
+				int max_interval);
+extern void adaptive_set_backoff(struct t_adaptive *adaptive, double backoff);
+extern int adaptive_update(struct t_adaptive *adaptive, double value,
+			   int *interval);
+extern void adaptive_get_stats(struct t_adaptive *adaptive,
+			       struct t_adaptive_stats *stats);
+extern void adaptive_free(struct t_adaptive *adaptive);
+
+#endif
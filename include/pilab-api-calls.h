@@ -2,10 +2,24 @@
 #define _PILAB_API_CALLS_H
 #include "pilab-api-client.h"
 
+/* Endpoint taking a json array of readings, see pilab-batch.h */
+#define PILAB_API_CALLS_ADD_DATA_BATCH "sensor/adddatabatch"
+
+extern struct t_api_client_request *
+	pilab_login_request(struct t_api_client *client);
+extern int pilab_login_finish(struct t_api_client *client,
+			      struct t_api_client_request *request);
 extern void pilab_login(struct t_api_client *client);
 extern void pilab_add_pi(struct t_api_client *client);
 extern void pilab_add_sensor(struct t_api_client *client, const char *name,
 			     const char *type_value);
-extern void pilab_add_data(struct t_api_client *client, const char *value);
+extern int pilab_add_data(struct t_api_client *client, const char *value);
+extern struct t_api_client_request *
+	pilab_add_data_batch_request(struct t_api_client *client,
+				     json_object *readings, const char *name);
+extern int pilab_add_data_batch_finish(struct t_api_client *client,
+				       struct t_api_client_request *request);
+extern int pilab_add_data_batch(struct t_api_client *client,
+				json_object *readings);
 
 #endif
@@ -1,15 +1,29 @@
 #ifndef _PILAB_API_CLIENT
 #define _PILAB_API_CLIENT
+#include <stdint.h>
+#include <pthread.h>
 #include <curl/curl.h>
 #include <json-c/json.h>
 #include "pilab-hashtable.h"
 #include "pilab-config.h"
+#include "pilab-circuit.h"
 
 #define PILAB_API_CLIENT_USER_AGENT "libcurl-agent/1.0"
 
+/* Seconds an idle connection waits before keepalive probes, and between them */
+#define PILAB_API_CLIENT_KEEPALIVE_IDLE 60
+#define PILAB_API_CLIENT_KEEPALIVE_INTERVAL 30
+
+/* Returned by api_client_request_retry when the cookie has to be renewed */
+#define PILAB_API_CLIENT_RETRY_LOGIN -2
+
 #define PILAB_API_CLIENT_REQUEST_GET "GET"
 #define PILAB_API_CLIENT_REQUEST_POST "POST"
 
+#define PILAB_API_CLIENT_CLASS_DEFAULT "default"
+#define PILAB_API_CLIENT_CLASS_LOGIN "login"
+#define PILAB_API_CLIENT_CLASS_READING "reading"
+
 typedef size_t(t_api_client_write_response_body)(char *contents, size_t size,
 						 size_t nmemb,
 						 void *response_buffer);
@@ -19,6 +33,27 @@ typedef size_t(t_api_client_write_response_headers)(char *contents, size_t size,
 
 typedef void(t_api_client_request_free_request_fields)(char *request_fields);
 
+struct t_api_client;
+
+/*
+ * Called to log in again, when the backend no longer accepts the cookie.
+ */
+
+typedef void(t_api_client_login)(struct t_api_client *client);
+
+struct t_api_client_request;
+
+/*
+ * Create the request logging in, without running it, and handle its response
+ * once it ran (returning 1 when logged in, 0 otherwise), for the requests that
+ * can't block on a login (see api_multi).
+ */
+
+typedef struct t_api_client_request *(t_api_client_login_request)(
+	struct t_api_client *client);
+typedef int(t_api_client_login_finish)(struct t_api_client *client,
+				       struct t_api_client_request *request);
+
 enum t_api_client_request_type {
 	API_CLIENT_REQUEST_GET = 0,
 	API_CLIENT_REQUEST_POST,
@@ -28,6 +63,88 @@ enum t_api_client_request_type {
 	API_CLIENT_REQUEST_NUM_TYPES,
 };
 
+/*
+ * Classes of requests, each with its own retry policy.
+ */
+
+enum t_api_client_request_class {
+	API_CLIENT_CLASS_DEFAULT = 0,
+	API_CLIENT_CLASS_LOGIN,
+	/*
+	 * Uploads of readings, which are spooled when they fail.
+	 */
+	API_CLIENT_CLASS_READING,
+	/*
+	 * Number of request classes
+	 */
+	API_CLIENT_CLASS_NUM_CLASSES,
+};
+
+/*
+ * How a request of a class is retried. Connect errors and 5xx responses are
+ * retried, a 401 logs in again once (when relogin is set) and other failures
+ * are not retried, as the backend may have handled the request.
+ */
+
+struct t_api_client_retry_policy {
+	/*
+	 * Attempts per request, the first one included.
+	 */
+	int attempts;
+	/*
+	 * Delay (in ms) before the first retry, doubled for every next retry
+	 * up to max_delay. Up to half of it is taken off at random, so the
+	 * retries of many pis spread out.
+	 */
+	int delay;
+	int max_delay;
+	/*
+	 * Time (in ms) a connect, and a whole attempt, may take.
+	 */
+	int connect_timeout;
+	int timeout;
+	/*
+	 * 1 when a 401 logs in again and retries.
+	 */
+	int relogin;
+};
+
+/*
+ * Counters of the connection layer all clients share.
+ */
+
+struct t_api_client_connection_stats {
+	/*
+	 * Amount of requests executed.
+	 */
+	unsigned long requests;
+	/*
+	 * Amount of requests that went over an already open connection.
+	 */
+	unsigned long reused;
+	/*
+	 * Amount of new connections opened.
+	 */
+	unsigned long connects;
+	/*
+	 * Amount of TLS handshakes done, resumed sessions included.
+	 */
+	unsigned long tls_handshakes;
+	/*
+	 * Amount of requests that failed.
+	 */
+	unsigned long failures;
+	/*
+	 * Amount of attempts that were retried, and of logins redone for it.
+	 */
+	unsigned long retries;
+	unsigned long relogins;
+	/*
+	 * Time spent opening connections, handshakes included.
+	 */
+	uint64_t connect_total_ns;
+};
+
 struct t_api_client_cookie {
 	/*
 	 * The cookie content.
@@ -55,6 +172,25 @@ struct t_api_client_request {
 	 * Name of the request.
 	 */
 	const char *name;
+	/*
+	 * The client the request belongs to.
+	 */
+	struct t_api_client *client;
+	/*
+	 * Class of the request, selecting its retry policy.
+	 */
+	enum t_api_client_request_class request_class;
+	/*
+	 * Generation of the cookie sent with the request, 0 without one.
+	 */
+	unsigned long cookie_generation;
+	/*
+	 * Attempts made so far, whether the cookie was renewed for it and the
+	 * seed of its backoff, see api_client_request_retry.
+	 */
+	int attempt;
+	int relogged;
+	unsigned int seed;
 	/*
 	 * list containing the request headers, according to rfc2616 the order does
 	 * not matter.
@@ -96,6 +232,54 @@ struct t_api_client_request {
 	t_api_client_request_free_request_fields *callback_free_request_fields;
 };
 
+/*
+ * What the clients of one backend share: every sampler worker has a client of
+ * its own, but they log in once and see the backend go down together.
+ */
+
+struct t_api_client_session {
+	/*
+	 * The login cookie, NULL when not logged in. It is only read and
+	 * replaced under the lock, a login frees the cookie it replaces.
+	 */
+	struct t_api_client_cookie *cookie;
+	/*
+	 * Bumped whenever the cookie is replaced, tells a request refused
+	 * with an old cookie whether another client logged in since.
+	 */
+	unsigned long generation;
+	/*
+	 * Retry policy of every request class.
+	 */
+	struct t_api_client_retry_policy retry[API_CLIENT_CLASS_NUM_CLASSES];
+	/*
+	 * Breaker failing the requests fast while the backend is down.
+	 */
+	struct t_circuit *circuit;
+	/*
+	 * The callback used for logging in again, NULL when a 401 fails.
+	 */
+	t_api_client_login *callback_login;
+	/*
+	 * The callbacks used for logging in without blocking, NULL when only
+	 * callback_login is available.
+	 */
+	t_api_client_login_request *callback_login_request;
+	t_api_client_login_finish *callback_login_finish;
+	/*
+	 * Amount of clients sharing the session.
+	 */
+	int refs;
+	/*
+	 * Protects the cookie, the generation and the refs.
+	 */
+	pthread_mutex_t lock;
+	/*
+	 * Serializes logging in again, the workers run into a 401 together.
+	 */
+	pthread_mutex_t login_lock;
+};
+
 struct t_api_client {
 	/*
 	 * Settings for pilab.
@@ -106,9 +290,15 @@ struct t_api_client {
 	 */
 	struct t_hashtable *request_table;
 	/*
-	 * A client can have a login cookie.
+	 * The login, retry policies and circuit, shared with the clients
+	 * created by api_client_create_shared.
 	 */
-	struct t_api_client_cookie *cookie;
+	struct t_api_client_session *session;
+	/*
+	 * Handle of a freed request, kept with its open connection for the
+	 * next request of the client. NULL when there is none.
+	 */
+	CURL *spare_handle;
 
 	/* Callbacks */
 
@@ -123,11 +313,23 @@ struct t_api_client {
 };
 
 extern int api_client_get_request_type(const char *type);
+extern int api_client_get_request_class(const char *request_class);
+extern int api_client_connections_init(void);
+extern void api_client_get_connection_stats(
+	struct t_api_client_connection_stats *stats);
+extern void api_client_connections_free(void);
 extern struct t_api_client *api_client_create_custom(
 	struct t_pilab_config *config,
 	t_api_client_write_response_body *callback_write_response_body,
 	t_api_client_write_response_headers *callback_write_response_headers);
 extern struct t_api_client *api_client_create(struct t_pilab_config *config);
+extern struct t_api_client *api_client_create_shared(struct t_api_client *client);
+extern void api_client_set_pointer(struct t_api_client *client,
+				   const char *property, void *pointer);
+extern int api_client_set_retry(struct t_api_client *client, int request_class,
+				const char *policy);
+extern int api_client_set_circuit(struct t_api_client *client, int threshold,
+				  int probe_interval);
 extern struct t_api_client_cookie *api_client_cookie_create(char *content);
 extern struct t_api_client_request *api_client_request_create_custom(
 	struct t_api_client *client, const char *url, const char *type_request,
@@ -150,13 +352,23 @@ extern int api_client_init_request(struct t_api_client *client,
 				   struct t_api_client_request *request,
 				   int with_headers);
 extern int api_client_is_valid_cookie(struct t_api_client_cookie *cookie);
+extern int api_client_has_valid_cookie(struct t_api_client *client);
+extern int api_client_request_add_cookie(struct t_api_client_request *request);
+extern int api_client_request_renew_cookie(struct t_api_client_request *request);
+extern int api_client_request_relogin(struct t_api_client_request *request);
 extern char *api_client_get_cookie_content(struct t_api_client *client);
 extern char *api_client_get_cookie_expire_date(struct t_api_client *client);
 extern void api_client_set_cookie(struct t_api_client *client,
 				  struct t_api_client_cookie *cookie);
 extern char *api_client_request_get_header(struct t_api_client_request *request,
 					   const char *header);
+extern int api_client_request_begin(struct t_api_client_request *request);
+extern int api_client_request_allow(struct t_api_client_request *request);
+extern long api_client_request_retry(struct t_api_client_request *request,
+				     CURLcode rc);
 extern int api_client_request_execute(struct t_api_client_request *request);
+extern int api_client_request_complete(struct t_api_client_request *request,
+				       CURLcode rc);
 extern int api_client_execute_all_requests(struct t_api_client *client);
 extern int api_client_get_http_status_code_request(
 	struct t_api_client_request *request);
@@ -174,6 +386,8 @@ extern size_t api_client_write_response_body_default_cb(char *contents,
 							void *response_buffer);
 extern void api_client_request_set_pointer(struct t_api_client_request *request,
 					   const char *property, void *pointer);
+extern void api_client_request_set_class(struct t_api_client_request *request,
+					 int request_class);
 struct t_api_client_request *
 	api_client_request_json(struct t_api_client *client,
 				json_object *fields, const char *url,
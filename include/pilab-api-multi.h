@@ -0,0 +1,152 @@
+#ifndef _PILAB_API_MULTI_H
+#define _PILAB_API_MULTI_H
+#include <pthread.h>
+#include <stdint.h>
+#include <curl/curl.h>
+#include "pilab-api-client.h"
+#include "pilab-event-loop.h"
+
+/* Transfers in flight at once, unless asked otherwise */
+#define PILAB_API_MULTI_DEFAULT_PARALLEL 4
+/* Longest wait (in ms) for activity, when the multi drives itself */
+#define PILAB_API_MULTI_WAIT 1000
+
+struct t_api_multi;
+
+/*
+ * Callback functions.
+ *
+ * Called once per request when it finished, retries included, rc is what
+ * api_client_request_complete returned for its last attempt (0 when the
+ * circuit of the client let it fail fast). The request is no longer part of
+ * the multi, so the callback may close it.
+ */
+
+typedef void(t_api_multi_callback_done)(struct t_api_multi *multi,
+					struct t_api_client_request *request,
+					int rc, void *data);
+
+struct t_api_multi_stats {
+	/*
+	 * Amount of transfers started.
+	 */
+	unsigned long started;
+	/*
+	 * Amount of transfers that succeeded.
+	 */
+	unsigned long completed;
+	/*
+	 * Amount of transfers that failed.
+	 */
+	unsigned long failed;
+	/*
+	 * Amount of transfers that were retried, see api_client_request_retry.
+	 */
+	unsigned long retried;
+	/*
+	 * Amount of logins the multi ran for its requests.
+	 */
+	unsigned long logins;
+	/*
+	 * Most transfers that were in flight at once.
+	 */
+	int running_max;
+};
+
+struct t_api_multi {
+	/*
+	 * The client the requests belong to.
+	 */
+	struct t_api_client *client;
+	/*
+	 * The multi handle provided by the curl library.
+	 */
+	CURLM *handle;
+	/*
+	 * Cap on the transfers in flight at once.
+	 */
+	int max_parallel;
+	/*
+	 * Requests waiting for a free transfer slot, in the order they were
+	 * added.
+	 */
+	struct t_api_client_request **queue;
+	int queue_size;
+	int queue_head;
+	int queue_tail;
+	/*
+	 * Requests in flight, by transfer slot (NULL for a free slot).
+	 */
+	struct t_api_client_request **active;
+	/*
+	 * Amount of transfers in flight.
+	 */
+	int running;
+	/*
+	 * Requests waiting out the backoff before their next attempt, with when
+	 * (monotonic ns) they are due. The ones waiting for the login are due
+	 * once it is done.
+	 */
+	struct t_api_client_request **waiting;
+	uint64_t *waiting_due;
+	int waiting_size;
+	int num_waiting;
+	/*
+	 * The login the multi runs for its requests, NULL when none is on its
+	 * way. It is owned by the multi.
+	 */
+	struct t_api_client_request *login;
+	/*
+	 * The event loop driving the multi, NULL when it drives itself.
+	 */
+	struct t_event_loop *loop;
+	/*
+	 * The timeout curl asked for, while driven by an event loop.
+	 */
+	struct t_event_loop_source *timeout;
+	/*
+	 * The timeout of the first waiting request, while driven by an event
+	 * loop.
+	 */
+	struct t_event_loop_source *retry_timeout;
+	/*
+	 * The thread driving the multi, see api_multi_start.
+	 */
+	pthread_t thread;
+	int threaded;
+	/*
+	 * Statistics of the multi.
+	 */
+	struct t_api_multi_stats stats;
+
+	/* Callbacks */
+
+	/*
+	 * Called for every finished request.
+	 */
+	t_api_multi_callback_done *callback_done;
+	/*
+	 * Data passed to the done callback.
+	 */
+	void *callback_done_data;
+};
+
+extern struct t_api_multi *api_multi_create(struct t_api_client *client,
+					    int max_parallel);
+extern void api_multi_set_pointer(struct t_api_multi *multi,
+				  const char *property, void *pointer);
+extern int api_multi_add_request(struct t_api_multi *multi,
+				 struct t_api_client_request *request);
+extern int api_multi_add_all_requests(struct t_api_multi *multi);
+extern int api_multi_remaining(struct t_api_multi *multi);
+extern int api_multi_attach(struct t_api_multi *multi,
+			    struct t_event_loop *loop);
+extern int api_multi_perform(struct t_api_multi *multi, int timeout);
+extern int api_multi_run(struct t_api_multi *multi);
+extern int api_multi_start(struct t_api_multi *multi);
+extern int api_multi_join(struct t_api_multi *multi);
+extern void api_multi_get_stats(struct t_api_multi *multi,
+				struct t_api_multi_stats *stats);
+extern void api_multi_free(struct t_api_multi *multi);
+
+#endif
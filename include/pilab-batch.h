@@ -0,0 +1,99 @@
+#ifndef _PILAB_BATCH_H
+#define _PILAB_BATCH_H
+#include <pthread.h>
+#include <stdint.h>
+#include <json-c/json.h>
+
+/* Readings per upload, used when a batch doesn't specify it */
+#define PILAB_BATCH_DEFAULT_SIZE 32
+/* Longest time (in ms) a reading waits for its upload, used by default */
+#define PILAB_BATCH_DEFAULT_AGE 10000
+/* Longest sensor name and type kept with a reading */
+#define PILAB_BATCH_MAX_NAME 64
+#define PILAB_BATCH_MAX_TYPE 32
+
+/* Sensor option naming what the sensor measures */
+#define PILAB_BATCH_OPTION_TYPE "type"
+#define PILAB_BATCH_DEFAULT_TYPE "Temperature"
+
+/* Keys of a reading in the uploaded array */
+#define PILAB_BATCH_KEY_NAME "Name"
+#define PILAB_BATCH_KEY_TYPE "Type"
+#define PILAB_BATCH_KEY_TIMESTAMP "Timestamp"
+#define PILAB_BATCH_KEY_VALUE "Value"
+
+struct t_batch_item {
+	char name[PILAB_BATCH_MAX_NAME];
+	char type[PILAB_BATCH_MAX_TYPE];
+	/*
+	 * Wall clock time (ms since the epoch) the reading was taken.
+	 */
+	uint64_t timestamp;
+	double value;
+};
+
+struct t_batch_stats {
+	/*
+	 * Amount of readings added.
+	 */
+	unsigned long added;
+	/*
+	 * Amount of readings that didn't fit, as the batch wasn't taken.
+	 */
+	unsigned long dropped;
+	/*
+	 * Amount of batches taken, because they were full or old.
+	 */
+	unsigned long full;
+	unsigned long aged;
+	/*
+	 * Amount of batches taken on request, e.g. at shutdown.
+	 */
+	unsigned long forced;
+	/*
+	 * Amount of readings taken.
+	 */
+	unsigned long taken;
+};
+
+struct t_batch {
+	/*
+	 * The readings waiting for their upload.
+	 */
+	struct t_batch_item *items;
+	int num_items;
+	/*
+	 * Amount of readings that makes the batch due.
+	 */
+	int max_items;
+	/*
+	 * Age (ns) of the oldest reading that makes the batch due.
+	 */
+	uint64_t max_age;
+	/*
+	 * When (monotonic ns) the oldest reading was added.
+	 */
+	uint64_t oldest;
+	/*
+	 * Statistics of the batch.
+	 */
+	struct t_batch_stats stats;
+	/*
+	 * Protects the readings, every sampler worker adds to the batch.
+	 */
+	pthread_mutex_t lock;
+};
+
+extern struct t_batch *batch_create(int max_items, int max_age);
+extern int batch_add(struct t_batch *batch, const char *name,
+		     const char *type, uint64_t timestamp, double value,
+		     uint64_t now);
+extern int batch_is_due(struct t_batch *batch, uint64_t now);
+extern json_object *batch_items_to_json(const struct t_batch_item *items,
+					int num_items);
+extern json_object *batch_take(struct t_batch *batch, uint64_t now, int force);
+extern void batch_get_stats(struct t_batch *batch,
+			    struct t_batch_stats *stats);
+extern void batch_free(struct t_batch *batch);
+
+#endif
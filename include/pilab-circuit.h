@@ -0,0 +1,78 @@
+#ifndef _PILAB_CIRCUIT_H
+#define _PILAB_CIRCUIT_H
+#include <pthread.h>
+#include <stdint.h>
+
+/* Failures in a row that open a circuit, used when it doesn't specify it */
+#define PILAB_CIRCUIT_DEFAULT_THRESHOLD 5
+/* Time (in ms) between two probes of an open circuit, used by default */
+#define PILAB_CIRCUIT_DEFAULT_PROBE 30000
+
+enum t_circuit_state {
+	/*
+	 * Everything goes through.
+	 */
+	CIRCUIT_CLOSED = 0,
+	/*
+	 * The backend is down, everything fails fast until the next probe.
+	 */
+	CIRCUIT_OPEN,
+	/*
+	 * A probe is on its way, everything else fails fast.
+	 */
+	CIRCUIT_HALF_OPEN,
+};
+
+struct t_circuit_stats {
+	/*
+	 * Amount of times the circuit opened.
+	 */
+	unsigned long opened;
+	/*
+	 * Amount of times a probe closed the circuit again.
+	 */
+	unsigned long closed;
+	/*
+	 * Amount of probes let through.
+	 */
+	unsigned long probes;
+	/*
+	 * Amount of requests that failed fast.
+	 */
+	unsigned long rejected;
+};
+
+struct t_circuit {
+	enum t_circuit_state state;
+	/*
+	 * Failures in a row, and the amount that opens the circuit.
+	 */
+	int failures;
+	int threshold;
+	/*
+	 * Time (ns) between two probes.
+	 */
+	uint64_t probe_interval;
+	/*
+	 * When (monotonic ns) the next probe is let through.
+	 */
+	uint64_t next_probe;
+	/*
+	 * Statistics of the circuit.
+	 */
+	struct t_circuit_stats stats;
+	/*
+	 * Protects the state, every worker goes through the circuit.
+	 */
+	pthread_mutex_t lock;
+};
+
+extern struct t_circuit *circuit_create(int threshold, int probe_interval);
+extern int circuit_allow(struct t_circuit *circuit, uint64_t now);
+extern void circuit_success(struct t_circuit *circuit);
+extern void circuit_failure(struct t_circuit *circuit, uint64_t now);
+extern void circuit_get_stats(struct t_circuit *circuit,
+			      struct t_circuit_stats *stats);
+extern void circuit_free(struct t_circuit *circuit);
+
+#endif
@@ -10,6 +10,25 @@ enum t_config_field_types {
 	CONFIG_FIELD_ADDRESS,
 	CONFIG_FIELD_PORT,
 	CONFIG_FIELD_MAC,
+	CONFIG_FIELD_SAMPLER_WORKERS,
+	CONFIG_FIELD_SCHEDULE_JITTER,
+	CONFIG_FIELD_SHUTDOWN_TIMEOUT,
+	CONFIG_FIELD_W1_ROOT,
+	CONFIG_FIELD_HAL,
+	CONFIG_FIELD_TRACE_RECORD,
+	CONFIG_FIELD_TRACE_REPLAY,
+	CONFIG_FIELD_TRACE_SPEED,
+	CONFIG_FIELD_BATCH_SIZE,
+	CONFIG_FIELD_BATCH_AGE,
+	CONFIG_FIELD_SPOOL_DIR,
+	CONFIG_FIELD_SPOOL_MODE,
+	CONFIG_FIELD_SPOOL_SIZE,
+	CONFIG_FIELD_SPOOL_RATE,
+	CONFIG_FIELD_RETRY_DEFAULT,
+	CONFIG_FIELD_RETRY_LOGIN,
+	CONFIG_FIELD_RETRY_READING,
+	CONFIG_FIELD_CIRCUIT_THRESHOLD,
+	CONFIG_FIELD_CIRCUIT_PROBE,
 	/*
 	 * Number of fields.
 	 */
@@ -59,6 +78,110 @@ struct t_pilab_config {
 	 * NOTE: This will be set automatically.
 	 */
 	char *base_url;
+	/*
+	 * Amount of threads used for reading the sensors.
+	 *
+	 * NOTE: 0 means the sampler default is used.
+	 */
+	int sampler_workers;
+	/*
+	 * Maximum random delay added to every reading, as a percentage of the
+	 * sampling interval of the device.
+	 */
+	int schedule_jitter;
+	/*
+	 * Maximum time (in seconds) a shutdown waits for running readings.
+	 *
+	 * NOTE: 0 means the sampler default is used.
+	 */
+	int shutdown_timeout;
+	/*
+	 * Sysfs directory of the 1-Wire bus, e.g. a simulated w1 tree.
+	 *
+	 * NOTE: NULL means /sys/bus/w1/devices is used.
+	 */
+	char *w1_root;
+	/*
+	 * Backend the drivers go through, wiringpi or sim.
+	 *
+	 * NOTE: NULL means wiringpi is used.
+	 */
+	char *hal;
+	/*
+	 * Trace file every raw device read is recorded to.
+	 *
+	 * NOTE: NULL means nothing is recorded.
+	 */
+	char *trace_record;
+	/*
+	 * Trace file the device reads are served from, instead of the devices.
+	 *
+	 * NOTE: NULL means the devices are read.
+	 */
+	char *trace_replay;
+	/*
+	 * Multiple of the recorded time a trace is replayed at (1 to 1000).
+	 *
+	 * NOTE: 0 means the trace is replayed in real time.
+	 */
+	int trace_speed;
+	/*
+	 * Amount of readings uploaded together.
+	 *
+	 * NOTE: 0 (or 1) uploads every reading on its own.
+	 */
+	int batch_size;
+	/*
+	 * Longest time (in ms) a reading waits for the rest of its batch.
+	 *
+	 * NOTE: 0 means the batch default is used.
+	 */
+	int batch_age;
+	/*
+	 * Directory the readings are spooled to while they can't be uploaded.
+	 *
+	 * NOTE: NULL means readings that fail to upload are lost.
+	 */
+	char *spool_dir;
+	/*
+	 * When readings go through the spool, fallback or always.
+	 *
+	 * NOTE: NULL means fallback, only the readings that failed to upload.
+	 */
+	char *spool_mode;
+	/*
+	 * Disk space (in KB) the spool may take.
+	 *
+	 * NOTE: 0 means the spool default is used.
+	 */
+	int spool_size;
+	/*
+	 * Amount of spooled readings forwarded per second.
+	 *
+	 * NOTE: 0 means the spool default is used.
+	 */
+	int spool_rate;
+	/*
+	 * Retry policies of the request classes, as "attempts/delay/max_delay"
+	 * with the delays in ms.
+	 *
+	 * NOTE: NULL means the api client default of the class is used.
+	 */
+	char *retry_default;
+	char *retry_login;
+	char *retry_reading;
+	/*
+	 * Failed requests in a row after which requests fail fast.
+	 *
+	 * NOTE: 0 means the circuit default is used.
+	 */
+	int circuit_threshold;
+	/*
+	 * Time (in ms) between two probes of the backend while it is down.
+	 *
+	 * NOTE: 0 means the circuit default is used.
+	 */
+	int circuit_probe;
 };
 
 /* Keywords config */
@@ -68,6 +191,25 @@ struct t_pilab_config {
 #define PILAB_CONFIG_FIELD_ADDRESS "address"
 #define PILAB_CONFIG_FIELD_PORT "port"
 #define PILAB_CONFIG_FIELD_MAC "mac"
+#define PILAB_CONFIG_FIELD_SAMPLER_WORKERS "sampler_workers"
+#define PILAB_CONFIG_FIELD_SCHEDULE_JITTER "schedule_jitter"
+#define PILAB_CONFIG_FIELD_SHUTDOWN_TIMEOUT "shutdown_timeout"
+#define PILAB_CONFIG_FIELD_W1_ROOT "w1_root"
+#define PILAB_CONFIG_FIELD_HAL "hal"
+#define PILAB_CONFIG_FIELD_TRACE_RECORD "trace_record"
+#define PILAB_CONFIG_FIELD_TRACE_REPLAY "trace_replay"
+#define PILAB_CONFIG_FIELD_TRACE_SPEED "trace_speed"
+#define PILAB_CONFIG_FIELD_BATCH_SIZE "batch_size"
+#define PILAB_CONFIG_FIELD_BATCH_AGE "batch_age"
+#define PILAB_CONFIG_FIELD_SPOOL_DIR "spool_dir"
+#define PILAB_CONFIG_FIELD_SPOOL_MODE "spool_mode"
+#define PILAB_CONFIG_FIELD_SPOOL_SIZE "spool_size"
+#define PILAB_CONFIG_FIELD_SPOOL_RATE "spool_rate"
+#define PILAB_CONFIG_FIELD_RETRY_DEFAULT "retry_default"
+#define PILAB_CONFIG_FIELD_RETRY_LOGIN "retry_login"
+#define PILAB_CONFIG_FIELD_RETRY_READING "retry_reading"
+#define PILAB_CONFIG_FIELD_CIRCUIT_THRESHOLD "circuit_threshold"
+#define PILAB_CONFIG_FIELD_CIRCUIT_PROBE "circuit_probe"
 
 extern int config_get_field_type(const char *type);
 extern struct t_pilab_config *config_create_custom(const char *path);
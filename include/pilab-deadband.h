@@ -0,0 +1,74 @@
+#ifndef _PILAB_DEADBAND_H
+#define _PILAB_DEADBAND_H
+#include <pthread.h>
+#include <stdint.h>
+
+/* Heartbeat (in seconds) used when a deadband doesn't specify one */
+#define PILAB_DEADBAND_DEFAULT_MAX_SILENCE (60 * 60)
+
+/* Sensor options controlling the deadband */
+#define PILAB_DEADBAND_OPTION_ABSOLUTE "deadband_abs"
+#define PILAB_DEADBAND_OPTION_RELATIVE "deadband_rel"
+#define PILAB_DEADBAND_OPTION_MAX_SILENCE "max_silence"
+
+struct t_deadband_stats {
+	/*
+	 * Amount of readings checked against the deadband.
+	 */
+	unsigned long readings;
+	/*
+	 * Amount of readings that were sent.
+	 */
+	unsigned long sent;
+	/*
+	 * Amount of readings sent only because the heartbeat expired.
+	 */
+	unsigned long heartbeats;
+	/*
+	 * Amount of readings that fell within the deadband.
+	 */
+	unsigned long suppressed;
+};
+
+struct t_deadband {
+	/*
+	 * Smallest absolute change that is reported.
+	 */
+	double absolute;
+	/*
+	 * Smallest change that is reported, relative to the last sent value
+	 * (0.01 is 1%).
+	 */
+	double relative;
+	/*
+	 * Longest time (ns) without sending a reading, 0 disables the
+	 * heartbeat.
+	 */
+	uint64_t max_silence;
+	/*
+	 * Last value sent and when (monotonic ns), valid when has_sent is set.
+	 */
+	double last_value;
+	uint64_t last_sent_at;
+	int has_sent;
+	/*
+	 * Statistics of the deadband.
+	 */
+	struct t_deadband_stats stats;
+	/*
+	 * Protects the state, readings of one sensor may overlap.
+	 */
+	pthread_mutex_t lock;
+};
+
+extern struct t_deadband *deadband_create(double absolute, double relative,
+					  int max_silence);
+extern int deadband_check(struct t_deadband *deadband, double value,
+			  uint64_t now);
+extern void deadband_sent(struct t_deadband *deadband, double value,
+			  uint64_t now);
+extern void deadband_get_stats(struct t_deadband *deadband,
+			       struct t_deadband_stats *stats);
+extern void deadband_free(struct t_deadband *deadband);
+
+#endif
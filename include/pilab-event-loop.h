@@ -0,0 +1,108 @@
+#ifndef _PILAB_EVENT_LOOP_H
+#define _PILAB_EVENT_LOOP_H
+#include <stdint.h>
+#include <signal.h>
+#include <sys/epoll.h>
+
+/* Amount of events handled per epoll_wait */
+#define PILAB_EVENT_LOOP_MAX_EVENTS 16
+
+struct t_event_loop;
+struct t_event_loop_source;
+
+/*
+ * Callback functions.
+ *
+ * Called from the thread running the event loop.
+ */
+
+typedef void(t_event_loop_fd_callback)(struct t_event_loop *loop, int fd,
+				       uint32_t events, void *data);
+typedef void(t_event_loop_signal_callback)(struct t_event_loop *loop,
+					   int signo, void *data);
+
+struct t_event_loop_source {
+	/*
+	 * The watched file descriptor.
+	 */
+	int fd;
+	/*
+	 * The epoll events the source is interested in.
+	 */
+	uint32_t events;
+	/*
+	 * 1 when the loop owns (and closes) the file descriptor.
+	 */
+	int owned;
+	/*
+	 * 1 when the source has been removed, it is freed after the current
+	 * round of events.
+	 */
+	int removed;
+	/*
+	 * Data passed to the callbacks.
+	 */
+	void *data;
+	/*
+	 * Next source of the loop.
+	 */
+	struct t_event_loop_source *next;
+
+	/* Callbacks */
+
+	/*
+	 * Called when the file descriptor is ready.
+	 */
+	t_event_loop_fd_callback *callback_fd;
+	/*
+	 * Called for every signal received on a signalfd source.
+	 */
+	t_event_loop_signal_callback *callback_signal;
+};
+
+struct t_event_loop {
+	/*
+	 * The epoll instance.
+	 */
+	int epoll_fd;
+	/*
+	 * eventfd used for waking the loop from other threads.
+	 */
+	int wake_fd;
+	/*
+	 * 1 while the loop is running, 0 otherwise.
+	 */
+	volatile sig_atomic_t running;
+	/*
+	 * All the sources registered with the loop.
+	 */
+	struct t_event_loop_source *sources;
+};
+
+extern struct t_event_loop *event_loop_create(void);
+extern struct t_event_loop_source *
+	event_loop_add_fd(struct t_event_loop *loop, int fd, uint32_t events,
+			  t_event_loop_fd_callback *callback_fd, void *data);
+extern int event_loop_modify_fd(struct t_event_loop *loop,
+				struct t_event_loop_source *source,
+				uint32_t events);
+extern struct t_event_loop_source *
+	event_loop_add_timer(struct t_event_loop *loop, int interval,
+			     t_event_loop_fd_callback *callback_fd, void *data);
+extern struct t_event_loop_source *
+	event_loop_add_timeout(struct t_event_loop *loop, int timeout,
+			       t_event_loop_fd_callback *callback_fd, void *data);
+extern int event_loop_arm_timeout(struct t_event_loop_source *source,
+				  int timeout);
+extern struct t_event_loop_source *
+	event_loop_add_signals(struct t_event_loop *loop, const sigset_t *mask,
+			       t_event_loop_signal_callback *callback_signal,
+			       void *data);
+extern void event_loop_remove_source(struct t_event_loop *loop,
+				     struct t_event_loop_source *source);
+extern int event_loop_dispatch(struct t_event_loop *loop, int timeout);
+extern int event_loop_run(struct t_event_loop *loop);
+extern void event_loop_stop(struct t_event_loop *loop);
+extern void event_loop_free(struct t_event_loop *loop);
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef _PILAB_FILTER_H
+#define _PILAB_FILTER_H
+#include <pthread.h>
+
+/* Defaults of the filter stage */
+#define PILAB_FILTER_DEFAULT_SAMPLES 1
+#define PILAB_FILTER_DEFAULT_REREADS 2
+#define PILAB_FILTER_DEFAULT_TRIM 25
+#define PILAB_FILTER_DEFAULT_ALPHA 0.3
+#define PILAB_FILTER_MAX_SENTINELS 8
+
+/* Strings for the filter methods */
+#define PILAB_FILTER_MEDIAN "median"
+#define PILAB_FILTER_TRIMMED_MEAN "trimmed"
+#define PILAB_FILTER_EWMA "ewma"
+
+/* Sensor options controlling the filter */
+#define PILAB_FILTER_OPTION_SAMPLES "oversample"
+#define PILAB_FILTER_OPTION_METHOD "filter"
+#define PILAB_FILTER_OPTION_REREADS "filter_rereads"
+#define PILAB_FILTER_OPTION_TRIM "filter_trim"
+#define PILAB_FILTER_OPTION_ALPHA "filter_alpha"
+#define PILAB_FILTER_OPTION_SENTINEL "sentinel"
+
+enum t_filter_methods {
+	FILTER_MEDIAN = 0,
+	FILTER_TRIMMED_MEAN,
+	FILTER_EWMA,
+	/*
+	 * Number of fields.
+	 */
+	FILTER_NUM_METHODS,
+};
+
+/*
+ * Callback functions.
+ *
+ * Takes a single sub-sample, returns 1 and stores the value on success.
+ */
+
+typedef int(t_filter_read_sample)(void *data, double *value);
+
+struct t_filter_stats {
+	/*
+	 * Amount of filtered readings.
+	 */
+	unsigned long readings;
+	/*
+	 * Amount of sub-samples taken, including the rejected ones.
+	 */
+	unsigned long samples;
+	/*
+	 * Amount of sub-samples rejected (failed read or sentinel value).
+	 */
+	unsigned long rejects;
+	/*
+	 * Amount of extra sub-samples taken to replace rejected ones.
+	 */
+	unsigned long rereads;
+	/*
+	 * Amount of readings without a single valid sub-sample.
+	 */
+	unsigned long failures;
+};
+
+struct t_filter {
+	/*
+	 * How the sub-samples are reduced to a single reading.
+	 */
+	enum t_filter_methods method;
+	/*
+	 * Amount of valid sub-samples taken per reading.
+	 */
+	int samples;
+	/*
+	 * Extra sub-samples allowed per reading, to replace rejected ones.
+	 */
+	int max_rereads;
+	/*
+	 * Percentage cut from both ends, for the trimmed mean.
+	 */
+	int trim;
+	/*
+	 * Smoothing factor (0, 1] of the EWMA, higher follows faster.
+	 */
+	double alpha;
+	/*
+	 * Values the device returns when a read went wrong.
+	 */
+	double sentinels[PILAB_FILTER_MAX_SENTINELS];
+	int num_sentinels;
+	/*
+	 * State of the EWMA, valid when has_average is set.
+	 */
+	double average;
+	int has_average;
+	/*
+	 * Room for the sub-samples of one reading.
+	 */
+	double *buffer;
+	/*
+	 * Statistics of the filter.
+	 */
+	struct t_filter_stats stats;
+	/*
+	 * Protects the state, readings of one sensor may overlap.
+	 */
+	pthread_mutex_t lock;
+};
+
+extern int filter_get_method(const char *method);
+extern struct t_filter *filter_create(int method, int samples);
+extern void filter_set_max_rereads(struct t_filter *filter, int max_rereads);
+extern void filter_set_trim(struct t_filter *filter, int trim);
+extern void filter_set_alpha(struct t_filter *filter, double alpha);
+extern int filter_add_sentinel(struct t_filter *filter, double sentinel);
+extern int filter_is_sentinel(struct t_filter *filter, double value);
+extern int filter_read(struct t_filter *filter,
+		       t_filter_read_sample *read_sample, void *data,
+		       double *value);
+extern void filter_get_stats(struct t_filter *filter,
+			     struct t_filter_stats *stats);
+extern void filter_free(struct t_filter *filter);
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef _PILAB_GPIO_BANK_H
+#define _PILAB_GPIO_BANK_H
+#include <pthread.h>
+#include <stdint.h>
+
+/* Lines in a single request, as limited by the kernel */
+#define PILAB_GPIO_BANK_MAX_LINES 64
+/* Label of the requested lines, as shown by gpioinfo */
+#define PILAB_GPIO_BANK_CONSUMER "pilab"
+
+struct t_gpio_bank;
+
+/*
+ * Interface functions.
+ *
+ * These functions should be implemented by the bank backends, the lines are
+ * addressed by their index in the bank (bit i of mask and bits is line i).
+ */
+
+/*
+ * Read the lines in mask at once.
+ *
+ * Returns 1 on success, 0 otherwise.
+ */
+typedef int(t_gpio_bank_get_values)(void *instance, uint64_t mask,
+				    uint64_t *bits);
+/*
+ * Drive the lines in mask at once.
+ *
+ * Returns 1 on success, 0 otherwise.
+ */
+typedef int(t_gpio_bank_set_values)(void *instance, uint64_t mask,
+				    uint64_t bits);
+typedef void(t_gpio_bank_free_bank)(void *instance);
+
+struct t_gpio_bank_stats {
+	/*
+	 * Amount of reads from the backend.
+	 */
+	unsigned long reads;
+	/*
+	 * Amount of line values those reads returned.
+	 */
+	unsigned long lines_read;
+	/*
+	 * Amount of writes to the backend.
+	 */
+	unsigned long writes;
+	/*
+	 * Amount of line values those writes drove.
+	 */
+	unsigned long lines_written;
+	/*
+	 * Amount of reads and writes that failed.
+	 */
+	unsigned long errors;
+};
+
+struct t_gpio_bank {
+	/*
+	 * The concrete backend of the bank.
+	 */
+	void *instance;
+	/*
+	 * Offsets of the lines on their chip, by index in the bank.
+	 */
+	int offsets[PILAB_GPIO_BANK_MAX_LINES];
+	int num_lines;
+	/*
+	 * 1 when the lines are outputs, 0 when they are inputs.
+	 */
+	int output;
+	/*
+	 * Line values of the last snapshot, or the last write of an output
+	 * bank.
+	 */
+	uint64_t values;
+	/*
+	 * Statistics of the bank.
+	 */
+	struct t_gpio_bank_stats stats;
+	/*
+	 * Protects the values and the statistics.
+	 */
+	pthread_mutex_t lock;
+	/*
+	 * Function used for reading lines at once.
+	 */
+	t_gpio_bank_get_values *get_values;
+	/*
+	 * Function used for driving lines at once, NULL for an input bank.
+	 */
+	t_gpio_bank_set_values *set_values;
+	/*
+	 * Free the backend.
+	 */
+	t_gpio_bank_free_bank *free_bank;
+};
+
+extern struct t_gpio_bank *gpio_bank_create(void *instance,
+					    const int *offsets, int num_lines,
+					    int output,
+					    t_gpio_bank_get_values *get_values,
+					    t_gpio_bank_set_values *set_values,
+					    t_gpio_bank_free_bank *free_bank);
+extern struct t_gpio_bank *gpio_bank_request(const char *chip,
+					     const int *offsets, int num_lines,
+					     int output);
+extern int gpio_bank_index(struct t_gpio_bank *bank, int offset);
+extern int gpio_bank_snapshot(struct t_gpio_bank *bank, uint64_t *values);
+extern int gpio_bank_read_line(struct t_gpio_bank *bank, int offset);
+extern int gpio_bank_get(struct t_gpio_bank *bank, int offset);
+extern int gpio_bank_write(struct t_gpio_bank *bank, uint64_t mask,
+			   uint64_t bits);
+extern int gpio_bank_write_line(struct t_gpio_bank *bank, int offset,
+				int value);
+extern void gpio_bank_get_stats(struct t_gpio_bank *bank,
+				struct t_gpio_bank_stats *stats);
+extern void gpio_bank_free(struct t_gpio_bank *bank);
+
+#endif
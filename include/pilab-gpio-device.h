@@ -2,6 +2,10 @@
 #define _PILAB_GPIO_DEVICE_H
 #include "pilab-slave-device.h"
 #include "pilab-host-device.h"
+#include "pilab-w1-bus.h"
+
+/* A 1-Wire conversion takes 750 ms, the kernel adds its share */
+#define PILAB_GPIO_DEVICE_READ_TIMEOUT 2000
 
 typedef int(t_gpio_device_init_strategy)(void *arg1, void *arg2);
 
@@ -20,6 +24,23 @@ struct t_gpio_device {
 	 * Pin base should be a number > 0x40.
 	 */
 	int pin_base;
+	/*
+	 * Factor that turns a raw reading into unit.
+	 */
+	double scale;
+	/*
+	 * Unit of a scaled reading, "" for raw values.
+	 */
+	const char *unit;
+	/*
+	 * Raw value the module returns when a read fails, besides
+	 * PILAB_SLAVE_DEVICE_READ_FAILED.
+	 */
+	int failed_raw;
+	/*
+	 * Probe on the 1-Wire bus of the host, NULL for other modules.
+	 */
+	struct t_w1_probe *w1_probe;
 
 	/* Callbacks */
 
@@ -37,6 +58,8 @@ extern int gpio_device_analog_read(const void *instance, int pin);
 extern void gpio_device_analog_write(const void *instance, int pin, int value);
 extern int gpio_device_digitial_read(const void *instance, int pin);
 extern void gpio_device_digital_write(const void *instance, int pin, int value);
+extern int gpio_device_read_sample(const void *instance,
+				   struct t_slave_device_sample *sample);
 extern void gpio_device_init(const void *instance);
 extern int gpio_device_get_pin_base(const void *instance);
 extern void gpio_device_set_pointer(const void *instance, const char *property,
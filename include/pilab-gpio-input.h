@@ -0,0 +1,102 @@
+#ifndef _PILAB_GPIO_INPUT_H
+#define _PILAB_GPIO_INPUT_H
+#include <stdint.h>
+
+/* The gpio controller of the Raspberry Pi, its lines are the BCM numbers */
+#define PILAB_GPIO_INPUT_DEFAULT_CHIP "/dev/gpiochip0"
+/* Label of the requested lines, as shown by gpioinfo */
+#define PILAB_GPIO_INPUT_CONSUMER "pilab"
+/* Lines in a single request, as limited by the kernel */
+#define PILAB_GPIO_INPUT_MAX_LINES 64
+/* Edges closer (in ms) to the last accepted edge of a line are bounces */
+#define PILAB_GPIO_INPUT_DEFAULT_DEBOUNCE 50
+/* Amount of events read from the kernel at once */
+#define PILAB_GPIO_INPUT_MAX_EVENTS 16
+
+struct t_gpio_input;
+
+/*
+ * Callback functions.
+ *
+ * Called from the thread dispatching the events, for every edge that passes
+ * the debounce with the new level (HIGH/LOW) of the line.
+ */
+
+typedef void(t_gpio_input_callback_edge)(struct t_gpio_input *input,
+					 int line, int level, void *data);
+
+struct t_gpio_input_line {
+	/*
+	 * Offset of the line on the gpio chip.
+	 */
+	int offset;
+	/*
+	 * Level of the line, after the debounce.
+	 */
+	int level;
+	/*
+	 * Kernel timestamp (ns) of the last accepted edge, 0 when none yet.
+	 */
+	uint64_t last_edge;
+};
+
+struct t_gpio_input_stats {
+	/*
+	 * Amount of edges reported by the kernel.
+	 */
+	unsigned long events;
+	/*
+	 * Amount of rising edges passed on.
+	 */
+	unsigned long rising;
+	/*
+	 * Amount of falling edges passed on.
+	 */
+	unsigned long falling;
+	/*
+	 * Amount of edges dropped as contact bounce.
+	 */
+	unsigned long bounces;
+	/*
+	 * Longest time (ns) between an edge and its dispatch.
+	 */
+	uint64_t max_latency;
+};
+
+struct t_gpio_input {
+	/*
+	 * Descriptor of the line request, it becomes readable on an edge.
+	 */
+	int fd;
+	/*
+	 * The requested lines.
+	 */
+	struct t_gpio_input_line lines[PILAB_GPIO_INPUT_MAX_LINES];
+	int num_lines;
+	/*
+	 * Minimum time (ns) between two accepted edges of a line.
+	 */
+	uint64_t debounce;
+	/*
+	 * Statistics of the input.
+	 */
+	struct t_gpio_input_stats stats;
+
+	/* Callbacks */
+
+	/*
+	 * Called for every edge that passes the debounce.
+	 */
+	t_gpio_input_callback_edge *callback_edge;
+};
+
+extern struct t_gpio_input *gpio_input_create(const char *chip,
+					      const int *offsets, int num_lines,
+					      int debounce);
+extern void gpio_input_set_pointer(struct t_gpio_input *input,
+				   const char *property, void *pointer);
+extern int gpio_input_dispatch(struct t_gpio_input *input, void *data);
+extern int gpio_input_get_level(struct t_gpio_input *input, int offset);
+extern void gpio_input_free(struct t_gpio_input *input);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef _PILAB_GPIO_SIM_H
+#define _PILAB_GPIO_SIM_H
+#include <stdint.h>
+#include "pilab-gpio-bank.h"
+
+/*
+ * An in-memory gpio chip, the lines keep the level they are set to.
+ */
+
+struct t_gpio_sim {
+	/*
+	 * Levels of the lines, bit i is line i of the bank.
+	 */
+	uint64_t levels;
+	/*
+	 * Time (ns) every access takes, like the round-trip of an ioctl.
+	 */
+	uint64_t latency;
+	/*
+	 * Amount of accesses to the chip.
+	 */
+	unsigned long accesses;
+};
+
+extern struct t_gpio_bank *gpio_sim_create(const int *offsets, int num_lines,
+					   int output, int latency);
+extern int gpio_sim_set_level(struct t_gpio_bank *bank, int offset,
+			      int value);
+extern int gpio_sim_get_level(struct t_gpio_bank *bank, int offset);
+
+#endif
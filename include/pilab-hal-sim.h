@@ -0,0 +1,77 @@
+#ifndef _PILAB_HAL_SIM_H
+#define _PILAB_HAL_SIM_H
+#include <pthread.h>
+#include <stdint.h>
+#include "pilab-hal.h"
+#include "pilab-hashtable.h"
+
+/* Keys of the simulated signals, followed by the pin, address or slave id */
+#define PILAB_HAL_SIM_KEY_PIN "pin:"
+#define PILAB_HAL_SIM_KEY_I2C "i2c:"
+#define PILAB_HAL_SIM_KEY_W1 "w1:"
+/* Size of the signal lookup */
+#define PILAB_HAL_SIM_SIGNALS 32
+/* Pins that remember what was written to them */
+#define PILAB_HAL_SIM_PINS 1024
+
+struct t_hal_sim_stats {
+	/*
+	 * Amount of pin reads and writes.
+	 */
+	unsigned long pin_reads;
+	unsigned long pin_writes;
+	/*
+	 * Amount of i2c transactions.
+	 */
+	unsigned long i2c_transfers;
+	/*
+	 * Amount of 1-Wire conversions and scratchpad reads.
+	 */
+	unsigned long w1_conversions;
+	unsigned long w1_reads;
+};
+
+/*
+ * A board that only exists in memory, its sensors follow waveforms.
+ */
+
+struct t_hal_sim {
+	/*
+	 * The simulated signals by key, e.g. w1:28-0316a2795a1c.
+	 */
+	struct t_hashtable *signals;
+	/*
+	 * Last value written to every pin, read back when the pin has no
+	 * signal.
+	 */
+	int levels[PILAB_HAL_SIM_PINS];
+	/*
+	 * Time (in ms) a 1-Wire conversion takes, the latency of the slowest
+	 * simulated probe.
+	 */
+	int conversion_time;
+	/*
+	 * Monotonic time (ns) the waveforms start at.
+	 */
+	uint64_t started;
+	/*
+	 * Seed of the noise.
+	 */
+	unsigned int seed;
+	/*
+	 * Statistics of the simulation.
+	 */
+	struct t_hal_sim_stats stats;
+	/*
+	 * Protects the signals, the levels and the statistics.
+	 */
+	pthread_mutex_t lock;
+};
+
+extern struct t_hal *hal_sim_create(void);
+extern double hal_sim_waveform_value(const struct t_hal_waveform *waveform,
+				     double seconds, unsigned int *seed);
+extern void hal_sim_get_stats(struct t_hal *hal,
+			      struct t_hal_sim_stats *stats);
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef _PILAB_HAL_H
+#define _PILAB_HAL_H
+#include "pilab-i2c-bus.h"
+
+/* Names of the backends, as selected by the hal config field */
+#define PILAB_HAL_WIRINGPI "wiringpi"
+#define PILAB_HAL_SIM "sim"
+
+/* Sensor options of a simulated signal, see sensors.in */
+#define PILAB_HAL_OPTION_WAVE "sim_wave"
+#define PILAB_HAL_OPTION_OFFSET "sim_offset"
+#define PILAB_HAL_OPTION_AMPLITUDE "sim_amplitude"
+#define PILAB_HAL_OPTION_PERIOD "sim_period"
+#define PILAB_HAL_OPTION_LATENCY "sim_latency"
+
+/* Waveform types of a simulated signal */
+enum t_hal_waveform_types {
+	HAL_WAVEFORM_CONSTANT = 0,
+	HAL_WAVEFORM_SINE,
+	HAL_WAVEFORM_SQUARE,
+	HAL_WAVEFORM_RAMP,
+	HAL_WAVEFORM_NOISE,
+	/*
+	 * Number of fields.
+	 */
+	HAL_WAVEFORM_NUM_TYPES,
+};
+
+/* Strings for the waveform types */
+#define PILAB_HAL_WAVEFORM_CONSTANT "constant"
+#define PILAB_HAL_WAVEFORM_SINE "sine"
+#define PILAB_HAL_WAVEFORM_SQUARE "square"
+#define PILAB_HAL_WAVEFORM_RAMP "ramp"
+#define PILAB_HAL_WAVEFORM_NOISE "noise"
+
+/*
+ * A simulated signal, offset + amplitude * wave(time / period). Noise is
+ * uniform within the amplitude.
+ */
+
+struct t_hal_waveform {
+	enum t_hal_waveform_types type;
+	double offset;
+	double amplitude;
+	/*
+	 * Period (in seconds) of the wave.
+	 */
+	double period;
+	/*
+	 * Time (in ms) every read of the signal takes.
+	 */
+	int latency;
+};
+
+/*
+ * Interface functions.
+ *
+ * These functions should be implemented by the backends, pins are numbered
+ * the way wiringPi numbers them.
+ */
+
+typedef void(t_hal_pin_mode)(void *instance, int pin, int mode);
+typedef int(t_hal_read)(void *instance, int pin);
+typedef void(t_hal_write)(void *instance, int pin, int value);
+/*
+ * Open the i2c bus at path for the device at address.
+ *
+ * Returns the bus, NULL otherwise.
+ */
+typedef struct t_i2c_bus *(t_hal_i2c_open)(void *instance, const char *path,
+					    int address);
+/*
+ * Convert every probe on the 1-Wire bus at once, and wait for it.
+ *
+ * Returns 1 when the probes converted, 0 when the bus can't broadcast.
+ */
+typedef int(t_hal_w1_convert)(void *instance, const char *root,
+			      const char *master);
+/*
+ * Read the w1_slave attribute of the probe with id into buffer, as a nul
+ * terminated string.
+ *
+ * Returns the amount of bytes read, -1 otherwise.
+ */
+typedef int(t_hal_w1_read)(void *instance, const char *root, const char *id,
+			   char *buffer, int size);
+/*
+ * Feed the signal to reads of key (see hal_simulate_pin and friends).
+ *
+ * Returns 1 on success, 0 otherwise.
+ */
+typedef int(t_hal_simulate)(void *instance, const char *key,
+			    const struct t_hal_waveform *waveform);
+typedef void(t_hal_free_hal)(void *instance);
+
+struct t_hal {
+	/*
+	 * Name of the backend.
+	 */
+	const char *name;
+	/*
+	 * The concrete backend.
+	 */
+	void *instance;
+	/*
+	 * 1 when the wiringPi extension modules (ds18b20, pcf8574) can be set
+	 * up, 0 when there is no wiringPi behind the backend.
+	 */
+	int extensions;
+
+	t_hal_pin_mode *pin_mode;
+	t_hal_read *digital_read;
+	t_hal_write *digital_write;
+	t_hal_read *analog_read;
+	t_hal_write *analog_write;
+	t_hal_i2c_open *i2c_open;
+	/*
+	 * The 1-Wire functions are NULL when the kernel w1 sysfs interface is
+	 * used as is.
+	 */
+	t_hal_w1_convert *w1_convert;
+	t_hal_w1_read *w1_read;
+	/*
+	 * NULL for a backend on real hardware.
+	 */
+	t_hal_simulate *simulate;
+	t_hal_free_hal *free_hal;
+};
+
+extern struct t_hal *hal_wiringpi_create(void);
+extern struct t_hal *hal_create_by_name(const char *name);
+extern struct t_hal *hal_get(void);
+extern void hal_set(struct t_hal *hal);
+extern int hal_get_waveform_type(const char *type);
+extern void hal_pin_mode(int pin, int mode);
+extern int hal_digital_read(int pin);
+extern void hal_digital_write(int pin, int value);
+extern int hal_analog_read(int pin);
+extern void hal_analog_write(int pin, int value);
+extern struct t_i2c_bus *hal_i2c_open(const char *path, int address);
+extern int hal_w1_convert(const char *root, const char *master);
+extern int hal_w1_read(const char *root, const char *id, char *buffer,
+		       int size);
+extern int hal_simulate_pin(int pin, const struct t_hal_waveform *waveform);
+extern int hal_simulate_i2c(int address,
+			    const struct t_hal_waveform *waveform);
+extern int hal_simulate_w1(const char *id,
+			   const struct t_hal_waveform *waveform);
+extern void hal_free(struct t_hal *hal);
+
+#endif
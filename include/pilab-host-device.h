@@ -1,7 +1,13 @@
 #ifndef _PILAB_HOST_DEVICE_H
 #define _PILAB_HOST_DEVICE_H
+#include <stdint.h>
 #include "pilab-hashtable.h"
 #include "pilab-slave-device.h"
+#include "pilab-gpio-bank.h"
+#include "pilab-pin-table.h"
+
+/* Banks of gpio lines a host can hold */
+#define PILAB_HOST_DEVICE_MAX_GPIO_BANKS 8
 
 enum t_host_device_sensor_types {
 	HOST_DEVICE_GPIO = 0,
@@ -17,21 +23,99 @@ enum t_host_device_sensor_modules {
 	HOST_DEVICE_MODULE_DS18B20 = 0,
 	HOST_DEVICE_MODULE_PCF8574,
 	HOST_DEVICE_MODULE_HD44780,
+	HOST_DEVICE_MODULE_W1,
 	/*
 	 * Number of fields.
 	 */
 	HOST_DEVICE_NUM_MODULES,
 };
 
+/* Bus of the setups that go through the 1-Wire bus */
+#define PILAB_HOST_DEVICE_W1_BUS "w1"
+
+/*
+ * Setup of a registered device that does bus I/O, run once every line of the
+ * sensors file is registered.
+ */
+
+struct t_host_device_setup {
+	enum t_host_device_sensor_modules module;
+	/*
+	 * The registered device, and its concrete type.
+	 */
+	struct t_slave_device *slave;
+	void *device;
+	int pin_base;
+	char *addr;
+	/*
+	 * Bus the setup does its I/O on, setups on the same bus run in order.
+	 */
+	const char *bus;
+	/*
+	 * Time (ns) the setup took.
+	 */
+	uint64_t elapsed;
+	/*
+	 * 1 when the device got set up, 0 otherwise.
+	 */
+	int done;
+};
+
+struct t_host_device_startup_stats {
+	/*
+	 * Time (ns) spent reading and registering the sensors file.
+	 */
+	uint64_t parse_ns;
+	/*
+	 * Time (ns) from the first setup starting to the last one finishing.
+	 */
+	uint64_t setup_ns;
+	/*
+	 * Sum of the time (ns) the setups took, what it would have taken one
+	 * by one.
+	 */
+	uint64_t busy_ns;
+	/*
+	 * Amount of buses set up concurrently, devices set up and setups
+	 * that failed.
+	 */
+	int buses;
+	int devices;
+	int failures;
+};
+
 struct t_host_device {
 	/*
 	 * Hashtable with the slaves.
 	 */
 	struct t_hashtable *slave_devices_lookup;
+	/*
+	 * The device of every extension pin, for resolving a pin in constant
+	 * time.
+	 */
+	struct t_pin_table *pin_table;
 	/*
 	 * For now a host device, will have an lcd that is not a slave_device.
 	 */
 	struct t_lcd *lcd;
+	/*
+	 * The 1-Wire bus the ds18b20 probes are attached to.
+	 */
+	struct t_w1_bus *w1_bus;
+	/*
+	 * Banks of gpio lines, read or driven together in a single call.
+	 */
+	struct t_gpio_bank *gpio_banks[PILAB_HOST_DEVICE_MAX_GPIO_BANKS];
+	int num_gpio_banks;
+	/*
+	 * Setups waiting for host_device_setup_devices.
+	 */
+	struct t_host_device_setup *setups;
+	int num_setups;
+	/*
+	 * Where the startup time of the devices went.
+	 */
+	struct t_host_device_startup_stats startup;
 };
 
 /* Strings for the sensor types */
@@ -39,10 +123,14 @@ struct t_host_device {
 #define PILAB_HOST_DEVICE_I2C "i2c"
 #define PILAB_HOST_DEVICE_LCD_I2C "lcd_i2c"
 
+/* Separates the module from the label in a sensor name, e.g. ds18b20:office */
+#define PILAB_HOST_DEVICE_LABEL_SEPARATOR ':'
+
 /* Strings for the module types */
 #define PILAB_HOST_MODULE_DS18B20 "ds18b20"
 #define PILAB_HOST_MODULE_PCF8574 "pcf8574"
 #define PILAB_HOST_MODULE_HD44780 "hd44780"
+#define PILAB_HOST_MODULE_W1 "w1"
 
 extern int host_device_get_sensor_module(const char *type);
 extern int host_device_get_sensor_type(const char *type);
@@ -51,15 +139,21 @@ extern void host_device_free_device_default_cb(struct t_hashtable *hashtable,
 					       const void *key, void *value);
 extern void host_device_free_name_default_cb(struct t_hashtable *hashtable,
 					     void *key);
-extern void host_device_module_register(struct t_host_device *host_device,
-					char *sensor_name, int pin_base,
-					char *addr);
+extern int host_device_module_register(struct t_host_device *host_device,
+				       char *sensor_name, int pin_base,
+				       char *addr);
 
+extern int host_device_set_sample_interval(struct t_host_device *host_device,
+					   const char *sensor_name,
+					   const char *interval);
+extern int host_device_set_option(struct t_host_device *host_device,
+				  const char *sensor_name, const char *option);
 extern int host_device_slave_builder(struct t_host_device *host_device,
 				     struct t_pilist *slave_components);
 extern struct t_host_device *
 	host_device_create_with_max_registrations_size(int size);
 extern struct t_host_device *host_device_create(void);
+extern void host_device_free(struct t_host_device *host_device);
 extern void host_device_register_slave_device(
 	struct t_host_device *host_device,
 	const struct t_slave_device *slave_device);
@@ -70,11 +164,20 @@ extern void host_device_deregister_all_slave_devices(
 	struct t_host_device *host_device);
 extern int
 	host_device_get_slave_devices_count(struct t_host_device *host_device);
-extern void
+extern int host_device_setup_devices(struct t_host_device *host_device);
+extern int
 	host_device_read_in_sensor_modules(struct t_host_device *host_device);
+extern struct t_slave_device *
+	host_device_get_slave_by_pin(struct t_host_device *host_device, int pin);
 extern struct t_pilist *
 	host_device_get_sensor_name_list(struct t_host_device *host_device);
 extern struct t_pilist *
 	host_device_get_sensor_list(struct t_host_device *host_device);
+extern int host_device_add_gpio_bank(struct t_host_device *host_device,
+				     struct t_gpio_bank *bank);
+extern struct t_gpio_bank *
+	host_device_request_gpio_bank(struct t_host_device *host_device,
+				      const int *pins, int num_pins,
+				      int output);
 
 #endif
@@ -0,0 +1,108 @@
+#ifndef _PILAB_I2C_BUS_H
+#define _PILAB_I2C_BUS_H
+#include <pthread.h>
+#include <stdint.h>
+
+/* The i2c bus on the header of the Raspberry Pi */
+#define PILAB_I2C_BUS_DEFAULT_DEVICE "/dev/i2c-1"
+/* Longest SMBus block transfer */
+#define PILAB_I2C_BUS_BLOCK_MAX 32
+
+struct t_i2c_bus;
+
+/*
+ * Interface functions.
+ *
+ * These functions should be implemented by the bus backends.
+ */
+
+/*
+ * Write write_length bytes, followed by a repeated start reading read_length
+ * bytes, in a single transaction. Either length may be 0.
+ *
+ * Returns 1 on success, 0 otherwise.
+ */
+typedef int(t_i2c_bus_transfer)(void *instance, int address,
+				const uint8_t *write_buffer, int write_length,
+				uint8_t *read_buffer, int read_length);
+/*
+ * Read length bytes starting at command, as an SMBus i2c block read.
+ *
+ * Returns 1 on success, 0 otherwise.
+ */
+typedef int(t_i2c_bus_block_read)(void *instance, int address,
+				  uint8_t command, uint8_t *buffer, int length);
+typedef void(t_i2c_bus_free_bus)(void *instance);
+
+struct t_i2c_bus_stats {
+	/*
+	 * Amount of transactions put on the bus.
+	 */
+	unsigned long transactions;
+	/*
+	 * Amount of bytes read from the devices.
+	 */
+	unsigned long bytes_read;
+	/*
+	 * Amount of bytes written to the devices, register pointers included.
+	 */
+	unsigned long bytes_written;
+	/*
+	 * Amount of transactions that failed.
+	 */
+	unsigned long errors;
+};
+
+struct t_i2c_bus {
+	/*
+	 * The concrete backend of the bus.
+	 */
+	void *instance;
+	/*
+	 * 1 when the backend can combine a write and a read in one
+	 * transaction, register reads fall back to block reads otherwise.
+	 */
+	int combined;
+	/*
+	 * Statistics of the bus.
+	 */
+	struct t_i2c_bus_stats stats;
+	/*
+	 * Serialises the transactions and protects the statistics.
+	 */
+	pthread_mutex_t lock;
+	/*
+	 * Function used for a combined write-then-read transaction.
+	 */
+	t_i2c_bus_transfer *transfer;
+	/*
+	 * Function used for an SMBus block read, NULL when not supported.
+	 */
+	t_i2c_bus_block_read *block_read;
+	/*
+	 * Free the backend.
+	 */
+	t_i2c_bus_free_bus *free_bus;
+};
+
+extern struct t_i2c_bus *i2c_bus_create(void *instance, int combined,
+					t_i2c_bus_transfer *transfer,
+					t_i2c_bus_block_read *block_read,
+					t_i2c_bus_free_bus *free_bus);
+extern struct t_i2c_bus *i2c_bus_open(const char *path, int address);
+extern int i2c_bus_transfer(struct t_i2c_bus *bus, int address,
+			    const uint8_t *write_buffer, int write_length,
+			    uint8_t *read_buffer, int read_length);
+extern int i2c_bus_read(struct t_i2c_bus *bus, int address, uint8_t *buffer,
+			int length);
+extern int i2c_bus_write(struct t_i2c_bus *bus, int address,
+			 const uint8_t *buffer, int length);
+extern int i2c_bus_read_registers(struct t_i2c_bus *bus, int address,
+				  uint8_t reg, uint8_t *buffer, int length);
+extern int i2c_bus_block_read(struct t_i2c_bus *bus, int address,
+			      uint8_t command, uint8_t *buffer, int length);
+extern void i2c_bus_get_stats(struct t_i2c_bus *bus,
+			      struct t_i2c_bus_stats *stats);
+extern void i2c_bus_free(struct t_i2c_bus *bus);
+
+#endif
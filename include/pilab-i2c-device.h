@@ -1,7 +1,23 @@
 #ifndef _PILAB_I2C_DEVICE_H
 #define _PILAB_I2C_DEVICE_H
+#include <pthread.h>
+#include <stdint.h>
 #include "pilab-slave-device.h"
 #include "pilab-host-device.h"
+#include "pilab-i2c-bus.h"
+#include "pilab-pin-table.h"
+
+/* An i2c transaction is over in a few ms, unless the bus is stuck */
+#define PILAB_I2C_DEVICE_READ_TIMEOUT 250
+/* A pcf8574 has 8 pins */
+#define PILAB_I2C_DEVICE_PCF8574_PINS 8
+/* Most bytes a single sample is built from (big endian) */
+#define PILAB_I2C_DEVICE_MAX_LENGTH 4
+
+/* Sensor options controlling the reads */
+#define PILAB_I2C_DEVICE_OPTION_BUS "i2c_bus"
+#define PILAB_I2C_DEVICE_OPTION_REGISTER "i2c_register"
+#define PILAB_I2C_DEVICE_OPTION_LENGTH "i2c_length"
 
 struct t_i2c_device;
 
@@ -35,6 +51,63 @@ struct t_i2c_device {
 	 * File descriptor for accessing the device.
 	 */
 	int handle;
+	/*
+	 * Factor that turns a raw reading into unit.
+	 */
+	double scale;
+	/*
+	 * Unit of a scaled reading, "" for raw values.
+	 */
+	const char *unit;
+	/*
+	 * The slave device wrapping this device, for its options.
+	 */
+	struct t_slave_device *slave;
+	/*
+	 * Bus the device is read through, opened on first use.
+	 *
+	 * NOTE: NULL when it could not be opened, wiringPi is used then.
+	 */
+	struct t_i2c_bus *bus;
+	/*
+	 * 1 once opening the bus has been tried.
+	 */
+	int bus_tried;
+	/*
+	 * First register of a sample, -1 for devices without registers.
+	 */
+	int reg;
+	/*
+	 * Amount of bytes a sample is built from.
+	 */
+	int length;
+	/*
+	 * Amount of samples read through the bus.
+	 */
+	unsigned long reads;
+	/*
+	 * Shadow copy of the output port of an expander, and what the device
+	 * holds right now.
+	 */
+	uint8_t shadow;
+	uint8_t written;
+	/*
+	 * 1 when the pins are driven through the shadow register.
+	 */
+	int expander;
+	/*
+	 * Depth of the open batches, the port is written when it drops to 0.
+	 */
+	int batch_depth;
+	/*
+	 * Amount of pin writes, and the port writes they turned into.
+	 */
+	unsigned long pin_writes;
+	unsigned long port_writes;
+	/*
+	 * Protects the shadow register, the batches and their counters.
+	 */
+	pthread_mutex_t shadow_lock;
 
 	/* Callbacks */
 
@@ -52,6 +125,14 @@ extern int i2c_device_analog_read(const void *instance, int pin);
 extern void i2c_device_analog_write(const void *instance, int pin, int value);
 extern int i2c_device_digital_read(const void *instance, int pin);
 extern void i2c_device_digital_write(const void *instance, int pin, int value);
+extern int i2c_device_read_sample(const void *instance,
+				  struct t_slave_device_sample *sample);
+extern void i2c_device_set_bus(struct t_i2c_device *device,
+			       struct t_i2c_bus *bus);
+extern int i2c_device_pcf8574_setup(struct t_i2c_device *device,
+				    struct t_pin_table *pin_table);
+extern void i2c_device_batch_begin(const void *instance);
+extern void i2c_device_batch_commit(const void *instance);
 extern void i2c_device_set_pointer(const void *instance, const char *property,
 				   void *pointer);
 extern int i2c_device_get_pin_base(const void *instance);
@@ -0,0 +1,37 @@
+#ifndef _PILAB_I2C_SIM_H
+#define _PILAB_I2C_SIM_H
+#include <stdint.h>
+#include "pilab-i2c-bus.h"
+
+/* Addresses on a 7 bit bus, and registers of a simulated device */
+#define PILAB_I2C_SIM_ADDRESSES 128
+#define PILAB_I2C_SIM_REGISTERS 256
+
+/*
+ * A device on the simulated bus, with a register file and a register pointer
+ * that increments with every byte, like most sensors do.
+ */
+
+struct t_i2c_sim_device {
+	uint8_t registers[PILAB_I2C_SIM_REGISTERS];
+	/*
+	 * Register the next byte is read from, or written to.
+	 */
+	uint8_t pointer;
+};
+
+struct t_i2c_sim {
+	/*
+	 * The devices on the bus by address, NULL when nothing answers.
+	 */
+	struct t_i2c_sim_device *devices[PILAB_I2C_SIM_ADDRESSES];
+};
+
+extern struct t_i2c_bus *i2c_sim_create(int combined, int block_read);
+extern int i2c_sim_add_device(struct t_i2c_bus *bus, int address);
+extern int i2c_sim_set_register(struct t_i2c_bus *bus, int address,
+				uint8_t reg, uint8_t value);
+extern int i2c_sim_get_register(struct t_i2c_bus *bus, int address,
+				uint8_t reg);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef _PILAB_PIN_TABLE_H
+#define _PILAB_PIN_TABLE_H
+#include "pilab-slave-device.h"
+
+/* Extension pins start above the pins of the Raspberry Pi itself */
+#define PILAB_PIN_TABLE_FIRST_PIN 0x40
+/* Highest pin the table grows to, beyond this a pin base is refused */
+#define PILAB_PIN_TABLE_MAX_PIN 0x10000
+
+/*
+ * A flat table of the extension pins, every pin points at the slave device
+ * whose range it is part of. A pin resolves to its device in constant time.
+ */
+
+struct t_pin_table {
+	/*
+	 * The device of every pin, indexed by pin - PILAB_PIN_TABLE_FIRST_PIN,
+	 * NULL when the pin is not taken.
+	 */
+	struct t_slave_device **pins;
+	/*
+	 * Amount of pins the table covers.
+	 */
+	int size;
+	/*
+	 * Amount of ranges added.
+	 */
+	int num_ranges;
+};
+
+extern struct t_pin_table *pin_table_create(void);
+extern int pin_table_check(struct t_pin_table *table, int pin_base,
+			   int num_pins);
+extern int pin_table_add(struct t_pin_table *table, int pin_base, int num_pins,
+			 struct t_slave_device *slave);
+extern struct t_slave_device *pin_table_lookup(struct t_pin_table *table,
+					       int pin);
+extern void pin_table_remove(struct t_pin_table *table,
+			     struct t_slave_device *slave);
+extern void pin_table_free(struct t_pin_table *table);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef _PILAB_REPLAY_DEVICE_H
+#define _PILAB_REPLAY_DEVICE_H
+#include <pthread.h>
+#include "pilab-slave-device.h"
+#include "pilab-trace.h"
+
+/* Fastest replay, as a multiple of the recorded time */
+#define PILAB_REPLAY_DEVICE_MAX_SPEED 1000
+
+/*
+ * A slave device that serves the reads of a trace back, in the order they
+ * were recorded. Every read takes the recorded latency, divided by the speed.
+ */
+
+struct t_replay_device {
+	/*
+	 * The recorded reads of the device.
+	 */
+	struct t_trace_device *trace;
+	/*
+	 * Index of the next read served.
+	 */
+	int next;
+	/*
+	 * Multiple of the recorded time the reads are served at.
+	 */
+	int speed;
+	/*
+	 * Amount of reads asked for after the trace ran out.
+	 */
+	unsigned long exhausted;
+	/*
+	 * The device that was replaced, its name and pins are still served.
+	 */
+	void *replaced;
+	t_slave_device_get_name *replaced_get_name;
+	t_slave_device_get_pin_base *replaced_get_pinbase;
+	t_slave_device_get_expansion_pin *replaced_get_expansion_pin;
+	t_slave_device_free_device *replaced_free_device;
+	/*
+	 * The reads of a device can come from several workers.
+	 */
+	pthread_mutex_t lock;
+};
+
+extern int replay_device_attach(struct t_slave_device *slave,
+				struct t_trace *trace, int speed);
+extern int replay_device_read_sample(const void *instance,
+				     struct t_slave_device_sample *sample);
+extern int replay_device_analog_read(const void *instance, int pin);
+extern void replay_device_analog_write(const void *instance, int pin,
+				       int value);
+extern int replay_device_get_pin_base(const void *instance);
+extern int replay_device_get_expansion_pin(const void *instance, int pin);
+extern const char *replay_device_get_name(const void *instance);
+extern void replay_device_free_device(const void *instance);
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef _PILAB_SAMPLER_H
+#define _PILAB_SAMPLER_H
+#include <pthread.h>
+#include <stdint.h>
+#include "pilab-slave-device.h"
+
+/* Defaults for the sampler pool */
+#define PILAB_SAMPLER_DEFAULT_WORKERS 4
+#define PILAB_SAMPLER_DEFAULT_QUEUE_SIZE 64
+/* Time (in seconds) a shutdown may spend waiting for running reads */
+#define PILAB_SAMPLER_DEFAULT_DRAIN_TIMEOUT 10
+
+struct t_sampler;
+
+/*
+ * Callback functions.
+ *
+ * These can be set through sampler_set_pointer, before the sampler is started.
+ */
+
+typedef void(t_sampler_read_slave)(struct t_sampler *sampler,
+				   void *worker_data,
+				   struct t_slave_device *slave, void *data);
+typedef void *(t_sampler_worker_init)(struct t_sampler *sampler, void *data);
+typedef void(t_sampler_worker_free)(struct t_sampler *sampler,
+				    void *worker_data);
+
+struct t_sampler_job {
+	/*
+	 * The device that has to be read.
+	 */
+	struct t_slave_device *slave;
+	/*
+	 * Extra data handed to the read callback.
+	 */
+	void *data;
+	/*
+	 * Monotonic timestamp (ns) of when the job was queued.
+	 */
+	uint64_t enqueued_at;
+};
+
+struct t_sampler_stats {
+	/*
+	 * Amount of jobs waiting in the queue.
+	 */
+	int queue_depth;
+	/*
+	 * Highest amount of jobs that were waiting in the queue at once.
+	 */
+	int queue_depth_max;
+	/*
+	 * Amount of jobs being executed right now.
+	 */
+	int jobs_active;
+	/*
+	 * Amount of jobs accepted by the sampler.
+	 */
+	unsigned long jobs_submitted;
+	/*
+	 * Amount of jobs that have been executed.
+	 */
+	unsigned long jobs_completed;
+	/*
+	 * Amount of jobs refused, because the queue was full.
+	 */
+	unsigned long jobs_dropped;
+	/*
+	 * Amount of queued jobs thrown away, because a drain timed out.
+	 */
+	unsigned long jobs_cancelled;
+	/*
+	 * Amount of workers stuck in a job that were replaced by a new worker.
+	 */
+	unsigned long workers_replaced;
+	/*
+	 * Amount of replaced workers that have not returned yet.
+	 */
+	int workers_abandoned;
+	/*
+	 * Total time (ns) jobs spent waiting in the queue.
+	 */
+	uint64_t wait_total_ns;
+	/*
+	 * Total time (ns) spent executing jobs.
+	 */
+	uint64_t latency_total_ns;
+	/*
+	 * Longest time (ns) spent executing a single job.
+	 */
+	uint64_t latency_max_ns;
+};
+
+struct t_sampler_worker {
+	/*
+	 * The sampler this worker belongs to.
+	 */
+	struct t_sampler *sampler;
+	/*
+	 * Thread of the worker.
+	 */
+	pthread_t thread;
+	/*
+	 * Data private to this worker, created by callback_worker_init.
+	 */
+	void *worker_data;
+	/*
+	 * The job being executed, valid when busy is set.
+	 */
+	struct t_sampler_job job;
+	int busy;
+	/*
+	 * Set when the worker got replaced, it exits once its job returns.
+	 */
+	int abandoned;
+};
+
+struct t_sampler {
+	/*
+	 * Amount of worker threads.
+	 */
+	int num_workers;
+	/*
+	 * The worker threads, started once by sampler_start.
+	 */
+	struct t_sampler_worker **workers;
+	/*
+	 * Ring buffer holding the queued jobs.
+	 */
+	struct t_sampler_job *queue;
+	/*
+	 * Capacity of the ring buffer.
+	 */
+	int queue_size;
+	/*
+	 * Index of the first queued job.
+	 */
+	int queue_head;
+	/*
+	 * Protects the queue, the state and the statistics.
+	 */
+	pthread_mutex_t lock;
+	/*
+	 * Signalled when a job is queued, or when the sampler stops.
+	 */
+	pthread_cond_t job_available;
+	/*
+	 * Signalled when the last running job finishes and the queue is empty.
+	 */
+	pthread_cond_t idle;
+	/*
+	 * 1 when the workers are running, 0 otherwise.
+	 */
+	int running;
+	/*
+	 * Statistics of the sampler.
+	 */
+	struct t_sampler_stats stats;
+	/*
+	 * Data passed to the callbacks.
+	 */
+	void *callback_data;
+
+	/* Callbacks */
+
+	/*
+	 * Reads the slave of a job.
+	 */
+	t_sampler_read_slave *callback_read_slave;
+	/*
+	 * Creates the private data of a worker, called from the worker thread.
+	 */
+	t_sampler_worker_init *callback_worker_init;
+	/*
+	 * Frees the private data of a worker, called from the worker thread.
+	 */
+	t_sampler_worker_free *callback_worker_free;
+};
+
+extern struct t_sampler *sampler_create(int num_workers, int queue_size);
+extern void sampler_set_pointer(struct t_sampler *sampler,
+				const char *property, void *pointer);
+extern int sampler_start(struct t_sampler *sampler);
+extern int sampler_submit(struct t_sampler *sampler,
+			  struct t_slave_device *slave, void *data);
+extern void sampler_get_stats(struct t_sampler *sampler,
+			      struct t_sampler_stats *stats);
+extern int sampler_replace_worker(struct t_sampler *sampler,
+				  struct t_slave_device *slave);
+extern int sampler_drain(struct t_sampler *sampler, int timeout);
+extern void sampler_stop(struct t_sampler *sampler);
+extern void sampler_free(struct t_sampler *sampler);
+
+#endif
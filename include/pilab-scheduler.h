@@ -0,0 +1,120 @@
+#ifndef _PILAB_SCHEDULER_H
+#define _PILAB_SCHEDULER_H
+#include <stdint.h>
+#include <pthread.h>
+#include "pilab-slave-device.h"
+
+/* Sampling interval (in seconds) used when a device doesn't specify one */
+#define PILAB_SCHEDULER_DEFAULT_INTERVAL (5 * 60)
+
+#define PILAB_SCHEDULER_NSEC_PER_SEC 1000000000ULL
+
+/* Upper bound for the jitter, as a percentage of the interval */
+#define PILAB_SCHEDULER_MAX_JITTER 50
+
+struct t_scheduler_entry {
+	/*
+	 * The device that has to be sampled.
+	 */
+	struct t_slave_device *slave;
+	/*
+	 * Extra data attached to the entry.
+	 */
+	void *data;
+	/*
+	 * Time (ns) between two samples.
+	 */
+	uint64_t interval;
+	/*
+	 * Absolute monotonic time (ns) at which the next sample is due.
+	 */
+	uint64_t deadline;
+	/*
+	 * The deadline without jitter, the period is kept relative to this so
+	 * the jitter doesn't accumulate.
+	 */
+	uint64_t nominal;
+	/*
+	 * Group of entries that are due together (see scheduler_group), 0 when
+	 * the entry is on its own.
+	 */
+	int group;
+	/*
+	 * Position of the entry in the heap.
+	 */
+	int index;
+	/*
+	 * Amount of periods skipped, because the scheduler fell behind.
+	 */
+	unsigned long missed;
+};
+
+struct t_scheduler {
+	/*
+	 * Binary min-heap of entries, ordered by deadline.
+	 */
+	struct t_scheduler_entry **heap;
+	/*
+	 * Amount of entries in the heap.
+	 */
+	int size;
+	/*
+	 * Allocated size of the heap.
+	 */
+	int capacity;
+	/*
+	 * A timerfd armed at the earliest deadline, for use with poll/epoll.
+	 */
+	int timer_fd;
+	/*
+	 * Hash of the identity of this device (mac or classroom), used to give
+	 * every device in the fleet its own deterministic phase.
+	 */
+	unsigned long long identity;
+	/*
+	 * State of the random generator used for the jitter.
+	 */
+	unsigned int seed;
+	/*
+	 * Maximum jitter added to each deadline, as a percentage of the
+	 * interval.
+	 */
+	int jitter;
+	/*
+	 * Amount of groups handed out.
+	 */
+	int groups;
+	/*
+	 * Multiple of real time the intervals run at, 1 unless a trace is
+	 * replayed faster.
+	 */
+	int speed;
+	/*
+	 * Protects the heap, so the intervals can be changed from the sampler
+	 * workers.
+	 */
+	pthread_mutex_t lock;
+};
+
+extern struct t_scheduler *scheduler_create(int capacity);
+extern struct t_scheduler_entry *
+	scheduler_add(struct t_scheduler *scheduler,
+		      struct t_slave_device *slave, int interval, void *data);
+extern void scheduler_group(struct t_scheduler *scheduler,
+			    struct t_scheduler_entry *entry,
+			    struct t_scheduler_entry *leader);
+extern void scheduler_set_interval(struct t_scheduler *scheduler,
+				   struct t_scheduler_entry *entry,
+				   int interval);
+extern void scheduler_set_identity(struct t_scheduler *scheduler,
+				   const char *identity);
+extern void scheduler_set_jitter(struct t_scheduler *scheduler, int jitter);
+extern void scheduler_set_speed(struct t_scheduler *scheduler, int speed);
+extern void scheduler_spread(struct t_scheduler *scheduler, uint64_t start);
+extern struct t_scheduler_entry *
+	scheduler_pop_due(struct t_scheduler *scheduler, uint64_t now);
+extern int scheduler_arm_timer(struct t_scheduler *scheduler);
+extern int scheduler_disarm_timer(struct t_scheduler *scheduler);
+extern void scheduler_free(struct t_scheduler *scheduler);
+
+#endif
@@ -1,5 +1,42 @@
 #ifndef _PILAB_SLAVE_DEVICE_H
 #define _PILAB_SLAVE_DEVICE_H
+#include <stdint.h>
+#include "pilab-hashtable.h"
+
+/* Raw value returned by the read functions when the read failed */
+#define PILAB_SLAVE_DEVICE_READ_FAILED -99999
+
+enum t_slave_device_sample_quality {
+	SLAVE_DEVICE_QUALITY_GOOD = 0,
+	SLAVE_DEVICE_QUALITY_BAD,
+	/*
+	 * Number of fields.
+	 */
+	SLAVE_DEVICE_NUM_QUALITIES,
+};
+
+struct t_slave_device_sample {
+	/*
+	 * The reading, scaled to unit.
+	 */
+	double value;
+	/*
+	 * Unit of the value, "" for raw values.
+	 */
+	const char *unit;
+	/*
+	 * Whether the read succeeded.
+	 */
+	enum t_slave_device_sample_quality quality;
+	/*
+	 * Wall clock time (ns since the epoch) of the acquisition.
+	 */
+	uint64_t timestamp;
+	/*
+	 * The unscaled value, as returned by the device.
+	 */
+	int raw;
+};
 
 /*
  * Interface functions.
@@ -20,6 +57,12 @@ typedef void(t_slave_device_analog_write)(const void *instance, int pin,
 typedef int(t_slave_device_digital_read)(const void *instance, int pin);
 typedef void(t_slave_device_digital_write)(const void *instance, int pin,
 					   int value);
+typedef int(t_slave_device_read_sample)(const void *instance,
+					struct t_slave_device_sample *sample);
+typedef int(t_slave_device_start_sample)(const void *instance);
+typedef void(t_slave_device_batch)(const void *instance);
+typedef int(t_slave_device_collect_sample)(
+	const void *instance, struct t_slave_device_sample *sample);
 
 /*
  * Callback functions.
@@ -39,6 +82,23 @@ struct t_slave_device {
 	 * concrete instance of the slave device.
 	 */
 	void *instance;
+	/*
+	 * Interval (in seconds) at which the device should be sampled.
+	 *
+	 * NOTE: 0 means the default interval of the scheduler is used.
+	 */
+	int sample_interval;
+	/*
+	 * Longest time (in ms) a single read_sample may take, set by the
+	 * driver.
+	 */
+	int read_timeout;
+	/*
+	 * Optional key=value settings of the device, from the sensor config.
+	 *
+	 * NOTE: NULL when no options were given.
+	 */
+	struct t_hashtable *options;
 	/*
 	 * Function used for reading the raw sensor data of the device (analog).
 	 */
@@ -55,6 +115,32 @@ struct t_slave_device {
 	 * Function used for writing to a specific pin of the device (digital).
 	 */
 	t_slave_device_digital_write *digital_write;
+	/*
+	 * Take a single reading in one bus transaction, scaled to the unit of
+	 * the device.
+	 */
+	t_slave_device_read_sample *read_sample;
+	/*
+	 * Start a reading without waiting for it, returns the time (in ms)
+	 * until it can be collected.
+	 *
+	 * NOTE: NULL when the device can only be read in one go.
+	 */
+	t_slave_device_start_sample *start_sample;
+	/*
+	 * Collect the reading that was started by start_sample.
+	 *
+	 * NOTE: NULL when the device can only be read in one go.
+	 */
+	t_slave_device_collect_sample *collect_sample;
+	/*
+	 * Hold back the writes to the pins of the device, until the matching
+	 * batch_commit sends them in one go. Batches can be nested.
+	 *
+	 * NOTE: NULL when every write goes to the device right away.
+	 */
+	t_slave_device_batch *batch_begin;
+	t_slave_device_batch *batch_commit;
 	/*
 	 * Allows for changing the callbacks  of the concrete devices,
 	 * effectively changing the function pointer to point to alternative
@@ -93,4 +179,23 @@ struct t_slave_device {
 	t_slave_device_init_strategy *callback_init_strategy;
 };
 
+/* Size of the options table of a slave device */
+#define PILAB_SLAVE_DEVICE_OPTIONS_SIZE 8
+
+extern void slave_device_sample_init(struct t_slave_device_sample *sample,
+				     int raw, int failed_raw, double scale,
+				     const char *unit);
+extern int slave_device_set_option(struct t_slave_device *slave,
+				   const char *key, const char *value);
+extern int slave_device_parse_option(struct t_slave_device *slave,
+				     const char *option);
+extern const char *slave_device_get_option(struct t_slave_device *slave,
+					   const char *key);
+extern int slave_device_get_option_int(struct t_slave_device *slave,
+				       const char *key, int default_value);
+extern double slave_device_get_option_double(struct t_slave_device *slave,
+					     const char *key,
+					     double default_value);
+extern void slave_device_free_options(struct t_slave_device *slave);
+
 #endif
@@ -0,0 +1,126 @@
+#ifndef _PILAB_SPOOL_H
+#define _PILAB_SPOOL_H
+#include <stdint.h>
+#include <pthread.h>
+#include "pilab-batch.h"
+
+/*
+ * A spool keeps the readings that still have to be uploaded on disk, in a
+ * directory of append-only segment files and a cursor file. All fields are
+ * little endian.
+ *
+ * record: <name:64> <type:32> <timestamp:u64> <value:f64> <checksum:u32>
+ *         <reserved:u32>
+ * cursor: "<segment> <offset>\n"
+ *
+ * Segments are named after their sequence number (00000001.seg) and hold
+ * PILAB_SPOOL_SEGMENT_RECORDS records, only the last one is appended to. The
+ * cursor points at the first record that wasn't forwarded yet, the segments
+ * before it are removed.
+ */
+
+#define PILAB_SPOOL_RECORD_SIZE 120
+#define PILAB_SPOOL_SEGMENT_RECORDS 2048
+#define PILAB_SPOOL_SEGMENT_SUFFIX ".seg"
+#define PILAB_SPOOL_CURSOR "cursor"
+/* Disk space (in KB) a spool may take, used when it doesn't specify it */
+#define PILAB_SPOOL_DEFAULT_MAX_SIZE (16 * 1024)
+/* Appended records, or time (in ms), after which they are synced to disk */
+#define PILAB_SPOOL_SYNC_RECORDS 32
+#define PILAB_SPOOL_SYNC_INTERVAL 1000
+/* Readings forwarded per second, and at most per forward */
+#define PILAB_SPOOL_DEFAULT_RATE 20
+#define PILAB_SPOOL_MAX_FORWARD 256
+/* Time (in ms) between two forwards */
+#define PILAB_SPOOL_FORWARD_INTERVAL 1000
+
+/* Modes of a spool, as selected by the spool_mode config field */
+#define PILAB_SPOOL_MODE_FALLBACK "fallback"
+#define PILAB_SPOOL_MODE_ALWAYS "always"
+
+struct t_spool_position {
+	/*
+	 * Segment and byte offset of a record.
+	 */
+	uint32_t segment;
+	uint32_t offset;
+};
+
+struct t_spool_stats {
+	/*
+	 * Amount of readings appended.
+	 */
+	unsigned long appended;
+	/*
+	 * Amount of readings forwarded (committed).
+	 */
+	unsigned long forwarded;
+	/*
+	 * Amount of readings lost to keep the spool within its size.
+	 */
+	unsigned long dropped;
+	/*
+	 * Amount of damaged records skipped while peeking.
+	 */
+	unsigned long corrupt;
+	/*
+	 * Amount of times the appended readings were synced to disk.
+	 */
+	unsigned long syncs;
+};
+
+struct t_spool {
+	/*
+	 * Directory of the segments and the cursor.
+	 */
+	char *dir;
+	/*
+	 * Sequence number of the oldest segment on disk.
+	 */
+	uint32_t first_segment;
+	/*
+	 * The cursor, segment and byte offset of the next record to forward.
+	 */
+	uint32_t read_segment;
+	uint32_t read_offset;
+	/*
+	 * The segment appended to, and where the next record goes.
+	 */
+	uint32_t write_segment;
+	uint32_t write_offset;
+	int write_fd;
+	/*
+	 * Disk space (in bytes) the segments may take.
+	 */
+	uint64_t max_size;
+	/*
+	 * Records appended since the last sync, and when (monotonic ns) the
+	 * first of them was.
+	 */
+	int unsynced;
+	uint64_t unsynced_since;
+	/*
+	 * Statistics of the spool.
+	 */
+	struct t_spool_stats stats;
+	/*
+	 * Protects the spool, the workers append while the loop forwards.
+	 */
+	pthread_mutex_t lock;
+};
+
+extern struct t_spool *spool_open(const char *dir, int max_size);
+extern int spool_append(struct t_spool *spool, const char *name,
+			const char *type, uint64_t timestamp, double value,
+			uint64_t now);
+extern int spool_sync(struct t_spool *spool, uint64_t now, int force);
+extern int spool_peek(struct t_spool *spool, struct t_batch_item *items,
+		      int max_items, int *records, struct t_spool_position *end);
+extern int spool_commit(struct t_spool *spool,
+			const struct t_spool_position *end);
+extern unsigned long spool_pending(struct t_spool *spool);
+extern void spool_get_stats(struct t_spool *spool,
+			    struct t_spool_stats *stats);
+extern void spool_close(struct t_spool *spool);
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef _PILAB_TIME_H
 #define _PILAB_TIME_H
 #include <time.h>
+#include <stdint.h>
 
 #define PILAB_TIME_DEFAULT_FORMAT "%a, %m %b %Y %H:%M:%S"
 
@@ -10,5 +11,7 @@ extern int time_cmpstr_fmt(const char *fmt, const char *date1,
 extern int time_cmpstr(const char *date1, const char *date2);
 extern char *time_get_time_fmt(const char *fmt);
 extern char *time_get_time(void);
+extern uint64_t time_monotonic_ns(void);
+extern uint64_t time_realtime_ns(void);
 
 #endif
@@ -0,0 +1,119 @@
+#ifndef _PILAB_TRACE_H
+#define _PILAB_TRACE_H
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "pilab-slave-device.h"
+
+/*
+ * A trace is a binary log of every raw device read, it starts with a header
+ * followed by records. All fields are little endian.
+ *
+ * header: "PLTR" <version:u16> <reserved:u16>
+ * device: <type:u8=1> <id:u16> <name length:u8> <name> <unit length:u8> <unit>
+ * read:   <type:u8=2> <id:u16> <quality:u8> <pin:i32> <raw:i32> <value:f64>
+ *         <timestamp:u64> <latency:u32>
+ *
+ * A device record precedes the first read of the device, the reads of a device
+ * refer to it by its id.
+ */
+
+#define PILAB_TRACE_MAGIC "PLTR"
+#define PILAB_TRACE_VERSION 1
+#define PILAB_TRACE_HEADER_SIZE 8
+#define PILAB_TRACE_READ_SIZE 32
+/* Longest device name or unit in a device record */
+#define PILAB_TRACE_MAX_NAME 255
+/* Devices in a single trace, ids are 16 bit */
+#define PILAB_TRACE_MAX_DEVICES 65535
+/* Buffer of the trace file, records are written in blocks of this size */
+#define PILAB_TRACE_BUFFER_SIZE (64 * 1024)
+
+enum t_trace_record_types {
+	TRACE_RECORD_DEVICE = 1,
+	TRACE_RECORD_READ,
+};
+
+/*
+ * A single raw read of a device.
+ */
+
+struct t_trace_read {
+	/*
+	 * Wall clock time (ns since the epoch) of the acquisition.
+	 */
+	uint64_t timestamp;
+	/*
+	 * The reading scaled to the unit of the device, and the unscaled value.
+	 */
+	double value;
+	int raw;
+	/*
+	 * Pin (base) of the device that was read.
+	 */
+	int pin;
+	/*
+	 * Time (in us) the read took.
+	 */
+	uint32_t latency;
+	enum t_slave_device_sample_quality quality;
+};
+
+/*
+ * The reads of a single device, in the order they were taken.
+ */
+
+struct t_trace_device {
+	char *name;
+	char *unit;
+	struct t_trace_read *reads;
+	int num_reads;
+	int capacity;
+};
+
+/*
+ * A trace loaded in memory, for replay.
+ */
+
+struct t_trace {
+	struct t_trace_device *devices;
+	int num_devices;
+	/*
+	 * Timestamp of the first and the last read in the trace.
+	 */
+	uint64_t first;
+	uint64_t last;
+};
+
+struct t_trace_writer {
+	FILE *file;
+	/*
+	 * Names of the devices that got a device record, their index is their
+	 * id.
+	 */
+	char **names;
+	int num_names;
+	/*
+	 * Amount of reads and bytes written.
+	 */
+	unsigned long reads;
+	unsigned long bytes;
+	/*
+	 * The sampler workers record concurrently.
+	 */
+	pthread_mutex_t lock;
+};
+
+extern struct t_trace_writer *trace_writer_open(const char *path);
+extern int trace_writer_record(struct t_trace_writer *writer,
+			       const char *name, int pin,
+			       const struct t_slave_device_sample *sample,
+			       uint64_t latency);
+extern int trace_writer_flush(struct t_trace_writer *writer);
+extern void trace_writer_close(struct t_trace_writer *writer);
+extern struct t_trace *trace_load(const char *path);
+extern struct t_trace_device *trace_get_device(struct t_trace *trace,
+					       const char *name);
+extern void trace_free(struct t_trace *trace);
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef _PILAB_W1_BUS_H
+#define _PILAB_W1_BUS_H
+#include <pthread.h>
+#include <stdint.h>
+
+/* Where the kernel w1 subsystem exposes the bus masters and their slaves */
+#define PILAB_W1_BUS_DEFAULT_ROOT "/sys/bus/w1/devices"
+#define PILAB_W1_BUS_DEFAULT_MASTER "w1_bus_master1"
+/* Family code of the ds18b20, prefixed to its serial in the slave id */
+#define PILAB_W1_BUS_FAMILY_DS18B20 "28"
+/* A 12 bit conversion takes 750 ms, give the bus some slack on top */
+#define PILAB_W1_BUS_CONVERSION_TIME 750
+#define PILAB_W1_BUS_CONVERSION_TIMEOUT 1000
+#define PILAB_W1_BUS_POLL_INTERVAL 10
+/* Time (in ms) a conversion may be handed to probes that did not use it yet */
+#define PILAB_W1_BUS_DEFAULT_MAX_AGE 10000
+
+/* Sysfs attributes */
+#define PILAB_W1_BUS_BULK_READ "therm_bulk_read"
+#define PILAB_W1_BUS_SLAVE "w1_slave"
+
+struct t_w1_bus;
+
+struct t_w1_probe {
+	/*
+	 * The bus the probe is attached to.
+	 */
+	struct t_w1_bus *bus;
+	/*
+	 * Slave id of the probe, <family>-<serial>.
+	 */
+	char *id;
+	/*
+	 * Temperature (millidegrees) of the last conversion.
+	 */
+	int millidegrees;
+	/*
+	 * 1 when the scratchpad of the last conversion passed its crc.
+	 */
+	int valid;
+	/*
+	 * Conversion the result belongs to, and the last one handed out.
+	 */
+	unsigned long epoch;
+	unsigned long consumed;
+};
+
+struct t_w1_bus_stats {
+	/*
+	 * Amount of conversions started on the bus.
+	 */
+	unsigned long conversions;
+	/*
+	 * Amount of conversions that were broadcast to all probes at once.
+	 */
+	unsigned long bulk_conversions;
+	/*
+	 * Amount of probe reads.
+	 */
+	unsigned long reads;
+	/*
+	 * Amount of probe reads served by a conversion another read started.
+	 */
+	unsigned long shared;
+	/*
+	 * Amount of scratchpads that could not be read, or failed their crc.
+	 */
+	unsigned long failures;
+	/*
+	 * Total and longest time (ns) spent converting and reading the bus.
+	 */
+	uint64_t conversion_total_ns;
+	uint64_t conversion_max_ns;
+};
+
+struct t_w1_bus {
+	/*
+	 * Directory holding the bus master and its slaves.
+	 */
+	char *root;
+	/*
+	 * Name of the bus master.
+	 */
+	char *master;
+	/*
+	 * The probes attached to the bus.
+	 */
+	struct t_w1_probe **probes;
+	int num_probes;
+	/*
+	 * 1 while the master accepts bulk conversions, 0 once it refused one.
+	 */
+	int bulk;
+	/*
+	 * Cached descriptor of the bulk read attribute, -1 until first used.
+	 */
+	int bulk_fd;
+	/*
+	 * Monotonic time (ns) the last conversion was started without waiting
+	 * for it, 0 when there is none.
+	 */
+	uint64_t started_at;
+	/*
+	 * 1 while a conversion is running.
+	 */
+	int converting;
+	/*
+	 * Amount of finished conversions.
+	 */
+	unsigned long epoch;
+	/*
+	 * Monotonic time (ns) the last conversion finished.
+	 */
+	uint64_t converted_at;
+	/*
+	 * Time (ns) a conversion may be handed out.
+	 */
+	uint64_t max_age;
+	/*
+	 * Statistics of the bus.
+	 */
+	struct t_w1_bus_stats stats;
+	/*
+	 * Protects the state, the probe results and the statistics.
+	 */
+	pthread_mutex_t lock;
+	/*
+	 * Signalled when a conversion finishes.
+	 */
+	pthread_cond_t converted;
+};
+
+extern int w1_bus_parse_slave(const char *buffer, int *millidegrees);
+extern struct t_w1_bus *w1_bus_create(const char *root, const char *master);
+extern int w1_bus_set_root(struct t_w1_bus *bus, const char *root);
+extern void w1_bus_set_max_age(struct t_w1_bus *bus, int max_age);
+extern struct t_w1_probe *w1_bus_add_probe(struct t_w1_bus *bus,
+					   const char *serial);
+extern int w1_bus_start_conversion(struct t_w1_bus *bus);
+extern int w1_bus_convert(struct t_w1_bus *bus);
+extern int w1_probe_read(struct t_w1_probe *probe, int *millidegrees);
+extern void w1_bus_get_stats(struct t_w1_bus *bus,
+			     struct t_w1_bus_stats *stats);
+extern void w1_bus_free(struct t_w1_bus *bus);
+
+#endif
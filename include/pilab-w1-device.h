@@ -0,0 +1,65 @@
+#ifndef _PILAB_W1_DEVICE_H
+#define _PILAB_W1_DEVICE_H
+#include <stdint.h>
+#include "pilab-slave-device.h"
+#include "pilab-host-device.h"
+#include "pilab-w1-bus.h"
+
+/* A read waits for one conversion at most, the kernel adds its share */
+#define PILAB_W1_DEVICE_READ_TIMEOUT 2000
+/* Attribute with the conversion time (in ms) of the probe, on newer kernels */
+#define PILAB_W1_DEVICE_CONV_TIME "conv_time"
+
+struct t_w1_device {
+	/*
+	 * The name of the device.
+	 */
+	const char *device_name;
+	/*
+	 * Pin base should be a number > 0x40.
+	 */
+	int pin_base;
+	/*
+	 * Slave id of the probe, <family>-<serial>.
+	 */
+	char *id;
+	/*
+	 * The bus the probe is attached to, it holds the sysfs root.
+	 */
+	struct t_w1_bus *bus;
+	/*
+	 * Cached descriptor of the w1_slave attribute, -1 until first used.
+	 */
+	int slave_fd;
+	/*
+	 * Time (in ms) a conversion of the probe takes.
+	 */
+	int conversion_time;
+	/*
+	 * Monotonic time (ns) the started conversion is done, 0 when no
+	 * conversion is pending.
+	 */
+	uint64_t ready_at;
+};
+
+extern int w1_device_analog_read(const void *instance, int pin);
+extern void w1_device_analog_write(const void *instance, int pin, int value);
+extern int w1_device_digital_read(const void *instance, int pin);
+extern void w1_device_digital_write(const void *instance, int pin, int value);
+extern int w1_device_start_sample(const void *instance);
+extern int w1_device_collect_sample(const void *instance,
+				    struct t_slave_device_sample *sample);
+extern int w1_device_read_sample(const void *instance,
+				 struct t_slave_device_sample *sample);
+extern int w1_device_get_pin_base(const void *instance);
+extern void w1_device_set_pointer(const void *instance, const char *property,
+				  void *pointer);
+extern int w1_device_get_expansion_pin(const void *instance, int pin);
+extern const char *w1_device_get_name(const void *instance);
+extern void w1_device_free_device(const void *instance);
+extern struct t_w1_device *w1_device_create(int pin_base,
+					    const char *device_name,
+					    const char *serial,
+					    struct t_host_device *host);
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef _PILAB_WATCHDOG_H
+#define _PILAB_WATCHDOG_H
+#include <pthread.h>
+#include <stdint.h>
+
+/* Defaults of the watchdog */
+#define PILAB_WATCHDOG_DEFAULT_THRESHOLD 3
+#define PILAB_WATCHDOG_DEFAULT_BACKOFF 60
+#define PILAB_WATCHDOG_MAX_BACKOFF (60 * 60)
+/* Interval (in ms) at which the reads in flight are checked */
+#define PILAB_WATCHDOG_CHECK_INTERVAL 500
+
+/* Sensor options controlling the watchdog */
+#define PILAB_WATCHDOG_OPTION_TIMEOUT "read_timeout"
+#define PILAB_WATCHDOG_OPTION_THRESHOLD "quarantine_after"
+#define PILAB_WATCHDOG_OPTION_BACKOFF "quarantine_backoff"
+
+struct t_watchdog_stats {
+	/*
+	 * Amount of reads watched.
+	 */
+	unsigned long reads;
+	/*
+	 * Amount of reads that passed their deadline.
+	 */
+	unsigned long timeouts;
+	/*
+	 * Amount of timed out reads that did return eventually.
+	 */
+	unsigned long late;
+	/*
+	 * Amount of times the device got quarantined.
+	 */
+	unsigned long quarantines;
+	/*
+	 * Amount of readings skipped, because the device was busy or
+	 * quarantined.
+	 */
+	unsigned long skipped;
+};
+
+struct t_watchdog {
+	/*
+	 * Deadline (ns) of a single read.
+	 */
+	uint64_t timeout;
+	/*
+	 * Consecutive timeouts before the device is quarantined.
+	 */
+	int threshold;
+	/*
+	 * First quarantine (ns), it doubles with every next quarantine.
+	 */
+	uint64_t backoff;
+	/*
+	 * Monotonic time (ns) the read in flight started, 0 when idle.
+	 */
+	uint64_t started;
+	/*
+	 * 1 from the moment a reading of the device is handed out until the
+	 * worker is done with it, across every read it takes.
+	 */
+	int busy;
+	/*
+	 * 1 when the read in flight passed its deadline.
+	 */
+	int timed_out;
+	/*
+	 * Timeouts since the last read that finished in time.
+	 */
+	int consecutive;
+	/*
+	 * Amount of quarantines since the last read that finished in time.
+	 */
+	int level;
+	/*
+	 * Monotonic time (ns) until which the device is left alone.
+	 */
+	uint64_t quarantined_until;
+	/*
+	 * Statistics of the watchdog.
+	 */
+	struct t_watchdog_stats stats;
+	/*
+	 * Protects the state, shared by the workers and the event loop.
+	 */
+	pthread_mutex_t lock;
+};
+
+extern struct t_watchdog *watchdog_create(int timeout, int threshold,
+					  int backoff);
+extern void watchdog_begin(struct t_watchdog *watchdog, uint64_t now);
+extern int watchdog_end(struct t_watchdog *watchdog, uint64_t now);
+extern int watchdog_check(struct t_watchdog *watchdog, uint64_t now);
+extern int watchdog_claim(struct t_watchdog *watchdog, uint64_t now);
+extern void watchdog_release(struct t_watchdog *watchdog);
+extern void watchdog_get_stats(struct t_watchdog *watchdog,
+			       struct t_watchdog_stats *stats);
+extern void watchdog_free(struct t_watchdog *watchdog);
+
+#endif
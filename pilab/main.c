@@ -3,10 +3,10 @@
 #include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include <json-c/json.h>
 #include <wiringPi.h>
 #include <unistd.h>
-#include <pthread.h>
 #include <errno.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -21,144 +21,1626 @@
 #include "pilab-host-device.h"
 #include "pilab-api-client.h"
 #include "pilab-api-calls.h"
+#include "pilab-api-multi.h"
 #include "pilab-json-parser.h"
 #include "pilab-gpio-device.h"
 #include "pilab-lcd.h"
+#include "pilab-hal.h"
 #include "pilab-time.h"
+#include "pilab-sampler.h"
+#include "pilab-scheduler.h"
+#include "pilab-event-loop.h"
+#include "pilab-adaptive.h"
+#include "pilab-deadband.h"
+#include "pilab-filter.h"
+#include "pilab-watchdog.h"
+#include "pilab-w1-bus.h"
+#include "pilab-trace.h"
+#include "pilab-batch.h"
+#include "pilab-spool.h"
+#include "pilab-replay-device.h"
+#include "pilab-gpio-input.h"
+
+struct t_pilab_config *pilab_config(char *config_file_path)
+{
+	struct t_pilab_config *config;
+	config = config_create_custom(config_file_path);
+	if (!config) {
+		pilab_log(LOG_ERROR,
+			  "Could not create a pilab config instance.");
+		exit(EXIT_FAILURE);
+	}
+	return config;
+}
+
+struct t_api_client *pilab_client(struct t_pilab_config *config)
+{
+	struct t_api_client *client;
+	/* curl is set up before any thread can start a request */
+	if (!api_client_connections_init())
+		pilab_log(LOG_ERROR,
+			  "Requests will not share their connections");
+	/* create a new client */
+	client = api_client_create(config);
+	if (!client) {
+		pilab_log(LOG_ERROR, "Could not create a api client instance.");
+		exit(EXIT_FAILURE);
+	}
+	/*
+	 * a refused cookie is renewed on the spot, or by a login transfer for
+	 * the uploads of the event loop
+	 */
+	api_client_set_pointer(client, "callback_login", &pilab_login);
+	api_client_set_pointer(client, "callback_login_request",
+			       &pilab_login_request);
+	api_client_set_pointer(client, "callback_login_finish",
+			       &pilab_login_finish);
+	return client;
+}
+
+/*
+ * Apply the retry policies and the circuit breaker of the config to the
+ * client.
+ */
+
+void pilab_retry(struct t_api_client *client, struct t_pilab_config *config)
+{
+	const char *policies[API_CLIENT_CLASS_NUM_CLASSES];
+	int i;
+
+	policies[API_CLIENT_CLASS_DEFAULT] = config->retry_default;
+	policies[API_CLIENT_CLASS_LOGIN] = config->retry_login;
+	policies[API_CLIENT_CLASS_READING] = config->retry_reading;
+
+	for (i = 0; i < API_CLIENT_CLASS_NUM_CLASSES; ++i)
+		if (policies[i] &&
+		    api_client_set_retry(client, i, policies[i]) < 1)
+			pilab_log(LOG_ERROR,
+				  "Invalid retry policy %s, keeping the default",
+				  policies[i]);
+
+	if ((config->circuit_threshold > 0 || config->circuit_probe > 0) &&
+	    api_client_set_circuit(client, config->circuit_threshold,
+				   config->circuit_probe) < 1)
+		pilab_log(LOG_ERROR,
+			  "Could not set up the circuit, keeping the default");
+}
+
+/* A special feature for MR Minuto */
+void pilab_grandma_needs_a_prompt(struct t_pilab_config *config, int *argc,
+				  char ***argv)
+{
+	struct t_popup *popup;
+	/* first read of config */
+	if (config_read_configuration_file(config)) {
+		/* check if the config file has the necessary configrations */
+		if (config_has_necessary_configurations(config) < 1) {
+			popup = popup_create(config);
+			if (!popup) {
+				pilab_log(LOG_ERROR,
+					  "Could not create a popup instance.");
+				exit(EXIT_FAILURE);
+			}
+			popup_init(popup, argc, argv);
+
+			/* wipe the config */
+			/* config_clear_file(config); */
+			/* prompt again */
+			popup_show(popup);
+		}
+	}
+}
+
+void pilab_read_config(struct t_pilab_config *config)
+{
+	/* read configuration (again, we need the newly added values) */
+	if (config_read_configuration_file(config)) {
+		if (config_has_necessary_configurations(config) < 1) {
+			pilab_log(
+				LOG_ERROR,
+				"Double reading of configuration file resulted in no results, please make sure there is a valid config and read/write operations are properly executed!");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/*
+ * Select the backend the drivers go through, wiringPi is set up when it is
+ * the one selected.
+ */
+
+void pilab_hal(struct t_pilab_config *config)
+{
+	struct t_hal *hal;
+
+	/* a replay doesn't touch the hardware, unless told otherwise */
+	hal = hal_create_by_name((!config->hal && config->trace_replay) ?
+					 PILAB_HAL_SIM :
+					 config->hal);
+	if (!hal) {
+		pilab_log(LOG_ERROR, "Could not create the %s hal.",
+			  (config->hal) ? config->hal : PILAB_HAL_WIRINGPI);
+		exit(EXIT_FAILURE);
+	}
+	hal_set(hal);
+
+	pilab_log(LOG_INFO, "Using the %s hal.", hal->name);
+	if (hal->extensions)
+		wiringPiSetupGpio();
+}
+
+struct t_host_device *pilab_host()
+{
+	struct t_host_device *new_host;
+
+	new_host = host_device_create();
+	if (!new_host) {
+		pilab_log(LOG_ERROR,
+			  "Could not create a host device instance.");
+		exit(EXIT_FAILURE);
+	}
+
+	if (host_device_read_in_sensor_modules(new_host) < 1) {
+		pilab_log(LOG_ERROR,
+			  "The sensors file is misconfigured, exiting...");
+		exit(EXIT_FAILURE);
+	}
+
+	return new_host;
+}
+
+/*
+ * Per-sensor state, attached as data to the scheduler entry of the sensor.
+ */
+
+struct t_pilab_sensor {
+	struct t_scheduler *scheduler;
+	struct t_scheduler_entry *entry;
+	/*
+	 * Adaptive sampling policy, NULL when the interval is fixed.
+	 */
+	struct t_adaptive *adaptive;
+	/*
+	 * Deadband of the uploads, NULL when every reading is uploaded.
+	 */
+	struct t_deadband *deadband;
+	/*
+	 * Oversampling and sentinel rejection of the readings.
+	 */
+	struct t_filter *filter;
+	/*
+	 * Deadline of the reads, and quarantine of a hanging device.
+	 */
+	struct t_watchdog *watchdog;
+	/*
+	 * Timer for collecting a reading that was started, armed by the worker
+	 * that started it. NULL when the device is read in one go.
+	 */
+	struct t_event_loop_source *collect;
+	/*
+	 * 1 when the next worker starts a reading instead of taking it.
+	 */
+	int starting;
+	/*
+	 * 1 when the next sample is collected from a started reading.
+	 */
+	int started;
+	struct t_sampler *sampler;
+	/*
+	 * Trace every raw read is recorded to, NULL when not recording.
+	 */
+	struct t_trace_writer *trace;
+	/*
+	 * Batch the readings are uploaded with, NULL when every reading is
+	 * uploaded on its own.
+	 */
+	struct t_batch *batch;
+	/*
+	 * What the sensor measures, as labelled in the batch.
+	 */
+	const char *type;
+	/*
+	 * Spool of the readings that could not be uploaded, NULL without one.
+	 */
+	struct t_spool *spool;
+	/*
+	 * 1 when every reading goes through the spool, instead of only the
+	 * ones that failed to upload.
+	 */
+	int spool_always;
+};
+
+/* Power-on value of the ds18b20 (in degrees), it reads fine but isn't real */
+#define PILAB_DS18B20_POWER_ON 85.0
+
+/*
+ * Create the adaptive sampling policy of a sensor, when the sensor config
+ * sets a threshold for it.
+ *
+ * Returns a pointer to the policy, NULL when the sensor uses a fixed interval.
+ */
+
+struct t_adaptive *pilab_adaptive(struct t_slave_device *slave, int interval)
+{
+	struct t_adaptive *adaptive;
+	double threshold;
+
+	threshold = slave_device_get_option_double(
+		slave, PILAB_ADAPTIVE_OPTION_THRESHOLD, 0);
+	if (threshold <= 0)
+		return NULL;
+
+	adaptive = adaptive_create(interval, threshold);
+	if (!adaptive) {
+		pilab_log(LOG_ERROR,
+			  "Could not create an adaptive policy for %s.",
+			  slave->get_name(slave->instance));
+		return NULL;
+	}
+
+	adaptive_set_bounds(
+		adaptive,
+		slave_device_get_option_int(slave, PILAB_ADAPTIVE_OPTION_MIN, 0),
+		slave_device_get_option_int(slave, PILAB_ADAPTIVE_OPTION_MAX, 0));
+	adaptive_set_backoff(adaptive,
+			     slave_device_get_option_double(
+				     slave, PILAB_ADAPTIVE_OPTION_BACKOFF, 0));
+
+	return adaptive;
+}
+
+/*
+ * Create the deadband of a sensor, when the sensor config sets an absolute or
+ * relative change (or a heartbeat) for it.
+ *
+ * Returns a pointer to the deadband, NULL when every reading is uploaded.
+ */
+
+struct t_deadband *pilab_deadband(struct t_slave_device *slave)
+{
+	struct t_deadband *deadband;
+	double absolute, relative;
+	int max_silence;
+
+	absolute = slave_device_get_option_double(
+		slave, PILAB_DEADBAND_OPTION_ABSOLUTE, 0);
+	relative = slave_device_get_option_double(
+		slave, PILAB_DEADBAND_OPTION_RELATIVE, 0);
+	max_silence = slave_device_get_option_int(
+		slave, PILAB_DEADBAND_OPTION_MAX_SILENCE, 0);
+	if (absolute <= 0 && relative <= 0 && max_silence <= 0)
+		return NULL;
+
+	deadband = deadband_create(absolute, relative, max_silence);
+	if (!deadband)
+		pilab_log(LOG_ERROR, "Could not create a deadband for %s.",
+			  slave->get_name(slave->instance));
+
+	return deadband;
+}
+
+/*
+ * Create the filter stage of a sensor, every sensor gets one so bad
+ * sub-samples are always rejected.
+ *
+ * Returns a pointer to the filter, NULL otherwise.
+ */
+
+struct t_filter *pilab_filter(struct t_slave_device *slave)
+{
+	struct t_filter *filter;
+	const char *method_name;
+	int method, module;
+
+	method = FILTER_MEDIAN;
+	method_name = slave_device_get_option(slave, PILAB_FILTER_OPTION_METHOD);
+	if (method_name) {
+		method = filter_get_method(method_name);
+		if (method < 0) {
+			pilab_log(LOG_ERROR,
+				  "Unknown filter '%s' for %s, using median.",
+				  method_name, slave->get_name(slave->instance));
+			method = FILTER_MEDIAN;
+		}
+	}
+
+	filter = filter_create(method,
+			       slave_device_get_option_int(
+				       slave, PILAB_FILTER_OPTION_SAMPLES, 0));
+	if (!filter) {
+		pilab_log(LOG_ERROR, "Could not create a filter for %s.",
+			  slave->get_name(slave->instance));
+		return NULL;
+	}
+
+	filter_set_max_rereads(filter, slave_device_get_option_int(
+					       slave, PILAB_FILTER_OPTION_REREADS,
+					       PILAB_FILTER_DEFAULT_REREADS));
+	filter_set_trim(filter,
+			slave_device_get_option_int(slave,
+						    PILAB_FILTER_OPTION_TRIM,
+						    PILAB_FILTER_DEFAULT_TRIM));
+	filter_set_alpha(filter, slave_device_get_option_double(
+					 slave, PILAB_FILTER_OPTION_ALPHA,
+					 PILAB_FILTER_DEFAULT_ALPHA));
+
+	/* failed reads are rejected through the quality of the sample */
+	module = host_device_get_sensor_module(slave->get_name(slave->instance));
+	if (module == HOST_DEVICE_MODULE_DS18B20 ||
+	    module == HOST_DEVICE_MODULE_W1)
+		filter_add_sentinel(filter, PILAB_DS18B20_POWER_ON);
+	if (slave_device_get_option(slave, PILAB_FILTER_OPTION_SENTINEL))
+		filter_add_sentinel(filter,
+				    slave_device_get_option_double(
+					    slave, PILAB_FILTER_OPTION_SENTINEL,
+					    PILAB_SLAVE_DEVICE_READ_FAILED));
+
+	return filter;
+}
+
+/*
+ * Create the watchdog of a sensor, with the read deadline of its driver unless
+ * the sensor config overrides it.
+ *
+ * Returns a pointer to the watchdog, NULL otherwise.
+ */
+
+struct t_watchdog *pilab_watchdog(struct t_slave_device *slave)
+{
+	struct t_watchdog *watchdog;
+
+	watchdog = watchdog_create(
+		slave_device_get_option_int(slave,
+					    PILAB_WATCHDOG_OPTION_TIMEOUT,
+					    slave->read_timeout),
+		slave_device_get_option_int(slave,
+					    PILAB_WATCHDOG_OPTION_THRESHOLD, 0),
+		slave_device_get_option_int(slave, PILAB_WATCHDOG_OPTION_BACKOFF,
+					    0));
+	if (!watchdog)
+		pilab_log(LOG_ERROR, "Could not create a watchdog for %s.",
+			  slave->get_name(slave->instance));
+
+	return watchdog;
+}
+
+/*
+ * Let the adaptive policy of a sensor pick the interval until its next
+ * reading.
+ */
+
+void pilab_adapt(struct t_pilab_sensor *sensor, struct t_slave_device *slave,
+		 double value)
+{
+	int interval;
+
+	if (!sensor || !sensor->adaptive)
+		return;
+
+	if (adaptive_update(sensor->adaptive, value, &interval) < 1)
+		return;
+
+	pilab_log(LOG_INFO, "Sampling %s every %d s",
+		  slave->get_name(slave->instance), interval);
+
+	scheduler_set_interval(sensor->scheduler, sensor->entry, interval);
+	/* the next deadline may have moved forward */
+	scheduler_arm_timer(sensor->scheduler);
+}
+
+/*
+ * Log the effect of the adaptive policy of a sensor.
+ */
+
+void pilab_log_adaptive_stats(struct t_pilab_sensor *sensor)
+{
+	struct t_adaptive_stats stats;
+	struct t_slave_device *slave;
+
+	if (!sensor || !sensor->entry || !sensor->adaptive)
+		return;
+
+	slave = sensor->entry->slave;
+	adaptive_get_stats(sensor->adaptive, &stats);
+
+	pilab_log(
+		LOG_INFO,
+		"Adaptive %s: %lu readings instead of %lu at a fixed interval, %lu speedups, %lu backoffs",
+		slave->get_name(slave->instance), stats.readings,
+		stats.fixed_readings, stats.speedups, stats.backoffs);
+}
+
+/*
+ * Log how many uploads the deadband of a sensor saved.
+ */
+
+void pilab_log_deadband_stats(struct t_pilab_sensor *sensor)
+{
+	struct t_deadband_stats stats;
+	struct t_slave_device *slave;
+
+	if (!sensor || !sensor->entry || !sensor->deadband)
+		return;
+
+	slave = sensor->entry->slave;
+	deadband_get_stats(sensor->deadband, &stats);
+
+	pilab_log(
+		LOG_INFO,
+		"Deadband %s: %lu of %lu readings uploaded (%lu heartbeats), %lu suppressed",
+		slave->get_name(slave->instance), stats.sent, stats.readings,
+		stats.heartbeats, stats.suppressed);
+}
+
+/*
+ * Log what the filter of a sensor rejected, and how many extra reads it took.
+ */
+
+void pilab_log_filter_stats(struct t_pilab_sensor *sensor)
+{
+	struct t_filter_stats stats;
+	struct t_slave_device *slave;
+
+	if (!sensor || !sensor->entry || !sensor->filter)
+		return;
+
+	slave = sensor->entry->slave;
+	filter_get_stats(sensor->filter, &stats);
+
+	pilab_log(
+		LOG_INFO,
+		"Filter %s: %lu readings from %lu samples, %lu rejected, %lu re-reads, %lu failed readings",
+		slave->get_name(slave->instance), stats.readings,
+		stats.samples, stats.rejects, stats.rereads, stats.failures);
+}
+
+/*
+ * Log how often the reads of a sensor timed out.
+ */
+
+void pilab_log_watchdog_stats(struct t_pilab_sensor *sensor)
+{
+	struct t_watchdog_stats stats;
+	struct t_slave_device *slave;
+
+	if (!sensor || !sensor->entry || !sensor->watchdog)
+		return;
+
+	slave = sensor->entry->slave;
+	watchdog_get_stats(sensor->watchdog, &stats);
+
+	pilab_log(
+		LOG_INFO,
+		"Watchdog %s: %lu reads, %lu timeouts (%lu returned late), %lu quarantines, %lu readings skipped",
+		slave->get_name(slave->instance), stats.reads, stats.timeouts,
+		stats.late, stats.quarantines, stats.skipped);
+}
+
+/*
+ * Give every sampler worker its own api client, so the workers don't have to
+ * share (and lock) the request table of the main client. They share its
+ * login, retry policies and circuit.
+ */
+
+void *pilab_worker_init(struct t_sampler *sampler, void *data)
+{
+	struct t_api_client *client, *worker_client;
+
+	client = (struct t_api_client *)data;
+
+	worker_client = api_client_create_shared(client);
+	if (!worker_client) {
+		pilab_log(LOG_ERROR, "Could not create a api client instance.");
+		return NULL;
+	}
+
+	return worker_client;
+}
+
+void pilab_worker_free(struct t_sampler *sampler, void *worker_data)
+{
+	api_client_free_minimal((struct t_api_client *)worker_data);
+}
+
+/*
+ * Take a single sample of a sensor under its watchdog, for the filter stage.
+ *
+ * Returns 1 on success, 0 when the device reported a failed read.
+ */
+
+int pilab_read_sample(void *data, double *value)
+{
+	struct t_pilab_sensor *sensor;
+	struct t_slave_device *slave;
+	struct t_slave_device_sample sample;
+	uint64_t started, ended;
+	int rc;
+
+	sensor = (struct t_pilab_sensor *)data;
+	slave = sensor->entry->slave;
+
+	started = time_monotonic_ns();
+	watchdog_begin(sensor->watchdog, started);
+	if (sensor->started && slave->collect_sample) {
+		sensor->started = 0;
+		rc = slave->collect_sample(slave->instance, &sample);
+	} else {
+		rc = slave->read_sample(slave->instance, &sample);
+	}
+	ended = time_monotonic_ns();
+	if (watchdog_end(sensor->watchdog, ended) == 0)
+		pilab_log(LOG_ERROR, "Late read from %s returned after all",
+			  slave->get_name(slave->instance));
+
+	if (sensor->trace && rc >= 0)
+		(void)trace_writer_record(sensor->trace,
+					  slave->get_name(slave->instance),
+					  slave->get_pinbase(slave->instance),
+					  &sample, ended - started);
+
+	if (rc < 1)
+		return 0;
+
+	*value = sample.value;
+
+	return 1;
+}
+
+/*
+ * Create the batch the readings are uploaded with, when the config asks for
+ * more than one reading per upload.
+ *
+ * Returns a pointer to the batch, NULL when every reading is uploaded on its
+ * own.
+ */
+
+struct t_batch *pilab_batch(struct t_pilab_config *config)
+{
+	struct t_batch *batch;
+
+	if (config->batch_size < 2)
+		return NULL;
+
+	batch = batch_create(config->batch_size, config->batch_age);
+	if (!batch)
+		pilab_log(LOG_ERROR,
+			  "Could not create a batch, uploading every reading");
+
+	return batch;
+}
+
+/*
+ * Open the spool the readings go to while they can't be uploaded, when the
+ * config names a directory for it.
+ *
+ * Returns a pointer to the spool, NULL when failed uploads are lost.
+ */
+
+struct t_spool *pilab_spool(struct t_pilab_config *config)
+{
+	struct t_spool *spool;
+
+	if (!config->spool_dir)
+		return NULL;
+
+	spool = spool_open(config->spool_dir, config->spool_size);
+	if (!spool) {
+		pilab_log(LOG_ERROR,
+			  "Could not open spool %s, failed uploads are lost",
+			  config->spool_dir);
+		return NULL;
+	}
+
+	if (spool_pending(spool) > 0)
+		pilab_log(LOG_INFO, "%lu spooled readings left to upload",
+			  spool_pending(spool));
+
+	return spool;
+}
+
+/*
+ * Spool the readings of a batch that failed to upload.
+ *
+ * Returns the amount of readings spooled.
+ */
+
+int pilab_spool_readings(struct t_spool *spool, json_object *readings)
+{
+	json_object *reading, *name, *type, *timestamp, *value;
+	uint64_t now;
+	size_t i, length;
+	int spooled;
+
+	now = time_monotonic_ns();
+	spooled = 0;
+	length = json_object_array_length(readings);
+	for (i = 0; i < length; ++i) {
+		reading = json_object_array_get_idx(readings, i);
+		if (!json_object_object_get_ex(reading, PILAB_BATCH_KEY_NAME,
+					       &name) ||
+		    !json_object_object_get_ex(reading, PILAB_BATCH_KEY_TYPE,
+					       &type) ||
+		    !json_object_object_get_ex(reading,
+					       PILAB_BATCH_KEY_TIMESTAMP,
+					       &timestamp) ||
+		    !json_object_object_get_ex(reading, PILAB_BATCH_KEY_VALUE,
+					       &value))
+			continue;
+
+		if (spool_append(spool, json_object_get_string(name),
+				 json_object_get_string(type),
+				 (uint64_t)json_object_get_int64(timestamp),
+				 json_object_get_double(value), now) == 1)
+			spooled++;
+	}
+
+	return spooled;
+}
+
+/*
+ * Upload the readings taken out of the batch, they are spooled when that
+ * fails.
+ */
+
+void pilab_upload_batch(struct t_api_client *client, struct t_spool *spool,
+			json_object *readings)
+{
+	if (!readings)
+		return;
+
+	if (!spool) {
+		if (pilab_add_data_batch(client, readings) < 1)
+			pilab_log(LOG_ERROR, "A batch of readings was lost");
+		return;
+	}
+
+	/* the upload puts the readings, they are still needed on failure */
+	json_object_get(readings);
+	if (pilab_add_data_batch(client, readings) < 1 &&
+	    pilab_spool_readings(spool, readings) <
+		    (int)json_object_array_length(readings))
+		pilab_log(LOG_ERROR, "A batch of readings was lost");
+	json_object_put(readings);
+}
+
+/*
+ * Spool a reading of a sensor, it is uploaded by the forwarder.
+ *
+ * Returns 1 when the reading was spooled, 0 otherwise.
+ */
+
+int pilab_spool_reading(struct t_pilab_sensor *sensor, double value,
+			uint64_t now)
+{
+	struct t_slave_device *slave;
+
+	slave = sensor->entry->slave;
+
+	return (spool_append(sensor->spool, slave->get_name(slave->instance),
+			     sensor->type, time_realtime_ns() / 1000000, value,
+			     now) == 1) ?
+		       1 :
+		       0;
+}
+
+/*
+ * Add a reading of a sensor to the batch, and upload the batch when that
+ * made it due.
+ *
+ * Returns 1 when the reading was added, 0 otherwise.
+ */
+
+int pilab_batch_reading(struct t_api_client *client,
+			struct t_pilab_sensor *sensor, double value,
+			uint64_t now)
+{
+	struct t_slave_device *slave;
+	int rc;
+
+	slave = sensor->entry->slave;
+
+	rc = batch_add(sensor->batch, slave->get_name(slave->instance),
+		       sensor->type, time_realtime_ns() / 1000000, value, now);
+	if (rc == 0) {
+		/* full, another worker is about to take it, or failed to */
+		pilab_upload_batch(client, sensor->spool,
+				   batch_take(sensor->batch, now, 1));
+		rc = batch_add(sensor->batch, slave->get_name(slave->instance),
+			       sensor->type, time_realtime_ns() / 1000000,
+			       value, now);
+	}
+
+	pilab_upload_batch(client, sensor->spool,
+			   batch_take(sensor->batch, now, 0));
+
+	return (rc == 1) ? 1 : 0;
+}
+
+/*
+ * Take a reading of a sensor and hand it to the deadband, the spool, the batch
+ * or the backend.
+ */
+
+void pilab_take_reading(struct t_api_client *client,
+			struct t_pilab_sensor *sensor,
+			struct t_slave_device *slave)
+{
+	uint64_t now;
+	double value;
+	char char_value[20];
+
+	if (sensor->filter) {
+		if (filter_read(sensor->filter, &pilab_read_sample, sensor,
+				&value) < 1) {
+			pilab_log(LOG_ERROR, "No valid reading from %s",
+				  slave->get_name(slave->instance));
+			return;
+		}
+	} else if (pilab_read_sample(sensor, &value) < 1) {
+		pilab_log(LOG_ERROR, "No valid reading from %s",
+			  slave->get_name(slave->instance));
+		return;
+	}
+
+	/* make it a 1 precision floating point number */
+	sprintf(char_value, "%.1f", value);
+
+	/* the adaptive policy sees every reading, the backend only changes */
+	pilab_adapt(sensor, slave, value);
+
+	now = time_monotonic_ns();
+	if (sensor->deadband &&
+	    deadband_check(sensor->deadband, value, now) == 0) {
+		pilab_log(LOG_DEBUG, "Reading within deadband: %s", char_value);
+		return;
+	}
+
+	pilab_log(LOG_DEBUG, "Adding reading: %s", char_value);
+
+	/* the forwarder uploads it, at the pace of the spool */
+	if (sensor->spool && sensor->spool_always) {
+		if (pilab_spool_reading(sensor, value, now))
+			deadband_sent(sensor->deadband, value, now);
+		return;
+	}
+
+	if (sensor->batch) {
+		if (pilab_batch_reading(client, sensor, value, now))
+			deadband_sent(sensor->deadband, value, now);
+		return;
+	}
+
+	if (pilab_add_data(client, char_value) ||
+	    (sensor->spool && pilab_spool_reading(sensor, value, now)))
+		deadband_sent(sensor->deadband, value, now);
+}
+
+/*
+ * Start the reading of a device that can be read in two steps, and arm the
+ * timer of the sensor to have it collected once it is done, instead of letting
+ * a worker wait for it.
+ *
+ * Returns 1 when the timer hands the reading out again, 0 when the worker
+ * should take it right away.
+ */
+
+int pilab_start_sample(struct t_pilab_sensor *sensor)
+{
+	struct t_slave_device *slave;
+	int remaining;
+
+	slave = sensor->entry->slave;
+
+	/* one that can't be started is read in one go by the next worker */
+	remaining = slave->start_sample(slave->instance);
+	sensor->started = (remaining > 0);
+	if (event_loop_arm_timeout(sensor->collect, remaining) < 1) {
+		sensor->started = 0;
+		return 0;
+	}
+
+	return 1;
+}
+
+void pilab_worker(struct t_sampler *sampler, void *worker_data,
+		  struct t_slave_device *slave, void *data)
+{
+	struct t_api_client *client;
+	struct t_scheduler_entry *entry;
+	struct t_pilab_sensor *sensor;
+
+	client = (struct t_api_client *)worker_data;
+	entry = (struct t_scheduler_entry *)data;
+	sensor = (entry) ? (struct t_pilab_sensor *)entry->data : NULL;
+
+	if (!sensor) {
+		pilab_log(LOG_ERROR, "Could not find the sensor of %s",
+			  slave->get_name(slave->instance));
+		return;
+	}
+
+	/* the device stays busy until the reading is collected */
+	if (sensor->starting) {
+		sensor->starting = 0;
+		if (pilab_start_sample(sensor))
+			return;
+	}
+
+	if (!client)
+		pilab_log(
+			LOG_ERROR,
+			"Could not find client in the thread pilab_worker for %s",
+			slave->get_name(slave->instance));
+	else
+		pilab_take_reading(client, sensor, slave);
+
+	/* the device can be handed out again */
+	watchdog_release(sensor->watchdog);
+}
+
+/*
+ * Log the counters of the sampler.
+ */
+
+void pilab_log_sampler_stats(struct t_sampler *sampler)
+{
+	struct t_sampler_stats stats;
+
+	sampler_get_stats(sampler, &stats);
+
+	pilab_log(
+		LOG_DEBUG,
+		"Sampler: %lu completed, %lu dropped, %lu workers replaced (%d not returned), queue depth %d (max %d), avg latency %llu us (max %llu us), avg wait %llu us",
+		stats.jobs_completed, stats.jobs_dropped, stats.workers_replaced,
+		stats.workers_abandoned, stats.queue_depth,
+		stats.queue_depth_max,
+		(unsigned long long)((stats.jobs_completed) ?
+					     stats.latency_total_ns /
+						     stats.jobs_completed / 1000 :
+					     0),
+		(unsigned long long)(stats.latency_max_ns / 1000),
+		(unsigned long long)((stats.jobs_completed) ?
+					     stats.wait_total_ns /
+						     stats.jobs_completed / 1000 :
+					     0));
+}
+
+/*
+ * Log the counters of the 1-Wire bus.
+ */
+
+void pilab_log_w1_stats(struct t_w1_bus *bus)
+{
+	struct t_w1_bus_stats stats;
+
+	w1_bus_get_stats(bus, &stats);
+	if (stats.reads == 0)
+		return;
+
+	pilab_log(
+		LOG_DEBUG,
+		"1-Wire bus: %lu reads, %lu conversions (%lu broadcast), %lu reads shared a conversion, %lu failures, avg conversion %llu ms (max %llu ms)",
+		stats.reads, stats.conversions, stats.bulk_conversions,
+		stats.shared, stats.failures,
+		(unsigned long long)((stats.conversions) ?
+					     stats.conversion_total_ns /
+						     stats.conversions /
+						     1000000 :
+					     0),
+		(unsigned long long)(stats.conversion_max_ns / 1000000));
+}
+
+/*
+ * The login and registration of the pi with the backend, done while the
+ * devices are set up.
+ */
+
+struct t_pilab_handshake {
+	struct t_api_client *client;
+	pthread_t thread;
+	/*
+	 * 1 when the handshake runs on the thread, 0 when it already ran.
+	 */
+	int threaded;
+	/*
+	 * Time (ns) the handshake took.
+	 */
+	uint64_t elapsed;
+};
+
+void *pilab_handshake_run(void *data)
+{
+	struct t_pilab_handshake *handshake;
+	uint64_t started;
+
+	handshake = (struct t_pilab_handshake *)data;
+
+	started = time_monotonic_ns();
+	/* adding the pi needs the cookie of the login */
+	pilab_login(handshake->client);
+	pilab_add_pi(handshake->client);
+	handshake->elapsed = time_monotonic_ns() - started;
+
+	return NULL;
+}
+
+/*
+ * Start the handshake with the backend, the client is not to be touched until
+ * pilab_handshake_join returns.
+ */
+
+void pilab_handshake_start(struct t_pilab_handshake *handshake,
+			   struct t_api_client *client)
+{
+	handshake->client = client;
+	handshake->elapsed = 0;
+	handshake->threaded = (pthread_create(&handshake->thread, NULL,
+					      &pilab_handshake_run,
+					      handshake) == 0);
+	if (!handshake->threaded) {
+		pilab_log(LOG_DEBUG,
+			  "Could not start the handshake thread, logging in first");
+		(void)pilab_handshake_run(handshake);
+	}
+}
+
+/*
+ * Wait for the handshake with the backend to finish.
+ */
+
+void pilab_handshake_join(struct t_pilab_handshake *handshake)
+{
+	if (handshake->threaded)
+		pthread_join(handshake->thread, NULL);
+	handshake->threaded = 0;
+}
+
+/*
+ * Points in time (monotonic ns) of the startup, for the startup report.
+ */
+
+struct t_pilab_startup {
+	uint64_t started;
+	uint64_t configured;
+	uint64_t hal_ready;
+	uint64_t host_ready;
+	uint64_t handshake_done;
+	uint64_t ready;
+};
+
+/*
+ * Log where the time between starting and sampling the first device went.
+ */
+
+void pilab_log_startup(struct t_pilab_startup *startup,
+		       struct t_host_device *host,
+		       struct t_pilab_handshake *handshake)
+{
+	pilab_log(
+		LOG_INFO,
+		"Started in %llu ms: config %llu ms, hal %llu ms, sensors file %llu ms, device setup %llu ms, sampler %llu ms",
+		(unsigned long long)((startup->ready - startup->started) /
+				     1000000),
+		(unsigned long long)((startup->configured - startup->started) /
+				     1000000),
+		(unsigned long long)((startup->hal_ready -
+				      startup->configured) /
+				     1000000),
+		(unsigned long long)(host->startup.parse_ns / 1000000),
+		(unsigned long long)(host->startup.setup_ns / 1000000),
+		(unsigned long long)((startup->ready -
+				      startup->handshake_done) /
+				     1000000));
+	pilab_log(
+		LOG_INFO,
+		"Set up %d devices on %d buses at once in %llu ms (%llu ms one by one), %d failed",
+		host->startup.devices, host->startup.buses,
+		(unsigned long long)(host->startup.setup_ns / 1000000),
+		(unsigned long long)(host->startup.busy_ns / 1000000),
+		host->startup.failures);
+	pilab_log(
+		LOG_INFO,
+		"Login and adding the pi took %llu ms, %llu ms of it after the devices were set up",
+		(unsigned long long)(handshake->elapsed / 1000000),
+		(unsigned long long)((startup->handshake_done -
+				      startup->host_ready) /
+				     1000000));
+}
+
+/*
+ * Start recording every raw device read, when the config names a trace.
+ *
+ * Returns the writer of the trace, NULL when not recording.
+ */
+
+struct t_trace_writer *pilab_trace_record(struct t_pilab_config *config)
+{
+	struct t_trace_writer *writer;
+
+	if (!config->trace_record)
+		return NULL;
+
+	writer = trace_writer_open(config->trace_record);
+	if (!writer)
+		pilab_log(LOG_ERROR,
+			  "Could not record to %s, the reads are not traced.",
+			  config->trace_record);
+	else
+		pilab_log(LOG_INFO, "Recording the reads to %s",
+			  config->trace_record);
+
+	return writer;
+}
+
+/*
+ * Load the trace the reads are replayed from, when the config names one.
+ *
+ * Returns the trace, NULL when the devices are read.
+ */
+
+struct t_trace *pilab_trace_replay(struct t_pilab_config *config)
+{
+	struct t_trace *trace;
+
+	if (!config->trace_replay)
+		return NULL;
+
+	trace = trace_load(config->trace_replay);
+	if (!trace) {
+		pilab_log(LOG_ERROR, "Could not replay %s, exiting...",
+			  config->trace_replay);
+		exit(EXIT_FAILURE);
+	}
+
+	pilab_log(LOG_INFO,
+		  "Replaying %d devices from %s, %llu s recorded at %dx",
+		  trace->num_devices, config->trace_replay,
+		  (unsigned long long)((trace->last - trace->first) /
+				       PILAB_SCHEDULER_NSEC_PER_SEC),
+		  (config->trace_speed > 1) ? config->trace_speed : 1);
+
+	return trace;
+}
+
+/*
+ * Log the counters of the trace that was recorded.
+ */
+
+void pilab_log_trace_stats(struct t_trace_writer *writer)
+{
+	if (!writer)
+		return;
+
+	pilab_log(LOG_DEBUG, "Trace: %lu reads of %d devices in %lu bytes",
+		  writer->reads, writer->num_names, writer->bytes);
+}
+
+/*
+ * Log the counters of the connections to the backend.
+ */
+
+void pilab_log_connection_stats(void)
+{
+	struct t_api_client_connection_stats stats;
+
+	api_client_get_connection_stats(&stats);
+	if (stats.requests == 0)
+		return;
+
+	pilab_log(
+		LOG_DEBUG,
+		"Connections: %lu requests, %lu reused a connection, %lu connects (%lu TLS handshakes), %lu failures (%lu retried, %lu logins redone), avg connect %llu ms",
+		stats.requests, stats.reused, stats.connects,
+		stats.tls_handshakes, stats.failures, stats.retries,
+		stats.relogins,
+		(unsigned long long)((stats.connects) ?
+					     stats.connect_total_ns /
+						     stats.connects / 1000000 :
+					     0));
+}
+
+/*
+ * Log the counters of the circuit breaker of the client.
+ */
+
+void pilab_log_circuit_stats(struct t_api_client *client)
+{
+	struct t_circuit_stats stats;
+
+	circuit_get_stats(client->session->circuit, &stats);
+	if (stats.opened == 0)
+		return;
+
+	pilab_log(
+		LOG_DEBUG,
+		"Circuit: opened %lu times, closed %lu times after %lu probes, %lu requests failed fast",
+		stats.opened, stats.closed, stats.probes, stats.rejected);
+}
+
+/*
+ * Get the 1-Wire module of a sensor that may share a conversion of the bus
+ * with others: one on a fixed interval.
+ *
+ * Returns the module, -1 when the sensor can't be grouped.
+ */
+
+int pilab_w1_module(struct t_pilab_sensor *sensor)
+{
+	struct t_slave_device *slave;
+	int module;
+
+	if (!sensor->entry || sensor->adaptive)
+		return -1;
 
-struct t_pilab_config *pilab_config(char *config_file_path)
+	slave = sensor->entry->slave;
+	module = host_device_get_sensor_module(slave->get_name(slave->instance));
+	if (module != HOST_DEVICE_MODULE_DS18B20 &&
+	    module != HOST_DEVICE_MODULE_W1)
+		return -1;
+
+	return module;
+}
+
+/*
+ * Group every probe on the 1-Wire bus with the first one that is read the same
+ * way (a ds18b20 converts the whole bus, a w1 device starts and collects) at
+ * the same interval, so they stay due together and a single conversion of the
+ * bus serves all of them. A probe with an adaptive interval is left alone, it
+ * would drift out of its group anyway.
+ */
+
+void pilab_group_w1(struct t_pilab_sensor *sensors, int num_sensors)
 {
-	struct t_pilab_config *config;
-	config = config_create_custom(config_file_path);
-	if (!config) {
-		pilab_log(LOG_ERROR,
-			  "Could not create a pilab config instance.");
-		exit(EXIT_FAILURE);
+	int i, j, module;
+
+	for (i = 0; i < num_sensors; ++i) {
+		module = pilab_w1_module(&sensors[i]);
+		if (module < 0)
+			continue;
+
+		for (j = 0; j < i; ++j) {
+			if (pilab_w1_module(&sensors[j]) != module ||
+			    sensors[j].entry->interval !=
+				    sensors[i].entry->interval)
+				continue;
+			scheduler_group(sensors[i].scheduler, sensors[i].entry,
+					sensors[j].entry);
+			break;
+		}
 	}
-	return config;
 }
 
-struct t_api_client *pilab_client(struct t_pilab_config *config)
-{
+/*
+ * State shared by the callbacks of the event loop.
+ */
+
+struct t_pilab_daemon {
+	struct t_event_loop *loop;
+	struct t_scheduler *scheduler;
+	struct t_sampler *sampler;
+	struct t_pilab_sensor *sensors;
+	int num_sensors;
+	/*
+	 * Display the button presses are faked on, NULL without one.
+	 */
+	Display *display;
+	/*
+	 * The button lines, NULL when they could not be requested.
+	 */
+	struct t_gpio_input *buttons;
+	/*
+	 * Batch of readings, uploaded by the loop through the client when it
+	 * gets old. NULL when every reading is uploaded on its own.
+	 */
+	struct t_batch *batch;
 	struct t_api_client *client;
-	/* create a new client */
-	client = api_client_create(config);
-	if (!client) {
-		pilab_log(LOG_ERROR, "Could not create a api client instance.");
-		exit(EXIT_FAILURE);
+	/*
+	 * Spool of the readings waiting for their upload, forwarded by the
+	 * loop at spool_rate readings per second. NULL without one.
+	 */
+	struct t_spool *spool;
+	struct t_batch_item *spool_items;
+	int spool_rate;
+	/*
+	 * Uploads of the loop, run by it without waiting for the backend.
+	 * NULL when they could not be set up, the loop waits for them then.
+	 */
+	struct t_api_multi *uploads;
+	/*
+	 * Spooled readings on their way, and where the records they were read
+	 * from end. NULL when none are.
+	 */
+	struct t_api_client_request *spool_request;
+	struct t_spool_position spool_end;
+	/*
+	 * Aged batch on its way, and its readings, spooled when it fails. NULL
+	 * when none is.
+	 */
+	struct t_api_client_request *batch_request;
+	json_object *batch_readings;
+};
+
+/*
+ * Set up the uploads of the loop, on the main client.
+ *
+ * Returns a pointer to the multi, NULL otherwise.
+ */
+
+struct t_api_multi *pilab_uploads(struct t_pilab_daemon *daemon,
+				  t_api_multi_callback_done *callback_done)
+{
+	struct t_api_multi *uploads;
+
+	uploads = api_multi_create(daemon->client,
+				   PILAB_API_MULTI_DEFAULT_PARALLEL);
+	if (!uploads)
+		return NULL;
+
+	api_multi_set_pointer(uploads, "callback_done", callback_done);
+	api_multi_set_pointer(uploads, "callback_done_data", daemon);
+	if (api_multi_attach(uploads, daemon->loop) < 1) {
+		api_multi_free(uploads);
+		return NULL;
 	}
-	return client;
+
+	return uploads;
 }
 
-/* A special feature for MR Minuto */
-void pilab_grandma_needs_a_prompt(struct t_pilab_config *config, int *argc,
-				  char ***argv)
+/*
+ * Start an upload of readings on the loop, request points to the upload while
+ * it is on its way. The multi may be done with it right away, when the
+ * backend is down.
+ *
+ * Returns 1 when the upload started, 0 otherwise.
+ */
+
+int pilab_upload_start(struct t_pilab_daemon *daemon, json_object *readings,
+		       const char *name, struct t_api_client_request **request)
 {
-	struct t_popup *popup;
-	/* first read of config */
-	if (config_read_configuration_file(config)) {
-		/* check if the config file has the necessary configrations */
-		if (config_has_necessary_configurations(config) < 1) {
-			popup = popup_create(config);
-			if (!popup) {
-				pilab_log(LOG_ERROR,
-					  "Could not create a popup instance.");
-				exit(EXIT_FAILURE);
-			}
-			popup_init(popup, argc, argv);
+	*request = pilab_add_data_batch_request(daemon->client, readings, name);
+	if (!*request)
+		return 0;
 
-			/* wipe the config */
-			/* config_clear_file(config); */
-			/* prompt again */
-			popup_show(popup);
-		}
+	if (api_multi_add_request(daemon->uploads, *request) < 1) {
+		(void)pilab_add_data_batch_finish(daemon->client, *request);
+		*request = NULL;
+		return 0;
 	}
+
+	return 1;
 }
 
-void pilab_read_config(struct t_pilab_config *config)
+/*
+ * The reading a sensor started is done, let a worker collect it.
+ */
+
+void pilab_on_collect(struct t_event_loop *loop, int fd, uint32_t events,
+		      void *data)
 {
-	/* read configuration (again, we need the newly added values) */
-	if (config_read_configuration_file(config)) {
-		if (config_has_necessary_configurations(config) < 1) {
-			pilab_log(
-				LOG_ERROR,
-				"Double reading of configuration file resulted in no results, please make sure there is a valid config and read/write operations are properly executed!");
-			exit(EXIT_FAILURE);
+	struct t_pilab_sensor *sensor;
+	struct t_slave_device *slave;
+	uint64_t expirations;
+
+	sensor = (struct t_pilab_sensor *)data;
+	slave = sensor->entry->slave;
+
+	/* acknowledge the timer */
+	(void)read(fd, &expirations, sizeof(expirations));
+
+	if (sampler_submit(sensor->sampler, slave, sensor->entry) < 1) {
+		sensor->started = 0;
+		watchdog_release(sensor->watchdog);
+		pilab_log(LOG_ERROR, "Could not queue a reading for: %s",
+			  slave->get_name(slave->instance));
+	}
+}
+
+/*
+ * The scheduler timer expired, hand every device that is due to the sampler
+ * and arm the timer for the next deadline.
+ */
+
+void pilab_on_deadline(struct t_event_loop *loop, int fd, uint32_t events,
+		       void *data)
+{
+	struct t_pilab_daemon *daemon;
+	struct t_scheduler_entry *entry;
+	struct t_pilab_sensor *sensor;
+	uint64_t expirations, now;
+
+	daemon = (struct t_pilab_daemon *)data;
+
+	/* acknowledge the timer */
+	(void)read(fd, &expirations, sizeof(expirations));
+
+	now = time_monotonic_ns();
+	while ((entry = scheduler_pop_due(daemon->scheduler, now))) {
+		sensor = (struct t_pilab_sensor *)entry->data;
+		/*
+		 * a hanging or quarantined device doesn't get a worker, nor
+		 * does one whose previous reading isn't done yet
+		 */
+		if (!watchdog_claim(sensor->watchdog, now)) {
+			pilab_log(LOG_DEBUG, "Skipping a reading for: %s",
+				  entry->slave->get_name(entry->slave->instance));
+			continue;
+		}
+		/* a device read in two steps is started by a worker as well */
+		sensor->starting = (sensor->collect != NULL);
+		if (sampler_submit(daemon->sampler, entry->slave, entry) < 1) {
+			sensor->starting = 0;
+			watchdog_release(sensor->watchdog);
+			pilab_log(LOG_ERROR, "Could not queue a reading for: %s",
+				  entry->slave->get_name(entry->slave->instance));
 		}
 	}
+	pilab_log_sampler_stats(daemon->sampler);
+
+	scheduler_arm_timer(daemon->scheduler);
 }
 
-struct t_host_device *pilab_host()
+/*
+ * Check the reads in flight against their deadlines, a worker stuck in a read
+ * is replaced so the other sensors keep being read.
+ */
+
+void pilab_on_watchdog(struct t_event_loop *loop, int fd, uint32_t events,
+		       void *data)
 {
-	struct t_host_device *new_host;
+	struct t_pilab_daemon *daemon;
+	struct t_pilab_sensor *sensor;
+	struct t_slave_device *slave;
+	uint64_t expirations, now;
+	int i;
 
-	new_host = host_device_create();
-	if (!new_host) {
-		pilab_log(LOG_ERROR,
-			  "Could not create a host device instance.");
-		exit(EXIT_FAILURE);
+	daemon = (struct t_pilab_daemon *)data;
+
+	/* acknowledge the timer */
+	(void)read(fd, &expirations, sizeof(expirations));
+
+	now = time_monotonic_ns();
+	for (i = 0; i < daemon->num_sensors; ++i) {
+		sensor = &daemon->sensors[i];
+		if (!sensor->entry ||
+		    watchdog_check(sensor->watchdog, now) < 1)
+			continue;
+
+		slave = sensor->entry->slave;
+		pilab_log(LOG_ERROR, "Read from %s timed out",
+			  slave->get_name(slave->instance));
+		if (sampler_replace_worker(daemon->sampler, slave) < 1)
+			pilab_log(LOG_ERROR,
+				  "Could not replace the worker stuck on %s",
+				  slave->get_name(slave->instance));
 	}
+}
 
-	host_device_read_in_sensor_modules(new_host);
+/*
+ * The upload of an aged batch is done, its readings are spooled when it
+ * failed.
+ */
 
-	return new_host;
+void pilab_batch_uploaded(struct t_pilab_daemon *daemon, int accepted)
+{
+	daemon->batch_request = NULL;
+
+	if (!accepted &&
+	    (!daemon->spool ||
+	     pilab_spool_readings(daemon->spool, daemon->batch_readings) <
+		     (int)json_object_array_length(daemon->batch_readings)))
+		pilab_log(LOG_ERROR, "A batch of readings was lost");
+
+	json_object_put(daemon->batch_readings);
+	daemon->batch_readings = NULL;
 }
 
-void *pilab_worker(void *arg)
+/*
+ * Upload the batch once its oldest reading waited long enough, for when the
+ * readings come in too slowly to fill it. While the previous one is on its
+ * way the batch keeps filling, the workers upload it when it is full.
+ */
+
+void pilab_on_batch(struct t_event_loop *loop, int fd, uint32_t events,
+		    void *data)
 {
-	struct t_api_client *client, *new_client;
-	struct t_pilist *arg_list;
-	struct t_host_device *host;
-	struct t_slave_device *slave;
-	int analog_value, digital_value;
-	float value;
-	char char_value[20];
+	struct t_pilab_daemon *daemon;
+	json_object *readings;
+	uint64_t expirations;
 
-	arg_list = (struct t_pilist *)arg;
-	slave = (struct t_slave_device *)pilist_get_data(arg_list, 0);
-	client = (struct t_api_client *)pilist_get_data(arg_list, 1);
-	host = (struct t_host_device *)pilist_get_data(arg_list, 2);
+	daemon = (struct t_pilab_daemon *)data;
 
-	if (!client) {
-		pilab_log(
-			LOG_ERROR,
-			"Could not find client in the thread pilab_worker for %s",
-			slave->get_name(slave->instance));
-		hashtable_free(host->slave_devices_lookup);
-		if (host->lcd)
-			lcd_free(host->lcd);
-		free(host);
-		pilist_free(arg_list);
-		exit(EXIT_FAILURE);
+	/* acknowledge the timer */
+	(void)read(fd, &expirations, sizeof(expirations));
+
+	if (daemon->batch_request)
+		return;
+
+	readings = batch_take(daemon->batch, time_monotonic_ns(), 0);
+	if (!readings)
+		return;
+
+	if (!daemon->uploads) {
+		pilab_upload_batch(daemon->client, daemon->spool, readings);
+		return;
 	}
 
-	new_client = api_client_create(client->config);
-	api_client_set_cookie(new_client, client->cookie);
+	/* the upload puts the readings, they are still needed on failure */
+	daemon->batch_readings = json_object_get(readings);
+	if (!pilab_upload_start(daemon, readings, "agedbatch",
+				&daemon->batch_request))
+		pilab_batch_uploaded(daemon, 0);
+}
 
-	analog_value = slave->analog_read(slave->instance,
-					  slave->get_pinbase(slave->instance));
-	digital_value = slave->digital_read(
-		slave->instance, slave->get_pinbase(slave->instance));
+/*
+ * The upload of spooled readings is done, they only leave the spool when the
+ * backend accepted them.
+ */
 
-	if (analog_value >= digital_value) {
-		value = analog_value;
-		if (string_strcmp(slave->get_name(slave->instance),
-				  "ds18b20") == 0)
-			value = 1.0 * analog_value / 10;
-	} else {
-		value = digital_value;
+void pilab_spool_forwarded(struct t_pilab_daemon *daemon, int accepted)
+{
+	daemon->spool_request = NULL;
+
+	if (!accepted) {
+		pilab_log(LOG_DEBUG, "Backend unavailable, %lu readings spooled",
+			  spool_pending(daemon->spool));
+		return;
 	}
 
-	/* make it a 1 precision floating point number */
-	sprintf(char_value, "%.1f", value);
+	spool_commit(daemon->spool, &daemon->spool_end);
+}
 
-	pilab_add_data(new_client, char_value);
+/*
+ * An upload of the loop is done.
+ */
 
-	api_client_free_minimal(new_client);
+void pilab_on_upload(struct t_api_multi *multi,
+		     struct t_api_client_request *request, int rc, void *data)
+{
+	struct t_pilab_daemon *daemon;
+	int accepted;
 
-	pilab_log(LOG_DEBUG, "Adding reading: %s", char_value);
+	daemon = (struct t_pilab_daemon *)data;
+
+	accepted = pilab_add_data_batch_finish(daemon->client, request);
+	if (request == daemon->spool_request)
+		pilab_spool_forwarded(daemon, accepted);
+	else if (request == daemon->batch_request)
+		pilab_batch_uploaded(daemon, accepted);
+}
+
+/*
+ * Forward the oldest spooled readings, they are uploaded in the order they
+ * were spooled and only removed from the spool once the upload succeeded.
+ * One forward is on its way at a time.
+ */
+
+void pilab_on_spool(struct t_event_loop *loop, int fd, uint32_t events,
+		    void *data)
+{
+	struct t_pilab_daemon *daemon;
+	json_object *readings;
+	uint64_t expirations;
+	int count, records;
+
+	daemon = (struct t_pilab_daemon *)data;
+
+	/* acknowledge the timer */
+	(void)read(fd, &expirations, sizeof(expirations));
+
+	spool_sync(daemon->spool, time_monotonic_ns(), 0);
+
+	if (daemon->spool_request)
+		return;
+
+	count = spool_peek(daemon->spool, daemon->spool_items,
+			   daemon->spool_rate, &records, &daemon->spool_end);
+	if (records < 1)
+		return;
+
+	/* only damaged records, skip them */
+	if (count < 1) {
+		spool_commit(daemon->spool, &daemon->spool_end);
+		return;
+	}
+
+	readings = batch_items_to_json(daemon->spool_items, count);
+	if (!readings)
+		return;
+
+	if (!daemon->uploads) {
+		pilab_spool_forwarded(daemon, pilab_add_data_batch(
+						      daemon->client, readings));
+		return;
+	}
+
+	if (!pilab_upload_start(daemon, readings, "spooledbatch",
+				&daemon->spool_request))
+		pilab_spool_forwarded(daemon, 0);
+}
+
+/*
+ * Log the counters of the spool.
+ */
+
+void pilab_log_spool_stats(struct t_spool *spool)
+{
+	struct t_spool_stats stats;
+
+	if (!spool)
+		return;
+
+	spool_get_stats(spool, &stats);
+	pilab_log(
+		LOG_DEBUG,
+		"Spool: %lu readings spooled, %lu forwarded, %lu left (%lu dropped, %lu damaged), %lu syncs",
+		stats.appended, stats.forwarded, spool_pending(spool),
+		stats.dropped, stats.corrupt, stats.syncs);
+}
+
+/*
+ * Log the counters of the batch.
+ */
+
+void pilab_log_batch_stats(struct t_batch *batch)
+{
+	struct t_batch_stats stats;
+
+	if (!batch)
+		return;
+
+	batch_get_stats(batch, &stats);
+	pilab_log(
+		LOG_DEBUG,
+		"Batch: %lu readings added (%lu dropped), %lu uploaded in %lu batches (%lu full, %lu aged, %lu at exit)",
+		stats.added, stats.dropped, stats.taken,
+		stats.full + stats.aged + stats.forced, stats.full, stats.aged,
+		stats.forced);
+}
+
+/*
+ * A shutdown signal was received through the signalfd.
+ */
 
-	return 0;
+void pilab_on_signal(struct t_event_loop *loop, int signo, void *data)
+{
+	struct t_pilab_daemon *daemon;
+
+	daemon = (struct t_pilab_daemon *)data;
+
+	pilab_log(LOG_INFO, "Received signal %d, stopping...", signo);
+
+	/* no new readings from here on */
+	scheduler_disarm_timer(daemon->scheduler);
+	event_loop_stop(loop);
+}
+
+/*
+ * Wait (within the configured bound) for the readings that are still queued or
+ * running, as they upload their data before they finish.
+ *
+ * Returns the amount of readings that are still running.
+ */
+
+int pilab_drain(struct t_sampler *sampler, int timeout)
+{
+	struct t_sampler_stats stats;
+	uint64_t started;
+	int active;
+
+	if (timeout < 1)
+		timeout = PILAB_SAMPLER_DEFAULT_DRAIN_TIMEOUT;
+
+	started = time_monotonic_ns();
+	active = sampler_drain(sampler, timeout);
+	sampler_get_stats(sampler, &stats);
+
+	pilab_log(
+		LOG_INFO,
+		"Drained the sampler in %llu ms: %lu completed, %lu cancelled, %d still running",
+		(unsigned long long)((time_monotonic_ns() - started) / 1000000),
+		stats.jobs_completed, stats.jobs_cancelled, active);
+
+	return active;
 }
 
 /* Go up in Day,Week,Month,Year (Keyboard letter "W") (keycode: 119) */
@@ -168,64 +1650,107 @@ void *pilab_worker(void *arg)
 /* Go to previous Day,Week,Month,Year (Keyboard letter "A") (keycode: 97) */
 /* Go to next Day,Week,Month,Year (Keyboard letter "D") (keycode: 100) */
 
-void *detect_press()
+struct t_pilab_button {
+	/*
+	 * BCM number of the pin the button pulls high.
+	 */
+	int pin;
+	/*
+	 * Key pressed on the browser when the button goes down.
+	 */
+	KeySym key;
+};
+
+static const struct t_pilab_button pilab_buttons[] = {
+	{ 6, XK_w }, { 13, XK_s }, { 16, XK_d },
+	{ 19, XK_r }, { 22, XK_a }, { 26, XK_f },
+};
+
+#define PILAB_NUM_BUTTONS \
+	(int)(sizeof(pilab_buttons) / sizeof(pilab_buttons[0]))
+
+/*
+ * A button changed, fake the key press it stands for when it went down.
+ */
+
+void pilab_on_press(struct t_gpio_input *input, int line, int level,
+		    void *data)
 {
-	Display *display;
+	struct t_pilab_daemon *daemon;
 	unsigned int keycode;
-	int pins[] = { 6, 13, 16, 19, 22, 26 };
 
-	for (int i = 0; i < 4; i++)
-		pinMode(pins[i], INPUT);
+	daemon = (struct t_pilab_daemon *)data;
 
-	display = XOpenDisplay(NULL);
+	if (level != HIGH || !daemon->display)
+		return;
 
-	while (1) {
-		if (digitalRead(6) == HIGH) {
-			keycode = XKeysymToKeycode(display, XK_w);
-			XTestFakeKeyEvent(display, keycode, True, 0);
-			XTestFakeKeyEvent(display, keycode, False, 0);
-			XFlush(display);
-			pilab_log(LOG_DEBUG, "button number %d pressed\n", 6);
-			sleep(1.5);
-		} else if (digitalRead(13) == HIGH) {
-			keycode = XKeysymToKeycode(display, XK_s);
-			XTestFakeKeyEvent(display, keycode, True, 0);
-			XTestFakeKeyEvent(display, keycode, False, 0);
-			XFlush(display);
-			pilab_log(LOG_DEBUG, "button number %d pressed\n", 13);
-			sleep(1);
-		} else if (digitalRead(16) == HIGH) {
-			keycode = XKeysymToKeycode(display, XK_d);
-			XTestFakeKeyEvent(display, keycode, True, 0);
-			XTestFakeKeyEvent(display, keycode, False, 0);
-			XFlush(display);
-			pilab_log(LOG_DEBUG, "button number %d pressed\n", 16);
-			sleep(1);
-		} else if (digitalRead(19) == HIGH) {
-			keycode = XKeysymToKeycode(display, XK_r);
-			XTestFakeKeyEvent(display, keycode, True, 0);
-			XTestFakeKeyEvent(display, keycode, False, 0);
-			XFlush(display);
-			pilab_log(LOG_DEBUG, "button number %d pressed\n", 19);
-			sleep(1);
-		} else if (digitalRead(22) == HIGH) {
-			keycode = XKeysymToKeycode(display, XK_a);
-			XTestFakeKeyEvent(display, keycode, True, 0);
-			XTestFakeKeyEvent(display, keycode, False, 0);
-			XFlush(display);
-			pilab_log(LOG_DEBUG, "button number %d pressed\n", 22);
-			sleep(1);
-		} else if (digitalRead(26) == HIGH) {
-			keycode = XKeysymToKeycode(display, XK_f);
-			XTestFakeKeyEvent(display, keycode, True, 0);
-			XTestFakeKeyEvent(display, keycode, False, 0);
-			XFlush(display);
-			pilab_log(LOG_DEBUG, "button number %d pressed\n", 26);
-			sleep(1);
-		}
+	for (int i = 0; i < PILAB_NUM_BUTTONS; i++) {
+		if (pilab_buttons[i].pin != line)
+			continue;
+
+		keycode = XKeysymToKeycode(daemon->display,
+					   pilab_buttons[i].key);
+		XTestFakeKeyEvent(daemon->display, keycode, True, 0);
+		XTestFakeKeyEvent(daemon->display, keycode, False, 0);
+		XFlush(daemon->display);
+		pilab_log(LOG_DEBUG, "button number %d pressed", line);
+		break;
 	}
+}
+
+/*
+ * The button lines have edges pending, debounce and dispatch them.
+ */
+
+void pilab_on_buttons(struct t_event_loop *loop, int fd, uint32_t events,
+		      void *data)
+{
+	struct t_pilab_daemon *daemon;
+
+	daemon = (struct t_pilab_daemon *)data;
+
+	(void)gpio_input_dispatch(daemon->buttons, daemon);
+}
+
+/*
+ * Request the lines of the buttons as inputs with edge events, so presses
+ * wake the event loop instead of being polled for.
+ *
+ * Returns a pointer to the buttons, NULL otherwise.
+ */
 
-	return 0;
+struct t_gpio_input *pilab_buttons_create(void)
+{
+	struct t_gpio_input *buttons;
+	int pins[PILAB_NUM_BUTTONS];
+
+	for (int i = 0; i < PILAB_NUM_BUTTONS; i++)
+		pins[i] = pilab_buttons[i].pin;
+
+	buttons = gpio_input_create(NULL, pins, PILAB_NUM_BUTTONS, 0);
+	if (!buttons)
+		return NULL;
+
+	gpio_input_set_pointer(buttons, "callback_edge", &pilab_on_press);
+
+	return buttons;
+}
+
+/*
+ * Log the counters of the buttons.
+ */
+
+void pilab_log_button_stats(struct t_gpio_input *buttons)
+{
+	if (!buttons || buttons->stats.events == 0)
+		return;
+
+	pilab_log(
+		LOG_DEBUG,
+		"Buttons: %lu edges, %lu presses, %lu bounces dropped, max latency %llu us",
+		buttons->stats.events, buttons->stats.rising,
+		buttons->stats.bounces,
+		(unsigned long long)(buttons->stats.max_latency / 1000));
 }
 
 #define URL_INFIX_1 "/Schedule/Index?roomName="
@@ -302,29 +1827,121 @@ int main(int argc, char *argv[])
 	struct t_api_client *client;
 	struct t_host_device *host;
 	struct t_pilist *sensor_list;
+	struct t_sampler *sampler;
+	struct t_scheduler *scheduler;
+	struct t_event_loop *loop;
+	struct t_pilab_daemon daemon;
+	sigset_t shutdown_signals;
+	struct t_pilab_sensor *sensors;
+	struct t_trace_writer *trace_writer;
+	struct t_trace *trace;
+	struct t_batch *batch;
+	struct t_spool *spool;
+	struct t_pilab_handshake handshake;
+	struct t_pilab_startup startup;
+	int still_running;
 
+	startup.started = time_monotonic_ns();
 	config = pilab_config(config_path);
 	client = pilab_client(config);
 
 	pilab_grandma_needs_a_prompt(config, &argc, &argv);
 	pilab_read_config(config);
+	pilab_retry(client, config);
+
+	startup.configured = time_monotonic_ns();
+
+	/* the backend needs to be selected before calling pilab_host */
+	pilab_hal(config);
+	startup.hal_ready = time_monotonic_ns();
 
-	/* needs to be called before calling pilab_host */
-	wiringPiSetupGpio();
+	/* the backend is talked to while the devices are set up */
+	pilab_handshake_start(&handshake, client);
 	host = pilab_host();
+	startup.host_ready = time_monotonic_ns();
+	if (config->w1_root)
+		w1_bus_set_root(host->w1_bus, config->w1_root);
+	trace = pilab_trace_replay(config);
+	trace_writer = pilab_trace_record(config);
+	batch = pilab_batch(config);
+	spool = pilab_spool(config);
 	/* end initialisation of the program */
 
 	/* start work here */
-	pilab_login(client);
-	pilab_add_pi(client);
+	pilab_handshake_join(&handshake);
+	startup.handshake_done = time_monotonic_ns();
 
 	sensor_list = host_device_get_sensor_name_list(host);
 
-	/*
-	 * +1 we need a thread for detecting the key presses.
-	 */
-	const int num_threads = sensor_list->size + 1;
-	pthread_t devices[num_threads];
+	/* the workers are started once, and are fed with jobs every cycle */
+	sampler = sampler_create(config->sampler_workers, sensor_list->size);
+	if (!sampler) {
+		pilab_log(LOG_ERROR, "Could not create a sampler instance.");
+		exit(EXIT_FAILURE);
+	}
+	sampler_set_pointer(sampler, "callback_data", client);
+	sampler_set_pointer(sampler, "callback_read_slave", &pilab_worker);
+	sampler_set_pointer(sampler, "callback_worker_init",
+			    &pilab_worker_init);
+	sampler_set_pointer(sampler, "callback_worker_free",
+			    &pilab_worker_free);
+
+	/* every device gets its own deadline */
+	scheduler = scheduler_create(sensor_list->size);
+	sensors = calloc(sensor_list->size, sizeof(*sensors));
+	if (!scheduler || !sensors) {
+		pilab_log(LOG_ERROR, "Could not create a scheduler instance.");
+		exit(EXIT_FAILURE);
+	}
+	/* a replayed day passes in a fraction of it */
+	if (trace)
+		scheduler_set_speed(scheduler, config->trace_speed);
+	for (int i = 0; i < sensor_list->size; i++) {
+		struct t_slave_device *slave;
+
+		slave = (struct t_slave_device *)hashtable_get(
+			host->slave_devices_lookup,
+			pilist_get_data(sensor_list, i));
+		if (!slave)
+			continue;
+
+		if (trace && replay_device_attach(slave, trace,
+						  config->trace_speed) < 1)
+			pilab_log(LOG_ERROR, "%s is not in the trace, reading it",
+				  slave->get_name(slave->instance));
+
+		sensors[i].scheduler = scheduler;
+		sensors[i].trace = trace_writer;
+		sensors[i].batch = batch;
+		sensors[i].spool = spool;
+		sensors[i].spool_always =
+			(string_strcasecmp(config->spool_mode,
+					   PILAB_SPOOL_MODE_ALWAYS) == 0);
+		sensors[i].type =
+			slave_device_get_option(slave, PILAB_BATCH_OPTION_TYPE);
+		if (!sensors[i].type)
+			sensors[i].type = PILAB_BATCH_DEFAULT_TYPE;
+		sensors[i].sampler = sampler;
+		sensors[i].entry = scheduler_add(
+			scheduler, slave, slave->sample_interval, &sensors[i]);
+		if (!sensors[i].entry)
+			continue;
+
+		sensors[i].adaptive = pilab_adaptive(
+			slave,
+			sensors[i].entry->interval * scheduler->speed /
+				PILAB_SCHEDULER_NSEC_PER_SEC);
+		sensors[i].deadband = pilab_deadband(slave);
+		sensors[i].filter = pilab_filter(slave);
+		sensors[i].watchdog = pilab_watchdog(slave);
+	}
+
+	/* don't let every sensor, or every pi in the building, fire at once */
+	scheduler_set_identity(scheduler,
+			       (config->mac) ? config->mac : config->classroom);
+	scheduler_set_jitter(scheduler, config->schedule_jitter);
+	scheduler_spread(scheduler, time_monotonic_ns());
+	pilab_group_w1(sensors, sensor_list->size);
 
 	char *cmd = "";
 	cmd = string_strcat_delimiter_recursive(
@@ -336,58 +1953,193 @@ int main(int argc, char *argv[])
 
 	system(cmd);
 
-	if (pthread_create(&devices[0], NULL, &detect_press, NULL)) {
-		pilab_log(
-			LOG_ERROR,
-			"Failed to create a thread for detecting key presses, exiting...");
+	loop = event_loop_create();
+	if (!loop) {
+		pilab_log(LOG_ERROR, "Could not create an event loop instance.");
+		exit(EXIT_FAILURE);
+	}
+
+	daemon.loop = loop;
+	daemon.scheduler = scheduler;
+	daemon.sampler = sampler;
+	daemon.sensors = sensors;
+	daemon.num_sensors = sensor_list->size;
+	daemon.display = NULL;
+	daemon.buttons = NULL;
+	daemon.batch = batch;
+	daemon.client = client;
+	daemon.spool = spool;
+	daemon.spool_rate = (config->spool_rate > 0) ?
+				    config->spool_rate :
+				    PILAB_SPOOL_DEFAULT_RATE;
+	if (daemon.spool_rate > PILAB_SPOOL_MAX_FORWARD)
+		daemon.spool_rate = PILAB_SPOOL_MAX_FORWARD;
+	daemon.spool_items =
+		(spool) ? calloc(daemon.spool_rate, sizeof(*daemon.spool_items)) :
+			  NULL;
+	daemon.spool_request = NULL;
+	daemon.spool_end.segment = 0;
+	daemon.spool_end.offset = 0;
+	daemon.batch_request = NULL;
+	daemon.batch_readings = NULL;
+	daemon.uploads = pilab_uploads(&daemon, &pilab_on_upload);
+	if (!daemon.uploads)
+		pilab_log(LOG_ERROR,
+			  "Could not set up the uploads, the loop waits for them.");
+
+	/*
+	 * The signals are blocked before any thread is created, so they are
+	 * only delivered through the signalfd of the loop.
+	 */
+	sigemptyset(&shutdown_signals);
+	sigaddset(&shutdown_signals, SIGINT);
+	sigaddset(&shutdown_signals, SIGTERM);
+	if (!event_loop_add_signals(loop, &shutdown_signals, &pilab_on_signal,
+				    &daemon)) {
+		pilab_log(LOG_ERROR, "Could not watch the shutdown signals.");
+		exit(EXIT_FAILURE);
+	}
+
+	if (scheduler->size < 1 ||
+	    !event_loop_add_fd(loop, scheduler->timer_fd, EPOLLIN,
+			       &pilab_on_deadline, &daemon)) {
+		pilab_log(LOG_ERROR,
+			  "There are no devices to sample, exiting...");
+		exit_value = EXIT_FAILURE;
 		goto cleanup;
 	}
 
-	while (1) {
-		for (int i = 1; i < num_threads; i++) {
-			struct t_slave_device *slave;
-			char *slave_name;
-			slave_name = pilist_get_data(sensor_list, i - 1);
-			struct t_pilist *args;
-			args = pilist_create();
-			if (!args) {
-				pilab_log(
-					LOG_ERROR,
-					"Could not create argument list for thread, exiting...");
-				exit_value = EXIT_FAILURE;
-				goto cleanup;
-			}
+	/*
+	 * The watchdog keeps a device that is read in two steps busy between
+	 * its start and its collect, one without it is read in one go.
+	 */
+	for (int i = 0; i < sensor_list->size; i++) {
+		if (!sensors[i].entry || !sensors[i].watchdog ||
+		    !sensors[i].entry->slave->start_sample ||
+		    !sensors[i].entry->slave->collect_sample)
+			continue;
+		sensors[i].collect = event_loop_add_timeout(
+			loop, 0, &pilab_on_collect, &sensors[i]);
+		if (!sensors[i].collect)
+			pilab_log(LOG_ERROR,
+				  "Could not set up the collect of %s, it is read in one go.",
+				  sensors[i].entry->slave->get_name(
+					  sensors[i].entry->slave->instance));
+	}
 
-			slave = (struct t_slave_device *)hashtable_get(
-				host->slave_devices_lookup, slave_name);
-
-			pilist_add(args, host);
-			pilist_add_pointer(args, client);
-			pilist_add_pointer(args, slave);
-
-			if (pthread_create(&devices[i], NULL, pilab_worker,
-					   args)) {
-				pilab_log(
-					LOG_ERROR,
-					"Failed to create a thread for device :%s",
-					slave_name);
-				exit_value = EXIT_FAILURE;
-				goto cleanup;
-			}
-		}
-		/* sleep 5 * one minute */
-		sleep(5 * 60);
+	if (!event_loop_add_timer(loop, PILAB_WATCHDOG_CHECK_INTERVAL,
+				  &pilab_on_watchdog, &daemon))
+		pilab_log(LOG_ERROR,
+			  "Could not start the watchdog, hanging reads go unnoticed.");
+
+	/* checked twice per age, an aged batch is at most half an age late */
+	if (batch &&
+	    !event_loop_add_timer(loop,
+				  (int)(batch->max_age / 2 / 1000000) + 1,
+				  &pilab_on_batch, &daemon))
+		pilab_log(LOG_ERROR,
+			  "Could not watch the batch age, it is uploaded when full.");
+
+	if (spool &&
+	    (!daemon.spool_items ||
+	     !event_loop_add_timer(loop, PILAB_SPOOL_FORWARD_INTERVAL,
+				   &pilab_on_spool, &daemon)))
+		pilab_log(LOG_ERROR,
+			  "Could not start the forwarder, readings stay spooled.");
+
+	/* the kiosk works without buttons, don't give up on the sensors */
+	daemon.display = XOpenDisplay(NULL);
+	daemon.buttons = pilab_buttons_create();
+	if (!daemon.display || !daemon.buttons ||
+	    !event_loop_add_fd(loop, daemon.buttons->fd, EPOLLIN,
+			       &pilab_on_buttons, &daemon))
+		pilab_log(LOG_ERROR,
+			  "Could not watch the buttons, key presses go unnoticed.");
+
+	if (sampler_start(sampler) < 1) {
+		pilab_log(LOG_ERROR,
+			  "Failed to start the sampler workers, exiting...");
+		exit_value = EXIT_FAILURE;
+		goto cleanup;
 	}
 
-	return exit_value;
+	startup.ready = time_monotonic_ns();
+	pilab_log_startup(&startup, host, &handshake);
+
+	/* sleep until there is something to do */
+	scheduler_arm_timer(scheduler);
+	if (event_loop_run(loop) < 0)
+		exit_value = EXIT_FAILURE;
 
 cleanup:
 	pilab_log(LOG_INFO, "Shutting down pilab");
+	scheduler_disarm_timer(scheduler);
+	still_running = pilab_drain(sampler, config->shutdown_timeout);
+	if (still_running > 0) {
+		pilab_log(LOG_ERROR,
+			  "%d readings did not finish in time, exiting anyway",
+			  still_running);
+		exit_value = EXIT_FAILURE;
+	} else {
+		sampler_free(sampler);
+	}
+	/*
+	 * A forward on its way stays spooled for the next start, an aged batch
+	 * on its way is uploaded again. The workers never use this client, so
+	 * that holds with stuck workers too.
+	 */
+	api_multi_free(daemon.uploads);
+	if (daemon.batch_request)
+		pilab_upload_batch(client, spool, daemon.batch_readings);
+	/* upload what the workers left in the batch */
+	pilab_upload_batch(client, spool,
+			   batch_take(batch, time_monotonic_ns(), 1));
+	pilab_log_batch_stats(batch);
+	/* what wasn't forwarded yet is forwarded after the next start */
+	pilab_log_spool_stats(spool);
+	if (still_running > 0) {
+		/*
+		 * The stuck workers still use the devices, the batch, the spool
+		 * and the trace, let the process exit take them down instead of
+		 * freeing them. Get what is on its way to disk there first.
+		 */
+		(void)spool_sync(spool, 0, 1);
+		(void)trace_writer_flush(trace_writer);
+		return exit_value;
+	}
+	batch_free(batch);
+	spool_close(spool);
+	free(daemon.spool_items);
+	event_loop_free(loop);
+	pilab_log_button_stats(daemon.buttons);
+	gpio_input_free(daemon.buttons);
+	if (daemon.display)
+		XCloseDisplay(daemon.display);
+	for (int i = 0; i < sensor_list->size; i++) {
+		pilab_log_adaptive_stats(&sensors[i]);
+		pilab_log_deadband_stats(&sensors[i]);
+		pilab_log_filter_stats(&sensors[i]);
+		pilab_log_watchdog_stats(&sensors[i]);
+		adaptive_free(sensors[i].adaptive);
+		deadband_free(sensors[i].deadband);
+		filter_free(sensors[i].filter);
+		watchdog_free(sensors[i].watchdog);
+	}
+	free(sensors);
+	pilab_log_w1_stats(host->w1_bus);
+	pilab_log_trace_stats(trace_writer);
+	pilab_log_connection_stats();
+	pilab_log_circuit_stats(client);
+	trace_writer_close(trace_writer);
+	scheduler_free(scheduler);
+	pilist_free(sensor_list);
+	/* the client owns the config */
 	api_client_free(client);
-	config_free(config);
-	hashtable_free(host->slave_devices_lookup);
-	if (host->lcd)
-		lcd_free(host->lcd);
-	free(host);
+	/* every request is freed, the shared connections can be closed */
+	api_client_connections_free();
+	host_device_free(host);
+	/* the replayed devices are freed, they don't need the trace anymore */
+	trace_free(trace);
+	hal_free(hal_get());
 	return exit_value;
 }